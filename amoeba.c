@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -16,6 +17,12 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "amoeba_async.h"
 
 trpar	am_tp= { { {0, 0, 0}, {0, 0, 0} }, 300};
 
@@ -24,80 +31,1268 @@ struct am_hdr {
 	uint32_t len;
 } __attribute__((packed));
 
-int _amoeba(int req)
+#define AM_REQUEST	4
+#define AM_REPLY	5
+#define AM_TRANS_TAGGED	7
+#define AM_REGISTER	8
+#define AM_GROUP_JOIN	10
+#define AM_GROUP_LEAVE	11
+#define AM_GROUP_SEND	12
+#define AM_GROUP_MESSAGE	13
+
+/* Prefix of requests handed to a server, echoed in its reply */
+struct am_req_hdr {
+	uint64_t client;
+	uint32_t tid;
+} __attribute__((packed));
+
+/*
+ * Optional shared-memory transport, enabled by setting FLIP_SHM in the
+ * environment. Requests and replies travel through rings in a memfd shared
+ * with the daemon instead of through the socket. The layout must match
+ * include/shm_transport.hpp in the daemon.
+ */
+#define AM_SHM_ATTACH	6
+#define SHM_MAGIC	0x464c534d
+#define SHM_VERSION	1
+#define SHM_DATA_OFFSET	4096
+#define SHM_RING_SIZE	(1024 * 1024)
+#define SHM_RECORD_PAD	0
+
+struct shm_ring_hdr {
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+};
+
+struct shm_region {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ring_size;
+	uint32_t reserved;
+	struct shm_ring_hdr request;
+	struct shm_ring_hdr reply;
+};
+
+#define SHM_RECORD(len)	((sizeof(struct am_hdr) + (len) + 7) & ~(size_t)7)
+
+/*
+ * Connection state. One socket is shared by every thread. Requests carry a
+ * tag that the daemon echoes in the reply, so any number of transactions can
+ * be in flight. Sends are serialised by am_send_lock; replies are read by
+ * whichever waiting thread currently holds the reader role, which hands each
+ * one to its call and wakes the owner.
+ */
+static pthread_mutex_t am_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t am_send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t am_cond = PTHREAD_COND_INITIALIZER;
+static int am_sock = -1;
+static int am_seqpacket;	/* am_sock carries one message per datagram */
+static int am_reading;
+static uint32_t am_next_tag;
+static struct am_call *am_calls;
+
+/*
+ * Server side. Threads in getreq() wait in a FIFO for a request on their
+ * port; requests that arrive while nobody is waiting are queued. Each thread
+ * remembers the request it took, which its next putrep() answers.
+ */
+struct am_getreq {
+	struct am_getreq *next;
+	header *hdr;
+	char *buf;
+	unsigned cnt;
+	unsigned len;		/* Request data length; only cnt bytes of it are stored */
+	struct am_req_hdr req;
+	int status;
+	int done;
+};
+
+struct am_request {
+	struct am_request *next;
+	struct am_req_hdr req;
+	header hdr;
+	unsigned len;
+	char data[];
+};
+
+struct am_port {
+	struct am_port *next;
+	uint8_t port[6];
+};
+
+static struct am_getreq *am_getreqs;
+static struct am_request *am_requests, **am_requests_tail = &am_requests;
+static struct am_port *am_ports;	/* Ports registered on this connection */
+static pthread_mutex_t am_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static int am_reg_done;
+static int am_reg_status;
+static __thread struct am_req_hdr am_serving;
+static __thread int am_serving_valid;
+
+/*
+ * Group messages. Threads in am_grp_receive() wait in a FIFO for a message
+ * to their group; messages that arrive while nobody is waiting are queued,
+ * up to AM_GRP_QUEUE_MAX of them, and later ones dropped.
+ */
+#define AM_GRP_QUEUE_MAX	256
+
+/* Prefix of a group message from the daemon */
+struct am_grp_hdr {
+	uint64_t sender;
+	uint8_t port[6];
+} __attribute__((packed));
+
+struct am_grp_wait {
+	struct am_grp_wait *next;
+	const uint8_t *port;
+	char *buf;
+	unsigned cnt;
+	unsigned len;		/* Message length; only cnt bytes of it are stored */
+	uint64_t sender;
+	int status;
+	int done;
+};
+
+struct am_grp_msg {
+	struct am_grp_msg *next;
+	struct am_grp_hdr hdr;
+	unsigned len;
+	char data[];
+};
+
+static struct am_grp_wait *am_grp_waits;
+static struct am_grp_msg *am_grp_msgs, **am_grp_msgs_tail = &am_grp_msgs;
+static unsigned am_grp_queued;
+
+static struct shm_region *shm;
+static int shm_req_efd = -1;
+static int shm_rep_efd = -1;
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = recv(fd, (char *)buf + done, len - done, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+/* Scatter-read exactly the bytes described by iov, however the socket splits them */
+static int readv_full(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t n = readv(fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int writev_full(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t n = writev(fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static void shm_detach(void)
+{
+	if (shm) {
+		munmap(shm, SHM_DATA_OFFSET + 2 * SHM_RING_SIZE);
+		shm = NULL;
+	}
+	if (shm_req_efd >= 0) {
+		close(shm_req_efd);
+		shm_req_efd = -1;
+	}
+	if (shm_rep_efd >= 0) {
+		close(shm_rep_efd);
+		shm_rep_efd = -1;
+	}
+}
+
+/* Hand the daemon a memfd and two doorbell eventfds; falls back to the socket on any failure */
+static void shm_attach(int fd)
 {
-    static int fd = -1;
+	size_t size = SHM_DATA_OFFSET + 2 * (size_t)SHM_RING_SIZE;
+	int mfd = memfd_create("amoeba-flip", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (mfd < 0)
+		return;
+	if (ftruncate(mfd, size) < 0 || fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+		close(mfd);
+		return;
+	}
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+	if (mem == MAP_FAILED) {
+		close(mfd);
+		return;
+	}
+	shm = mem;
+	shm->magic = SHM_MAGIC;
+	shm->version = SHM_VERSION;
+	shm->ring_size = SHM_RING_SIZE;
+	shm_req_efd = eventfd(0, EFD_CLOEXEC);
+	shm_rep_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (shm_req_efd < 0 || shm_rep_efd < 0) {
+		close(mfd);
+		shm_detach();
+		return;
+	}
+
+	struct am_hdr hdr = { AM_SHM_ATTACH, 0 };
+	struct iovec iov = { &hdr, sizeof(hdr) };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	int fds[3] = { mfd, shm_req_efd, shm_rep_efd };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
 
+	/* Read the result in one go: on a seqpacket socket a short read drops the rest */
+	struct {
+		struct am_hdr hdr;
+		int32_t status;
+	} __attribute__((packed)) result;
+	result.status = -1;
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hdr) ||
+	    read_full(fd, &result, sizeof(result)) < 0 || result.hdr.type != AM_SHM_ATTACH ||
+	    result.hdr.len != sizeof(result.status) || result.status != 0) {
+		if (result.status > 0)
+			printf("Amoeba driver refused shared memory: %s\n", strerror(result.status));
+		shm_detach();
+	}
+	/* The mapping keeps the region alive */
+	close(mfd);
+}
+
+/* Try the seqpacket socket, which needs no reframing; returns -1 if the driver has none */
+static int am_connect_seqpacket(void)
+{
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, "/tmp/flip.seqpacket");
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
 	if (fd < 0)
-    {
-		struct sockaddr_un sa;
-		sa.sun_family = AF_UNIX;
-		strcpy(sa.sun_path, "/tmp/flip.sock");
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Connect on first use; called with am_lock held */
+static int am_connect(void)
+{
+	if (am_sock >= 0)
+		return 0;
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	int fd = am_connect_seqpacket();
+	if (fd >= 0) {
+		if (getenv("FLIP_SHM"))
+			shm_attach(fd);
+		am_seqpacket = 1;
+		am_sock = fd;
+		return 0;
+	}
+
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, "/tmp/flip.sock");
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
 	{
 		printf("Cannot create socket for amoeba driver: %s\n", strerror(errno));
-	    return (errno == ENOENT || errno == ENODEV) ?
-					RPC_NOTFOUND : RPC_TRYAGAIN;
+		return (errno == ENOENT || errno == ENODEV) ? RPC_NOTFOUND : RPC_TRYAGAIN;
 	}
 	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
 	{
+		int err = errno;
 		close(fd);
-		fd = -1;
-		printf("Cannot connect to amoeba driver: %s\n", strerror(errno));
-	    return (errno == ENOENT || errno == ENODEV) ?
-					RPC_NOTFOUND : RPC_TRYAGAIN;
+		printf("Cannot connect to amoeba driver: %s\n", strerror(err));
+		return (err == ENOENT || err == ENODEV) ? RPC_NOTFOUND : RPC_TRYAGAIN;
+	}
+	if (getenv("FLIP_SHM"))
+		shm_attach(fd);
+	am_seqpacket = 0;
+	am_sock = fd;
+	return 0;
+}
+
+/* Fail every call in flight and drop the connection; called with am_lock held */
+static void am_disconnect(void)
+{
+	struct am_call *c;
+	for (c = am_calls; c; c = c->next) {
+		c->status = RPC_TRYAGAIN;
+		c->done = 1;
 	}
-	fcntl(fd, F_SETFD, 1);
-    }
+	am_calls = NULL;
+
+	struct am_getreq *g;
+	for (g = am_getreqs; g; g = g->next) {
+		g->status = RPC_TRYAGAIN;
+		g->done = 1;
+	}
+	am_getreqs = NULL;
+	while (am_requests) {
+		struct am_request *r = am_requests;
+		am_requests = r->next;
+		free(r);
+	}
+	am_requests_tail = &am_requests;
+
+	struct am_grp_wait *w;
+	for (w = am_grp_waits; w; w = w->next) {
+		w->status = RPC_TRYAGAIN;
+		w->done = 1;
+	}
+	am_grp_waits = NULL;
+	while (am_grp_msgs) {
+		struct am_grp_msg *m = am_grp_msgs;
+		am_grp_msgs = m->next;
+		free(m);
+	}
+	am_grp_msgs_tail = &am_grp_msgs;
+	am_grp_queued = 0;
+	/* The daemon forgets our ports and groups with the connection */
+	while (am_ports) {
+		struct am_port *p = am_ports;
+		am_ports = p->next;
+		free(p);
+	}
+	am_reg_status = RPC_TRYAGAIN;
+	am_reg_done = 1;
+
+	if (am_sock >= 0) {
+		close(am_sock);
+		am_sock = -1;
+	}
+	shm_detach();
+	pthread_cond_broadcast(&am_cond);
+}
+
+/* Unlink the call waiting for a tag; called with am_lock held */
+static struct am_call *am_take_call(uint32_t tag)
+{
+	struct am_call **pp;
+	for (pp = &am_calls; *pp; pp = &(*pp)->next) {
+		if ((*pp)->tag == tag) {
+			struct am_call *c = *pp;
+			*pp = c->next;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+/* A reply too short to carry a header means the daemon gave up on the transaction */
+static void am_complete(struct am_call *c, unsigned len)
+{
+	pthread_mutex_lock(&am_lock);
+	c->rep_len = len >= sizeof(header) ? len - sizeof(header) : 0;
+	c->status = len >= sizeof(header) ? 0 : RPC_FAILURE;
+	c->done = 1;
+	pthread_cond_broadcast(&am_cond);
+	pthread_mutex_unlock(&am_lock);
+}
+
+/* Unlink the first getreq() waiting on the port a request is for; called with am_lock held */
+static struct am_getreq *am_take_getreq(const header *hdr)
+{
+	struct am_getreq **pp;
+	for (pp = &am_getreqs; *pp; pp = &(*pp)->next) {
+		if (memcmp(&(*pp)->hdr->h_port, &hdr->h_port, sizeof(hdr->h_port)) == 0) {
+			struct am_getreq *g = *pp;
+			*pp = g->next;
+			return g;
+		}
+	}
+	return NULL;
+}
+
+/* Hand a request to its getreq(); the header has already been copied in */
+static void am_getreq_complete(struct am_getreq *g, const struct am_req_hdr *req, unsigned len)
+{
+	pthread_mutex_lock(&am_lock);
+	g->req = *req;
+	g->len = len;
+	g->status = 0;
+	g->done = 1;
+	pthread_cond_broadcast(&am_cond);
+	pthread_mutex_unlock(&am_lock);
+}
+
+/* Queue a request nobody is waiting for; called with am_lock held */
+static struct am_request *am_queue_request(const struct am_req_hdr *req, const header *hdr, unsigned len)
+{
+	struct am_request *r = malloc(sizeof(*r) + len);
+	if (!r)
+		return NULL;
+	r->next = NULL;
+	r->req = *req;
+	r->hdr = *hdr;
+	r->len = len;
+	*am_requests_tail = r;
+	am_requests_tail = &r->next;
+	return r;
+}
+
+/* Unlink the first am_grp_receive() waiting on a message's group; called with am_lock held */
+static struct am_grp_wait *am_take_grp_wait(const struct am_grp_hdr *hdr)
+{
+	struct am_grp_wait **pp;
+	for (pp = &am_grp_waits; *pp; pp = &(*pp)->next) {
+		if (memcmp((*pp)->port, hdr->port, sizeof(hdr->port)) == 0) {
+			struct am_grp_wait *w = *pp;
+			*pp = w->next;
+			return w;
+		}
+	}
+	return NULL;
+}
+
+/* Hand a group message to its am_grp_receive(); the data has already been copied in */
+static void am_grp_complete(struct am_grp_wait *w, const struct am_grp_hdr *hdr, unsigned len)
+{
+	pthread_mutex_lock(&am_lock);
+	w->sender = hdr->sender;
+	w->len = len;
+	w->status = 0;
+	w->done = 1;
+	pthread_cond_broadcast(&am_cond);
+	pthread_mutex_unlock(&am_lock);
+}
+
+/* Queue a group message nobody is waiting for, unless the queue is full; called with am_lock held */
+static struct am_grp_msg *am_queue_grp_msg(const struct am_grp_hdr *hdr, unsigned len)
+{
+	if (am_grp_queued >= AM_GRP_QUEUE_MAX)
+		return NULL;
+	struct am_grp_msg *m = malloc(sizeof(*m) + len);
+	if (!m)
+		return NULL;
+	m->next = NULL;
+	m->hdr = *hdr;
+	m->len = len;
+	*am_grp_msgs_tail = m;
+	am_grp_msgs_tail = &m->next;
+	am_grp_queued++;
+	return m;
+}
+
+/* Queue a request in the request ring; returns 0 if it did not fit */
+static int shm_send(const struct iovec *iov, int iovcnt, size_t len)
+{
+	uint8_t *data = (uint8_t *)shm + SHM_DATA_OFFSET;
+	size_t rec = SHM_RECORD(len - sizeof(struct am_hdr));
+	uint64_t tail = shm->request.tail;
+	uint64_t head = __atomic_load_n(&shm->request.head, __ATOMIC_ACQUIRE);
+	size_t pos = tail & (SHM_RING_SIZE - 1);
+	size_t contiguous = SHM_RING_SIZE - pos;
+	size_t needed = rec > contiguous ? contiguous + rec : rec;
+
+	if (rec > SHM_RING_SIZE / 2 || SHM_RING_SIZE - (tail - head) < needed)
+		return 0;
+	if (rec > contiguous) {
+		struct am_hdr pad = { SHM_RECORD_PAD, (uint32_t)(contiguous - sizeof(pad)) };
+		memcpy(data + pos, &pad, sizeof(pad));
+		tail += contiguous;
+		pos = 0;
+	}
+	uint8_t *out = data + pos;
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(out, iov[i].iov_base, iov[i].iov_len);
+		out += iov[i].iov_len;
+	}
+	__atomic_store_n(&shm->request.tail, tail + rec, __ATOMIC_RELEASE);
+
+	/* The request is queued now, even if ringing the doorbell fails */
+	uint64_t one = 1;
+	write(shm_req_efd, &one, sizeof(one));
+	return 1;
+}
+
+/* Handle a message that is already in memory: a ring record, or a short control message */
+static void am_message(uint32_t type, const uint8_t *data, uint32_t len)
+{
+	if (type == AM_TRANS_TAGGED && len >= sizeof(uint32_t)) {
+		uint32_t tag;
+		memcpy(&tag, data, sizeof(tag));
+		data += sizeof(tag);
+		len -= sizeof(tag);
+
+		pthread_mutex_lock(&am_lock);
+		struct am_call *c = am_take_call(tag);
+		pthread_mutex_unlock(&am_lock);
+		if (!c)
+			return;
+		if (len < sizeof(header)) {
+			am_complete(c, len);
+			return;
+		}
+		memcpy(c->rep_hdr, data, sizeof(header));
+		unsigned cnt = len - sizeof(header) < c->rep_cnt ? len - sizeof(header) : c->rep_cnt;
+		if (cnt)
+			memcpy(c->rep_buf, data + sizeof(header), cnt);
+		am_complete(c, len);
+	} else if (type == AM_REQUEST && len >= sizeof(struct am_req_hdr) + sizeof(header)) {
+		struct am_req_hdr req;
+		header hdr;
+		memcpy(&req, data, sizeof(req));
+		memcpy(&hdr, data + sizeof(req), sizeof(hdr));
+		data += sizeof(req) + sizeof(hdr);
+		len -= sizeof(req) + sizeof(hdr);
+
+		pthread_mutex_lock(&am_lock);
+		struct am_getreq *g = am_take_getreq(&hdr);
+		if (!g) {
+			struct am_request *r = am_queue_request(&req, &hdr, len);
+			if (r)
+				memcpy(r->data, data, len);
+			pthread_mutex_unlock(&am_lock);
+			return;
+		}
+		pthread_mutex_unlock(&am_lock);
+		memcpy(g->hdr, &hdr, sizeof(hdr));
+		if (g->cnt)
+			memcpy(g->buf, data, len < g->cnt ? len : g->cnt);
+		am_getreq_complete(g, &req, len);
+	} else if (type == AM_GROUP_MESSAGE && len >= sizeof(struct am_grp_hdr)) {
+		struct am_grp_hdr hdr;
+		memcpy(&hdr, data, sizeof(hdr));
+		data += sizeof(hdr);
+		len -= sizeof(hdr);
+
+		pthread_mutex_lock(&am_lock);
+		struct am_grp_wait *w = am_take_grp_wait(&hdr);
+		if (!w) {
+			struct am_grp_msg *m = am_queue_grp_msg(&hdr, len);
+			if (m)
+				memcpy(m->data, data, len);
+			pthread_mutex_unlock(&am_lock);
+			return;
+		}
+		pthread_mutex_unlock(&am_lock);
+		if (w->cnt)
+			memcpy(w->buf, data, len < w->cnt ? len : w->cnt);
+		am_grp_complete(w, &hdr, len);
+	} else if ((type == AM_REGISTER || type == AM_GROUP_JOIN || type == AM_GROUP_LEAVE) && len >= sizeof(int32_t)) {
+		int32_t status;
+		memcpy(&status, data, sizeof(status));
+		pthread_mutex_lock(&am_lock);
+		am_reg_status = status ? RPC_FAILURE : 0;
+		am_reg_done = 1;
+		pthread_cond_broadcast(&am_cond);
+		pthread_mutex_unlock(&am_lock);
+	}
+}
+
+/* Hand every message waiting in the reply ring to its call; returns how many there were */
+static int shm_receive(void)
+{
+	uint8_t *data = (uint8_t *)shm + SHM_DATA_OFFSET + SHM_RING_SIZE;
+	uint64_t head = shm->reply.head;
+	uint64_t tail, rings;
+	int n = 0;
+
+	/* Clear the doorbell before looking at the ring, or a record posted in
+	 * between would be left there with nothing to ring for it again */
+	read(shm_rep_efd, &rings, sizeof(rings));
+	tail = __atomic_load_n(&shm->reply.tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		size_t pos = head & (SHM_RING_SIZE - 1);
+		struct am_hdr rec;
+		memcpy(&rec, data + pos, sizeof(rec));
+		if (rec.type == SHM_RECORD_PAD) {
+			head += SHM_RING_SIZE - pos;
+		} else {
+			am_message(rec.type, data + pos + sizeof(rec), rec.len);
+			head += SHM_RECORD(rec.len);
+			n++;
+		}
+		__atomic_store_n(&shm->reply.head, head, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+
+/*
+ * Read one datagram from a seqpacket socket. The fixed part of a reply or
+ * request is peeked first so the rest can be scattered straight into the
+ * waiting caller's buffers; the kernel drops whatever does not fit them.
+ */
+static int seqpacket_receive(int fd)
+{
+	union {
+		struct {
+			struct am_hdr hdr;
+			uint32_t tag;
+		} __attribute__((packed)) reply;
+		struct {
+			struct am_hdr hdr;
+			struct am_req_hdr req;
+			header h;
+		} __attribute__((packed)) request;
+		struct {
+			struct am_hdr hdr;
+			struct am_grp_hdr grp;
+		} __attribute__((packed)) group;
+		struct {
+			struct am_hdr hdr;
+			uint8_t data[64];
+		} __attribute__((packed)) control;
+	} pre;
+	ssize_t n = recv(fd, &pre, sizeof(pre), MSG_PEEK);
+	if (n < 0 && errno == EINTR)
+		return 0;
+	if (n < (ssize_t)sizeof(struct am_hdr))
+		return -1;
+
+	struct iovec iov[3] = { { &pre, (size_t)n } };
+	int iovcnt = 1;
+	struct am_call *c = NULL;
+	struct am_getreq *g = NULL;
+	struct am_request *r = NULL;
+	struct am_grp_wait *w = NULL;
+	struct am_grp_msg *m = NULL;
+	uint32_t type = pre.reply.hdr.type;
+	unsigned len = 0;
+
+	if (type == AM_TRANS_TAGGED && n >= (ssize_t)sizeof(pre.reply)) {
+		iov[0].iov_len = sizeof(pre.reply);
+		pthread_mutex_lock(&am_lock);
+		c = am_take_call(pre.reply.tag);
+		pthread_mutex_unlock(&am_lock);
+		if (c) {
+			iov[iovcnt].iov_base = c->rep_hdr;
+			iov[iovcnt++].iov_len = sizeof(header);
+			if (c->rep_cnt) {
+				iov[iovcnt].iov_base = c->rep_buf;
+				iov[iovcnt++].iov_len = c->rep_cnt;
+			}
+		}
+	} else if (type == AM_REQUEST && n >= (ssize_t)sizeof(pre.request)) {
+		iov[0].iov_len = sizeof(pre.request);
+		len = pre.request.hdr.len - sizeof(pre.request.req) - sizeof(header);
+		pthread_mutex_lock(&am_lock);
+		g = am_take_getreq(&pre.request.h);
+		if (!g)
+			r = am_queue_request(&pre.request.req, &pre.request.h, len);
+		pthread_mutex_unlock(&am_lock);
+		if (g && g->cnt) {
+			iov[iovcnt].iov_base = g->buf;
+			iov[iovcnt++].iov_len = g->cnt;
+		} else if (r) {
+			iov[iovcnt].iov_base = r->data;
+			iov[iovcnt++].iov_len = len;
+		}
+	} else if (type == AM_GROUP_MESSAGE && n >= (ssize_t)sizeof(pre.group)) {
+		iov[0].iov_len = sizeof(pre.group);
+		len = pre.group.hdr.len - sizeof(pre.group.grp);
+		pthread_mutex_lock(&am_lock);
+		w = am_take_grp_wait(&pre.group.grp);
+		if (!w)
+			m = am_queue_grp_msg(&pre.group.grp, len);
+		pthread_mutex_unlock(&am_lock);
+		if (w && w->cnt) {
+			iov[iovcnt].iov_base = w->buf;
+			iov[iovcnt++].iov_len = w->cnt;
+		} else if (m) {
+			iov[iovcnt].iov_base = m->data;
+			iov[iovcnt++].iov_len = len;
+		}
+	}
+
+	do
+		n = readv(fd, iov, iovcnt);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return -1;
+
+	if (c) {
+		len = pre.reply.hdr.len - sizeof(pre.reply.tag);
+		am_complete(c, len);
+	} else if (g) {
+		memcpy(g->hdr, &pre.request.h, sizeof(header));
+		am_getreq_complete(g, &pre.request.req, len);
+	} else if (w) {
+		am_grp_complete(w, &pre.group.grp, len);
+	} else if (type != AM_TRANS_TAGGED && type != AM_REQUEST && type != AM_GROUP_MESSAGE &&
+		   pre.control.hdr.len <= sizeof(pre.control.data)) {
+		am_message(type, pre.control.data, pre.control.hdr.len);
+	}
+	return 0;
+}
+
+/* Read and drop the rest of a message */
+static int sock_discard(int fd, unsigned len)
+{
+	static char discard[4096];
+	while (len) {
+		unsigned n = len < sizeof(discard) ? len : sizeof(discard);
+		if (read_full(fd, discard, n) < 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Read a tagged reply, scattering it straight into its call's buffers */
+static int sock_receive_reply(int fd, unsigned len)
+{
+	uint32_t tag;
+	if (len < sizeof(tag))
+		return sock_discard(fd, len);
+	if (read_full(fd, &tag, sizeof(tag)) < 0)
+		return -1;
+	len -= sizeof(tag);
+
+	pthread_mutex_lock(&am_lock);
+	struct am_call *c = am_take_call(tag);
+	pthread_mutex_unlock(&am_lock);
+
+	struct iovec iov[2];
+	int iovcnt = 0;
+	unsigned rest = len;
+	if (c && rest >= sizeof(header)) {
+		iov[iovcnt].iov_base = c->rep_hdr;
+		iov[iovcnt++].iov_len = sizeof(header);
+		rest -= sizeof(header);
+		unsigned cnt = rest < c->rep_cnt ? rest : c->rep_cnt;
+		if (cnt) {
+			iov[iovcnt].iov_base = c->rep_buf;
+			iov[iovcnt++].iov_len = cnt;
+			rest -= cnt;
+		}
+	}
+	if (iovcnt && readv_full(fd, iov, iovcnt) < 0)
+		return -1;
+	/* Whatever does not fit the caller's buffers (or has no caller) is dropped */
+	if (sock_discard(fd, rest) < 0)
+		return -1;
+	if (c)
+		am_complete(c, len);
+	return 0;
+}
+
+/* Read a request into the getreq() waiting for its port, or queue it */
+static int sock_receive_request(int fd, unsigned len)
+{
+	struct {
+		struct am_req_hdr req;
+		header h;
+	} __attribute__((packed)) pre;
+	if (len < sizeof(pre))
+		return sock_discard(fd, len);
+	if (read_full(fd, &pre, sizeof(pre)) < 0)
+		return -1;
+	len -= sizeof(pre);
+
+	pthread_mutex_lock(&am_lock);
+	struct am_getreq *g = am_take_getreq(&pre.h);
+	struct am_request *r = g ? NULL : am_queue_request(&pre.req, &pre.h, len);
+	pthread_mutex_unlock(&am_lock);
+
+	if (r)
+		return read_full(fd, r->data, len);
+	if (!g)
+		return sock_discard(fd, len);
+	unsigned cnt = len < g->cnt ? len : g->cnt;
+	if (cnt && read_full(fd, g->buf, cnt) < 0)
+		return -1;
+	if (sock_discard(fd, len - cnt) < 0)
+		return -1;
+	memcpy(g->hdr, &pre.h, sizeof(header));
+	am_getreq_complete(g, &pre.req, len);
+	return 0;
+}
+
+/* Read a group message into the am_grp_receive() waiting for its group, or queue it */
+static int sock_receive_group(int fd, unsigned len)
+{
+	struct am_grp_hdr hdr;
+	if (len < sizeof(hdr))
+		return sock_discard(fd, len);
+	if (read_full(fd, &hdr, sizeof(hdr)) < 0)
+		return -1;
+	len -= sizeof(hdr);
+
+	pthread_mutex_lock(&am_lock);
+	struct am_grp_wait *w = am_take_grp_wait(&hdr);
+	struct am_grp_msg *m = w ? NULL : am_queue_grp_msg(&hdr, len);
+	pthread_mutex_unlock(&am_lock);
+
+	if (m)
+		return read_full(fd, m->data, len);
+	if (!w)
+		return sock_discard(fd, len);
+	unsigned cnt = len < w->cnt ? len : w->cnt;
+	if (cnt && read_full(fd, w->buf, cnt) < 0)
+		return -1;
+	if (sock_discard(fd, len - cnt) < 0)
+		return -1;
+	am_grp_complete(w, &hdr, len);
+	return 0;
+}
+
+/* Read one message from the socket */
+static int sock_receive(int fd)
+{
+	if (am_seqpacket)
+		return seqpacket_receive(fd);
+
+	struct am_hdr hdr;
+	if (read_full(fd, &hdr, sizeof(hdr)) < 0)
+		return -1;
+	if (hdr.type == AM_TRANS_TAGGED)
+		return sock_receive_reply(fd, hdr.len);
+	if (hdr.type == AM_REQUEST)
+		return sock_receive_request(fd, hdr.len);
+	if (hdr.type == AM_GROUP_MESSAGE)
+		return sock_receive_group(fd, hdr.len);
+
+	uint8_t data[64];
+	if (hdr.len > sizeof(data))
+		return sock_discard(fd, hdr.len);	/* Not ours to interpret */
+	if (read_full(fd, data, hdr.len) < 0)
+		return -1;
+	am_message(hdr.type, data, hdr.len);
+	return 0;
+}
+
+/*
+ * Wait for replies as the reader and dispatch whatever arrives. With
+ * block == 0 this only handles what is already there. Called without
+ * am_lock, by the single thread holding the reader role.
+ */
+static int am_receive(int fd, int block)
+{
+	struct pollfd pfd[2] = { { fd, POLLIN, 0 }, { shm_rep_efd, POLLIN, 0 } };
+	int nfds = shm ? 2 : 1;
+
+	/* What is already in the ring may be what the caller waits for */
+	if (shm && shm_receive())
+		block = 0;
+	if (poll(pfd, nfds, block ? -1 : 0) < 0)
+		return errno == EINTR ? 0 : -1;
+	if (nfds == 2 && (pfd[1].revents & POLLIN))
+		shm_receive();
+	if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+		return sock_receive(fd);
+	return 0;
+}
+
+/*
+ * Wait until *done is set, taking the reader role whenever nobody else holds
+ * it. Called with am_lock held.
+ */
+static void am_wait(int *done)
+{
+	while (!*done) {
+		if (am_reading) {
+			pthread_cond_wait(&am_cond, &am_lock);
+			continue;
+		}
+		/* Take the reader role until our own message has arrived */
+		am_reading = 1;
+		int fd = am_sock;
+		pthread_mutex_unlock(&am_lock);
+		int rc = am_receive(fd, 1);
+		pthread_mutex_lock(&am_lock);
+		am_reading = 0;
+		if (rc < 0) {
+			printf("Error receiving reply from amoeba driver: %s\n", strerror(errno));
+			am_disconnect();
+		}
+		pthread_cond_broadcast(&am_cond);
+	}
+}
+
+/* Send one message, through the request ring if there is room in it */
+static int am_send(int fd, struct iovec *iov, int iovcnt, size_t len)
+{
+	pthread_mutex_lock(&am_send_lock);
+	int ok = (shm && shm_send(iov, iovcnt, len)) || writev_full(fd, iov, iovcnt) == 0;
+	pthread_mutex_unlock(&am_send_lock);
+
+	if (!ok) {
+		printf("Error sending request to amoeba driver: %s\n", strerror(errno));
+		pthread_mutex_lock(&am_lock);
+		am_disconnect();
+		pthread_mutex_unlock(&am_lock);
+		return RPC_TRYAGAIN;
+	}
+	return 0;
+}
+
+int am_trans_start(struct am_call *call, header *req_hdr, char *req_buf, unsigned req_cnt,
+		   header *rep_hdr, char *rep_buf, unsigned rep_cnt)
+{
+	pthread_mutex_lock(&am_lock);
+	int err = am_connect();
+	if (err) {
+		pthread_mutex_unlock(&am_lock);
+		return err;
+	}
+	int fd = am_sock;
+	call->tag = ++am_next_tag;
+	call->rep_hdr = rep_hdr;
+	call->rep_buf = rep_buf;
+	call->rep_cnt = rep_cnt;
+	call->rep_len = 0;
+	call->status = 0;
+	call->done = 0;
+	call->next = am_calls;
+	am_calls = call;
+	pthread_mutex_unlock(&am_lock);
+
+	struct am_hdr hdr = { AM_TRANS_TAGGED, (uint32_t)(sizeof(call->tag) + sizeof(header) + (req_buf ? req_cnt : 0)) };
+	struct iovec iov[4] = {
+		{ &hdr, sizeof(hdr) },
+		{ &call->tag, sizeof(call->tag) },
+		{ req_hdr, sizeof(header) },
+		{ req_buf, req_buf ? req_cnt : 0 },
+	};
+	int iovcnt = req_buf && req_cnt ? 4 : 3;
+	return am_send(fd, iov, iovcnt, sizeof(hdr) + hdr.len);
+}
+
+int am_trans_wait(struct am_call *call)
+{
+	pthread_mutex_lock(&am_lock);
+	am_wait(&call->done);
+	pthread_mutex_unlock(&am_lock);
+	return call->status;
+}
+
+int am_poll_fds(int fds[2])
+{
+	pthread_mutex_lock(&am_lock);
+	int err = am_connect();
+	int n = 0;
+	if (!err) {
+		fds[n++] = am_sock;
+		if (shm)
+			fds[n++] = shm_rep_efd;
+	}
+	pthread_mutex_unlock(&am_lock);
+	return err ? err : n;
+}
+
+int am_dispatch(void)
+{
+	pthread_mutex_lock(&am_lock);
+	if (am_reading || am_sock < 0) {
+		pthread_mutex_unlock(&am_lock);
+		return 0;
+	}
+	am_reading = 1;
+	int fd = am_sock;
+	pthread_mutex_unlock(&am_lock);
+	int rc = am_receive(fd, 0);
+	pthread_mutex_lock(&am_lock);
+	am_reading = 0;
+	if (rc < 0)
+		am_disconnect();
+	pthread_cond_broadcast(&am_cond);
+	pthread_mutex_unlock(&am_lock);
+	return rc < 0 ? RPC_TRYAGAIN : 0;
+}
+
+/*
+ * Send the daemon a port in a control message (registration, group join or
+ * leave) and wait for its answer. Only one is outstanding at a time, under
+ * am_reg_lock. Control messages go over the socket only, so the answer cannot
+ * overtake a request already in the ring. Called with am_reg_lock and am_lock
+ * held; returns 0 or an RPC_* error.
+ */
+static int am_control(uint32_t type, const uint8_t port[6])
+{
+	int err = am_connect();
+	if (err)
+		return err;
+	int fd = am_sock;
+	am_reg_done = 0;
+	pthread_mutex_unlock(&am_lock);
+
+	struct am_hdr hdr = { type, 6 };
+	struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { (void *)port, 6 } };
+	pthread_mutex_lock(&am_send_lock);
+	int ok = writev_full(fd, iov, 2) == 0;
+	pthread_mutex_unlock(&am_send_lock);
+
+	pthread_mutex_lock(&am_lock);
+	if (!ok) {
+		printf("Error sending control message to amoeba driver: %s\n", strerror(errno));
+		am_disconnect();
+	}
+	am_wait(&am_reg_done);
+	return am_reg_status;
+}
+
+/*
+ * Ask the daemon to route requests for a port to this connection, once per
+ * connection. Called with am_lock held.
+ */
+static int am_register(const uint8_t port[6])
+{
+	struct am_port *p;
+	for (p = am_ports; p; p = p->next) {
+		if (memcmp(p->port, port, sizeof(p->port)) == 0)
+			return 0;
+	}
+
+	pthread_mutex_unlock(&am_lock);
+	pthread_mutex_lock(&am_reg_lock);
+	pthread_mutex_lock(&am_lock);
+	for (p = am_ports; p; p = p->next) {
+		if (memcmp(p->port, port, sizeof(p->port)) == 0)
+			break;
+	}
+	int err = p ? 0 : am_control(AM_REGISTER, port);
+	if (!p && !err && (p = malloc(sizeof(*p))) != NULL) {
+		memcpy(p->port, port, sizeof(p->port));
+		p->next = am_ports;
+		am_ports = p;
+	}
+	pthread_mutex_unlock(&am_reg_lock);
+	return err;
+}
+
+int am_getreq(header *hdr, char *buf, unsigned cnt)
+{
+	struct am_getreq g;
+
+	am_serving_valid = 0;
+	pthread_mutex_lock(&am_lock);
+	int err = am_connect();
+	if (!err)
+		err = am_register((const uint8_t *)&hdr->h_port);
+	if (err) {
+		pthread_mutex_unlock(&am_lock);
+		return err;
+	}
+
+	/* A request may have come in while no thread was waiting for it */
+	struct am_request **pp;
+	for (pp = &am_requests; *pp; pp = &(*pp)->next) {
+		struct am_request *r = *pp;
+		if (memcmp(&r->hdr.h_port, &hdr->h_port, sizeof(hdr->h_port)) == 0) {
+			*pp = r->next;
+			if (am_requests_tail == &r->next)
+				am_requests_tail = pp;
+			pthread_mutex_unlock(&am_lock);
+
+			memcpy(hdr, &r->hdr, sizeof(header));
+			if (cnt)
+				memcpy(buf, r->data, r->len < cnt ? r->len : cnt);
+			am_serving = r->req;
+			am_serving_valid = 1;
+			unsigned len = r->len;
+			free(r);
+			return (int)len;
+		}
+	}
+
+	g.hdr = hdr;
+	g.buf = buf;
+	g.cnt = buf ? cnt : 0;
+	g.len = 0;
+	g.status = 0;
+	g.done = 0;
+	g.next = NULL;
+	struct am_getreq **tail = &am_getreqs;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = &g;
+	am_wait(&g.done);
+	pthread_mutex_unlock(&am_lock);
+
+	if (g.status)
+		return g.status;
+	am_serving = g.req;
+	am_serving_valid = 1;
+	return (int)g.len;
+}
+
+int am_putrep(header *hdr, char *buf, unsigned cnt)
+{
+	if (!am_serving_valid)
+		return RPC_FAILURE;
+	am_serving_valid = 0;
+
+	pthread_mutex_lock(&am_lock);
+	int fd = am_sock;
+	pthread_mutex_unlock(&am_lock);
+	if (fd < 0)
+		return RPC_TRYAGAIN;	/* The request went with the connection */
+
+	struct am_hdr ahdr = { AM_REPLY, (uint32_t)(sizeof(am_serving) + sizeof(header) + (buf ? cnt : 0)) };
+	struct iovec iov[4] = {
+		{ &ahdr, sizeof(ahdr) },
+		{ &am_serving, sizeof(am_serving) },
+		{ hdr, sizeof(header) },
+		{ buf, buf ? cnt : 0 },
+	};
+	return am_send(fd, iov, buf && cnt ? 4 : 3, sizeof(ahdr) + ahdr.len);
+}
+
+static int am_grp_control(uint32_t type, port *p)
+{
+	pthread_mutex_lock(&am_reg_lock);
+	pthread_mutex_lock(&am_lock);
+	int err = am_control(type, (const uint8_t *)p);
+	pthread_mutex_unlock(&am_lock);
+	pthread_mutex_unlock(&am_reg_lock);
+	return err;
+}
+
+int am_grp_join(port *p)
+{
+	return am_grp_control(AM_GROUP_JOIN, p);
+}
+
+int am_grp_leave(port *p)
+{
+	return am_grp_control(AM_GROUP_LEAVE, p);
+}
+
+int am_grp_send(port *p, char *buf, unsigned cnt)
+{
+	pthread_mutex_lock(&am_lock);
+	int err = am_connect();
+	int fd = am_sock;
+	pthread_mutex_unlock(&am_lock);
+	if (err)
+		return err;
+
+	struct am_hdr hdr = { AM_GROUP_SEND, (uint32_t)(sizeof(*p) + (buf ? cnt : 0)) };
+	struct iovec iov[3] = {
+		{ &hdr, sizeof(hdr) },
+		{ p, sizeof(*p) },
+		{ buf, buf ? cnt : 0 },
+	};
+	return am_send(fd, iov, buf && cnt ? 3 : 2, sizeof(hdr) + hdr.len);
+}
+
+int am_grp_receive(port *p, char *buf, unsigned cnt, uint64_t *sender)
+{
+	struct am_grp_wait w;
+
+	pthread_mutex_lock(&am_lock);
+	int err = am_connect();
+	if (err) {
+		pthread_mutex_unlock(&am_lock);
+		return err;
+	}
+
+	/* A message may have come in while no thread was waiting for it */
+	struct am_grp_msg **pp;
+	for (pp = &am_grp_msgs; *pp; pp = &(*pp)->next) {
+		struct am_grp_msg *m = *pp;
+		if (memcmp(m->hdr.port, p, sizeof(m->hdr.port)) == 0) {
+			*pp = m->next;
+			if (am_grp_msgs_tail == &m->next)
+				am_grp_msgs_tail = pp;
+			am_grp_queued--;
+			pthread_mutex_unlock(&am_lock);
+
+			if (cnt && buf)
+				memcpy(buf, m->data, m->len < cnt ? m->len : cnt);
+			if (sender)
+				*sender = m->hdr.sender;
+			unsigned len = m->len;
+			free(m);
+			return (int)len;
+		}
+	}
+
+	w.port = (const uint8_t *)p;
+	w.buf = buf;
+	w.cnt = buf ? cnt : 0;
+	w.len = 0;
+	w.sender = 0;
+	w.status = 0;
+	w.done = 0;
+	w.next = NULL;
+	struct am_grp_wait **tail = &am_grp_waits;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = &w;
+	am_wait(&w.done);
+	pthread_mutex_unlock(&am_lock);
+
+	if (w.status)
+		return w.status;
+	if (sender)
+		*sender = w.sender;
+	return (int)w.len;
+}
+
+int _amoeba(int req)
+{
+	struct am_call call;
+	int err;
 
-	struct am_hdr *hdr = malloc (sizeof (struct am_hdr));
-	hdr->type = req;
 	switch (req) {
 		case AM_TRANS:
-			hdr->len = sizeof(header) + am_tp.tp_par[0].par_cnt;
 			break;
+		case AM_GETREQ:
+			return am_getreq(am_tp.tp_par[0].par_hdr, am_tp.tp_par[0].par_buf, am_tp.tp_par[0].par_cnt);
+		case AM_PUTREP:
+			return am_putrep(am_tp.tp_par[0].par_hdr, am_tp.tp_par[0].par_buf, am_tp.tp_par[0].par_cnt);
 		default:
 			*(((int *)0)) = 0;
 			break;
 	}
-	uint8 p[6];
-	memcpy(p, &am_tp.tp_par[0].par_hdr->h_port, 6);
-	/* Send request */
-	struct iovec iov[3];
-	iov[0].iov_base = hdr;
-	iov[0].iov_len = sizeof(struct am_hdr);
-	iov[1].iov_base = (req == AM_TRANS || req == AM_PUTREP) ? (void *)am_tp.tp_par[0].par_hdr : NULL;
-	iov[1].iov_len = (req == AM_TRANS || req == AM_PUTREP) ? sizeof(header) : 0;
-	iov[2].iov_base = (req == AM_TRANS || req == AM_PUTREP) ? (void *)am_tp.tp_par[0].par_buf : NULL;
-	iov[2].iov_len = (req == AM_TRANS || req == AM_PUTREP) ? am_tp.tp_par[0].par_cnt : 0;
-
-	int written = writev(fd, iov, (req == AM_TRANS || req == AM_PUTREP) ? (am_tp.tp_par[0].par_buf ? 3 : 2) : 1);
-	/* Wait for reply */
-	int n = recv(fd, hdr, sizeof(*hdr), 0);
-	if (n < 0)
-	{
-		printf("Error receiving reply from amoeba driver: %s\n", strerror(errno));
-	    return RPC_TRYAGAIN;
-	}
-	if (hdr->len >= sizeof (header))
-	{
-		n = recv(fd, am_tp.tp_par[1].par_hdr, sizeof(header), 0);
-		if (n < 0)
-		{
-			printf("Error receiving header from amoeba driver: %s\n", strerror(errno));
-		    return RPC_TRYAGAIN;
-		}
-		if (hdr->len > sizeof(header))
-		{
-			n = recv(fd, am_tp.tp_par[1].par_buf, hdr->len - sizeof(header), 0);
-			if (n < 0)
-			{
-				printf("Error receiving buffer from amoeba driver: %s\n", strerror(errno));
-				return RPC_TRYAGAIN;
-			}
-		}
-	}
-	free (hdr);
-	return 0;
+	err = am_trans_start(&call, am_tp.tp_par[0].par_hdr, am_tp.tp_par[0].par_buf, am_tp.tp_par[0].par_cnt,
+			     am_tp.tp_par[1].par_hdr, am_tp.tp_par[1].par_buf, am_tp.tp_par[1].par_cnt);
+	if (err)
+		return err;
+	return am_trans_wait(&call);
 }
@@ -0,0 +1,67 @@
+#ifndef AMOEBA_ASYNC_H
+#define AMOEBA_ASYNC_H
+
+#include <stdint.h>
+
+/*
+ * Pipelined transactions over the flip_linux connection.
+ *
+ * Any number of threads may start transactions at once and each waits only
+ * for its own reply, or a single event-driven thread can keep many in
+ * flight: start them, poll the descriptors from am_poll_fds(), call
+ * am_dispatch() when one is readable and check each call's done flag.
+ * Replies are read straight into the buffers given to am_trans_start(),
+ * which must stay valid until the call is done.
+ */
+
+struct am_call {
+	struct am_call *next;
+	uint32_t tag;
+	header *rep_hdr;
+	char *rep_buf;
+	unsigned rep_cnt;
+	unsigned rep_len;	/* Reply data length; only rep_cnt bytes of it are stored */
+	int status;		/* 0, or an RPC_* error once done */
+	int done;
+};
+
+/* Send a request; returns 0 or an RPC_* error */
+int am_trans_start(struct am_call *call, header *req_hdr, char *req_buf, unsigned req_cnt,
+		   header *rep_hdr, char *rep_buf, unsigned rep_cnt);
+/* Block until the call is done; returns its status */
+int am_trans_wait(struct am_call *call);
+/* Descriptors that become readable when replies arrive; returns how many, or an RPC_* error */
+int am_poll_fds(int fds[2]);
+/* Handle replies that have arrived, without waiting for more */
+int am_dispatch(void);
+
+/*
+ * Serving a port. getreq() registers hdr->h_port with the daemon on first
+ * use and blocks for the next request on it; returns the request data length
+ * (only cnt bytes of it are stored) or an RPC_* error. Several threads, or
+ * several processes, may wait on the same port; the daemon hands each request
+ * to the connection with the fewest requests outstanding. putrep() answers
+ * the request the calling thread last took.
+ */
+int am_getreq(header *hdr, char *buf, unsigned cnt);
+int am_putrep(header *hdr, char *buf, unsigned cnt);
+
+/*
+ * Process groups, named by a port. Every member on every host gets each
+ * message sent to the group, the sender too if it is a member. Delivery is
+ * best effort and unordered between senders; the daemon takes a message off
+ * the network once per host and hands the same copy to all its members.
+ * Membership ends with the connection, after which am_grp_receive() returns
+ * RPC_TRYAGAIN and the group must be joined again. Messages for a group
+ * that arrive while no thread waits for them are queued, up to a limit.
+ */
+int am_grp_join(port *p);
+int am_grp_leave(port *p);
+/* Send to every member; returns 0 or an RPC_* error */
+int am_grp_send(port *p, char *buf, unsigned cnt);
+/* Block for the next message to a group; returns its length (only cnt bytes
+ * of it are stored) or an RPC_* error, and sets *sender to the sending
+ * member's FLIP address */
+int am_grp_receive(port *p, char *buf, unsigned cnt, uint64_t *sender);
+
+#endif
@@ -0,0 +1,498 @@
+// Microbenchmarks for the FLIP packet path, run against in-memory Loopback
+// networks so no TAP device or privileges are needed.
+//
+// Every benchmark reports ns/op, heap allocations/op and frames/s, where
+// frames counts both frames fed to the receiver and frames transmitted.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+
+#include "capture.hpp"
+#include "flip_receiver.hpp"
+#include "flip_router.hpp"
+#include "loopback.hpp"
+#include "pcap_replay.hpp"
+#include "log.hpp"
+#include "tunables.hpp"
+#include "unix_server.hpp"
+
+static uint64_t alloc_count = 0;
+
+void* operator new(size_t size)
+{
+    ++alloc_count;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    ++alloc_count;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+struct bench_result {
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double frames_per_sec;
+};
+
+// Run op until at least min_time has elapsed; frames_per_op is used for frames/s
+static bench_result run_bench(const char* name, double frames_per_op, const std::function<void()>& op)
+{
+    using clock = std::chrono::steady_clock;
+    constexpr auto min_time = std::chrono::milliseconds(200);
+
+    for (int i = 0; i < 16; ++i) {
+        op();  // Warm up caches and lazily sized buffers
+    }
+
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t allocs_before = alloc_count;
+        auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        auto elapsed = clock::now() - start;
+        uint64_t allocs = alloc_count - allocs_before;
+
+        if (elapsed >= min_time || iterations >= (1ULL << 30)) {
+            double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+            bench_result r{iterations, ns, static_cast<double>(allocs) / iterations,
+                           frames_per_op > 0 ? frames_per_op * 1e9 / ns : 0};
+            printf("%-40s %10llu %12.1f %12.2f %14.0f\n", name,
+                   static_cast<unsigned long long>(r.iterations), r.ns_per_op, r.allocs_per_op, r.frames_per_sec);
+            return r;
+        }
+        iterations *= 2;
+    }
+}
+
+static const hwaddr_t mac_a{0x02, 0, 0, 0, 0, 0x0a};
+static const hwaddr_t mac_b{0x02, 0, 0, 0, 0, 0x0b};
+static const hwaddr_t mac_peer1{0x02, 0, 0, 0, 0, 0x11};
+static const hwaddr_t mac_peer2{0x02, 0, 0, 0, 0, 0x22};
+
+// The byte order this host does not use, for packets from hosts that need swapping
+constexpr std::endian foreign_order = std::endian::native == std::endian::little ? std::endian::big : std::endian::little;
+
+template <std::endian Order = std::endian::native>
+static std::vector<uint8_t> build_flip(flip_type type, flip_address_t src, flip_address_t dst, uint32_t message_id,
+                                       size_t payload_len, uint16_t hopcount = 0, uint16_t max_hopcount = 8)
+{
+    std::vector<uint8_t> pkt(sizeof(flip_packet) + payload_len, 0x5a);
+    flip_builder<Order> fp(pkt.data());
+    fp.set_version(1);
+    fp.set_type(static_cast<uint8_t>(type));
+    fp.set_flags(Order == std::endian::little ? FLIP_FLAG_ENDIAN : 0);
+    fp.set_reserved(0);
+    fp.set_actual_hopcount(hopcount);
+    fp.set_max_hopcount(max_hopcount);
+    fp.set_dst_address(dst);
+    fp.set_src_address(src);
+    fp.set_message_id(message_id);
+    fp.set_length(static_cast<uint32_t>(payload_len));
+    fp.set_offset(0);
+    fp.set_total_length(static_cast<uint32_t>(payload_len));
+    return pkt;
+}
+
+// Wrap a FLIP packet (or fragment) in Ethernet and fragment control headers
+static std::vector<uint8_t> build_frame(const hwaddr_t& src_mac, const hwaddr_t& dst_mac, const uint8_t* flip, size_t len)
+{
+    std::vector<uint8_t> frame(sizeof(ethhdr) + sizeof(fc_header) + len);
+    ethhdr eth;
+    std::memcpy(eth.h_dest, dst_mac.data(), 6);
+    std::memcpy(eth.h_source, src_mac.data(), 6);
+    eth.h_proto = flip_ethertype_network();
+    fc_header fch{0, 0};
+    std::memcpy(frame.data(), &eth, sizeof(eth));
+    std::memcpy(frame.data() + sizeof(eth), &fch, sizeof(fch));
+    std::memcpy(frame.data() + sizeof(eth) + sizeof(fch), flip, len);
+    return frame;
+}
+
+// Split a FLIP packet into Ethernet frames the way fragment_and_send does
+static std::vector<std::vector<uint8_t>> build_fragments(const std::vector<uint8_t>& pkt, size_t mtu)
+{
+    auto driver = std::make_shared<Loopback>(mac_peer1, mtu, 4096);
+    fragment_and_send(driver, mac_a, FLIP_ETHERTYPE, pkt.data(), pkt.size());
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<uint8_t> buf(mtu + sizeof(ethhdr));
+    ssize_t n;
+    while ((n = driver->pop_tx(buf.data(), buf.size())) > 0) {
+        frames.emplace_back(buf.begin(), buf.begin() + n);
+    }
+    return frames;
+}
+
+struct bench_node {
+    std::shared_ptr<flip_networks> networks = std::make_shared<flip_networks>();
+    std::shared_ptr<Loopback> net1 = std::make_shared<Loopback>(mac_a, 1500, 4096);
+    std::shared_ptr<Loopback> net2 = std::make_shared<Loopback>(mac_b, 1500, 4096);
+    std::unique_ptr<flip_router> router;
+    std::unique_ptr<flip_receiver> receiver;
+
+    bench_node()
+    {
+        networks->add_network(net1);
+        networks->add_network(net2);
+        router = std::make_unique<flip_router>(networks);
+        receiver = std::make_unique<flip_receiver>(*router, networks);
+    }
+
+    // Teach the router that addr is reachable through net2
+    void learn_on_net2(flip_address_t addr)
+    {
+        auto pkt = build_flip(flip_type::UNIDATA, addr, 0, 1, 0, 0, 0);
+        router->route_packet(mac_peer2, pkt.data(), pkt.size(), net2->get_network_id());
+    }
+
+    void clear_tx()
+    {
+        net1->clear_tx();
+        net2->clear_tx();
+    }
+};
+
+static void bench_recv_packet()
+{
+    bench_node node;
+    constexpr flip_address_t src = 0x1001, dst = 0x2002;
+    node.learn_on_net2(dst);
+
+    auto pkt = build_flip(flip_type::UNIDATA, src, dst, 7, 1000);
+    auto frame = build_frame(mac_peer1, mac_a, pkt.data(), pkt.size());
+    run_bench("recv_packet/unfragmented-1000B", 2, [&] {
+        node.receiver->recv_packet(frame.data(), frame.size(), node.net1->get_network_id());
+        node.clear_tx();
+    });
+
+    // Same path with capture running; the writer thread drains the ring to a scratch file
+    capture_config cfg;
+    cfg.path = "/tmp/flip_bench." + std::to_string(getpid()) + ".pcapng";
+    cfg.max_file_bytes = 16ULL << 20;
+    cfg.max_files = 1;
+    std::string error;
+    if (g_frame_capture.start(cfg, error)) {
+        auto stamp = std::chrono::steady_clock::now();
+        run_bench("recv_packet/unfragmented-1000B+capture", 2, [&] {
+            // The daemon stamps each received frame with the clock reading it
+            // already takes for processing_ns, so no clock is read here
+            flip_capture_stamp(stamp);
+            node.receiver->recv_packet(frame.data(), frame.size(), node.net1->get_network_id());
+            node.clear_tx();
+        });
+        g_frame_capture.stop();
+        printf("%-40s %10llu frames, %llu dropped\n", "  capture", static_cast<unsigned long long>(g_frame_capture.captured()),
+               static_cast<unsigned long long>(g_frame_capture.dropped()));
+        unlink(cfg.path.c_str());
+    }
+
+    auto big = build_flip(flip_type::UNIDATA, src, dst, 8, 8192);
+    auto frags = build_fragments(big, 1500);
+    double frames = static_cast<double>(frags.size()) * 2;
+    run_bench("recv_packet/fragmented-8KiB", frames, [&] {
+        for (const auto& f : frags) {
+            node.receiver->recv_packet(f.data(), f.size(), node.net1->get_network_id());
+        }
+        node.clear_tx();
+    });
+
+    // The same message from a host of the other byte order
+    auto swapped = build_fragments(build_flip<foreign_order>(flip_type::UNIDATA, src, dst, 9, 8192), 1500);
+    run_bench("recv_packet/fragmented-8KiB-swapped", frames, [&] {
+        for (const auto& f : swapped) {
+            node.receiver->recv_packet(f.data(), f.size(), node.net1->get_network_id());
+        }
+        node.clear_tx();
+    });
+}
+
+static void bench_route_packet()
+{
+    bench_node node;
+    constexpr flip_address_t src = 0x1001, known = 0x2002, unknown = 0x3003;
+    node.learn_on_net2(known);
+    node.learn_on_net2(src);
+    flip_network_t in = node.net1->get_network_id();
+
+    struct type_case {
+        const char* name;
+        std::vector<uint8_t> pkt;
+        double frames;
+    };
+    std::vector<uint8_t> multidata = build_flip(flip_type::MULTIDATA, src, 0, 3, 64);
+    network_order::store<uint32_t>(multidata.data() + sizeof(flip_packet), PROTO_GROUP);
+
+    type_case cases[] = {
+        {"route_packet/LOCATE", build_flip(flip_type::LOCATE, src, unknown, 1, 0), 1},
+        {"route_packet/HEREIS", build_flip(flip_type::HEREIS, src, known, 2, 0), 1},
+        {"route_packet/UNIDATA-64B", build_flip(flip_type::UNIDATA, src, known, 3, 64), 1},
+        {"route_packet/UNIDATA-64B-swapped", build_flip<foreign_order>(flip_type::UNIDATA, src, known, 4, 64), 1},
+        {"route_packet/MULTIDATA-64B", multidata, 1},
+        {"route_packet/NOTHERE", build_flip(flip_type::NOTHERE, known, unknown, 5, 0), 1},
+    };
+    for (auto& c : cases) {
+        run_bench(c.name, c.frames, [&] {
+            node.router->route_packet(mac_peer1, c.pkt.data(), c.pkt.size(), in);
+            node.clear_tx();
+        });
+    }
+}
+
+static void bench_fragment_and_send()
+{
+    for (size_t mtu : {size_t{1500}, size_t{9000}}) {
+        auto driver = std::make_shared<Loopback>(mac_a, mtu, 4096);
+        auto pkt = build_flip(flip_type::UNIDATA, 0x1001, 0x2002, 9, 65536);
+        size_t frames = 65536 / (mtu - sizeof(fc_header) - sizeof(flip_packet)) + 1;
+        std::string name = "fragment_and_send/64KiB-mtu" + std::to_string(mtu);
+        run_bench(name.c_str(), static_cast<double>(frames), [&] {
+            fragment_and_send(driver, mac_peer1, FLIP_ETHERTYPE, pkt.data(), pkt.size());
+            driver->clear_tx();
+        });
+    }
+}
+
+static void bench_routing_table()
+{
+    constexpr size_t ROUTES = 100000;
+    bench_node node;
+    flip_network_t in = node.net1->get_network_id();
+
+    std::mt19937_64 rng(42);
+    std::vector<flip_address_t> addrs(ROUTES);
+    for (auto& a : addrs) {
+        a = (rng() & 0x00FFFFFFFFFFFFFFULL) | 1;
+    }
+
+    for (auto a : addrs) {
+        node.learn_on_net2(a);
+    }
+
+    // Learn: every packet comes from a source the 100k-entry table has not seen yet
+    auto pkt = build_flip(flip_type::UNIDATA, 0, 0x3003, 1, 0, 8, 8);
+    flip_builder<std::endian::native> fp(pkt.data());
+    flip_address_t next_src = 0x0100000000000000ULL;
+    run_bench("routing_table/learn-new", 0, [&] {
+        fp.set_src_address(next_src++);
+        node.router->route_packet(mac_peer1, pkt.data(), pkt.size(), in);
+    });
+
+    // Refresh: sources are already known, so only the path age is touched
+    size_t next = 0;
+    run_bench("routing_table/refresh-100k", 0, [&] {
+        fp.set_src_address(addrs[next++ % ROUTES]);
+        node.router->route_packet(mac_peer2, pkt.data(), pkt.size(), node.net2->get_network_id());
+    });
+
+    // Lookup: UNIDATA at its hop limit, so the router resolves the route but does not forward
+    fp.set_src_address(0x1001);
+    size_t i = 0;
+    run_bench("routing_table/lookup-100k", 0, [&] {
+        fp.set_dst_address(addrs[(i++ * 7919) % ROUTES]);
+        node.router->route_packet(mac_peer1, pkt.data(), pkt.size(), in);
+    });
+}
+
+static void bench_unix_framing()
+{
+    std::string path = "/tmp/flip_bench." + std::to_string(getpid()) + ".sock";
+    std::string seqpacket_path = "/tmp/flip_bench." + std::to_string(getpid()) + ".seqpacket";
+    UnixServer server(path, seqpacket_path);
+    if (!server.start()) {
+        fprintf(stderr, "unix framing: cannot listen on %s\n", path.c_str());
+        return;
+    }
+
+    size_t messages = 0;
+    server.set_on_message([&](int, uint32_t, const uint8_t*, size_t) { ++messages; });
+
+    int client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un sa{};
+    sa.sun_family = AF_UNIX;
+    std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+    if (connect(client, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "unix framing: connect failed\n");
+        close(client);
+        return;
+    }
+    server.accept_client();
+    int server_fd = server.get_client_fds().at(0);
+
+    auto make_batch = [](size_t count, size_t payload) {
+        std::vector<uint8_t> batch;
+        for (size_t i = 0; i < count; ++i) {
+            unix_message_header hdr{UNIX_MSG_TRANS, static_cast<uint32_t>(payload)};
+            const uint8_t* h = reinterpret_cast<const uint8_t*>(&hdr);
+            batch.insert(batch.end(), h, h + sizeof(hdr));
+            batch.insert(batch.end(), payload, 0x42);
+        }
+        return batch;
+    };
+
+    struct framing_case {
+        const char* name;
+        size_t count;
+        size_t payload;
+    };
+    framing_case cases[] = {
+        {"unix_framing/64x64B-pipelined", 64, 64},
+        {"unix_framing/1x64KiB", 1, 65536},
+    };
+    for (const auto& c : cases) {
+        auto batch = make_batch(c.count, c.payload);
+        run_bench(c.name, 0, [&] {
+            size_t target = messages + c.count;
+            size_t off = 0;
+            while (messages < target) {
+                if (off < batch.size()) {
+                    ssize_t n = write(client, batch.data() + off, batch.size() - off);
+                    if (n > 0) off += n;
+                }
+                server.handle_client_data(server_fd);
+            }
+        });
+    }
+
+    // The same messages as one datagram each
+    int seq_client = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    std::strncpy(sa.sun_path, seqpacket_path.c_str(), sizeof(sa.sun_path) - 1);
+    if (connect(seq_client, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "unix framing: seqpacket connect failed\n");
+    } else {
+        server.accept_seqpacket_client();
+        int seq_fd = server.get_client_fds().at(1);
+        framing_case seq_cases[] = {
+            {"unix_framing/seqpacket-64x64B", 64, 64},
+            {"unix_framing/seqpacket-1x64KiB", 1, 65536},
+        };
+        for (const auto& c : seq_cases) {
+            auto message = make_batch(1, c.payload);
+            run_bench(c.name, 0, [&] {
+                size_t target = messages + c.count;
+                size_t sent = 0;
+                while (messages < target) {
+                    // The peer queues only a few datagrams, so interleave sends and reads
+                    while (sent < c.count && send(seq_client, message.data(), message.size(), MSG_DONTWAIT) > 0) {
+                        ++sent;
+                    }
+                    server.handle_client_data(seq_fd);
+                }
+            });
+        }
+    }
+
+    close(seq_client);
+    close(client);
+    server.stop();
+}
+
+// Feed a capture through the receiver as fast as possible and report the cost per frame
+static int bench_replay(const std::string& spec)
+{
+    size_t comma = spec.find(',');
+    replay_options opts;
+    opts.pacing = replay_pacing::FAST;
+    if (comma != std::string::npos && !replay_options_parse(std::string_view(spec).substr(comma + 1), opts)) {
+        fprintf(stderr, "Bad replay options in %s\n", spec.c_str());
+        return 1;
+    }
+
+    auto networks = std::make_shared<flip_networks>();
+    std::shared_ptr<PcapReplay> replay;
+    try {
+        replay = std::make_shared<PcapReplay>(spec.substr(0, comma), opts);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    networks->add_network(replay);
+    auto sink = std::make_shared<Loopback>(mac_b, replay->get_mtu(), 4096);
+    networks->add_network(sink);
+    flip_router router(networks);
+    flip_receiver receiver(router, networks);
+
+    std::vector<uint8_t> buf(replay->get_mtu() + sizeof(ethhdr));
+    uint64_t frames = 0, bytes = 0;
+    uint64_t allocs_before = alloc_count;
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    auto start = std::chrono::steady_clock::now();
+    while (!replay->finished()) {
+        ssize_t n = replay->recv(buf.data(), buf.size());
+        if (n <= 0) {
+            // Recorded pacing: wait for the next frame to come due
+            usleep(10);
+            continue;
+        }
+        receiver.recv_packet(buf.data(), n, replay->get_network_id());
+        sink->clear_tx();
+        ++frames;
+        bytes += n;
+    }
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    double cpu_ns = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec);
+
+    if (!frames) {
+        printf("replay %s: no FLIP frames (%llu skipped)\n", spec.c_str(), static_cast<unsigned long long>(replay->get_skipped()));
+        return 0;
+    }
+    printf("replay %s\n", spec.c_str());
+    printf("  frames      %llu rx (%llu bytes), %llu tx, %llu skipped in file\n",
+           static_cast<unsigned long long>(frames), static_cast<unsigned long long>(bytes),
+           static_cast<unsigned long long>(sink->get_tx_frames() + replay->get_tx_frames()),
+           static_cast<unsigned long long>(replay->get_skipped()));
+    printf("  throughput  %.0f frames/s, %.1f MB/s over %.3f s\n", frames / wall_s, bytes / wall_s / 1e6, wall_s);
+    printf("  cost        %.1f CPU ns/frame, %.2f allocs/frame\n", cpu_ns / frames,
+           static_cast<double>(alloc_count - allocs_before) / frames);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    Logger::instance().set_level(log_level::OFF);
+    g_flip_tunables.fragment_delay_us = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        if (opt == 'r') {
+            return bench_replay(optarg);
+        }
+        fprintf(stderr, "Usage: %s [-r capture[,fast|,speed=N][,loops=N][,tx][,if=N]]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-40s %10s %12s %12s %14s\n", "benchmark", "iters", "ns/op", "allocs/op", "frames/s");
+    bench_recv_packet();
+    bench_route_packet();
+    bench_fragment_and_send();
+    bench_routing_table();
+    bench_unix_framing();
+    return 0;
+}
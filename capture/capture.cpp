@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+
+#include "capture.hpp"
+#include "log.hpp"
+#include "packet_view.hpp"
+
+FrameCapture g_frame_capture;
+
+// pcapng block types and options
+constexpr uint32_t PCAPNG_SHB = 0x0A0D0D0A;
+constexpr uint32_t PCAPNG_IDB = 0x00000001;
+constexpr uint32_t PCAPNG_EPB = 0x00000006;
+constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint16_t PCAPNG_LINKTYPE_ETHERNET = 1;
+constexpr uint16_t PCAPNG_OPT_END = 0;
+constexpr uint16_t PCAPNG_OPT_IF_NAME = 2;
+constexpr uint16_t PCAPNG_OPT_IF_TSRESOL = 9;
+constexpr uint16_t PCAPNG_OPT_EPB_FLAGS = 2;
+
+// Offset of the FLIP header in a captured frame
+constexpr size_t CAPTURE_FLIP_OFFSET = sizeof(ethhdr) + sizeof(fc_header);
+
+static const char* const capture_type_names[] = {
+    nullptr, "locate", "hereis", "unidata", "multidata", "nothere", "untrusted",
+};
+
+static bool parse_number(std::string_view s, uint64_t& out, int base = 10)
+{
+    if (base == 16 && s.starts_with("0x")) {
+        s.remove_prefix(2);
+    }
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out, base);
+    return ec == std::errc() && end == s.data() + s.size() && !s.empty();
+}
+
+bool capture_config_parse(std::string_view args, capture_config& cfg, std::string& error)
+{
+    while (!args.empty()) {
+        size_t space = args.find(' ');
+        std::string_view token = args.substr(0, space);
+        args = space == std::string_view::npos ? std::string_view{} : args.substr(space + 1);
+        if (token.empty()) {
+            continue;
+        }
+
+        size_t eq = token.find('=');
+        if (eq == std::string_view::npos) {
+            error = "expected key=value, got '" + std::string(token) + "'";
+            return false;
+        }
+        std::string_view key = token.substr(0, eq);
+        std::string_view value = token.substr(eq + 1);
+        uint64_t n = 0;
+
+        if (key == "file" && !value.empty()) {
+            cfg.path = value;
+        } else if (key == "addr" && parse_number(value, n, 16)) {
+            cfg.filter.address = n;
+        } else if (key == "net" && parse_number(value, n)) {
+            cfg.filter.network = static_cast<flip_network_t>(n);
+        } else if (key == "type") {
+            cfg.filter.type_mask = 0;
+            while (!value.empty()) {
+                size_t comma = value.find(',');
+                std::string name(value.substr(0, comma));
+                value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                size_t t = 1;
+                while (t < std::size(capture_type_names) && name != capture_type_names[t]) {
+                    ++t;
+                }
+                if (t == std::size(capture_type_names)) {
+                    error = "unknown FLIP type '" + name + "'";
+                    return false;
+                }
+                cfg.filter.type_mask |= static_cast<uint8_t>(1u << t);
+            }
+        } else if (key == "mode" && (value == "headers" || value == "replay")) {
+            cfg.replayable = value == "replay";
+        } else if (key == "snaplen" && parse_number(value, n) && n >= CAPTURE_FLIP_OFFSET && n <= CAPTURE_MAX_SNAPLEN) {
+            cfg.snaplen = static_cast<uint32_t>(n);
+        } else if (key == "size" && parse_number(value, n) && n > 0) {
+            cfg.max_file_bytes = n << 20;
+        } else if (key == "files" && parse_number(value, n) && n > 0 && n <= 1000) {
+            cfg.max_files = static_cast<uint32_t>(n);
+        } else if (key == "ring" && parse_number(value, n) && n >= 256 && n <= (1u << 20) && (n & (n - 1)) == 0) {
+            cfg.ring_bytes = static_cast<uint32_t>(n << 10);
+        } else {
+            error = "bad capture option '" + std::string(token) + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+FrameCapture::~FrameCapture()
+{
+    stop();
+}
+
+bool FrameCapture::start(const capture_config& cfg, std::string& error)
+{
+    if (running.load(std::memory_order_relaxed)) {
+        error = "capture already running";
+        return false;
+    }
+
+    config = cfg;
+    if (config.replayable) {
+        config.snaplen = CAPTURE_MAX_SNAPLEN;
+    }
+    filtered = config.filter.address || config.filter.type_mask || config.filter.network;
+    ring_mask = config.ring_bytes - 1;
+    // Touch every page now rather than on the packet path
+    ring.reset(new uint8_t[config.ring_bytes]);
+    std::memset(ring.get(), 0, config.ring_bytes);
+    tail = 0;
+    head_seen = 0;
+    published_tail.store(0, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    captured_count = 0;
+    dropped_count = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    auto steady = std::chrono::steady_clock::now().time_since_epoch();
+    realtime_offset_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec -
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(steady).count();
+    stamp_valid = false;
+
+    if (!open_file(error)) {
+        return false;
+    }
+
+    running.store(true, std::memory_order_release);
+    writer = std::thread([this] { run(); });
+    enabled.store(true, std::memory_order_release);
+    LOG_INFO("Capturing FLIP frames to {}", config.path);
+    return true;
+}
+
+void FrameCapture::stop()
+{
+    enabled.store(false, std::memory_order_release);
+    if (!running.exchange(false)) {
+        return;
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    LOG_INFO("Capture stopped: {} frames, {} dropped", captured(), dropped());
+}
+
+bool FrameCapture::matches(const uint8_t* hdr, size_t hdr_len, const uint8_t* body, size_t body_len,
+                           flip_network_t network) const
+{
+    const capture_filter& f = config.filter;
+    if (f.network && f.network != network) {
+        return false;
+    }
+    if (!f.address && !f.type_mask) {
+        return true;
+    }
+
+    // The FLIP header follows the Ethernet and fragment control headers
+    if (hdr_len + body_len < CAPTURE_FLIP_OFFSET + sizeof(flip_packet)) {
+        return false;
+    }
+    uint8_t raw[sizeof(flip_packet)];
+    if (hdr_len >= CAPTURE_FLIP_OFFSET + sizeof(flip_packet)) {
+        std::memcpy(raw, hdr + CAPTURE_FLIP_OFFSET, sizeof(raw));
+    } else {
+        std::memcpy(raw, body + (CAPTURE_FLIP_OFFSET - hdr_len), sizeof(raw));
+    }
+
+    return with_packet_order(raw, [&](auto order) {
+        const flip_view<decltype(order)::value> fp(raw);
+        if (f.type_mask && (fp.type() >= 8 || !(f.type_mask & (1u << fp.type())))) {
+            return false;
+        }
+        if (f.address && fp.src_address() != f.address && fp.dst_address() != f.address) {
+            return false;
+        }
+        return true;
+    });
+}
+
+void FrameCapture::stamp(std::chrono::steady_clock::time_point now)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    stamp_ns = static_cast<uint64_t>(ns + realtime_offset_ns);
+    stamp_valid = true;
+}
+
+// A single-producer byte ring like the shared-memory transport's: the event
+// loop owns tail and publishes it after each record, the writer owns head.
+void FrameCapture::record(flip_network_t network, capture_dir dir, const uint8_t* hdr, size_t hdr_len,
+                          const uint8_t* body, size_t body_len)
+{
+    if (filtered && !matches(hdr, hdr_len, body, body_len, network)) {
+        return;
+    }
+
+    const size_t orig_len = hdr_len + body_len;
+    const uint32_t cap_len = static_cast<uint32_t>(std::min<size_t>(orig_len, config.snaplen));
+    const size_t size = (sizeof(record_header) + cap_len + 7) & ~size_t{7};
+    size_t pos = tail & ring_mask;
+    size_t contiguous = ring_mask + 1 - pos;
+    size_t needed = size > contiguous ? contiguous + size : size;
+    if (tail + needed - head_seen > ring_mask + 1) {
+        head_seen = head.load(std::memory_order_acquire);
+        if (tail + needed - head_seen > ring_mask + 1) {
+            ++dropped_count;
+            return;
+        }
+    }
+
+    if (size > contiguous) {
+        if (contiguous >= sizeof(record_header)) {
+            record_header pad{};
+            pad.size = static_cast<uint32_t>(contiguous);
+            std::memcpy(&ring[pos], &pad, sizeof(pad));
+        }
+        tail += contiguous;
+        pos = 0;
+    }
+
+    if (config.replayable || !stamp_valid) {
+        stamp(std::chrono::steady_clock::now());
+    }
+    record_header r;
+    r.timestamp_ns = stamp_ns;
+    r.network = network;
+    r.orig_len = static_cast<uint32_t>(orig_len);
+    r.size = static_cast<uint32_t>(size);
+    r.cap_len = static_cast<uint16_t>(cap_len);
+    r.dir = dir;
+    r.reserved = 0;
+    uint8_t* data = &ring[pos];
+    std::memcpy(data, &r, sizeof(r));
+    data += sizeof(r);
+    size_t from_hdr = std::min<size_t>(hdr_len, cap_len);
+    if (from_hdr) {
+        std::memcpy(data, hdr, from_hdr);
+    }
+    std::memcpy(data + from_hdr, body, cap_len - from_hdr);
+
+    tail += size;
+    ++captured_count;
+    published_tail.store(tail, std::memory_order_release);
+}
+
+static void append_u16(std::string& out, uint16_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+static void append_u32(std::string& out, uint32_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+static void append_padded(std::string& out, const void* data, size_t len)
+{
+    out.append(static_cast<const char*>(data), len);
+    out.append((4 - len % 4) % 4, '\0');
+}
+
+static void append_option(std::string& out, uint16_t code, const void* data, size_t len)
+{
+    append_u16(out, code);
+    append_u16(out, static_cast<uint16_t>(len));
+    append_padded(out, data, len);
+}
+
+// Wrap a block body with its type and the leading and trailing total lengths
+static void append_block(std::string& out, uint32_t type, const std::string& body)
+{
+    uint32_t total = static_cast<uint32_t>(body.size() + 12);
+    append_u32(out, type);
+    append_u32(out, total);
+    out += body;
+    append_u32(out, total);
+}
+
+void FrameCapture::write_block(const uint8_t* data, size_t len)
+{
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = ::write(fd, data + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Capture write to {} failed: {}", config.path, log_errno(errno));
+            return;
+        }
+        off += n;
+    }
+}
+
+bool FrameCapture::open_file(std::string& error)
+{
+    fd = ::open(config.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "cannot open " + config.path + ": " + strerror(errno);
+        return false;
+    }
+    interface_ids.clear();
+    out_buf.clear();
+
+    std::string body;
+    append_u32(body, PCAPNG_BYTE_ORDER_MAGIC);
+    append_u16(body, 1);                    // Major version
+    append_u16(body, 0);                    // Minor version
+    uint64_t section_length = UINT64_MAX;   // Unknown
+    body.append(reinterpret_cast<const char*>(&section_length), sizeof(section_length));
+    append_block(out_buf, PCAPNG_SHB, body);
+    file_bytes = out_buf.size();
+    return true;
+}
+
+// Close the current file and shift older ones up: path -> path.1 -> path.2 ...
+void FrameCapture::rotate()
+{
+    write_block(reinterpret_cast<const uint8_t*>(out_buf.data()), out_buf.size());
+    out_buf.clear();
+    ::close(fd);
+    fd = -1;
+
+    for (uint32_t i = config.max_files - 1; i > 0; --i) {
+        std::string from = i == 1 ? config.path : config.path + "." + std::to_string(i - 1);
+        std::string to = config.path + "." + std::to_string(i);
+        ::rename(from.c_str(), to.c_str());
+    }
+
+    std::string error;
+    if (!open_file(error)) {
+        LOG_ERROR("Capture rotation failed: {}", error);
+    }
+}
+
+void FrameCapture::write_packet(const record_header& s, const uint8_t* data)
+{
+    // Block header and trailer, fixed EPB fields, padded data, flags option, end of options
+    size_t epb_len = 12 + 20 + ((s.cap_len + 3) & ~3u) + 8 + 4;
+    if (file_bytes + epb_len > config.max_file_bytes && !interface_ids.empty()) {
+        rotate();
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    // Interfaces are described the first time a network appears in a file
+    auto [it, added] = interface_ids.try_emplace(s.network, static_cast<uint32_t>(interface_ids.size()));
+    if (added) {
+        std::string body;
+        append_u16(body, PCAPNG_LINKTYPE_ETHERNET);
+        append_u16(body, 0);
+        append_u32(body, config.snaplen);
+        std::string name = "flip" + std::to_string(s.network);
+        append_option(body, PCAPNG_OPT_IF_NAME, name.data(), name.size());
+        uint8_t tsresol = 9;  // Nanoseconds
+        append_option(body, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+        append_option(body, PCAPNG_OPT_END, nullptr, 0);
+        size_t before = out_buf.size();
+        append_block(out_buf, PCAPNG_IDB, body);
+        file_bytes += out_buf.size() - before;
+    }
+
+    // The EPB is laid out straight into the output buffer
+    const uint32_t padded = (s.cap_len + 3) & ~3u;
+    const uint32_t fields[] = {
+        PCAPNG_EPB, static_cast<uint32_t>(epb_len), it->second,
+        static_cast<uint32_t>(s.timestamp_ns >> 32), static_cast<uint32_t>(s.timestamp_ns), s.cap_len, s.orig_len,
+    };
+    struct {
+        uint16_t flags_code = PCAPNG_OPT_EPB_FLAGS, flags_len = sizeof(uint32_t);
+        uint32_t flags;
+        uint16_t end_code = PCAPNG_OPT_END, end_len = 0;
+        uint32_t total;
+    } trailer;
+    trailer.flags = static_cast<uint32_t>(s.dir);
+    trailer.total = static_cast<uint32_t>(epb_len);
+    static_assert(sizeof(trailer) == 16);
+    size_t at = out_buf.size();
+    out_buf.resize(at + epb_len);
+    char* p = out_buf.data() + at;
+    std::memcpy(p, fields, sizeof(fields));
+    p += sizeof(fields);
+    std::memcpy(p, data, s.cap_len);
+    std::memset(p + s.cap_len, 0, padded - s.cap_len);
+    std::memcpy(p + padded, &trailer, sizeof(trailer));
+    file_bytes += epb_len;
+}
+
+// Write everything currently queued; returns false if the ring was empty.
+bool FrameCapture::drain()
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = published_tail.load(std::memory_order_acquire);
+    if (h == t) {
+        return false;
+    }
+    while (h != t) {
+        size_t pos = h & ring_mask;
+        size_t contiguous = ring_mask + 1 - pos;
+        if (contiguous < sizeof(record_header)) {
+            h += contiguous;
+            continue;
+        }
+        record_header r;
+        std::memcpy(&r, &ring[pos], sizeof(r));
+        if (r.dir != capture_dir{}) {
+            write_packet(r, &ring[pos + sizeof(r)]);
+        }
+        h += r.size;
+
+        if (out_buf.size() >= (1u << 20)) {
+            // Hand the space back before the write, which may block on disk
+            head.store(h, std::memory_order_release);
+            write_block(reinterpret_cast<const uint8_t*>(out_buf.data()), out_buf.size());
+            out_buf.clear();
+        }
+    }
+    head.store(h, std::memory_order_release);
+    if (fd >= 0 && !out_buf.empty()) {
+        write_block(reinterpret_cast<const uint8_t*>(out_buf.data()), out_buf.size());
+        out_buf.clear();
+    }
+    return true;
+}
+
+void FrameCapture::run()
+{
+    while (running.load(std::memory_order_acquire)) {
+        if (!drain()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    drain();
+}
+
+void FrameCapture::status(std::string& out) const
+{
+    if (!running.load(std::memory_order_relaxed)) {
+        out += "capture stopped\n";
+    } else {
+        char line[256];
+        snprintf(line, sizeof(line), "capture running to %s (%s, snaplen %u, ring %u KiB, rotate at %llu MiB x %u files)\n",
+                 config.path.c_str(), config.replayable ? "replay" : "headers", config.snaplen, config.ring_bytes >> 10,
+                 static_cast<unsigned long long>(config.max_file_bytes >> 20), config.max_files);
+        out += line;
+        const capture_filter& f = config.filter;
+        snprintf(line, sizeof(line), "filter addr %016llx net %u types",
+                 static_cast<unsigned long long>(f.address), f.network);
+        out += line;
+        if (!f.type_mask) {
+            out += " any";
+        }
+        for (size_t t = 1; t < std::size(capture_type_names); ++t) {
+            if (f.type_mask & (1u << t)) {
+                out += ' ';
+                out += capture_type_names[t];
+            }
+        }
+        out += '\n';
+    }
+    out += "frames " + std::to_string(captured()) + " dropped " + std::to_string(dropped()) + "\n";
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+#include "loopback.hpp"
+
+Loopback::frame_ring::frame_ring(size_t frames, size_t frame_size)
+    : storage(frames * frame_size), lengths(frames), frame_size(frame_size)
+{
+}
+
+bool Loopback::frame_ring::push(const void* hdr, size_t hdr_len, const void* buf, size_t len)
+{
+    if (count == lengths.size() || hdr_len + len > frame_size) {
+        return false;
+    }
+    size_t slot = (head + count) % lengths.size();
+    uint8_t* dst = storage.data() + slot * frame_size;
+    if (hdr_len) {
+        std::memcpy(dst, hdr, hdr_len);
+    }
+    std::memcpy(dst + hdr_len, buf, len);
+    lengths[slot] = static_cast<uint32_t>(hdr_len + len);
+    ++count;
+    return true;
+}
+
+ssize_t Loopback::frame_ring::pop(void* buf, size_t len)
+{
+    if (count == 0) {
+        return -1;
+    }
+    size_t n = std::min<size_t>(lengths[head], len);
+    std::memcpy(buf, storage.data() + head * frame_size, n);
+    head = (head + 1) % lengths.size();
+    --count;
+    return static_cast<ssize_t>(n);
+}
+
+Loopback::Loopback(hwaddr_t mac, size_t mtu, size_t ring_frames)
+    : mac(mac), mtu(mtu),
+      rx(ring_frames, mtu + sizeof(ethhdr)),
+      tx(ring_frames, mtu + sizeof(ethhdr))
+{
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        throw std::runtime_error("Failed to create loopback eventfd");
+    }
+}
+
+Loopback::~Loopback()
+{
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+}
+
+void Loopback::signal_rx()
+{
+    uint64_t one = 1;
+    (void)write(event_fd, &one, sizeof(one));
+}
+
+bool Loopback::send(hwaddr_t dst, uint16_t proto, const void *buf, size_t len)
+{
+    ethhdr eth_hdr;
+    memcpy(eth_hdr.h_dest, dst.data(), 6);
+    memcpy(eth_hdr.h_source, this->mac.data(), 6);
+    eth_hdr.h_proto = htons(proto);
+
+    bool ok;
+    if (peer) {
+        ok = peer->rx.push(&eth_hdr, sizeof(eth_hdr), buf, len);
+        if (!ok) {
+            ++peer->rx_drops;
+        } else if (peer->rx.count == 1) {
+            peer->signal_rx();
+        }
+    } else {
+        ok = tx.push(&eth_hdr, sizeof(eth_hdr), buf, len);
+    }
+
+    if (ok) {
+        ++tx_frames;
+    } else {
+        ++tx_drops;
+    }
+    return ok;
+}
+
+bool Loopback::inject(const void* frame, size_t len)
+{
+    if (!rx.push(nullptr, 0, frame, len)) {
+        ++rx_drops;
+        return false;
+    }
+    if (rx.count == 1) {
+        signal_rx();
+    }
+    return true;
+}
+
+ssize_t Loopback::recv(void* buf, size_t len)
+{
+    ssize_t n = rx.pop(buf, len);
+    if (rx.count == 0) {
+        uint64_t value;
+        (void)read(event_fd, &value, sizeof(value));
+    }
+    if (n < 0) {
+        errno = EAGAIN;
+    }
+    return n;
+}
+
+ssize_t Loopback::pop_tx(void* buf, size_t len)
+{
+    return tx.pop(buf, len);
+}
+
+void Loopback::clear_tx()
+{
+    tx.head = 0;
+    tx.count = 0;
+}
+
+int Loopback::get_fd() const
+{
+    return event_fd;
+}
+
+hwaddr_t Loopback::get_mac() const
+{
+    return mac;
+}
+
+size_t Loopback::get_mtu() const
+{
+    return mtu;
+}
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+#include "flip_proto.hpp"
+#include "pcap_replay.hpp"
+#include "log.hpp"
+
+// Classic pcap magic numbers (microsecond and nanosecond timestamps)
+constexpr uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+constexpr uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+constexpr uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+
+// pcapng blocks and options
+constexpr uint32_t PCAPNG_SHB = 0x0A0D0D0A;
+constexpr uint32_t PCAPNG_IDB = 0x00000001;
+constexpr uint32_t PCAPNG_SPB = 0x00000003;
+constexpr uint32_t PCAPNG_EPB = 0x00000006;
+constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint16_t PCAPNG_OPT_IF_TSRESOL = 9;
+constexpr uint16_t PCAPNG_OPT_EPB_FLAGS = 2;
+constexpr uint32_t PCAPNG_EPB_OUTBOUND = 2;
+
+bool replay_options_parse(std::string_view args, replay_options& opts)
+{
+    while (!args.empty()) {
+        size_t comma = args.find(',');
+        std::string_view token = args.substr(0, comma);
+        args = comma == std::string_view::npos ? std::string_view{} : args.substr(comma + 1);
+
+        if (token == "fast") {
+            opts.pacing = replay_pacing::FAST;
+        } else if (token == "tx") {
+            opts.include_tx = true;
+        } else if (token.starts_with("speed=")) {
+            std::string value(token.substr(6));
+            char* end = nullptr;
+            opts.speed = strtod(value.c_str(), &end);
+            if (end == value.c_str() || *end || opts.speed <= 0) {
+                return false;
+            }
+            opts.pacing = replay_pacing::RECORDED;
+        } else if (token.starts_with("loops=")) {
+            auto [end, ec] = std::from_chars(token.data() + 6, token.data() + token.size(), opts.loops);
+            if (ec != std::errc() || end != token.data() + token.size()) {
+                return false;
+            }
+        } else if (token.starts_with("if=")) {
+            auto [end, ec] = std::from_chars(token.data() + 3, token.data() + token.size(), opts.interface);
+            if (ec != std::errc() || end != token.data() + token.size() || opts.interface < 0) {
+                return false;
+            }
+        } else if (!token.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads little- or big-endian fields depending on the file's byte order
+class capture_reader
+{
+private:
+    const std::vector<uint8_t>& file;
+    bool swapped{false};
+
+public:
+    capture_reader(const std::vector<uint8_t>& file) : file(file) {}
+    void set_swapped(bool s) { swapped = s; }
+
+    uint16_t u16(size_t off) const
+    {
+        uint16_t v;
+        std::memcpy(&v, file.data() + off, sizeof(v));
+        return swapped ? __builtin_bswap16(v) : v;
+    }
+
+    uint32_t u32(size_t off) const
+    {
+        uint32_t v;
+        std::memcpy(&v, file.data() + off, sizeof(v));
+        return swapped ? __builtin_bswap32(v) : v;
+    }
+};
+
+PcapReplay::PcapReplay(const std::string& path, const replay_options& options, hwaddr_t mac)
+    : path(path), options(options), mac(mac)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        throw std::runtime_error("Failed to open capture " + path + ": " + strerror(errno));
+    }
+    std::vector<uint8_t> file;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        file.insert(file.end(), chunk, chunk + n);
+    }
+    fclose(f);
+
+    if (file.size() < 4) {
+        throw std::runtime_error("Capture " + path + " is too short");
+    }
+    uint32_t magic;
+    std::memcpy(&magic, file.data(), sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        load_pcapng(file);
+    } else {
+        load_pcap(file);
+    }
+
+    // Frames are replayed relative to the first one, in file order
+    for (size_t i = 1; i < frames.size(); ++i) {
+        frames[i].timestamp_ns = std::max(frames[i].timestamp_ns, frames[i - 1].timestamp_ns);
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        throw std::runtime_error("Failed to create replay timerfd");
+    }
+
+    LOG_INFO("Replaying {} frames from {} ({} skipped), MTU {}", frames.size(), path, skipped, mtu);
+    rewind();
+}
+
+PcapReplay::~PcapReplay()
+{
+    if (timer_fd >= 0) {
+        close(timer_fd);
+    }
+}
+
+void PcapReplay::add_frame(uint64_t timestamp_ns, const uint8_t* frame, uint32_t cap_len, uint32_t orig_len)
+{
+    if (cap_len < orig_len || cap_len < sizeof(ethhdr) + sizeof(fc_header)) {
+        ++skipped;
+        return;
+    }
+    const ethhdr* eth = reinterpret_cast<const ethhdr*>(frame);
+    if (eth->h_proto != flip_ethertype_network()) {
+        ++skipped;
+        return;
+    }
+    frames.push_back(frame_ref{timestamp_ns, data.size(), cap_len});
+    data.insert(data.end(), frame, frame + cap_len);
+    mtu = std::max<size_t>(mtu, cap_len - sizeof(ethhdr));
+}
+
+void PcapReplay::load_pcap(const std::vector<uint8_t>& file)
+{
+    if (file.size() < 24) {
+        throw std::runtime_error("Capture " + path + " is too short");
+    }
+    capture_reader r(file);
+    uint32_t magic = r.u32(0);
+    if (magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        r.set_swapped(true);
+        magic = __builtin_bswap32(magic);
+    }
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) {
+        throw std::runtime_error(path + " is not a pcap or pcapng file");
+    }
+    if (r.u32(20) != PCAP_LINKTYPE_ETHERNET) {
+        throw std::runtime_error(path + " is not an Ethernet capture");
+    }
+    uint64_t frac_ns = magic == PCAP_MAGIC_NS ? 1 : 1000;
+
+    size_t off = 24;
+    while (off + 16 <= file.size()) {
+        uint64_t ts = static_cast<uint64_t>(r.u32(off)) * 1000000000ULL + r.u32(off + 4) * frac_ns;
+        uint32_t cap_len = r.u32(off + 8);
+        uint32_t orig_len = r.u32(off + 12);
+        off += 16;
+        if (off + cap_len > file.size()) {
+            LOG_WARN("Capture {} ends in a truncated record", path);
+            break;
+        }
+        add_frame(ts, file.data() + off, cap_len, orig_len);
+        off += cap_len;
+    }
+}
+
+void PcapReplay::load_pcapng(const std::vector<uint8_t>& file)
+{
+    capture_reader r(file);
+    struct interface_info {
+        uint64_t ticks_per_sec;
+        bool ethernet;
+    };
+    std::vector<interface_info> interfaces;
+    uint64_t last_ts = 0;
+
+    size_t off = 0;
+    while (off + 12 <= file.size()) {
+        uint32_t type = r.u32(off);
+        if (type == PCAPNG_SHB) {
+            // A new section may switch byte order and starts a new interface list
+            r.set_swapped(false);
+            if (r.u32(off + 8) != PCAPNG_BYTE_ORDER_MAGIC) {
+                r.set_swapped(true);
+                if (r.u32(off + 8) != PCAPNG_BYTE_ORDER_MAGIC) {
+                    throw std::runtime_error(path + " has a bad pcapng section header");
+                }
+            }
+            interfaces.clear();
+        }
+        uint32_t len = r.u32(off + 4);
+        if (len < 12 || len % 4 || off + len > file.size()) {
+            LOG_WARN("Capture {} ends in a truncated block", path);
+            break;
+        }
+        size_t body = off + 8;
+        size_t body_end = off + len - 4;
+
+        if (type == PCAPNG_IDB && body + 8 <= body_end) {
+            interface_info info{1000000, r.u16(body) == PCAP_LINKTYPE_ETHERNET};
+            for (size_t opt = body + 8; opt + 4 <= body_end; ) {
+                uint16_t code = r.u16(opt);
+                uint16_t opt_len = r.u16(opt + 2);
+                if (code == 0) break;
+                if (code == PCAPNG_OPT_IF_TSRESOL && opt_len >= 1) {
+                    uint8_t res = file[opt + 4];
+                    uint64_t base = (res & 0x80) ? 2 : 10;
+                    info.ticks_per_sec = 1;
+                    for (uint8_t i = 0; i < (res & 0x7f) && info.ticks_per_sec < 1000000000000ULL; ++i) {
+                        info.ticks_per_sec *= base;
+                    }
+                }
+                opt += 4 + ((opt_len + 3) & ~3u);
+            }
+            interfaces.push_back(info);
+        } else if (type == PCAPNG_EPB && body + 20 <= body_end) {
+            uint32_t iface = r.u32(body);
+            uint64_t ticks = (static_cast<uint64_t>(r.u32(body + 4)) << 32) | r.u32(body + 8);
+            uint32_t cap_len = r.u32(body + 12);
+            uint32_t orig_len = r.u32(body + 16);
+            size_t pkt = body + 20;
+            if (pkt + cap_len > body_end || iface >= interfaces.size()) {
+                ++skipped;
+                off += len;
+                continue;
+            }
+
+            bool outbound = false;
+            for (size_t opt = pkt + ((cap_len + 3) & ~3u); opt + 4 <= body_end; ) {
+                uint16_t code = r.u16(opt);
+                uint16_t opt_len = r.u16(opt + 2);
+                if (code == 0) break;
+                if (code == PCAPNG_OPT_EPB_FLAGS && opt_len == 4) {
+                    outbound = (r.u32(opt + 4) & 3) == PCAPNG_EPB_OUTBOUND;
+                }
+                opt += 4 + ((opt_len + 3) & ~3u);
+            }
+
+            const interface_info& info = interfaces[iface];
+            if (!info.ethernet || (outbound && !options.include_tx) ||
+                (options.interface >= 0 && static_cast<uint32_t>(options.interface) != iface)) {
+                ++skipped;
+            } else {
+                uint64_t ts = ticks / info.ticks_per_sec * 1000000000ULL +
+                              (ticks % info.ticks_per_sec) * 1000000000ULL / info.ticks_per_sec;
+                last_ts = ts;
+                add_frame(ts, file.data() + pkt, cap_len, orig_len);
+            }
+        } else if (type == PCAPNG_SPB && body + 4 <= body_end && !interfaces.empty()) {
+            // Simple packets carry no timestamp; replay them right after the previous frame
+            uint32_t orig_len = r.u32(body);
+            uint32_t cap_len = std::min<uint32_t>(orig_len, static_cast<uint32_t>(body_end - body - 4));
+            if (!interfaces[0].ethernet || (options.interface > 0)) {
+                ++skipped;
+            } else {
+                add_frame(last_ts, file.data() + body + 4, cap_len, orig_len);
+            }
+        }
+        off += len;
+    }
+}
+
+std::chrono::steady_clock::time_point PcapReplay::due_time() const
+{
+    if (options.pacing == replay_pacing::FAST) {
+        return loop_start;
+    }
+    uint64_t offset_ns = frames[next].timestamp_ns - frames.front().timestamp_ns;
+    return loop_start + std::chrono::nanoseconds(static_cast<uint64_t>(offset_ns / options.speed));
+}
+
+void PcapReplay::arm()
+{
+    struct itimerspec spec = {};
+    if (!finished()) {
+        // steady_clock is CLOCK_MONOTONIC on Linux; a due time in the past fires at once
+        auto due = std::chrono::duration_cast<std::chrono::nanoseconds>(due_time().time_since_epoch()).count();
+        spec.it_value.tv_sec = due / 1000000000;
+        spec.it_value.tv_nsec = due % 1000000000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void PcapReplay::rewind()
+{
+    next = 0;
+    loops_done = 0;
+    loop_start = std::chrono::steady_clock::now();
+    arm();
+}
+
+bool PcapReplay::send(hwaddr_t, uint16_t, const void*, size_t len)
+{
+    ++tx_frames;
+    tx_bytes += len;
+    return true;
+}
+
+int PcapReplay::get_fd() const
+{
+    return timer_fd;
+}
+
+ssize_t PcapReplay::recv(void* buf, size_t len)
+{
+    // The timer is left expired while frames are due, so the fd stays readable
+    // and the caller can take them all in one wakeup. Arming it again, for the
+    // next frame or to disarm it at the end, also clears the expiration.
+    if (finished() || (options.pacing == replay_pacing::RECORDED && std::chrono::steady_clock::now() < due_time())) {
+        arm();
+        errno = EAGAIN;
+        return -1;
+    }
+
+    const frame_ref& f = frames[next];
+    size_t n = std::min<size_t>(f.length, len);
+    std::memcpy(buf, data.data() + f.offset, n);
+    ++rx_frames;
+    rx_bytes += n;
+
+    if (++next == frames.size()) {
+        ++loops_done;
+        if (!finished()) {
+            next = 0;
+            loop_start = std::chrono::steady_clock::now();
+        } else {
+            LOG_INFO("Replay of {} finished: {} frames", path, rx_frames);
+            arm();
+        }
+    }
+    return static_cast<ssize_t>(n);
+}
+
+hwaddr_t PcapReplay::get_mac() const
+{
+    return mac;
+}
+
+size_t PcapReplay::get_mtu() const
+{
+    return mtu;
+}
@@ -1,6 +1,5 @@
 #include <cerrno>
 #include <cstring>
-#include <iostream>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/uio.h>
@@ -8,9 +7,12 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
 #include <linux/if_tun.h>
 
 #include "tap.hpp"
+#include "log.hpp"
 
 Tap::Tap(const char *dev)
 {
@@ -30,17 +32,30 @@ Tap::Tap(const char *dev)
         throw std::runtime_error("Failed to set TUN interface");
     }
 
-    std::cout << "Allocated TAP interface: " << ifr.ifr_name << std::endl;
+    LOG_INFO("Allocated TAP interface: {}", std::string_view(ifr.ifr_name));
 
     ioctl(this->fd, SIOCGIFHWADDR, &ifr);
     ifr.ifr_hwaddr.sa_data[5] += 1; // Ensure locally administered bit is set to avoid conflicts with real hardware addresses
     memcpy(this->mac.data(), ifr.ifr_hwaddr.sa_data, 6);
-    std::cout << "TAP MAC Address: " << std::hex << (int)this->mac[0] << ":" << (int)this->mac[1] << ":" << (int)this->mac[2] << ":" << (int)this->mac[3] << ":" << (int)this->mac[4] << ":" << (int)this->mac[5] << std::endl;
+    LOG_INFO("TAP MAC Address: {}", log_mac(this->mac));
+
+    // The tun fd does not answer SIOCGIFMTU, so ask through an ordinary socket
+    this->mtu = ETH_DATA_LEN;
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock >= 0) {
+        if (ioctl(sock, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0) {
+            this->mtu = ifr.ifr_mtu;
+        } else {
+            LOG_WARN("Failed to read MTU of {}, assuming {}", std::string_view(ifr.ifr_name), this->mtu);
+        }
+        close(sock);
+    }
+    LOG_INFO("TAP MTU: {}", this->mtu);
 }
 
 Tap::~Tap()
 {
-    std::cout << "Closing TAP interface" << std::endl;
+    LOG_INFO("Closing TAP interface");
     if (this->fd >= 0) {
         close(this->fd);
     }
@@ -70,6 +85,11 @@ bool Tap::send(hwaddr_t dst, uint16_t proto, const void *buf, size_t len)
     return written == (ssize_t)total_len;
 }
 
+size_t Tap::get_mtu() const
+{
+    return this->mtu;
+}
+
 int Tap::get_fd() const
 {
     return this->fd;
@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstring>
+#include <linux/if_ether.h>
+
+#include "capture.hpp"
+#include "flip_receiver.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include "tunables.hpp"
+#include "trace.hpp"
+
+flip_receiver::flip_receiver(flip_router& router, std::shared_ptr<flip_networks> networks, RpcTransTracker* trans_tracker)
+    : router(router), networks(std::move(networks)), trans_tracker(trans_tracker)
+{
+}
+
+void flip_receiver::expire_reassembly()
+{
+    // Incomplete reassemblies older than the timeout are discarded
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::seconds(g_flip_tunables.reassembly_timeout_sec);
+    for (auto it = reassembly_map.begin(); it != reassembly_map.end(); ) {
+        if (now - it->second.started >= timeout) {
+            LOG_DEBUG("Reassembly of message {} from {} timed out", it->first.message_id, it->first.src_address);
+            ++g_flip_stats.reassembly_timeouts;
+            FLIP_TRACE(reassembly_drop, it->first.src_address, it->first.message_id, static_cast<uint8_t>(TRACE_DROP_TIMEOUT));
+            it = reassembly_map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void flip_receiver::dump_reassembly(std::string& out) const
+{
+    auto now = std::chrono::steady_clock::now();
+    char line[128];
+    for (const auto& [key, entry] : reassembly_map) {
+        auto age_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.started).count();
+        snprintf(line, sizeof(line), "%016llx msg %u net %u %u/%zu bytes age %lldms\n",
+                 static_cast<unsigned long long>(key.src_address), key.message_id, entry.incoming_network,
+                 entry.bytes_received, entry.packet.size() - sizeof(flip_packet), static_cast<long long>(age_ms));
+        out += line;
+    }
+}
+
+size_t flip_receiver::flush_reassembly()
+{
+    size_t count = reassembly_map.size();
+    g_flip_stats.reassembly_drops += count;
+    reassembly_map.clear();
+    return count;
+}
+
+template <std::endian Order>
+void flip_receiver::recv_fragment(const hwaddr_t& src_mac, const uint8_t* flip_data, size_t flip_len,
+                                  flip_network_t incoming_network)
+{
+    const flip_view<Order> fp(flip_data);
+    uint32_t frag_offset = fp.offset();
+    uint32_t frag_length = fp.length();
+    uint32_t total_length = fp.total_length();
+
+    if (frag_offset == 0 && trans_tracker && trans_tracker->active_count() &&
+        flip_len >= sizeof(struct flip_packet) + sizeof(rpc_header)) {
+        const rpc_view<Order> rpc(fp.payload());
+        if (rpc.type() == AM_RPC_REPLY) {
+            trans_tracker->reply_started(fp.dst_address(), rpc.tid());
+        }
+    }
+
+    // Not fragmented: deliver directly
+    if (frag_offset == 0 && (total_length == 0 || frag_length == total_length)) {
+        router.route_packet(src_mac, flip_data, flip_len, incoming_network);
+        return;
+    }
+
+    // Fragmented: reassemble
+    ReassemblyKey key{fp.src_address(), fp.message_id()};
+
+    if (frag_offset == 0) {
+        // First fragment: initialise entry, keeping its header in front of the payload
+        ReassemblyEntry& entry = reassembly_map[key];
+        entry.src_mac = src_mac;
+        entry.incoming_network = incoming_network;
+        entry.packet.assign(sizeof(flip_packet) + total_length, 0);
+        std::memcpy(entry.packet.data(), flip_data, sizeof(flip_packet));
+        entry.bytes_received = 0;
+        entry.started = std::chrono::steady_clock::now();
+        ++g_flip_stats.reassembly_started;
+        FLIP_TRACE(reassembly_start, key.src_address, key.message_id, total_length);
+    }
+
+    auto it = reassembly_map.find(key);
+    if (it == reassembly_map.end()) {
+        LOG_WARN("Out-of-order fragment (no first fragment yet), discarding");
+        ++g_flip_stats.reassembly_drops;
+        FLIP_TRACE(reassembly_drop, key.src_address, key.message_id, static_cast<uint8_t>(TRACE_DROP_NO_FIRST_FRAGMENT));
+        return;
+    }
+
+    ReassemblyEntry& entry = it->second;
+    const size_t entry_total = entry.packet.size() - sizeof(flip_packet);
+    size_t frag_payload_len = flip_len - sizeof(struct flip_packet);
+
+    if (size_t{frag_offset} + frag_length > entry_total || frag_length > frag_payload_len) {
+        LOG_WARN("Invalid fragment bounds, discarding reassembly");
+        ++g_flip_stats.reassembly_drops;
+        FLIP_TRACE(reassembly_drop, key.src_address, key.message_id, static_cast<uint8_t>(TRACE_DROP_BAD_BOUNDS));
+        reassembly_map.erase(it);
+        return;
+    }
+
+    std::memcpy(entry.packet.data() + sizeof(flip_packet) + frag_offset, fp.payload(), frag_length);
+    entry.bytes_received += frag_length;
+
+    if (entry.bytes_received >= entry_total) {
+        // Reassembly complete: the buffer is the whole packet once its header says so
+        const flip_builder<Order> hdr(entry.packet.data());
+        hdr.set_offset(0);
+        hdr.set_length(static_cast<uint32_t>(entry_total));
+        hdr.set_total_length(static_cast<uint32_t>(entry_total));
+
+        // Moved, not copied, into a buffer local group members can share
+        auto full_packet = std::make_shared<const std::vector<uint8_t>>(std::move(entry.packet));
+        hwaddr_t entry_mac = entry.src_mac;
+        flip_network_t net = entry.incoming_network;
+        FLIP_TRACE(reassembly_complete, key.src_address, key.message_id, entry_total);
+        reassembly_map.erase(it);
+        ++g_flip_stats.reassembly_completed;
+        router.route_packet(entry_mac, std::move(full_packet), net);
+    }
+}
+
+void flip_receiver::recv_packet(const uint8_t* packet, size_t len, flip_network_t incoming_network)
+{
+    if (len < sizeof(struct ethhdr)) {
+        LOG_WARN("Received packet too short for Ethernet header");
+        ++g_flip_stats.net(incoming_network).rx_drops;
+        return;
+    }
+
+    FLIP_TRACE(frame_rx, incoming_network, len);
+
+    struct ethhdr *eth = (struct ethhdr *)packet;
+    if (eth->h_proto != flip_ethertype_network()) {
+        // Not a FLIP packet, ignore
+        return;
+    }
+    flip_capture_rx(incoming_network, packet, len);
+
+    if (len < sizeof(struct ethhdr) + sizeof(struct fc_header)) {
+        LOG_WARN("Received packet too short for Fragment header");
+        ++g_flip_stats.net(incoming_network).rx_drops;
+        return;
+    }
+
+    struct fc_header *fc = (struct fc_header *)(packet + sizeof(struct ethhdr));
+    if (fc->fc_type == 0)
+    {
+        const uint8_t* flip_data = packet + sizeof(struct ethhdr) + sizeof(struct fc_header);
+        size_t flip_len = len - sizeof(struct ethhdr) - sizeof(struct fc_header);
+
+        if (flip_len < sizeof(struct flip_packet)) {
+            LOG_WARN("Fragment too short for FLIP header");
+            ++g_flip_stats.net(incoming_network).rx_drops;
+            return;
+        }
+
+        with_packet_order(flip_data, [&](auto order) {
+            recv_fragment<decltype(order)::value>(std::to_array(eth->h_source), flip_data, flip_len, incoming_network);
+        });
+    }
+    else if (fc->fc_type == 1)
+    {
+        constexpr size_t MIN_PAYLOAD = 60 - sizeof(struct ethhdr);
+        uint8_t response[MIN_PAYLOAD] = {};
+        struct fc_header *resp_fc = reinterpret_cast<struct fc_header *>(response);
+        resp_fc->fc_type = 2;
+        resp_fc->fc_cnt = 5;
+        auto net = networks->get_networks().at(incoming_network);
+        net->send(std::to_array(eth->h_source), FLIP_ETHERTYPE, response, sizeof(response));
+    }
+}
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <bit>
+
+#include "route_table.hpp"
+
+uint16_t flip_route_entry::best_hopcount() const
+{
+    uint16_t best = UINT16_MAX;
+    for (const auto& path : paths) {
+        best = std::min(best, path.hopcount);
+    }
+    return best;
+}
+
+bool flip_route_entry::needs_learn(flip_network_t network, const hwaddr_t& mac, uint16_t hopcount) const
+{
+    auto same = std::find_if(paths.begin(), paths.end(), [&](const flip_route_path& p) {
+        return p.network == network && p.next_hop_mac == mac;
+    });
+    if (same != paths.end()) {
+        return same->age != 0 || hopcount < same->hopcount;
+    }
+    uint16_t best = best_hopcount();
+    if (!paths.empty() && hopcount > best + FLIP_ROUTE_PATH_SLACK) {
+        return false;
+    }
+    return paths.size() < FLIP_MAX_ROUTE_PATHS || hopcount < best;
+}
+
+bool flip_route_entry::learn_path(flip_network_t network, const hwaddr_t& mac, uint16_t hopcount)
+{
+    auto same = std::find_if(paths.begin(), paths.end(), [&](const flip_route_path& p) {
+        return p.network == network && p.next_hop_mac == mac;
+    });
+
+    if (same != paths.end()) {
+        // A next hop's cost only improves; a longer way round via the same
+        // neighbour (a copy that went around a loop) is not taken
+        same->age = 0;
+        if (hopcount >= same->hopcount) {
+            return false;
+        }
+        same->hopcount = hopcount;
+    } else {
+        uint16_t best = best_hopcount();
+        if (!paths.empty() && hopcount > best + FLIP_ROUTE_PATH_SLACK) {
+            return false;
+        }
+        if (paths.size() >= FLIP_MAX_ROUTE_PATHS && hopcount >= best) {
+            return false;
+        }
+        paths.push_back(flip_route_path{network, mac, hopcount, 0});
+    }
+
+    // Drop paths that are no longer near the best cost
+    uint16_t best = best_hopcount();
+    std::erase_if(paths, [best](const flip_route_path& p) {
+        return p.hopcount > best + FLIP_ROUTE_PATH_SLACK;
+    });
+    while (paths.size() > FLIP_MAX_ROUTE_PATHS) {
+        auto worst = std::max_element(paths.begin(), paths.end(), [](const flip_route_path& a, const flip_route_path& b) {
+            return a.hopcount < b.hopcount;
+        });
+        paths.erase(worst);
+    }
+    return true;
+}
+
+bool flip_route_entry::remove_paths(flip_network_t network, const hwaddr_t& mac)
+{
+    bool mac_match = std::any_of(paths.begin(), paths.end(), [&](const flip_route_path& p) {
+        return p.network == network && p.next_hop_mac == mac;
+    });
+    size_t removed = std::erase_if(paths, [&](const flip_route_path& p) {
+        return p.network == network && (!mac_match || p.next_hop_mac == mac);
+    });
+    return removed > 0;
+}
+
+size_t flip_route_entry::age_paths()
+{
+    for (auto& path : paths) {
+        ++path.age;
+    }
+    return std::erase_if(paths, [](const flip_route_path& p) { return p.age >= FLIP_ROUTE_MAX_AGE; });
+}
+
+const flip_route_path& flip_route_entry::select_path(flip_address_t src, flip_address_t dst, uint32_t message_id) const
+{
+    if (paths.size() == 1) {
+        return paths.front();
+    }
+
+    // splitmix64 finaliser over the flow key
+    uint64_t h = src ^ (dst * 0x9e3779b97f4a7c15ULL) ^ (static_cast<uint64_t>(message_id) << 17);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return paths[h % paths.size()];
+}
+
+const flip_route_path* flip_route_entry::select_path_avoiding(flip_address_t src, flip_address_t dst, uint32_t message_id,
+                                                              flip_network_t avoid) const
+{
+    const flip_route_path& path = select_path(src, dst, message_id);
+    if (path.network != avoid) {
+        return &path;
+    }
+    // Take the next path round from the hashed one, so a flow still sticks to one
+    size_t start = &path - paths.data();
+    for (size_t i = 1; i < paths.size(); ++i) {
+        const flip_route_path& other = paths[(start + i) % paths.size()];
+        if (other.network != avoid) {
+            return &other;
+        }
+    }
+    return nullptr;
+}
+
+// Marks a slot whose entry was removed; probing continues past it
+static const flip_route_entry tombstone{};
+
+static size_t address_hash(flip_address_t address)
+{
+    uint64_t h = address;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+RouteTable::slot_array::slot_array(size_t n)
+    : mask(n - 1), slots(std::make_unique<std::atomic<const flip_route_entry*>[]>(n))
+{
+    for (size_t i = 0; i < n; ++i) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+RouteTable::RouteTable()
+    : current(new slot_array(ROUTE_TABLE_MIN_SLOTS))
+{
+}
+
+RouteTable::~RouteTable()
+{
+    slot_array* a = current.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= a->mask; ++i) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_relaxed);
+        if (e && e != &tombstone) {
+            delete e;
+        }
+    }
+    delete a;
+}
+
+const flip_route_entry* RouteTable::find(flip_address_t address) const
+{
+    const slot_array* a = current.load(std::memory_order_acquire);
+    for (size_t i = address_hash(address) & a->mask;; i = (i + 1) & a->mask) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_acquire);
+        if (!e) {
+            return nullptr;
+        }
+        if (e->dst_address == address && e != &tombstone) {
+            return e;
+        }
+    }
+}
+
+void RouteTable::publish(std::unique_ptr<flip_route_entry> entry)
+{
+    // Keep at least half the slots empty, so probes stay short and always end
+    if ((count + tombstones + 1) * 2 > current.load(std::memory_order_relaxed)->mask + 1) {
+        rebuild(count + 1);
+    }
+
+    slot_array* a = current.load(std::memory_order_relaxed);
+    const flip_address_t address = entry->dst_address;
+    size_t reuse = SIZE_MAX;
+    size_t i = address_hash(address) & a->mask;
+    for (;; i = (i + 1) & a->mask) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_relaxed);
+        if (!e) {
+            break;
+        }
+        if (e == &tombstone) {
+            if (reuse == SIZE_MAX) {
+                reuse = i;
+            }
+        } else if (e->dst_address == address) {
+            a->slots[i].store(entry.release(), std::memory_order_release);
+            retire(e);
+            return;
+        }
+    }
+    if (reuse != SIZE_MAX) {
+        i = reuse;
+        --tombstones;
+    }
+    a->slots[i].store(entry.release(), std::memory_order_release);
+    ++count;
+}
+
+bool RouteTable::erase(flip_address_t address)
+{
+    slot_array* a = current.load(std::memory_order_relaxed);
+    for (size_t i = address_hash(address) & a->mask;; i = (i + 1) & a->mask) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_relaxed);
+        if (!e) {
+            return false;
+        }
+        if (e != &tombstone && e->dst_address == address) {
+            a->slots[i].store(&tombstone, std::memory_order_release);
+            --count;
+            ++tombstones;
+            retire(e);
+            return true;
+        }
+    }
+}
+
+size_t RouteTable::erase_if(const std::function<bool(const flip_route_entry&)>& pred)
+{
+    slot_array* a = current.load(std::memory_order_relaxed);
+    size_t removed = 0;
+    for (size_t i = 0; i <= a->mask; ++i) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_relaxed);
+        if (e && e != &tombstone && pred(*e)) {
+            a->slots[i].store(&tombstone, std::memory_order_release);
+            --count;
+            ++tombstones;
+            retire(e);
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+void RouteTable::for_each(const std::function<void(const flip_route_entry&)>& fn) const
+{
+    const slot_array* a = current.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= a->mask; ++i) {
+        const flip_route_entry* e = a->slots[i].load(std::memory_order_relaxed);
+        if (e && e != &tombstone) {
+            fn(*e);
+        }
+    }
+}
+
+void RouteTable::rebuild(size_t n)
+{
+    slot_array* old = current.load(std::memory_order_relaxed);
+    auto a = new slot_array(std::max(ROUTE_TABLE_MIN_SLOTS, std::bit_ceil(n * 4)));
+    for (size_t i = 0; i <= old->mask; ++i) {
+        const flip_route_entry* e = old->slots[i].load(std::memory_order_relaxed);
+        if (!e || e == &tombstone) {
+            continue;
+        }
+        size_t j = address_hash(e->dst_address) & a->mask;
+        while (a->slots[j].load(std::memory_order_relaxed)) {
+            j = (j + 1) & a->mask;
+        }
+        a->slots[j].store(e, std::memory_order_relaxed);
+    }
+    current.store(a, std::memory_order_release);
+    tombstones = 0;
+    retired.retire(old);
+}
+
+void RouteTable::retire(const flip_route_entry* entry)
+{
+    retired.retire(entry);
+    if (retired.size() >= ROUTE_TABLE_RETIRE_BATCH) {
+        retired.collect();
+    }
+}
@@ -1,64 +1,128 @@
-#include <iostream>
+#include <cstdio>
 #include <cstring>
 #include <algorithm>
+#include <linux/if_ether.h>
+#include "capture.hpp"
 #include "flip_router.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include "tunables.hpp"
+#include "trace.hpp"
 
-// Standard Ethernet payload limit (excluding Ethernet header)
-constexpr size_t MAX_ETH_PAYLOAD = 1500;
-// Max FLIP data bytes per Ethernet frame after fc_header (2B) and flip_packet (40B)
-constexpr size_t MAX_FLIP_FRAGMENT_DATA = MAX_ETH_PAYLOAD - sizeof(fc_header) - sizeof(flip_packet);
+// Capture a transmitted frame; the driver adds the Ethernet header, so build it here
+static void capture_tx(const NetDrv& driver, const hwaddr_t& dst, uint16_t ethertype, const uint8_t* buf, size_t len)
+{
+    ethhdr eth;
+    std::memcpy(eth.h_dest, dst.data(), 6);
+    std::memcpy(eth.h_source, driver.get_mac().data(), 6);
+    eth.h_proto = htons(ethertype);
+    g_frame_capture.record(driver.get_network_id(), capture_dir::TX, reinterpret_cast<const uint8_t*>(&eth),
+                           sizeof(eth), buf, len);
+}
 
-// Send a FLIP packet (without fc_header), fragmenting across multiple Ethernet frames if needed.
-static bool fragment_and_send(std::shared_ptr<NetDrv> driver, const hwaddr_t& dst, uint16_t ethertype,
-                               const uint8_t* packet, size_t len)
+// Send a FLIP packet, fragmenting it to the driver's MTU, with hops added to
+// its actual_hopcount. Each frame is assembled in a buffer of its own: the
+// header is copied in and its changed fields are written there in the
+// packet's own byte order, and the payload is only read, from wherever the
+// caller keeps it.
+template <std::endian Order>
+static bool send_fragments(NetDrv& driver, const hwaddr_t& dst, uint16_t ethertype,
+                           const uint8_t* packet, size_t len, uint16_t hops)
 {
-    if (len < sizeof(flip_packet)) return false;
+    const size_t mtu = driver.get_mtu();
+    if (mtu <= sizeof(fc_header) + sizeof(flip_packet)) return false;
+    // Max FLIP data bytes per Ethernet frame after fc_header and flip_packet
+    const size_t max_fragment_data = mtu - sizeof(fc_header) - sizeof(flip_packet);
+
+    static thread_local std::vector<uint8_t> buf;
+    if (buf.size() < mtu) {
+        buf.resize(mtu);
+    }
 
-    const flip_packet* orig_fp = reinterpret_cast<const flip_packet*>(packet);
+    stats_network& net_stats = g_flip_stats.net(driver.get_network_id());
+    const fc_header fch{0, 0};
+    std::memcpy(buf.data(), &fch, sizeof(fch));
+    std::memcpy(buf.data() + sizeof(fch), packet, sizeof(flip_packet));
+    flip_builder<Order> fp(buf.data() + sizeof(fch));
+    if (hops) {
+        fp.set_actual_hopcount(fp.actual_hopcount() + hops);
+    }
     const uint8_t* payload = packet + sizeof(flip_packet);
-    size_t payload_len = len - sizeof(flip_packet);
-
-    if (sizeof(fc_header) + len <= MAX_ETH_PAYLOAD) {
-        uint8_t buf[MAX_ETH_PAYLOAD];
-        fc_header fch{0, 0};
-        std::memcpy(buf, &fch, sizeof(fch));
-        std::memcpy(buf + sizeof(fch), packet, len);
-        return driver->send(dst, ethertype, buf, sizeof(fch) + len);
+    const size_t payload_len = len - sizeof(flip_packet);
+
+    if (sizeof(fc_header) + sizeof(flip_packet) + payload_len <= mtu) {
+        size_t buf_len = sizeof(fch) + sizeof(flip_packet) + payload_len;
+        if (payload_len) {
+            std::memcpy(fp.payload(), payload, payload_len);
+        }
+        FLIP_TRACE(fragment_tx, driver.get_network_id(), fp.message_id(), fp.offset(), payload_len);
+        bool sent = driver.send(dst, ethertype, buf.data(), buf_len);
+        if (sent) {
+            if (g_frame_capture.active()) [[unlikely]] {
+                capture_tx(driver, dst, ethertype, buf.data(), buf_len);
+            }
+            ++net_stats.tx_frames;
+            net_stats.tx_bytes += buf_len;
+        } else {
+            ++net_stats.tx_drops;
+        }
+        return sent;
     }
 
-    // Packet exceeds Ethernet MTU — fragment the payload
-    uint32_t total_length = orig_fp->total_length ? orig_fp->total_length
-                                                   : static_cast<uint32_t>(payload_len);
-    uint32_t base_offset = orig_fp->offset;
+    // Packet exceeds the network MTU — fragment the payload
+    uint32_t total_length = fp.total_length() ? fp.total_length() : static_cast<uint32_t>(payload_len);
+    uint32_t base_offset = fp.offset();
     size_t offset = 0;
     bool ok = true;
+    fp.set_total_length(total_length);
 
     while (offset < payload_len) {
-        size_t chunk = std::min(payload_len - offset, MAX_FLIP_FRAGMENT_DATA);
-
-        flip_packet frag_fp = *orig_fp;
-        frag_fp.offset      = base_offset + static_cast<uint32_t>(offset);
-        frag_fp.length      = static_cast<uint32_t>(chunk);
-        frag_fp.total_length = total_length;
+        size_t chunk = std::min(payload_len - offset, max_fragment_data);
 
-        fc_header fch{0, 0};
-        uint8_t buf[MAX_ETH_PAYLOAD];
-        size_t buf_len = sizeof(fch) + sizeof(frag_fp) + chunk;
-        std::memcpy(buf, &fch, sizeof(fch));
-        std::memcpy(buf + sizeof(fch), &frag_fp, sizeof(frag_fp));
-        std::memcpy(buf + sizeof(fch) + sizeof(frag_fp), payload + offset, chunk);
+        fp.set_offset(base_offset + static_cast<uint32_t>(offset));
+        fp.set_length(static_cast<uint32_t>(chunk));
+        std::memcpy(fp.payload(), payload + offset, chunk);
+        size_t buf_len = sizeof(fch) + sizeof(flip_packet) + chunk;
 
-        if (!driver->send(dst, ethertype, buf, buf_len)) ok = false;
+        FLIP_TRACE(fragment_tx, driver.get_network_id(), fp.message_id(), fp.offset(), chunk);
+        if (driver.send(dst, ethertype, buf.data(), buf_len)) {
+            if (g_frame_capture.active()) [[unlikely]] {
+                capture_tx(driver, dst, ethertype, buf.data(), buf_len);
+            }
+            ++net_stats.tx_frames;
+            net_stats.tx_bytes += buf_len;
+        } else {
+            ++net_stats.tx_drops;
+            ok = false;
+        }
         offset += chunk;
 
-        usleep (1000); // Small delay to avoid overwhelming the network with fragments
+        if (g_flip_tunables.fragment_delay_us) {
+            usleep (g_flip_tunables.fragment_delay_us); // Small delay to avoid overwhelming the network with fragments
+        }
     }
     return ok;
 }
 
+static bool send_packet(NetDrv& driver, const hwaddr_t& dst, uint16_t ethertype,
+                        const uint8_t* packet, size_t len, uint16_t hops)
+{
+    return with_packet_order(packet, [&](auto order) {
+        return send_fragments<decltype(order)::value>(driver, dst, ethertype, packet, len, hops);
+    });
+}
+
+bool fragment_and_send(std::shared_ptr<NetDrv> driver, const hwaddr_t& dst, uint16_t ethertype,
+                               const uint8_t* packet, size_t len)
+{
+    if (len < sizeof(flip_packet)) return false;
+    return send_packet(*driver, dst, ethertype, packet, len, 0);
+}
+
 flip_router::flip_router(std::shared_ptr<flip_networks> net)
 {
     rpc_port_mgr = std::make_shared<RpcPortManager>();
+    group_mgr = std::make_shared<GroupManager>();
     networks = net;
 }
 
@@ -67,16 +131,59 @@ flip_router::~flip_router()
     // Cleanup resources if needed
 }
 
-std::shared_ptr<flip_route_entry> flip_router::find_route(flip_address_t dst)
+void flip_router::learn_route(flip_address_t src, flip_network_t network, const hwaddr_t& mac, uint16_t hopcount,
+                              bool trusted, bool unsafe)
 {
-    auto it = routing_table.find(dst);
-    if (it != routing_table.end()) {
-        return it->second;
+    const flip_route_entry* route = find_route(src);
+    // Local routes are authoritative; only add/update non-local entries.
+    // A route whose packets stayed on trusted networks is not given paths
+    // learned over an untrusted one, and is preferred to a route that was.
+    // Nearly every packet comes from a source whose route is already up to
+    // date, and then nothing is written at all.
+    if (route && (route->local ||
+                  (!route->provisional && unsafe && !route->unsafe) ||
+                  (!route->provisional && unsafe == route->unsafe && !route->needs_learn(network, mac, hopcount)))) {
+        return;
+    }
+
+    if (!route || route->provisional || route->unsafe != unsafe) {
+        auto entry = std::make_unique<flip_route_entry>();
+        entry->dst_address = src;
+        entry->paths.push_back(flip_route_path{network, mac, hopcount, 0});
+        entry->trusted = trusted;
+        entry->local = false;
+        entry->provisional = false;
+        entry->unsafe = unsafe;
+        routing_table.publish(std::move(entry));
+        ++g_flip_stats.route_learns;
+        g_flip_stats.routes = routing_table.size();
+        FLIP_TRACE(route_learn, src, network, hopcount);
+        LOG_DEBUG("{} route for {} via network {}", route ? "Replaced" : "Added", src, network);
+        return;
+    }
+
+    auto entry = std::make_unique<flip_route_entry>(*route);
+    bool changed = entry->learn_path(network, mac, hopcount);
+    size_t path_count = entry->paths.size();
+    routing_table.publish(std::move(entry));
+    if (changed) {
+        ++g_flip_stats.route_learns;
+        FLIP_TRACE(route_learn, src, network, hopcount);
+        LOG_DEBUG("Updated route for {} via network {} ({} paths)", src, network, path_count);
     }
-    return nullptr;
 }
 
-static std::string packet_type_to_string(flip_type type) {
+std::optional<flip_route_path> flip_router::next_hop(flip_address_t src, flip_address_t dst, uint32_t message_id) const
+{
+    epoch_guard guard;
+    const flip_route_entry* route = find_route(dst);
+    if (!route || route->local) {
+        return std::nullopt;
+    }
+    return route->select_path(src, dst, message_id);
+}
+
+static const char* packet_type_to_string(flip_type type) {
     switch (type) {
         case flip_type::LOCATE: return "LOCATE";
         case flip_type::HEREIS: return "HEREIS";
@@ -91,148 +198,210 @@ static std::string packet_type_to_string(flip_type type) {
 void flip_router::route_packet(hwaddr_t src_mac, const uint8_t* packet, size_t len, flip_network_t incoming_network)
 {
     if (len < sizeof(struct flip_packet)) {
-        std::cerr << "Received packet too short for FLIP header" << std::endl;
+        LOG_WARN("Received packet too short for FLIP header");
         return;
     }
-    const struct flip_packet* fp = (const struct flip_packet*)packet;
+    with_packet_order(packet, [&](auto order) {
+        route_packet_as<decltype(order)::value>(src_mac, packet, len, incoming_network, nullptr);
+    });
+}
 
-    if (fp->src_address != 0) {
+void flip_router::route_packet(hwaddr_t src_mac, std::shared_ptr<const std::vector<uint8_t>> packet,
+                               flip_network_t incoming_network)
+{
+    if (packet->size() < sizeof(struct flip_packet)) {
+        LOG_WARN("Received packet too short for FLIP header");
+        return;
+    }
+    with_packet_order(packet->data(), [&](auto order) {
+        route_packet_as<decltype(order)::value>(src_mac, packet->data(), packet->size(), incoming_network, packet);
+    });
+}
+
+template <std::endian Order>
+void flip_router::route_packet_as(const hwaddr_t& src_mac, const uint8_t* packet, size_t len, flip_network_t incoming_network,
+                                  const std::shared_ptr<const std::vector<uint8_t>>& buffer)
+{
+    const flip_view<Order> fp(packet);
+    const uint8_t type = fp.type();
+    const flip_address_t src_address = fp.src_address();
+    const flip_address_t dst_address = fp.dst_address();
+    const uint16_t actual_hopcount = fp.actual_hopcount();
+    const uint16_t max_hopcount = fp.max_hopcount();
+    g_flip_stats.count_flip_type(type);
+    g_flip_stats.message_size.record(len);
+
+    // Routes found below stay valid until the packet is done with
+    epoch_guard guard;
+
+    if (src_address != 0) {
         // Update routing table with source address and incoming network
-        auto route = this->find_route(fp->src_address);
-        // Local routes are authoritative; only add/update non-local entries.
-        if (!route || (!route->local && (fp->flags & FLIP_FLAG_UNSAFE) && route->hopcount > fp->actual_hopcount)) {
-            route = std::make_shared<flip_route_entry>();
-            route->dst_address = fp->src_address;
-            route->network = incoming_network;
-            route->next_hop_mac = src_mac;
-            route->hopcount = fp->actual_hopcount;
-            route->trusted = (fp->flags & FLIP_FLAG_SECURITY) != 0;
-            route->age = 0;
-            route->local = false;
-            routing_table[fp->src_address] = route;
-            std::cout << "Added route for " << fp->src_address << " via network " << incoming_network << std::endl;
-        }
+        learn_route(src_address, incoming_network, src_mac, actual_hopcount, (fp.flags() & FLIP_FLAG_SECURITY) != 0,
+                    (fp.flags() & FLIP_FLAG_UNSAFE) != 0);
     }
 
-    std::shared_ptr<flip_route_entry> dst_route = nullptr;
-    if (fp->dst_address != 0) {
-        dst_route = this->find_route(fp->dst_address);
+    const flip_route_entry* dst_route = nullptr;
+    if (dst_address != 0) {
+        dst_route = this->find_route(dst_address);
     }
 
-    std::cout << "Received " << (int)fp->type << " packet from " << (int)src_mac[0] << ":" << (int)src_mac[1] << ":" << (int)src_mac[2] << ":" << (int)src_mac[3] << ":" << (int)src_mac[4] << ":" << (int)src_mac[5] << std::endl;
+    LOG_DEBUG("Received {} packet from {}", packet_type_to_string((flip_type)type), log_mac(src_mac));
 
-    switch ((flip_type)fp->type)
+    trace_route_decision decision = TRACE_ROUTE_DROP;
+    switch ((flip_type)type)
     {
         case flip_type::LOCATE:
-            if (fp->actual_hopcount == fp->max_hopcount && dst_route && dst_route->local) {
-                std::cout << "Destination " << fp->dst_address << " is local, sending HEREIS response" << std::endl;
-                struct flip_packet hereis_pkt{};
-                hereis_pkt.version = fp->version;
-                hereis_pkt.type = static_cast<uint8_t>(flip_type::HEREIS);
-                hereis_pkt.flags = fp->flags;
-                hereis_pkt.reserved = 0;
-                hereis_pkt.actual_hopcount = 0;
-                hereis_pkt.max_hopcount = fp->max_hopcount;
-                hereis_pkt.dst_address = fp->src_address;
-                hereis_pkt.src_address = fp->dst_address;
-                hereis_pkt.message_id = fp->message_id;
-                hereis_pkt.length = 0;
-                hereis_pkt.offset = 0;
-                hereis_pkt.total_length = 0;
+            if (actual_hopcount == max_hopcount && dst_route && dst_route->local) {
+                decision = TRACE_ROUTE_LOCAL;
+                LOG_DEBUG("Destination {} is local, sending HEREIS response", dst_address);
+                uint8_t hereis_buf[sizeof(flip_packet)];
+                auto hereis = build_flip_header(hereis_buf, flip_type::HEREIS, dst_address, src_address,
+                                                fp.message_id(), 0, max_hopcount);
+                hereis.set_version(fp.version());
+                hereis.set_flags((fp.flags() & ~FLIP_FLAG_ENDIAN) | FLIP_NATIVE_ENDIAN_FLAG);
 
                 const auto& nets = networks->get_networks();
                 auto it = nets.find(incoming_network);
                 if (it != nets.end()) {
-                    if (!it->second->send(src_mac, flip_ethertype_network(), &hereis_pkt, sizeof(hereis_pkt))) {
-                        std::cerr << "Failed sending HEREIS response on network " << incoming_network << std::endl;
+                    if (!send_packet(*it->second, src_mac, FLIP_ETHERTYPE, hereis_buf, sizeof(hereis_buf), 0)) {
+                        LOG_WARN("Failed sending HEREIS response on network {}", incoming_network);
                     }
                 }
             } else if (!dst_route || !dst_route->local) {
                 // Forward LOCATE packet to all other networks if destination not found or not local
-                if (fp->actual_hopcount < fp->max_hopcount) {
+                if (actual_hopcount < max_hopcount) {
+                    decision = TRACE_ROUTE_BROADCAST;
                     forward_broadcast(packet, len, incoming_network);
                 }
+            } else {
+                decision = TRACE_ROUTE_LOCAL;
             }
             break;
         case flip_type::HEREIS:
             // Route already added by the source based route adding.
             // May need to forward this packet to nodes that requested this address
-            if (dst_route && !dst_route->local && dst_route->network != incoming_network) {
-                forward_unicast(packet, len, dst_route->next_hop_mac, dst_route->network);
+            if (dst_route && !dst_route->local) {
+                // Not back where it came from; another parallel path will do
+                const flip_route_path* path = dst_route->select_path_avoiding(src_address, dst_address, fp.message_id(),
+                                                                              incoming_network);
+                if (path) {
+                    decision = TRACE_ROUTE_UNICAST;
+                    forward_unicast(packet, len, path->next_hop_mac, path->network);
+                } else {
+                    ++g_flip_stats.route_no_path;
+                    LOG_DEBUG("HEREIS for {} only routes back to network {}, dropping", dst_address, incoming_network);
+                }
+            } else if (dst_route) {
+                decision = TRACE_ROUTE_LOCAL;
+            } else {
+                decision = TRACE_ROUTE_NO_ROUTE;
             }
             break;
         case flip_type::MULTIDATA:
             // MULTIDATA packets have a 4-byte proto field followed by protocol-specific data
-            if (len >= sizeof(flip_packet) + sizeof(uint32_t) + sizeof(rpc_header)) {
-                uint32_t proto;
-                std::memcpy(&proto, packet + sizeof(struct flip_packet), sizeof(uint32_t));
-                proto = ntohl(proto);
-                if (proto == PROTO_RPC) {
-                    const rpc_header* rpc_hdr = (const rpc_header*)(packet + sizeof(struct flip_packet) + sizeof(uint32_t));
-                    if (rpc_hdr->type == AM_RPC_LOCATE && fp->dst_address == 0) {
-                        const uint8_t* payload = packet + sizeof(struct flip_packet) + sizeof(uint32_t) + sizeof(rpc_header);
-                        size_t payload_len = len - sizeof(struct flip_packet) - sizeof(uint32_t) - sizeof(rpc_header);
-                        handle_rpc_locate(fp->src_address, fp->dst_address, rpc_hdr, fp->actual_hopcount, payload, payload_len, incoming_network);
+            if (len >= sizeof(flip_packet) + sizeof(uint32_t)) {
+                uint32_t proto = network_order::load<uint32_t>(fp.payload());
+                const uint8_t* body = fp.payload() + sizeof(uint32_t);
+                size_t body_len = len - sizeof(struct flip_packet) - sizeof(uint32_t);
+                if (proto == PROTO_RPC && body_len >= sizeof(rpc_header)) {
+                    const rpc_view<Order> rpc_hdr(body);
+                    if (rpc_hdr.type() == AM_RPC_LOCATE && dst_address == 0) {
+                        handle_rpc_locate(src_address, rpc_hdr);
+                    }
+                } else if (proto == PROTO_GROUP && body_len >= sizeof(group_header)) {
+                    if (!handle_group_message(src_address, fp.message_id(), body, body_len, buffer)) {
+                        break;
                     }
                 }
             }
             // Forward MULTIDATA as broadcast to all networks except incoming
-            if (fp->actual_hopcount < fp->max_hopcount) {
+            if (actual_hopcount < max_hopcount) {
+                decision = TRACE_ROUTE_BROADCAST;
                 forward_broadcast(packet, len, incoming_network);
             }
             break;
         case flip_type::UNIDATA:
-            // Check if this is an RPC HEREIS message
-            if (len >= sizeof(struct flip_packet) + sizeof(rpc_header) && fp->offset == 0) {
-                const rpc_header* rpc_hdr = (const rpc_header*)(packet + sizeof(struct flip_packet));
-                if (rpc_hdr->type == AM_RPC_HEREIS) {
-                    handle_rpc_hereis(fp->src_address, rpc_hdr);
+            // Only the first fragment carries an RPC header
+            if (len >= sizeof(struct flip_packet) + sizeof(rpc_header) && fp.offset() == 0) {
+                const rpc_view<Order> rpc_hdr(fp.payload());
+                const uint8_t rpc_type = rpc_hdr.type();
+                if (rpc_type == AM_RPC_HEREIS) {
+                    handle_rpc_hereis(src_address, rpc_hdr.port());
+                }
+
+                // Destination is local — deliver RPC replies to the associated
+                // client and requests to a client serving the port
+                if (dst_route && dst_route->local) {
+                    const uint8_t* payload = rpc_hdr.payload();
+                    size_t payload_len = len - sizeof(struct flip_packet) - sizeof(rpc_header);
+                    if (rpc_type == AM_RPC_REPLY && on_local_rpc_reply) {
+                        on_local_rpc_reply(dst_address, rpc_hdr.tid(), payload, payload_len);
+                        const rpc_header reply_hdr = rpc_hdr.decode();
+                        if (on_rpc_ack) {
+                            on_rpc_ack(dst_address, src_address, reply_hdr);
+                        } else {
+                            send_rpc_control(dst_address, src_address, &reply_hdr, AM_RPC_ACK);
+                        }
+                    } else if (rpc_type == AM_RPC_REQUEST && on_local_rpc_request) {
+                        on_local_rpc_request(dst_address, src_address, rpc_hdr.decode(), payload, payload_len);
+                    } else if (rpc_type != AM_RPC_HEREIS && on_local_rpc_control) {
+                        on_local_rpc_control(dst_address, src_address, rpc_hdr.decode(), payload, payload_len);
+                    }
                 }
             }
 
             // Route UNIDATA based on destination
             if (dst_route && dst_route->local) {
-                // Destination is local — deliver RPC replies to the associated client
-                if (len >= sizeof(struct flip_packet) + sizeof(rpc_header) && fp->offset == 0) {
-                    const rpc_header* rpc_hdr2 = (const rpc_header*)(packet + sizeof(struct flip_packet));
-                    if (rpc_hdr2->type == AM_RPC_REPLY && on_local_rpc_reply) {
-                        const uint8_t* payload = packet + sizeof(struct flip_packet) + sizeof(rpc_header);
-                        size_t payload_len = len - sizeof(struct flip_packet) - sizeof(rpc_header);
-                        on_local_rpc_reply(fp->dst_address, payload, payload_len);
-                        send_rpc_ack(fp->dst_address, fp->src_address, rpc_hdr2);
-                    }
-                }
-                std::cout << "UNIDATA for local destination " << fp->dst_address << std::endl;
-            } else if (dst_route && fp->actual_hopcount < fp->max_hopcount) {
+                decision = TRACE_ROUTE_LOCAL;
+                LOG_DEBUG("UNIDATA for local destination {}", dst_address);
+            } else if (dst_route && actual_hopcount < max_hopcount) {
                 // Destination is known, forward to specific network
-                forward_unicast(packet, len, dst_route->next_hop_mac, dst_route->network);
+                const auto& path = dst_route->select_path(src_address, dst_address, fp.message_id());
+                decision = TRACE_ROUTE_UNICAST;
+                forward_unicast(packet, len, path.next_hop_mac, path.network);
             } else if (!dst_route) {
+                decision = TRACE_ROUTE_NO_ROUTE;
                 // Destination unknown - may need to generate implicit LOCATE
-                std::cout << "UNIDATA for unknown destination " << fp->dst_address << " (no route)" << std::endl;
+                LOG_DEBUG("UNIDATA for unknown destination {} (no route)", dst_address);
             }
             break;
         case flip_type::NOTHERE:
         case flip_type::UNTRUSTED:
             {
-                if (dst_route && dst_route->network == incoming_network &&  fp->type == (uint8_t)flip_type::NOTHERE) {
-                    std::cout << "Received NOTHERE for destination " << fp->dst_address << " on network " << incoming_network << ", removing route" << std::endl;
-                    routing_table.erase(fp->dst_address);
+                if (dst_route && !dst_route->local && type == (uint8_t)flip_type::NOTHERE) {
+                    auto updated = std::make_unique<flip_route_entry>(*dst_route);
+                    if (updated->remove_paths(incoming_network, src_mac)) {
+                        FLIP_TRACE(route_remove, dst_address, incoming_network);
+                        if (updated->paths.empty()) {
+                            LOG_DEBUG("Received NOTHERE for destination {} on network {}, removing route", dst_address, incoming_network);
+                            routing_table.erase(dst_address);
+                            ++g_flip_stats.route_evictions;
+                            g_flip_stats.routes = routing_table.size();
+                        } else {
+                            LOG_DEBUG("Received NOTHERE for destination {} on network {}, failing over to {} remaining paths",
+                                      dst_address, incoming_network, updated->paths.size());
+                            routing_table.publish(std::move(updated));
+                        }
+                    }
                 }
-                auto src_route = this->find_route(fp->src_address);
-                if (src_route) {
-                    if (src_route->network == incoming_network) {
+                auto src_route = this->find_route(src_address);
+                if (src_route && !src_route->local) {
+                    const auto& path = src_route->select_path(dst_address, src_address, fp.message_id());
+                    if (path.network == incoming_network) {
                         // Skip forwarding NOTHERE/UNTRUSTED back to source of original packet if it came from this network
                     }
                     else {
-                        forward_unicast(packet, len, src_route->next_hop_mac, src_route->network);
+                        decision = TRACE_ROUTE_UNICAST;
+                        forward_unicast(packet, len, path.next_hop_mac, path.network);
                     }
                 }
             }
             break;
         default:
-            std::cerr << "Received packet with unknown FLIP type: " << (int)fp->type << std::endl;
+            LOG_WARN("Received packet with unknown FLIP type: {}", type);
             break;
     }
+    FLIP_TRACE(route_decision, type, src_address, dst_address, static_cast<uint8_t>(decision));
 }
 
 bool flip_router::install_local_address(flip_address_t address)
@@ -241,232 +410,294 @@ bool flip_router::install_local_address(flip_address_t address)
         return false;
     }
 
-    auto existing = find_route(address);
+    // Only this thread writes the table, so entries found here stay put
+    const flip_route_entry* existing = find_route(address);
     if (existing) {
         return existing->local;
     }
 
-    auto route = std::make_shared<flip_route_entry>();
+    auto route = std::make_unique<flip_route_entry>();
     route->dst_address = address;
-    route->network = 0;
-    route->next_hop_mac = hwaddr_t{0, 0, 0, 0, 0, 0};
-    route->hopcount = 0;
+    route->paths.push_back(flip_route_path{0, hwaddr_t{0, 0, 0, 0, 0, 0}, 0, 0});
     route->trusted = true;
-    route->age = 0;
     route->local = true;
-    routing_table[address] = route;
+    route->provisional = false;
+    routing_table.publish(std::move(route));
+    g_flip_stats.routes = routing_table.size();
+    return true;
+}
+
+bool flip_router::install_provisional_route(flip_address_t address, std::vector<flip_route_path> paths)
+{
+    if (address == 0 || paths.empty() || find_route(address)) {
+        return false;
+    }
+
+    auto route = std::make_unique<flip_route_entry>();
+    route->dst_address = address;
+    route->paths = std::move(paths);
+    route->trusted = false;
+    route->local = false;
+    route->provisional = true;
+    routing_table.publish(std::move(route));
+    g_flip_stats.routes = routing_table.size();
     return true;
 }
 
 void flip_router::remove_local_address(flip_address_t address)
 {
-    auto it = routing_table.find(address);
-    if (it == routing_table.end()) {
+    const flip_route_entry* route = find_route(address);
+    if (!route) {
         return;
     }
 
-    if (it->second->local) {
-        routing_table.erase(it);
-        std::cout << "Removed local FLIP address " << address << std::endl;
+    if (route->local) {
+        routing_table.erase(address);
+        FLIP_TRACE(route_remove, address, 0);
+        g_flip_stats.routes = routing_table.size();
+        LOG_INFO("Removed local FLIP address {}", address);
     }
 }
 
+void flip_router::dump_routes(std::string& out) const
+{
+    std::vector<const flip_route_entry*> routes;
+    routes.reserve(routing_table.size());
+    routing_table.for_each([&](const flip_route_entry& route) { routes.push_back(&route); });
+    std::sort(routes.begin(), routes.end(), [](const flip_route_entry* a, const flip_route_entry* b) {
+        return a->dst_address < b->dst_address;
+    });
+
+    char line[160];
+    for (const flip_route_entry* route : routes) {
+        flip_address_t addr = route->dst_address;
+        if (route->local) {
+            snprintf(line, sizeof(line), "%016llx local\n", static_cast<unsigned long long>(addr));
+            out += line;
+            continue;
+        }
+        snprintf(line, sizeof(line), "%016llx %s%s\n", static_cast<unsigned long long>(addr),
+                 route->trusted ? "trusted" : "untrusted", route->provisional ? " provisional" : "");
+        out += line;
+        for (const auto& path : route->paths) {
+            const hwaddr_t& m = path.next_hop_mac;
+            snprintf(line, sizeof(line), "    net %u via %02x:%02x:%02x:%02x:%02x:%02x hops %u age %u\n",
+                     path.network, m[0], m[1], m[2], m[3], m[4], m[5], path.hopcount, path.age);
+            out += line;
+        }
+    }
+}
+
+size_t flip_router::flush_routes()
+{
+    size_t removed = routing_table.erase_if([](const flip_route_entry& route) { return !route.local; });
+    g_flip_stats.route_evictions += removed;
+    g_flip_stats.routes = routing_table.size();
+    LOG_INFO("Flushed {} learned routes", removed);
+    return removed;
+}
+
 void flip_router::increment_age()
 {
-    // Increment the age of routing entries, remove stale entries, etc.
-    // This will be called periodically to maintain the routing table
+    // Age the paths of every learned route. Traffic learned over a path
+    // resets its age, so a path that stops carrying any (its link went down,
+    // or the neighbour no longer forwards that way) is dropped after
+    // FLIP_ROUTE_MAX_AGE periods and its flows move to the remaining paths.
+    // Published entries are never modified, so each one is replaced by an
+    // aged copy once the walk is done.
+    std::vector<std::unique_ptr<flip_route_entry>> aged;
+    routing_table.for_each([&](const flip_route_entry& route) {
+        if (!route.local) {
+            aged.push_back(std::make_unique<flip_route_entry>(route));
+        }
+    });
+
+    for (auto& route : aged) {
+        flip_address_t address = route->dst_address;
+        for (const auto& path : route->paths) {
+            if (path.age + 1 >= FLIP_ROUTE_MAX_AGE) {
+                FLIP_TRACE(route_remove, address, path.network);
+            }
+        }
+        size_t dropped = route->age_paths();
+        if (route->paths.empty()) {
+            LOG_DEBUG("Route for {} aged out", address);
+            routing_table.erase(address);
+            ++g_flip_stats.route_evictions;
+            continue;
+        }
+        if (dropped) {
+            LOG_DEBUG("Dropped {} stale paths for {} ({} paths left)", dropped, address, route->paths.size());
+        }
+        routing_table.publish(std::move(route));
+    }
+    g_flip_stats.routes = routing_table.size();
+    routing_table.reclaim();
 }
 
 void flip_router::send_rpc_locate(flip_address_t src_addr, const rpc_port_t& port)
 {
-    struct flip_packet fp{};
-    fp.version = 1;
-    fp.type = static_cast<uint8_t>(flip_type::MULTIDATA);
-    fp.flags = 0;
-    fp.actual_hopcount = 0;
-    fp.max_hopcount = 8;
-    fp.dst_address = 0;
-    fp.src_address = src_addr;
-    fp.message_id = ++locate_tid;
-    fp.length = sizeof(uint32_t) + sizeof(rpc_header);
-    fp.offset = 0;
-    fp.total_length = fp.length;
-
-    uint32_t proto = htonl(PROTO_RPC);
-
-    rpc_header rpc_hdr{};
-    std::copy(port.begin(), port.end(), rpc_hdr.port);
-    rpc_hdr.type = AM_RPC_LOCATE;
-    rpc_hdr.flags = 0;
-    rpc_hdr.tid = fp.message_id;
-    rpc_hdr.dest = 0;
-    rpc_hdr.from = 0;
-
     uint8_t buf[sizeof(flip_packet) + sizeof(uint32_t) + sizeof(rpc_header)];
-    std::memcpy(buf,                              &fp,      sizeof(fp));
-    std::memcpy(buf + sizeof(fp),                 &proto,   sizeof(proto));
-    std::memcpy(buf + sizeof(fp) + sizeof(proto), &rpc_hdr, sizeof(rpc_hdr));
+    auto fp = build_flip_header(buf, flip_type::MULTIDATA, src_addr, 0, ++locate_tid,
+                                sizeof(uint32_t) + sizeof(rpc_header), g_flip_tunables.max_hopcount);
+    network_order::store<uint32_t>(fp.payload(), PROTO_RPC);
+    build_rpc_header(fp.payload() + sizeof(uint32_t), 0, port.data(), AM_RPC_LOCATE, 0, fp.message_id());
 
+    FLIP_TRACE(rpc_locate_tx, trace_port(port.data()), src_addr);
     // incoming_network = 0: no real network has this id, so all networks receive the LOCATE
     forward_broadcast(buf, sizeof(buf), 0);
 }
 
-void flip_router::handle_rpc_locate(flip_address_t src_addr, flip_address_t dst_addr, const rpc_header* rpc_hdr, uint16_t actual_hopcount, const uint8_t* payload, size_t payload_len, flip_network_t incoming_network)
+template <std::endian Order>
+void flip_router::handle_rpc_locate(flip_address_t src_addr, const rpc_view<Order>& rpc_hdr)
 {
-    (void)payload;
-    (void)payload_len;
-    (void)incoming_network;
+    const uint8_t* port = rpc_hdr.port();
+    FLIP_TRACE(rpc_locate_rx, trace_port(port), src_addr);
 
     // Check if we have this port registered locally
     rpc_port_t port_array;
-    std::copy(rpc_hdr->port, rpc_hdr->port + 6, port_array.begin());
+    std::copy(port, port + 6, port_array.begin());
     auto binding = rpc_port_mgr->get_local_binding(port_array);
     if (!binding.has_value()) {
-        std::cout << "RPC LOCATE for port " << (int)rpc_hdr->port[0] << " not found locally" << std::endl;
+        LOG_DEBUG("RPC LOCATE for port {} not found locally", port[0]);
         return;
     }
 
-    std::cout << "RPC LOCATE for port " << (int)rpc_hdr->port[0] << " found locally, sending HEREIS" << std::endl;
-
-    // Build and send HEREIS response
-    struct flip_packet hereis_pkt;
-    hereis_pkt.version = 1;
-    hereis_pkt.type = (uint8_t)flip_type::UNIDATA;
-    hereis_pkt.flags = 0;
-    hereis_pkt.reserved = 0;
-    hereis_pkt.actual_hopcount = 0;
-    hereis_pkt.max_hopcount = actual_hopcount;
-    hereis_pkt.dst_address = src_addr;
-    hereis_pkt.src_address = dst_addr;
-    hereis_pkt.message_id = rpc_hdr->tid;
-    hereis_pkt.offset = 0;
-
-    // Create RPC HEREIS response header
-    rpc_header hereis_rpc;
-    hereis_rpc.kid = rpc_hdr->kid;
-    std::copy(rpc_hdr->port, rpc_hdr->port + 6, hereis_rpc.port);
-    hereis_rpc.type = AM_RPC_HEREIS;
-    hereis_rpc.flags = 0;
-    hereis_rpc.tid = rpc_hdr->tid;
-    hereis_rpc.dest = rpc_hdr->from;
-    hereis_rpc.from = rpc_hdr->dest;
-
-    // Socket name payload
-    const std::string& socket_name = binding->unix_socket;
-    size_t rpc_payload_len = sizeof(hereis_rpc) + socket_name.size();
-    hereis_pkt.length = rpc_payload_len;
-    hereis_pkt.total_length = rpc_payload_len;
+    // The route back to the locating host was learned from this LOCATE
+    const flip_route_entry* src_route = find_route(src_addr);
+    if (!src_route || src_route->local) {
+        LOG_DEBUG("RPC LOCATE for port {} from {} with no route back", port[0], src_addr);
+        return;
+    }
 
+    LOG_DEBUG("RPC LOCATE for port {} found locally, sending HEREIS from {}", port[0], binding->address);
+
+    // Answer with a HEREIS from the serving client's address, carrying the
+    // socket name. Requests sent to it are balanced over every client bound
+    // to the port on arrival.
+    const std::string& socket_name = binding->unix_socket;
+    size_t rpc_payload_len = sizeof(rpc_header) + socket_name.size();
     uint8_t hereis_buf[512];
-    if (sizeof(hereis_pkt) + sizeof(hereis_rpc) + socket_name.size() > sizeof(hereis_buf)) {
-        std::cerr << "RPC HEREIS response too large" << std::endl;
+    if (sizeof(flip_packet) + rpc_payload_len > sizeof(hereis_buf)) {
+        LOG_WARN("RPC HEREIS response too large");
         return;
     }
 
-    std::memcpy(hereis_buf, &hereis_pkt, sizeof(hereis_pkt));
-    std::memcpy(hereis_buf + sizeof(hereis_pkt), &hereis_rpc, sizeof(hereis_rpc));
-    std::memcpy(hereis_buf + sizeof(hereis_pkt) + sizeof(hereis_rpc), socket_name.c_str(), socket_name.size());
+    auto fp = build_flip_header(hereis_buf, flip_type::UNIDATA, binding->address, src_addr, ++locate_tid,
+                                static_cast<uint32_t>(rpc_payload_len), g_flip_tunables.max_hopcount);
+    auto hereis_rpc = build_rpc_header(fp.payload(), rpc_hdr.kid(), port, AM_RPC_HEREIS, 0, rpc_hdr.tid(),
+                                       rpc_hdr.from(), rpc_hdr.dest());
+    std::memcpy(hereis_rpc.payload(), socket_name.data(), socket_name.size());
 
-    // TODO: Send HEREIS packet through network driver
-    std::cout << "HEREIS response prepared (socket: " << socket_name << ")" << std::endl;
+    FLIP_TRACE(rpc_hereis_tx, trace_port(port), src_addr);
+    const auto& path = src_route->select_path(binding->address, src_addr, fp.message_id());
+    forward_unicast(hereis_buf, sizeof(flip_packet) + rpc_payload_len, path.next_hop_mac, path.network);
 }
 
-void flip_router::handle_rpc_hereis(flip_address_t src_addr, const rpc_header* rpc_hdr)
+void flip_router::handle_rpc_hereis(flip_address_t src_addr, const uint8_t* port)
 {
-    std::cout << "Received RPC HEREIS for port " << (int)rpc_hdr->port[0] << " from " << src_addr << std::endl;
+    FLIP_TRACE(rpc_hereis_rx, trace_port(port), src_addr);
+    LOG_DEBUG("Received RPC HEREIS for port {} from {}", port[0], src_addr);
     // Resolve pending lookup with the source address as the remote socket identifier
     rpc_port_t port_array;
-    std::copy(rpc_hdr->port, rpc_hdr->port + 6, port_array.begin());
+    std::copy(port, port + 6, port_array.begin());
+    rpc_port_mgr->cache_remote_location(port_array, src_addr);
     rpc_port_mgr->resolve_remote_lookup(port_array, std::to_string(src_addr), true);
 }
 
-void flip_router::send_rpc_ack(flip_address_t src, flip_address_t dst, const rpc_header* original_rpc_hdr)
+bool flip_router::handle_group_message(flip_address_t src_addr, uint32_t message_id, const uint8_t* body, size_t body_len,
+                                      const std::shared_ptr<const std::vector<uint8_t>>& buffer)
 {
-    auto dst_route = find_route(dst);
-    if (!dst_route) {
-        std::cerr << "send_rpc_ack: no route to " << dst << std::endl;
-        return;
+    // Taken once per host, from whichever network brings the first copy
+    if (!group_mgr->first_sighting(src_addr, message_id)) {
+        ++g_flip_stats.group_duplicates;
+        LOG_DEBUG("Dropped copy of group message {} from {}", message_id, src_addr);
+        return false;
     }
+    ++g_flip_stats.group_received;
 
-    struct flip_packet ack_fp{};
-    ack_fp.version = 1;
-    ack_fp.type = static_cast<uint8_t>(flip_type::UNIDATA);
-    ack_fp.flags = 0;
-    ack_fp.actual_hopcount = 0;
-    ack_fp.max_hopcount = 8;
-    ack_fp.dst_address = dst;
-    ack_fp.src_address = src;
-    ack_fp.message_id = ++locate_tid;
-    ack_fp.length = sizeof(rpc_header);
-    ack_fp.offset = 0;
-    ack_fp.total_length = sizeof(rpc_header);
-
-    rpc_header ack_rpc{};
-    ack_rpc.kid = original_rpc_hdr->kid;
-    std::copy(original_rpc_hdr->port, original_rpc_hdr->port + 6, ack_rpc.port);
-    ack_rpc.type = AM_RPC_ACK;
-    ack_rpc.flags = 0;
-    ack_rpc.tid = original_rpc_hdr->tid;
-    ack_rpc.dest = original_rpc_hdr->from;
-    ack_rpc.from = original_rpc_hdr->dest;
+    group_header hdr;
+    std::memcpy(&hdr, body, sizeof(hdr));
+    rpc_port_t port_array;
+    std::copy(hdr.port, hdr.port + 6, port_array.begin());
+    if (hdr.type == AM_GROUP_DATA && on_local_group && group_mgr->members(port_array)) {
+        on_local_group(src_addr, hdr, body + sizeof(hdr), body_len - sizeof(hdr), buffer);
+    }
+    return true;
+}
+
+uint32_t flip_router::send_group_message(flip_address_t src, const rpc_port_t& port, std::vector<uint8_t>& packet)
+{
+    auto fp = build_flip_header(packet.data(), flip_type::MULTIDATA, src, 0, ++locate_tid,
+                                static_cast<uint32_t>(packet.size() - sizeof(flip_packet)), g_flip_tunables.max_hopcount);
+    network_order::store<uint32_t>(fp.payload(), PROTO_GROUP);
+    group_builder<std::endian::native> grp_hdr(fp.payload() + sizeof(uint32_t));
+    grp_hdr.set_port(port.data());
+    grp_hdr.set_type(AM_GROUP_DATA);
+    grp_hdr.set_flags(0);
+
+    // Our own message coming back around a loop is a copy like any other
+    group_mgr->first_sighting(src, fp.message_id());
+    ++g_flip_stats.group_sent;
+    // incoming_network = 0: no real network has this id, so all networks receive it
+    forward_broadcast(packet.data(), packet.size(), 0);
+    return fp.message_id();
+}
+
+void flip_router::send_rpc_control(flip_address_t src, flip_address_t dst, const rpc_header* original_rpc_hdr, am_rpc_type type)
+{
+    const uint32_t message_id = ++locate_tid;
+    auto path = next_hop(src, dst, message_id);
+    if (!path) {
+        LOG_WARN("send_rpc_control: no route to {}", dst);
+        return;
+    }
 
     uint8_t buf[sizeof(flip_packet) + sizeof(rpc_header)];
-    std::memcpy(buf, &ack_fp, sizeof(ack_fp));
-    std::memcpy(buf + sizeof(ack_fp), &ack_rpc, sizeof(ack_rpc));
+    auto fp = build_flip_header(buf, flip_type::UNIDATA, src, dst, message_id, sizeof(rpc_header),
+                                g_flip_tunables.max_hopcount);
+    build_rpc_header(fp.payload(), original_rpc_hdr->kid, original_rpc_hdr->port, type, 0, original_rpc_hdr->tid,
+                     original_rpc_hdr->from, original_rpc_hdr->dest);
 
-    forward_unicast(buf, sizeof(buf), dst_route->next_hop_mac, dst_route->network);
+    if (type == AM_RPC_ACK) {
+        FLIP_TRACE(rpc_ack_tx, dst, original_rpc_hdr->tid);
+    }
+    forward_unicast(buf, sizeof(buf), path->next_hop_mac, path->network);
 }
 
 void flip_router::forward_broadcast(const uint8_t* packet, size_t len, flip_network_t incoming_network)
 {
     if (!networks || len < sizeof(flip_packet)) return;
 
-    uint8_t *fwd = new uint8_t[len + 1];
-    if (fwd == nullptr) {
-        std::cerr << "Packet allocation failed (" << len << " bytes)" << std::endl;
-        return;
-    }
-    std::memcpy(fwd, packet, len);
-    flip_packet* fwd_fp = reinterpret_cast<flip_packet*>(fwd);
-    fwd_fp->actual_hopcount += 3;
-    std::string pkt_type = packet_type_to_string((flip_type)fwd_fp->type);
+    // Only the hopcount changes on the way through, in each frame's copy of the header
+    const char* pkt_type = packet_type_to_string((flip_type)packet[offsetof(flip_packet, type)]);
 
     const hwaddr_t broadcast{0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
     const auto& nets = networks->get_networks();
     for (const auto& [net_id, driver] : nets) {
         if (net_id != incoming_network) {
-            if (!fragment_and_send(driver, broadcast, FLIP_ETHERTYPE, fwd, len)) {
-                std::cerr << "Failed to forward " << pkt_type << " to network " << net_id << std::endl;
+            if (!send_packet(*driver, broadcast, FLIP_ETHERTYPE, packet, len, 3)) {
+                LOG_WARN("Failed to forward {} to network {}", pkt_type, net_id);
             } else {
-                std::cout << "Forwarded " << pkt_type << " to network " << net_id << std::endl;
+                LOG_DEBUG("Forwarded {} to network {}", pkt_type, net_id);
             }
         }
     }
-    delete[] fwd;
 }
 
 void flip_router::forward_unicast(const uint8_t* packet, size_t len, const hwaddr_t dst_mac, flip_network_t dst_network)
 {
     if (!networks || len < sizeof(flip_packet)) return;
 
-    uint8_t *fwd = new uint8_t[len + 1];
-    if (fwd == nullptr) {
-        std::cerr << "Packet allocation failed (" << len << " bytes)" << std::endl;
-        return;
-    }
-    std::memcpy(fwd, packet, len);
-    flip_packet* fwd_fp = reinterpret_cast<flip_packet*>(fwd);
-    fwd_fp->actual_hopcount += 3;
-    std::string pkt_type = packet_type_to_string((flip_type)fwd_fp->type);
+    const char* pkt_type = packet_type_to_string((flip_type)packet[offsetof(flip_packet, type)]);
 
     const auto& nets = networks->get_networks();
     auto it = nets.find(dst_network);
     if (it != nets.end()) {
-        if (!fragment_and_send(it->second, dst_mac, FLIP_ETHERTYPE, fwd, len)) {
-            std::cerr << "Failed to forward " << pkt_type << " to network " << dst_network << std::endl;
+        if (!send_packet(*it->second, dst_mac, FLIP_ETHERTYPE, packet, len, 3)) {
+            LOG_WARN("Failed to forward {} to network {}", pkt_type, dst_network);
         } else {
-            std::cout << "Forwarded " << pkt_type << " to network " << dst_network << std::endl;
+            LOG_DEBUG("Forwarded {} to network {}", pkt_type, dst_network);
         }
     }
-    delete[] fwd;
-}
\ No newline at end of file
+}
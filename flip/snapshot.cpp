@@ -0,0 +1,160 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.hpp"
+#include "flip_router.hpp"
+#include "log.hpp"
+
+bool snapshot_save(const std::string& path, const flip_router& router)
+{
+    std::vector<snapshot_path> paths;
+    router.for_each_route([&](const flip_route_entry& route) {
+        if (route.local || route.provisional) {
+            return;
+        }
+        for (const auto& p : route.paths) {
+            snapshot_path rec{};
+            rec.address = route.dst_address;
+            rec.network = p.network;
+            rec.hopcount = p.hopcount;
+            std::memcpy(rec.next_hop_mac, p.next_hop_mac.data(), sizeof(rec.next_hop_mac));
+            paths.push_back(rec);
+        }
+    });
+
+    std::vector<snapshot_location> locations;
+    for (const auto& [port, location] : router.get_rpc_port_manager()->remote_locations()) {
+        if (location.provisional) {
+            continue;
+        }
+        snapshot_location rec{};
+        rec.address = location.address;
+        std::memcpy(rec.port, port.data(), sizeof(rec.port));
+        locations.push_back(rec);
+    }
+
+    const size_t size = sizeof(snapshot_header) + paths.size() * sizeof(snapshot_path) +
+                        locations.size() * sizeof(snapshot_location);
+    if (path.starts_with(std::string(FLIP_SNAPSHOT_DIR) + "/") && mkdir(FLIP_SNAPSHOT_DIR, 0700) < 0 && errno != EEXIST) {
+        LOG_WARN("Snapshot: mkdir({}) failed: {}", FLIP_SNAPSHOT_DIR, log_errno(errno));
+        return false;
+    }
+    // A fresh name created with O_EXCL, so nothing planted at it is followed or reused
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkostemp(tmp.data(), O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("Snapshot: mkostemp({}) failed: {}", tmp, log_errno(errno));
+        return false;
+    }
+    if (ftruncate(fd, size) < 0) {
+        LOG_WARN("Snapshot: ftruncate() failed: {}", log_errno(errno));
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        LOG_WARN("Snapshot: mmap() failed: {}", log_errno(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    auto* p = static_cast<uint8_t*>(mem);
+    snapshot_header hdr{FLIP_SNAPSHOT_MAGIC, FLIP_SNAPSHOT_VERSION, static_cast<uint32_t>(paths.size()),
+                        static_cast<uint32_t>(locations.size())};
+    std::memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    std::memcpy(p, paths.data(), paths.size() * sizeof(snapshot_path));
+    p += paths.size() * sizeof(snapshot_path);
+    std::memcpy(p, locations.data(), locations.size() * sizeof(snapshot_location));
+    munmap(mem, size);
+
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+        LOG_WARN("Snapshot: rename({}) failed: {}", path, log_errno(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    LOG_DEBUG("Snapshot: saved {} route paths and {} port locations to {}", paths.size(), locations.size(), path);
+    return true;
+}
+
+bool snapshot_load(const std::string& path, flip_router& router, const flip_networks& networks)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            LOG_WARN("Snapshot: open({}) failed: {}", path, log_errno(errno));
+        }
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        LOG_WARN("Snapshot: {} is not a regular file owned by uid {} and writable only by it, ignoring it",
+                 path, geteuid());
+        close(fd);
+        return false;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(snapshot_header)) {
+        LOG_WARN("Snapshot: {} is too short", path);
+        close(fd);
+        return false;
+    }
+    const size_t size = st.st_size;
+    void* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        LOG_WARN("Snapshot: mmap() failed: {}", log_errno(errno));
+        return false;
+    }
+
+    const auto* p = static_cast<const uint8_t*>(mem);
+    snapshot_header hdr;
+    std::memcpy(&hdr, p, sizeof(hdr));
+    if (hdr.magic != FLIP_SNAPSHOT_MAGIC || hdr.version != FLIP_SNAPSHOT_VERSION ||
+        size != sizeof(hdr) + size_t{hdr.path_count} * sizeof(snapshot_path) +
+                size_t{hdr.location_count} * sizeof(snapshot_location)) {
+        LOG_WARN("Snapshot: {} is not a version {} snapshot, ignoring it", path, FLIP_SNAPSHOT_VERSION);
+        munmap(mem, size);
+        return false;
+    }
+    const auto* paths = reinterpret_cast<const snapshot_path*>(p + sizeof(hdr));
+    const auto* locations = reinterpret_cast<const snapshot_location*>(paths + hdr.path_count);
+
+    const auto& nets = networks.get_networks();
+    size_t routes = 0;
+    for (uint32_t i = 0; i < hdr.path_count; ) {
+        // Gather the consecutive paths of one route
+        flip_address_t address = paths[i].address;
+        std::vector<flip_route_path> route_paths;
+        for (; i < hdr.path_count && paths[i].address == address; ++i) {
+            if (!nets.contains(paths[i].network) || route_paths.size() >= FLIP_MAX_ROUTE_PATHS) {
+                continue;
+            }
+            hwaddr_t mac;
+            std::memcpy(mac.data(), paths[i].next_hop_mac, mac.size());
+            route_paths.push_back(flip_route_path{paths[i].network, mac, paths[i].hopcount, 0});
+        }
+        if (router.install_provisional_route(address, std::move(route_paths))) {
+            ++routes;
+        }
+    }
+
+    auto rpc_mgr = router.get_rpc_port_manager();
+    for (uint32_t i = 0; i < hdr.location_count; ++i) {
+        rpc_port_t port;
+        std::memcpy(port.data(), locations[i].port, port.size());
+        rpc_mgr->cache_remote_location(port, locations[i].address, true);
+    }
+    munmap(mem, size);
+
+    LOG_INFO("Snapshot: loaded {} routes and {} port locations from {}", routes, hdr.location_count, path);
+    return true;
+}
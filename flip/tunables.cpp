@@ -0,0 +1,122 @@
+#include <charconv>
+#include <limits>
+
+#include "tunables.hpp"
+#include "log.hpp"
+
+flip_tunables g_flip_tunables;
+
+namespace {
+
+struct tunable_desc {
+    const char* name;
+    uint32_t flip_tunables::* u32;
+    uint16_t flip_tunables::* u16;
+    uint64_t min;
+    uint64_t max;
+};
+
+const tunable_desc tunable_table[] = {
+    {"max_hopcount",           nullptr, &flip_tunables::max_hopcount, 1, std::numeric_limits<uint16_t>::max()},
+    {"age_interval_sec",       &flip_tunables::age_interval_sec, nullptr, 1, 3600},
+    {"fragment_delay_us",      &flip_tunables::fragment_delay_us, nullptr, 0, 1000000},
+    {"reassembly_timeout_sec", &flip_tunables::reassembly_timeout_sec, nullptr, 1, 3600},
+    {"slow_trans_us",          &flip_tunables::slow_trans_us, nullptr, 0, 3600000000},
+    {"rpc_rto_initial_ms",     &flip_tunables::rpc_rto_initial_ms, nullptr, 1, 60000},
+    {"rpc_rto_min_ms",         &flip_tunables::rpc_rto_min_ms, nullptr, 1, 60000},
+    {"rpc_rto_max_ms",         &flip_tunables::rpc_rto_max_ms, nullptr, 1, 600000},
+    {"rpc_max_retries",        &flip_tunables::rpc_max_retries, nullptr, 0, 100},
+    {"rpc_enquire_ms",         &flip_tunables::rpc_enquire_ms, nullptr, 10, 3600000},
+    {"rpc_ack_delay_us",       &flip_tunables::rpc_ack_delay_us, nullptr, 0, 1000000},
+};
+
+const tunable_desc* find_tunable(std::string_view name)
+{
+    for (const auto& t : tunable_table) {
+        if (name == t.name) {
+            return &t;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t tunable_value(const tunable_desc& t)
+{
+    return t.u32 ? g_flip_tunables.*t.u32 : g_flip_tunables.*t.u16;
+}
+
+// Tunables whose ranges depend on each other; the retransmitter clamps the
+// timeout to [rpc_rto_min_ms, rpc_rto_max_ms], which must not be empty
+bool tunables_consistent(const flip_tunables& t)
+{
+    return t.rpc_rto_min_ms <= t.rpc_rto_initial_ms && t.rpc_rto_initial_ms <= t.rpc_rto_max_ms;
+}
+
+}
+
+bool flip_tunable_set(std::string_view name, std::string_view value)
+{
+    if (name == "log_level") {
+        log_level lvl;
+        if (!Logger::parse_level(value, lvl)) {
+            return false;
+        }
+        Logger::instance().set_level(lvl);
+        return true;
+    }
+
+    const tunable_desc* t = find_tunable(name);
+    if (!t) {
+        return false;
+    }
+
+    uint64_t v;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+    if (ec != std::errc() || end != value.data() + value.size() || v < t->min || v > t->max) {
+        return false;
+    }
+
+    flip_tunables updated = g_flip_tunables;
+    if (t->u32) {
+        updated.*t->u32 = static_cast<uint32_t>(v);
+    } else {
+        updated.*t->u16 = static_cast<uint16_t>(v);
+    }
+    if (!tunables_consistent(updated)) {
+        LOG_WARN("Tunable {} not set to {}: rpc_rto_min_ms <= rpc_rto_initial_ms <= rpc_rto_max_ms must hold", t->name, v);
+        return false;
+    }
+    g_flip_tunables = updated;
+    LOG_INFO("Tunable {} set to {}", t->name, v);
+    return true;
+}
+
+bool flip_tunable_get(std::string_view name, std::string& value)
+{
+    if (name == "log_level") {
+        value = Logger::level_name(Logger::instance().get_level());
+        return true;
+    }
+
+    const tunable_desc* t = find_tunable(name);
+    if (!t) {
+        return false;
+    }
+    value = std::to_string(tunable_value(*t));
+    return true;
+}
+
+std::string flip_tunables_dump()
+{
+    std::string out;
+    for (const auto& t : tunable_table) {
+        out += t.name;
+        out += ' ';
+        out += std::to_string(tunable_value(t));
+        out += '\n';
+    }
+    out += "log_level ";
+    out += Logger::level_name(Logger::instance().get_level());
+    out += '\n';
+    return out;
+}
@@ -4,352 +4,928 @@
 #include <chrono>
 #include <cstring>
 #include <csignal>
+#include <cstdlib>
+#include <map>
+#include <optional>
 #include <unordered_map>
-#include <random>
 #include <poll.h>
 #include <unistd.h>
 #include <sys/timerfd.h>
 #include <linux/if_ether.h>
 
 #include "tap.hpp"
+#include "packet_view.hpp"
+#include "pcap_replay.hpp"
 #include "flip_router.hpp"
+#include "flip_receiver.hpp"
 #include "unix_server.hpp"
+#include "client_io.hpp"
+#include "local_clients.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include "tunables.hpp"
+#include "admin.hpp"
+#include "trace.hpp"
+#include "rpc_trans_tracker.hpp"
+#include "rpc_retransmit.hpp"
+#include "capture.hpp"
+#include "snapshot.hpp"
 
 std::unique_ptr<flip_router> router;
+std::unique_ptr<flip_receiver> receiver;
 std::shared_ptr<flip_networks> networks;
-std::unique_ptr<UnixServer> unix_server;
-std::unordered_map<int, flip_address_t> unix_client_addresses;
+std::unique_ptr<ClientIoThread> client_io;
+std::unique_ptr<UnixServer> admin_server;
+static std::unique_ptr<LocalClients> local_clients;
 
-struct ReassemblyKey {
-    flip_address_t src_address;
-    uint32_t message_id;
-    bool operator==(const ReassemblyKey& o) const {
-        return src_address == o.src_address && message_id == o.message_id;
-    }
-};
+static RpcTransTracker trans_tracker;
+static std::unique_ptr<RpcRetransmitter> retransmitter;
+static uint32_t trans_tid{0};
 
-struct ReassemblyKeyHash {
-    size_t operator()(const ReassemblyKey& k) const {
-        return std::hash<uint64_t>()(k.src_address) ^ (std::hash<uint32_t>()(k.message_id) * 2654435761ULL);
-    }
-};
+// A transaction started by a Unix client, or a request from a remote host
+// served by one, keyed by an RPC tid unique among the transactions in flight
+struct unix_trans {
+    int client_fd;     // Requesting client, or -1 if the request came in over FLIP
+    flip_address_t client_addr;
+    uint32_t tag;      // Echoed in the reply of a UNIX_MSG_TRANS_TAGGED request
+    bool tagged;
+    int server_fd;     // Local client serving the request, or -1 if it went out over FLIP
+    rpc_port_t port;
 
-struct ReassemblyEntry {
-    hwaddr_t src_mac;
-    flip_network_t incoming_network;
-    flip_packet header;
-    std::vector<uint8_t> payload;
-    uint32_t bytes_received;
+    // Request that came in over FLIP: the reply goes back from the address
+    // it was sent to, with the sender's own tid
+    flip_address_t local_addr{0};
+    uint32_t remote_tid{0};
+    uint64_t kid{0};
+
+    // Request going out over FLIP: the packet, with room left for the FLIP
+    // and RPC headers, and the server it was sent to
+    std::shared_ptr<std::vector<uint8_t>> request{};
+    flip_address_t server_addr{0};
+    bool tentative{false};   // server_addr is a provisional port location the server has not confirmed
 };
+static std::unordered_map<uint32_t, unix_trans> transactions;
+// Requests from remote hosts being served or whose reply is held for
+// retransmission, by (sender, sender's tid), so a duplicate is not handed to
+// a second server
+static std::map<std::pair<flip_address_t, uint32_t>, uint32_t> served_requests;
+
+using trans_iterator = std::unordered_map<uint32_t, unix_trans>::iterator;
 
-static std::unordered_map<ReassemblyKey, ReassemblyEntry, ReassemblyKeyHash> reassembly_map;
+// Forget a transaction, releasing its slot on the serving client's binding.
+// The reply to a remote request stays with the retransmitter until ACKed.
+static trans_iterator erase_transaction(trans_iterator it)
+{
+    const unix_trans& trans = it->second;
+    if (trans.server_fd >= 0) {
+        router->get_rpc_port_manager()->request_finished(trans.port, trans.server_fd);
+    }
+    if (trans.client_fd >= 0) {
+        retransmitter->forget(it->first);
+    } else if (!retransmitter->holds(it->first)) {
+        served_requests.erase({trans.client_addr, trans.remote_tid});
+    }
+    return transactions.erase(it);
+}
 
-static flip_address_t allocate_unix_client_address()
+static uint32_t allocate_tid()
 {
-    static std::mt19937_64 rng(std::random_device{}());
-    static constexpr flip_address_t kAddressMask = 0x00FFFFFFFFFFFFFFULL;
+    do {
+        ++trans_tid;
+    } while (trans_tid == 0 || transactions.contains(trans_tid) || retransmitter->holds(trans_tid));
+    return trans_tid;
+}
 
-    for (int attempt = 0; attempt < 1024; ++attempt) {
-        flip_address_t candidate = rng() & kAddressMask;
-        if (candidate == 0) {
-            continue;
-        }
-        if (router->install_local_address(candidate)) {
-            return candidate;
-        }
+// Send a local server's reply to a request that came in over FLIP
+static void send_remote_reply(uint32_t tid, const unix_trans& trans, const uint8_t* payload, size_t len)
+{
+    auto pkt_buf = std::make_shared<std::vector<uint8_t>>(sizeof(flip_packet) + sizeof(rpc_header) + len);
+    std::vector<uint8_t>& pkt = *pkt_buf;
+
+    auto fp = build_flip_header(pkt.data(), flip_type::UNIDATA, trans.local_addr, trans.client_addr, trans.remote_tid,
+                                static_cast<uint32_t>(pkt.size() - sizeof(flip_packet)), g_flip_tunables.max_hopcount);
+    auto rpc_hdr = build_rpc_header(fp.payload(), trans.kid, trans.port.data(), AM_RPC_REPLY, RPC_FLAG_ACK_LISTS,
+                                    trans.remote_tid);
+    std::memcpy(rpc_hdr.payload(), payload, len);
+
+    static const hwaddr_t local_mac{};
+    router->route_packet(local_mac, pkt.data(), pkt.size(), 0);
+    retransmitter->reply_sent(tid, trans.client_addr, trans.remote_tid, std::move(pkt_buf));
+}
+
+// Send a reply to the Unix client that started a transaction; one without
+// an am_header tells the client the transaction failed
+static void send_client_reply(const unix_trans& trans, const uint8_t* payload, size_t len)
+{
+    if (trans.tagged) {
+        unix_trans_tag tag{trans.tag};
+        struct iovec parts[2];
+        parts[0].iov_base = &tag;
+        parts[0].iov_len = sizeof(tag);
+        parts[1].iov_base = const_cast<uint8_t*>(payload);
+        parts[1].iov_len = len;
+        client_io->send_to_client(trans.client_fd, UNIX_MSG_TRANS_TAGGED, parts, 2);
+    } else {
+        client_io->send_to_client(trans.client_fd, UNIX_MSG_TRANS, payload, len);
     }
+}
 
-    return 0;
+// Hand the reply of a transaction to the client that started it
+static void deliver_reply(trans_iterator it, const uint8_t* payload, size_t len)
+{
+    uint32_t tid = it->first;
+    const unix_trans& trans = it->second;
+    if (trans.client_fd < 0) {
+        send_remote_reply(tid, trans, payload, len);
+        erase_transaction(it);
+        return;
+    }
+    trans_tracker.reply_complete(trans.client_addr, tid);
+    send_client_reply(trans, payload, len);
+    trans_tracker.reply_delivered(tid);
+    erase_transaction(it);
 }
 
-static volatile sig_atomic_t should_exit = 0;
+// Give up on a transaction a Unix client started
+static void fail_transaction(trans_iterator it)
+{
+    send_client_reply(it->second, nullptr, 0);
+    trans_tracker.abort(it->first);
+    erase_transaction(it);
+}
 
-static void handle_sigint(int)
+// The server of a request we sent answered: the port location it came from is good
+static void server_answered(unix_trans& trans)
 {
-    should_exit = 1;
+    if (trans.tentative) {
+        router->get_rpc_port_manager()->confirm_remote_location(trans.port, trans.server_addr);
+        trans.tentative = false;
+    }
 }
 
-void recv_packet(const uint8_t* packet, size_t len, flip_network_t incoming_network)
+// Hand a request to the local client serving its port. From another local
+// client no FLIP packet is built or routed and no ACK is generated; the reply
+// comes back as UNIX_MSG_REPLY and is passed on the same way.
+static void deliver_local_request(uint32_t tid, int server_fd, const uint8_t* payload, size_t len)
 {
-    if (len < sizeof(struct ethhdr)) {
-        std::cerr << "Received packet too short for Ethernet header" << std::endl;
+    auto it = transactions.find(tid);
+    unix_trans& trans = it->second;
+    unix_request_header req{trans.client_addr, tid};
+    struct iovec parts[2];
+    parts[0].iov_base = &req;
+    parts[0].iov_len = sizeof(req);
+    parts[1].iov_base = const_cast<uint8_t*>(payload);
+    parts[1].iov_len = len;
+
+    trans_tracker.request_sent(tid);
+    if (!client_io->send_to_client(server_fd, UNIX_MSG_REQUEST, parts, 2)) {
+        LOG_WARN("Cannot deliver request from {} to local server fd={}", trans.client_addr, server_fd);
+        trans_tracker.abort(tid);
+        erase_transaction(it);
         return;
     }
+    trans.server_fd = server_fd;
+    router->get_rpc_port_manager()->request_started(trans.port, server_fd);
+}
+
+// The client has our reply to its request client_tid: stop resending it
+static void reply_acked(flip_address_t client, uint32_t client_tid)
+{
+    auto served = served_requests.find({client, client_tid});
+    if (served != served_requests.end() && !transactions.contains(served->second)) {
+        retransmitter->ack_received(served->second);
+        served_requests.erase(served);
+    }
+}
+
+// Handle an rpc_ack_list from a client; returns the bytes it took up, or 0 if it is malformed
+static size_t handle_ack_list(flip_address_t client, const uint8_t* data, size_t len)
+{
+    if (len < sizeof(rpc_ack_list)) {
+        return 0;
+    }
+    uint32_t count = network_order::load<uint32_t>(data);
+    if (count > RPC_ACK_LIST_MAX || len - sizeof(rpc_ack_list) < count * sizeof(uint32_t)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        reply_acked(client, network_order::load<uint32_t>(data + sizeof(rpc_ack_list) + i * sizeof(uint32_t)));
+    }
+    return sizeof(rpc_ack_list) + count * sizeof(uint32_t);
+}
 
-    struct ethhdr *eth = (struct ethhdr *)packet;
-    if (eth->h_proto != flip_ethertype_network()) {
-        // Not a FLIP packet, ignore
+// A request from a remote host for a port served by local clients
+static void handle_remote_request(flip_address_t dst, flip_address_t src, const rpc_header& rpc_hdr,
+                                  const uint8_t* payload, size_t len)
+{
+    if (rpc_hdr.flags & RPC_FLAG_ACKS) {
+        size_t used = handle_ack_list(src, payload, len);
+        if (used == 0) {
+            LOG_WARN("RPC request from {} with a malformed ACK list", src);
+            return;
+        }
+        payload += used;
+        len -= used;
+    }
+    if (len < sizeof(am_header)) {
+        LOG_WARN("RPC request from {} too short", src);
+        return;
+    }
+    auto served = served_requests.find({src, rpc_hdr.tid});
+    if (served != served_requests.end()) {
+        // The client did not hear from us in time: tell it the request is
+        // being worked on, or send the reply again
+        LOG_DEBUG("Duplicate RPC request {} from {}", rpc_hdr.tid, src);
+        if (transactions.contains(served->second)) {
+            router->send_rpc_control(dst, src, &rpc_hdr, AM_RPC_ALIVE);
+        } else {
+            retransmitter->resend_reply(served->second);
+        }
         return;
     }
 
-    if (len < sizeof(struct ethhdr) + sizeof(struct fc_header)) {
-        std::cerr << "Received packet too short for Fragment header" << std::endl;
+    rpc_port_t port_array;
+    std::copy(rpc_hdr.port, rpc_hdr.port + 6, port_array.begin());
+    auto binding = router->get_rpc_port_manager()->get_local_binding(port_array);
+    if (!binding.has_value()) {
+        // The serving clients have all gone away since the sender located the port
+        LOG_DEBUG("RPC request {} from {} for a port no longer served here", rpc_hdr.tid, src);
         return;
     }
 
-    struct fc_header *fc = (struct fc_header *)(packet + sizeof(struct ethhdr));
-    if (fc->fc_type == 0)
-    {
-        const uint8_t* flip_data = packet + sizeof(struct ethhdr) + sizeof(struct fc_header);
-        size_t flip_len = len - sizeof(struct ethhdr) - sizeof(struct fc_header);
+    uint32_t tid = allocate_tid();
+    unix_trans trans{-1, src, 0, false, -1, port_array};
+    trans.local_addr = dst;
+    trans.remote_tid = rpc_hdr.tid;
+    trans.kid = rpc_hdr.kid;
+    transactions.emplace(tid, trans);
+    served_requests[{src, rpc_hdr.tid}] = tid;
+    deliver_local_request(tid, binding->client_fd, payload, len);
+}
 
-        if (flip_len < sizeof(struct flip_packet)) {
-            std::cerr << "Fragment too short for FLIP header" << std::endl;
-            return;
+// ACK, NAK, ENQUIRE, ALIVE, RECEIVED or FAIL for one of our transactions
+static void handle_rpc_control(flip_address_t dst, flip_address_t src, const rpc_header& rpc_hdr,
+                               const uint8_t* payload, size_t len)
+{
+    if (rpc_hdr.type == AM_RPC_ACK) {
+        // About requests we are serving, known by the client's tids
+        reply_acked(src, rpc_hdr.tid);
+        if ((rpc_hdr.flags & RPC_FLAG_ACK_LISTS) && len) {
+            handle_ack_list(src, payload, len);
         }
+        return;
+    }
+    if (rpc_hdr.type == AM_RPC_ENQUIRE) {
+        auto served = served_requests.find({src, rpc_hdr.tid});
+        if (served != served_requests.end() && transactions.contains(served->second)) {
+            router->send_rpc_control(dst, src, &rpc_hdr, AM_RPC_ALIVE);
+        } else if (served == served_requests.end() || !retransmitter->resend_reply(served->second)) {
+            // Never got the request, or gave up on the reply: have it sent again
+            router->send_rpc_control(dst, src, &rpc_hdr, AM_RPC_NAK);
+        }
+        return;
+    }
 
-        const struct flip_packet* fp = (const struct flip_packet*)flip_data;
-        uint32_t frag_offset = fp->offset;
-        uint32_t frag_length = fp->length;
-        uint32_t total_length = fp->total_length;
+    // About a request we sent, known by our tid
+    auto it = transactions.find(rpc_hdr.tid);
+    if (it == transactions.end() || it->second.client_addr != dst || it->second.client_fd < 0) {
+        return;
+    }
+    switch (rpc_hdr.type) {
+        case AM_RPC_ALIVE:
+        case AM_RPC_RECEIVED:
+            server_answered(it->second);
+            retransmitter->alive_received(it->first);
+            break;
+        case AM_RPC_NAK:
+            server_answered(it->second);
+            retransmitter->nak_received(it->first);
+            break;
+        case AM_RPC_FAIL:
+            LOG_DEBUG("Server {} failed RPC {}", src, rpc_hdr.tid);
+            fail_transaction(it);
+            break;
+        default:
+            break;
+    }
+}
 
-        // Not fragmented: deliver directly
-        if (frag_offset == 0 && (total_length == 0 || frag_length == total_length)) {
-            router->route_packet(std::to_array(eth->h_source), flip_data, flip_len, incoming_network);
-            return;
+// Bind or unbind a port for the client and answer with the outcome
+static void handle_port_registration(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    unix_port_result result{0};
+    unix_port_request req;
+    flip_address_t addr = local_clients->address_of(client_fd);
+    if (len < sizeof(req) || addr == 0) {
+        result.status = EINVAL;
+    } else {
+        std::memcpy(&req, payload, sizeof(req));
+        rpc_port_t port_array;
+        std::copy(req.port, req.port + 6, port_array.begin());
+        auto rpc_mgr = router->get_rpc_port_manager();
+        if (type == UNIX_MSG_REGISTER) {
+            rpc_mgr->register_local_port(port_array, client_fd, addr);
+            LOG_INFO("Unix client fd={} serves port {}", client_fd, trace_port(req.port));
+        } else if (!rpc_mgr->unregister_local_port(port_array, client_fd)) {
+            result.status = ENOENT;
         }
+    }
+    client_io->send_to_client(client_fd, type, reinterpret_cast<const uint8_t*>(&result), sizeof(result));
+}
+
+static void handle_local_reply(int server_fd, const uint8_t* payload, size_t len)
+{
+    if (len < sizeof(unix_request_header) + sizeof(am_header)) {
+        LOG_WARN("Unix reply message too short from fd={}", server_fd);
+        return;
+    }
+    unix_request_header req;
+    std::memcpy(&req, payload, sizeof(req));
+
+    auto it = transactions.find(req.tid);
+    if (it == transactions.end() || it->second.server_fd != server_fd || it->second.client_addr != req.client) {
+        LOG_WARN("Unexpected reply from fd={} for client {} tid {}", server_fd, req.client, req.tid);
+        return;
+    }
+    trans_tracker.reply_started(req.client, req.tid);
+    deliver_reply(it, payload + sizeof(req), len - sizeof(req));
+}
 
-        // Fragmented: reassemble
-        ReassemblyKey key{fp->src_address, fp->message_id};
-
-        if (frag_offset == 0) {
-            // First fragment: initialise entry
-            ReassemblyEntry& entry = reassembly_map[key];
-            entry.src_mac = std::to_array(eth->h_source);
-            entry.incoming_network = incoming_network;
-            entry.header = *fp;
-            entry.payload.assign(total_length, 0);
-            entry.bytes_received = 0;
+// Join or leave a group for the client and answer with the outcome
+static void handle_group_membership(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    unix_port_result result{0};
+    unix_port_request req;
+    if (len < sizeof(req) || local_clients->address_of(client_fd) == 0) {
+        result.status = EINVAL;
+    } else {
+        std::memcpy(&req, payload, sizeof(req));
+        rpc_port_t port_array;
+        std::copy(req.port, req.port + 6, port_array.begin());
+        auto group_mgr = router->get_group_manager();
+        if (type == UNIX_MSG_GROUP_JOIN) {
+            if (group_mgr->join(port_array, client_fd)) {
+                LOG_INFO("Unix client fd={} joined group {}", client_fd, trace_port(req.port));
+            }
+        } else if (!group_mgr->leave(port_array, client_fd)) {
+            result.status = ENOENT;
         }
+    }
+    client_io->send_to_client(client_fd, type, reinterpret_cast<const uint8_t*>(&result), sizeof(result));
+}
 
-        auto it = reassembly_map.find(key);
-        if (it == reassembly_map.end()) {
-            std::cerr << "Out-of-order fragment (no first fragment yet), discarding" << std::endl;
-            return;
+// Hand a group message to every local member. The data is len bytes of body
+// from offset; all members' messages share that one buffer.
+static void deliver_group_message(flip_address_t sender, const rpc_port_t& port,
+                                  std::shared_ptr<const std::vector<uint8_t>> body, size_t offset, size_t len)
+{
+    const std::vector<int>* members = router->get_group_manager()->members(port);
+    if (!members) {
+        return;
+    }
+    unix_group_message msg{};
+    msg.sender = sender;
+    std::copy(port.begin(), port.end(), msg.port);
+    for (int member_fd : *members) {
+        if (client_io->send_to_client(member_fd, UNIX_MSG_GROUP_MESSAGE, reinterpret_cast<const uint8_t*>(&msg),
+                                      sizeof(msg), body, offset, len)) {
+            ++g_flip_stats.group_deliveries;
         }
+    }
+}
 
-        ReassemblyEntry& entry = it->second;
-        const uint8_t* frag_payload = flip_data + sizeof(struct flip_packet);
-        size_t frag_payload_len = flip_len - sizeof(struct flip_packet);
+// A member sends to its group: the packet is built once, with the data copied
+// in behind room for the headers, and that buffer is both broadcast and
+// handed to the local members
+static void handle_group_send(int client_fd, const uint8_t* payload, size_t len)
+{
+    unix_port_request req;
+    flip_address_t src_addr = local_clients->address_of(client_fd);
+    if (len < sizeof(req) || src_addr == 0) {
+        LOG_WARN("Unix group send message too short from fd={}", client_fd);
+        return;
+    }
+    std::memcpy(&req, payload, sizeof(req));
+    rpc_port_t port_array;
+    std::copy(req.port, req.port + 6, port_array.begin());
+    payload += sizeof(req);
+    len -= sizeof(req);
 
-        if (frag_offset + frag_length > total_length || frag_length > frag_payload_len) {
-            std::cerr << "Invalid fragment bounds, discarding reassembly" << std::endl;
-            reassembly_map.erase(it);
-            return;
-        }
+    auto packet = std::make_shared<std::vector<uint8_t>>(FLIP_GROUP_HEADERS + len);
+    std::memcpy(packet->data() + FLIP_GROUP_HEADERS, payload, len);
+    router->send_group_message(src_addr, port_array, *packet);
+    deliver_group_message(src_addr, port_array, std::move(packet), FLIP_GROUP_HEADERS, len);
+}
 
-        std::memcpy(entry.payload.data() + frag_offset, frag_payload, frag_length);
-        entry.bytes_received += frag_length;
+static int age_timer_fd = -1;
+static int rpc_timer_fd = -1;
+static std::optional<std::chrono::steady_clock::time_point> rpc_timer_armed;
 
-        if (entry.bytes_received >= total_length) {
-            // Reassembly complete: reconstruct full packet and deliver
-            entry.header.offset = 0;
-            entry.header.length = total_length;
-            entry.header.total_length = total_length;
+static void arm_age_timer()
+{
+    struct itimerspec timer_spec = {};
+    timer_spec.it_interval.tv_sec = g_flip_tunables.age_interval_sec;
+    timer_spec.it_value.tv_sec = g_flip_tunables.age_interval_sec;
+    timerfd_settime(age_timer_fd, 0, &timer_spec, nullptr);
+}
+
+// Make sure the RPC timer fires by the retransmitter's next deadline. A timer
+// left armed for a message that has since completed just fires early.
+static void arm_rpc_timer()
+{
+    auto next = retransmitter->next_deadline();
+    if (!next || (rpc_timer_armed && *rpc_timer_armed <= *next)) {
+        return;
+    }
+    rpc_timer_armed = next;
+    auto ns = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(next->time_since_epoch()).count());
+    struct itimerspec timer_spec = {};
+    timer_spec.it_value.tv_sec = ns / 1000000000;
+    timer_spec.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(rpc_timer_fd, TFD_TIMER_ABSTIME, &timer_spec, nullptr);
+}
 
-            std::vector<uint8_t> full_packet(sizeof(flip_packet) + total_length);
-            std::memcpy(full_packet.data(), &entry.header, sizeof(flip_packet));
-            std::memcpy(full_packet.data() + sizeof(flip_packet), entry.payload.data(), total_length);
+static void handle_admin_message(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    std::string_view arg(reinterpret_cast<const char*>(payload), len);
+    std::string reply;
+    bool ok = true;
 
-            hwaddr_t src_mac = entry.src_mac;
-            flip_network_t net = entry.incoming_network;
-            reassembly_map.erase(it);
-            router->route_packet(src_mac, full_packet.data(), full_packet.size(), net);
+    switch (type) {
+        case ADMIN_MSG_DUMP_ROUTES:
+            router->dump_routes(reply);
+            break;
+        case ADMIN_MSG_DUMP_LOOKUPS:
+            router->get_rpc_port_manager()->dump(reply);
+            break;
+        case ADMIN_MSG_DUMP_GROUPS:
+            router->get_group_manager()->dump(reply);
+            break;
+        case ADMIN_MSG_DUMP_REASSEMBLY:
+            receiver->dump_reassembly(reply);
+            break;
+        case ADMIN_MSG_DUMP_TRANS:
+            trans_tracker.dump(reply);
+            retransmitter->dump(reply);
+            break;
+        case ADMIN_MSG_FLUSH: {
+            bool all = arg.empty() || arg == "all";
+            if (!all && arg != "routes" && arg != "lookups" && arg != "reassembly" && arg != "trans") {
+                ok = false;
+                reply = "unknown cache '" + std::string(arg) + "'\n";
+                break;
+            }
+            if (all || arg == "routes") {
+                reply += "routes " + std::to_string(router->flush_routes()) + "\n";
+            }
+            if (all || arg == "lookups") {
+                reply += "lookups " + std::to_string(router->get_rpc_port_manager()->flush_pending_lookups()) + "\n";
+            }
+            if (all || arg == "reassembly") {
+                reply += "reassembly " + std::to_string(receiver->flush_reassembly()) + "\n";
+            }
+            if (all || arg == "trans") {
+                trans_tracker.reset();
+                reply += "trans\n";
+            }
+            break;
+        }
+        case ADMIN_MSG_GET: {
+            if (arg.empty()) {
+                reply = flip_tunables_dump();
+            } else if (flip_tunable_get(arg, reply)) {
+                reply += "\n";
+            } else {
+                ok = false;
+                reply = "unknown tunable '" + std::string(arg) + "'\n";
+            }
+            break;
+        }
+        case ADMIN_MSG_SET: {
+            auto space = arg.find(' ');
+            std::string_view name = arg.substr(0, space);
+            std::string_view value = space == std::string_view::npos ? std::string_view{} : arg.substr(space + 1);
+            uint32_t old_interval = g_flip_tunables.age_interval_sec;
+            if (!flip_tunable_set(name, value)) {
+                ok = false;
+                reply = "cannot set '" + std::string(name) + "' to '" + std::string(value) + "'\n";
+                break;
+            }
+            if (g_flip_tunables.age_interval_sec != old_interval) {
+                arm_age_timer();
+            }
+            break;
+        }
+        case ADMIN_MSG_CAPTURE: {
+            if (arg == "stop") {
+                g_frame_capture.stop();
+            } else if (arg.starts_with("start")) {
+                capture_config cfg;
+                std::string error;
+                if (!capture_config_parse(arg.substr(5), cfg, error) || !g_frame_capture.start(cfg, error)) {
+                    ok = false;
+                    reply = error + "\n";
+                    break;
+                }
+            } else if (!arg.empty()) {
+                ok = false;
+                reply = "usage: capture [start [key=value ...]|stop]\n";
+                break;
+            }
+            g_frame_capture.status(reply);
+            break;
         }
+        default:
+            ok = false;
+            reply = "unknown admin request " + std::to_string(type) + "\n";
+            break;
     }
-    else if (fc->fc_type == 1)
-    {
-        constexpr size_t MIN_PAYLOAD = 60 - sizeof(struct ethhdr);
-        uint8_t response[MIN_PAYLOAD] = {};
-        struct fc_header *resp_fc = reinterpret_cast<struct fc_header *>(response);
-        resp_fc->fc_type = 2;
-        resp_fc->fc_cnt = 5;
-        auto net = networks->get_networks().at(incoming_network);
-        net->send(std::to_array(eth->h_source), FLIP_ETHERTYPE, response, sizeof(response));
+
+    admin_server->send_to_client(client_fd, ok ? ADMIN_MSG_OK : ADMIN_MSG_ERROR,
+                                 reinterpret_cast<const uint8_t*>(reply.data()), reply.size());
+}
+
+static volatile sig_atomic_t should_exit = 0;
+
+static void handle_sigint(int)
+{
+    should_exit = 1;
+}
+
+// SIGUSR1 makes logging more verbose, SIGUSR2 less verbose
+static void handle_log_level_signal(int sig)
+{
+    auto lvl = static_cast<uint8_t>(Logger::instance().get_level());
+    if (sig == SIGUSR1 && lvl > static_cast<uint8_t>(log_level::TRACE)) {
+        --lvl;
+    } else if (sig == SIGUSR2 && lvl < static_cast<uint8_t>(log_level::OFF)) {
+        ++lvl;
     }
+    Logger::instance().set_level(static_cast<log_level>(lvl));
 }
 
 uint64_t kid_alloc = 1;
 
+// Send a Unix client's request over FLIP to the server at dst_addr. A
+// tentative request goes to a provisional port location; if the server does
+// not answer, the port is located again instead of the request being resent.
+static void send_remote_request(uint32_t tid, flip_address_t dst_addr, bool tentative)
+{
+    auto it = transactions.find(tid);
+    if (it == transactions.end()) {
+        return;  // Client went away while the port was being located
+    }
+    unix_trans& trans = it->second;
+    trans.server_addr = dst_addr;
+    trans.tentative = tentative;
+
+    // Carry the ACKs for replies this client has had from the server
+    constexpr size_t headers = sizeof(flip_packet) + sizeof(rpc_header);
+    auto acks = retransmitter->take_acks(trans.client_addr, dst_addr);
+    auto pkt = trans.request;
+    if (!acks.empty()) {
+        size_t list_len = sizeof(rpc_ack_list) + acks.size() * sizeof(uint32_t);
+        auto with_acks = std::make_shared<std::vector<uint8_t>>(pkt->size() + list_len);
+        uint8_t* out = with_acks->data() + headers;
+        network_order::store<uint32_t>(out, static_cast<uint32_t>(acks.size()));
+        for (size_t i = 0; i < acks.size(); ++i) {
+            network_order::store<uint32_t>(out + sizeof(rpc_ack_list) + i * sizeof(uint32_t), acks[i]);
+        }
+        std::memcpy(out + list_len, pkt->data() + headers, pkt->size() - headers);
+        pkt = std::move(with_acks);
+    }
+
+    // The headers go in place in front of the request
+    auto fp = build_flip_header(pkt->data(), flip_type::UNIDATA, trans.client_addr, dst_addr, tid,
+                                static_cast<uint32_t>(pkt->size() - sizeof(flip_packet)), g_flip_tunables.max_hopcount);
+    build_rpc_header(fp.payload(), kid_alloc++, trans.port.data(), AM_RPC_REQUEST, acks.empty() ? 0 : RPC_FLAG_ACKS, tid);
+
+    static const hwaddr_t local_mac{};
+    trans_tracker.request_sent(tid);
+    router->route_packet(local_mac, pkt->data(), pkt->size(), 0);
+    retransmitter->request_sent(tid, dst_addr, pkt, tentative);
+}
+
+// Locate the server of a Unix client's port with RPC LOCATE, then send it the request
+static void locate_server(uint32_t tid)
+{
+    const unix_trans& trans = transactions.at(tid);
+    auto rpc_mgr = router->get_rpc_port_manager();
+
+    // Only send LOCATE if no outstanding lookup for this port is already in flight
+    bool need_locate = !rpc_mgr->has_pending_lookup(trans.port);
+    rpc_mgr->begin_remote_lookup(trans.port, trans.client_fd,
+        [tid](int, const rpc_port_t&, const std::string& remote_socket, bool found) {
+            if (!found) return;
+            send_remote_request(tid, std::stoull(remote_socket), false);
+        });
+    if (need_locate) {
+        ++g_flip_stats.rpc_cache_misses;
+        router->send_rpc_locate(trans.client_addr, trans.port);
+    } else {
+        ++g_flip_stats.rpc_cache_hits;
+    }
+}
+
+static void handle_unix_message(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    if (type == UNIX_MSG_TRANS || type == UNIX_MSG_TRANS_TAGGED) {
+        unix_trans_tag tag{0};
+        if (type == UNIX_MSG_TRANS_TAGGED) {
+            if (len < sizeof(tag)) {
+                LOG_WARN("Unix tagged trans message too short from fd={}", client_fd);
+                return;
+            }
+            std::memcpy(&tag, payload, sizeof(tag));
+            payload += sizeof(tag);
+            len -= sizeof(tag);
+        }
+        if (len < sizeof(am_header)) {
+            LOG_WARN("Unix trans message too short from fd={}", client_fd);
+            return;
+        }
+        flip_address_t src_addr = local_clients->address_of(client_fd);
+        if (src_addr == 0) {
+            LOG_WARN("No FLIP address for unix client fd={}", client_fd);
+            return;
+        }
+
+        am_header hdr;
+        std::memcpy(&hdr, payload, sizeof(am_header));
+
+        rpc_port_t port_array;
+        std::copy(hdr.port, hdr.port + 6, port_array.begin());
+        uint32_t tid = allocate_tid();
+        transactions[tid] = unix_trans{client_fd, src_addr, tag.tag, type == UNIX_MSG_TRANS_TAGGED, -1, port_array};
+        trans_tracker.begin(client_fd, src_addr, tid, port_array);
+
+        // Both ends local: skip the FLIP path entirely
+        auto rpc_mgr = router->get_rpc_port_manager();
+        auto local_binding = rpc_mgr->get_local_binding(port_array);
+        ++g_flip_stats.rpc_lookups;
+        if (local_binding.has_value() && local_clients->address_of(local_binding->client_fd) != 0) {
+            ++g_flip_stats.rpc_cache_hits;
+            deliver_local_request(tid, local_binding->client_fd, payload, len);
+            return;
+        }
+
+        // Copy am_header + data once, behind room for the FLIP and RPC headers
+        // that are filled in when the port resolves
+        auto request = std::make_shared<std::vector<uint8_t>>(sizeof(flip_packet) + sizeof(rpc_header) + len);
+        std::memcpy(request->data() + sizeof(flip_packet) + sizeof(rpc_header), payload, len);
+        transactions[tid].request = std::move(request);
+
+        // Remote: go straight to the server if we know where the port is
+        if (auto location = rpc_mgr->get_remote_location(port_array)) {
+            ++g_flip_stats.rpc_cache_hits;
+            send_remote_request(tid, location->address, location->provisional);
+            return;
+        }
+        locate_server(tid);
+    } else if (type == UNIX_MSG_REPLY) {
+        handle_local_reply(client_fd, payload, len);
+    } else if (type == UNIX_MSG_REGISTER || type == UNIX_MSG_UNREGISTER) {
+        handle_port_registration(client_fd, type, payload, len);
+    } else if (type == UNIX_MSG_GROUP_JOIN || type == UNIX_MSG_GROUP_LEAVE) {
+        handle_group_membership(client_fd, type, payload, len);
+    } else if (type == UNIX_MSG_GROUP_SEND) {
+        handle_group_send(client_fd, payload, len);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     std::signal(SIGINT, handle_sigint);
 
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " tapX [tapY ...]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " tapX|replay:file[,fast|,speed=N][,loops=N][,tx][,if=N] ..." << std::endl;
         return 1;
     }
 
+    if (const char* env_level = std::getenv("FLIP_LOG_LEVEL")) {
+        log_level lvl;
+        if (Logger::parse_level(env_level, lvl)) {
+            Logger::instance().set_level(lvl);
+        } else {
+            std::cerr << "Ignoring unknown FLIP_LOG_LEVEL " << env_level << std::endl;
+        }
+    }
+    Logger::instance().start();
+    std::signal(SIGUSR1, handle_log_level_signal);
+    std::signal(SIGUSR2, handle_log_level_signal);
+
     networks = std::make_shared<flip_networks>();
-    std::vector<std::shared_ptr<Tap>> tap_devs;
+    std::vector<std::shared_ptr<NetDrv>> tap_devs;
     std::vector<struct pollfd> pfds;
 
-    // Add each tap device from argv
+    // Add each tap device (or capture replay) from argv
     for (int i = 1; i < argc; ++i) {
-        std::shared_ptr<Tap> tap = std::make_shared<Tap>(argv[i]);
-        networks->add_network(tap);
-        tap_devs.push_back(tap);
+        std::shared_ptr<NetDrv> dev;
+        std::string_view arg(argv[i]);
+        if (arg.starts_with("replay:")) {
+            arg.remove_prefix(7);
+            size_t comma = arg.find(',');
+            replay_options opts;
+            if (comma != std::string_view::npos && !replay_options_parse(arg.substr(comma + 1), opts)) {
+                std::cerr << "Bad replay options in " << argv[i] << std::endl;
+                return 1;
+            }
+            dev = std::make_shared<PcapReplay>(std::string(arg.substr(0, comma)), opts);
+        } else {
+            dev = std::make_shared<Tap>(argv[i]);
+        }
+        networks->add_network(dev);
+        tap_devs.push_back(dev);
         struct pollfd pfd = {};
-        pfd.fd = tap->get_fd();
+        pfd.fd = dev->get_fd();
         pfd.events = POLLIN;
         pfds.push_back(pfd);
     }
 
-    // Add timerfd for 30s timer
-    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-    if (timer_fd < 0) {
-        std::cerr << "Failed to create timerfd: " << strerror(errno) << std::endl;
+    // Add timerfd for the routing table maintenance timer
+    age_timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (age_timer_fd < 0) {
+        LOG_ERROR("Failed to create timerfd: {}", log_errno(errno));
         return 1;
     }
-    struct itimerspec timer_spec = {};
-    timer_spec.it_interval.tv_sec = 30;
-    timer_spec.it_value.tv_sec = 30;
-    timerfd_settime(timer_fd, 0, &timer_spec, nullptr);
+    arm_age_timer();
     struct pollfd timer_pfd = {};
-    timer_pfd.fd = timer_fd;
+    timer_pfd.fd = age_timer_fd;
     timer_pfd.events = POLLIN;
     pfds.push_back(timer_pfd);
 
+    // Add timerfd for publishing statistics once a second
+    StatsPublisher stats_publisher;
+    stats_publisher.open();
+    int stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (stats_timer_fd < 0) {
+        LOG_ERROR("Failed to create stats timerfd: {}", log_errno(errno));
+        return 1;
+    }
+    struct itimerspec stats_spec = {};
+    stats_spec.it_interval.tv_sec = 1;
+    stats_spec.it_value.tv_sec = 1;
+    timerfd_settime(stats_timer_fd, 0, &stats_spec, nullptr);
+    struct pollfd stats_pfd = {};
+    stats_pfd.fd = stats_timer_fd;
+    stats_pfd.events = POLLIN;
+    pfds.push_back(stats_pfd);
+
+    // Add timerfd for RPC retransmissions, armed for the earliest one due
+    rpc_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (rpc_timer_fd < 0) {
+        LOG_ERROR("Failed to create RPC timerfd: {}", log_errno(errno));
+        return 1;
+    }
+    struct pollfd rpc_timer_pfd = {};
+    rpc_timer_pfd.fd = rpc_timer_fd;
+    rpc_timer_pfd.events = POLLIN;
+    pfds.push_back(rpc_timer_pfd);
+
     router = std::make_unique<flip_router>(networks);
-    router->set_local_rpc_reply_cb([](flip_address_t dst, const uint8_t* payload, size_t len) {
-        for (const auto& [fd, addr] : unix_client_addresses) {
-            if (addr == dst) {
-                unix_server->send_to_client(fd, UNIX_MSG_TRANS, payload, len);
-                return;
-            }
+    receiver = std::make_unique<flip_receiver>(*router, networks, &trans_tracker);
+    local_clients = std::make_unique<LocalClients>(*router);
+    router->set_local_rpc_reply_cb([](flip_address_t dst, uint32_t tid, const uint8_t* payload, size_t len) {
+        auto it = transactions.find(tid);
+        if (it == transactions.end() || it->second.client_addr != dst || it->second.server_fd >= 0) {
+            // Duplicate, or the client has gone away
+            LOG_DEBUG("No transaction {} for local FLIP address {}", tid, dst);
+            return;
         }
-        std::cerr << "No unix client for local FLIP address " << dst << std::endl;
+        server_answered(it->second);
+        retransmitter->reply_received(tid);
+        deliver_reply(it, payload, len);
     });
-
-    // Start Unix socket server
-    unix_server = std::make_unique<UnixServer>("/tmp/flip.sock");
-    if (!unix_server->start()) {
-        std::cerr << "Failed to start Unix server" << std::endl;
-        return 1;
+    router->set_local_rpc_request_cb(handle_remote_request);
+    router->set_local_rpc_control_cb(handle_rpc_control);
+    router->set_rpc_ack_cb([](flip_address_t local, flip_address_t peer, const rpc_header& reply_hdr) {
+        retransmitter->ack_reply(local, peer, reply_hdr);
+    });
+    router->set_local_group_cb([](flip_address_t src, const group_header& hdr, const uint8_t* data, size_t len,
+                                  const std::shared_ptr<const std::vector<uint8_t>>& buffer) {
+        // Every member shares the reassembled packet; a message that came in
+        // one frame is copied out of the receive buffer, which is reused
+        rpc_port_t port_array;
+        std::copy(hdr.port, hdr.port + 6, port_array.begin());
+        if (buffer) {
+            deliver_group_message(src, port_array, buffer, data - buffer->data(), len);
+        } else {
+            deliver_group_message(src, port_array, std::make_shared<const std::vector<uint8_t>>(data, data + len), 0, len);
+        }
+    });
+    // Start from the routes and port locations the last run learned;
+    // FLIP_SNAPSHOT= (empty) turns snapshots off
+    const char* env_snapshot = std::getenv("FLIP_SNAPSHOT");
+    const std::string snapshot_path = env_snapshot ? env_snapshot : FLIP_SNAPSHOT_PATH;
+    if (!snapshot_path.empty()) {
+        snapshot_load(snapshot_path, *router, *networks);
     }
-    unix_server->set_on_message([](int client_fd, uint32_t type, const uint8_t* payload, size_t len) {
-        if (type == UNIX_MSG_TRANS) {
-            if (len < sizeof(am_header)) {
-                std::cerr << "Unix trans message too short from fd=" << client_fd << std::endl;
+    retransmitter = std::make_unique<RpcRetransmitter>(
+        [](const uint8_t* packet, size_t len) {
+            static const hwaddr_t local_mac{};
+            router->route_packet(local_mac, packet, len, 0);
+        },
+        [](uint32_t tid, flip_address_t peer, uint32_t peer_tid, bool reply) {
+            if (reply) {
+                served_requests.erase({peer, peer_tid});
                 return;
             }
-            auto addr_it = unix_client_addresses.find(client_fd);
-            if (addr_it == unix_client_addresses.end()) {
-                std::cerr << "No FLIP address for unix client fd=" << client_fd << std::endl;
+            auto it = transactions.find(tid);
+            if (it == transactions.end() || it->second.client_fd < 0) {
                 return;
             }
-
-            auto hdr = std::make_shared<am_header>();
-            std::memcpy(hdr.get(), payload, sizeof(am_header));
-            flip_address_t src_addr = addr_it->second;
-
-            rpc_port_t port_array;
-            std::copy(hdr->port, hdr->port + 6, port_array.begin());
-
-            // Capture am_header + data for later use (shared to allow copy into std::function)
-            auto trans_data = std::make_shared<std::vector<uint8_t>>(payload + sizeof(am_header), payload + len);
-
-            static uint32_t trans_tid{0};
-            auto send_unidata = [src_addr, hdr, trans_data](flip_address_t dst_addr) {
-                struct flip_packet fp{};
-                fp.version = 1;
-                fp.type = static_cast<uint8_t>(flip_type::UNIDATA);
-                fp.actual_hopcount = 0;
-                fp.max_hopcount = 8;
-                fp.dst_address = dst_addr;
-                fp.src_address = src_addr;
-                fp.message_id = ++trans_tid;
-                fp.length = static_cast<uint32_t>(sizeof(rpc_header) + sizeof(am_header) + trans_data->size());
-                fp.offset = 0;
-                fp.total_length = fp.length;
-
-                struct rpc_header rpc_hdr{};
-                rpc_hdr.kid = kid_alloc++;
-                std::copy(hdr->port, hdr->port + 6, rpc_hdr.port);
-                rpc_hdr.type = AM_RPC_REQUEST;
-                rpc_hdr.flags = 0;
-                rpc_hdr.tid = ntohs(fp.message_id);
-                rpc_hdr.dest = 0; // Not used for UNIDATA
-                rpc_hdr.from = 0; // Not used for UNIDATA
-
-                std::vector<uint8_t> pkt_buf(sizeof(flip_packet) + fp.length);
-                std::memcpy(pkt_buf.data(), &fp, sizeof(flip_packet));
-                std::memcpy(pkt_buf.data() + sizeof(flip_packet), &rpc_hdr, sizeof(rpc_header));
-                std::memcpy(pkt_buf.data() + sizeof(flip_packet) + sizeof(rpc_header), hdr.get(), sizeof(am_header));
-                if (!trans_data->empty()) {
-                    std::memcpy(pkt_buf.data() + sizeof(flip_packet) + sizeof(rpc_header) + sizeof(am_header), trans_data->data(), trans_data->size());
-                }
-
-                static const hwaddr_t local_mac{};
-                router->route_packet(local_mac, pkt_buf.data(), pkt_buf.size(), 0);
-            };
-
-            // Check if destination port is local
-            auto rpc_mgr = router->get_rpc_port_manager();
-            auto local_binding = rpc_mgr->get_local_binding(port_array);
-            if (local_binding.has_value()) {
-                auto dst_it = unix_client_addresses.find(local_binding->client_fd);
-                if (dst_it != unix_client_addresses.end()) {
-                    send_unidata(dst_it->second);
-                    return;
-                }
+            // Later requests for the port locate it again
+            unix_trans& trans = it->second;
+            router->get_rpc_port_manager()->forget_remote_location(trans.port, peer);
+            if (trans.tentative) {
+                LOG_INFO("Port {} did not answer at {}, locating it again", trace_port(trans.port.data()), peer);
+                trans.tentative = false;
+                ++g_flip_stats.rpc_lookups;
+                locate_server(tid);
+                return;
             }
+            fail_transaction(it);
+        });
 
-            // Remote: only send LOCATE if no outstanding lookup for this port is already in flight
-            bool need_locate = !rpc_mgr->has_pending_lookup(port_array);
-            rpc_mgr->begin_remote_lookup(port_array, client_fd,
-                [send_unidata](int, const rpc_port_t&, const std::string& remote_socket, bool found) {
-                    if (!found) return;
-                    send_unidata(std::stoull(remote_socket));
-                });
-            if (need_locate) {
-                router->send_rpc_locate(src_addr, port_array);
-            }
-        }
-    });
-    unix_server->set_on_connect([](int client_fd) {
-        flip_address_t addr = allocate_unix_client_address();
+    // Serve Unix clients from their own I/O thread: a stream socket for
+    // existing clients and a SOCK_SEQPACKET one that carries each message as
+    // a single datagram
+    client_io = std::make_unique<ClientIoThread>("/tmp/flip.sock", "/tmp/flip.seqpacket");
+    client_io->set_on_message(handle_unix_message);
+    client_io->set_on_connect([](int client_fd) {
+        flip_address_t addr = local_clients->attach(client_fd);
         if (addr == 0) {
-            std::cerr << "Failed to allocate FLIP address for unix client fd=" << client_fd << std::endl;
-            ::close(client_fd);
+            LOG_ERROR("Failed to allocate FLIP address for unix client fd={}", client_fd);
+            client_io->disconnect(client_fd);
             return;
         }
 
-        unix_client_addresses[client_fd] = addr;
-        std::cout << "Assigned FLIP address " << addr << " to unix client fd=" << client_fd << std::endl;
+        LOG_INFO("Assigned FLIP address {} to unix client fd={}", addr, client_fd);
     });
-    unix_server->set_on_disconnect([](int client_fd) {
-        auto it = unix_client_addresses.find(client_fd);
-        if (it != unix_client_addresses.end()) {
-            router->remove_local_address(it->second);
-            unix_client_addresses.erase(it);
+    client_io->set_on_disconnect([](int client_fd) {
+        local_clients->detach(client_fd);
+        router->get_rpc_port_manager()->remove_client(client_fd);
+        router->get_group_manager()->remove_client(client_fd);
+
+        // Drop the client's own transactions, and those it was serving,
+        // which will never be answered
+        for (auto it = transactions.begin(); it != transactions.end(); ) {
+            if (it->second.server_fd == client_fd) {
+                LOG_WARN("Local server fd={} went away with a request from {} outstanding", client_fd, it->second.client_addr);
+            }
+            if (it->second.client_fd == client_fd || it->second.server_fd == client_fd) {
+                trans_tracker.abort(it->first);
+                it = erase_transaction(it);
+            } else {
+                ++it;
+            }
         }
     });
+    if (!client_io->start()) {
+        LOG_ERROR("Failed to start Unix server");
+        return 1;
+    }
 
-    constexpr size_t BUF_SIZE = 2048;
-    uint8_t buf[BUF_SIZE];
+    // Start admin socket server for flipctl
+    admin_server = std::make_unique<UnixServer>(FLIP_ADMIN_SOCKET_PATH);
+    if (!admin_server->start()) {
+        LOG_ERROR("Failed to start admin server");
+        return 1;
+    }
+    admin_server->set_on_message(handle_admin_message);
+
+    // Size the receive buffer for the largest frame any network can deliver
+    std::vector<uint8_t> rx_buf(networks->max_mtu() + sizeof(struct ethhdr));
+    uint8_t* buf = rx_buf.data();
+    const size_t BUF_SIZE = rx_buf.size();
 
     while (!should_exit) {
         // Rebuild poll set each iteration to account for new/removed unix clients
-        pfds.resize(tap_devs.size() + 1); // tap fds + timer fd
-
-        // Add unix listen fd
-        struct pollfd unix_listen_pfd = {};
-        unix_listen_pfd.fd = unix_server->get_listen_fd();
-        unix_listen_pfd.events = POLLIN;
-        pfds.push_back(unix_listen_pfd);
-
-        // Add unix client fds
-        auto unix_client_fds = unix_server->get_client_fds();
-        size_t unix_clients_start = pfds.size();
-        for (int cfd : unix_client_fds) {
+        pfds.resize(tap_devs.size() + 3); // tap fds + timer fd + stats timer fd + RPC timer fd
+
+        // Add the eventfd the client I/O thread wakes us with
+        struct pollfd client_io_pfd = {};
+        client_io_pfd.fd = client_io->event_fd();
+        client_io_pfd.events = POLLIN;
+        pfds.push_back(client_io_pfd);
+
+        // Add admin listen fd and admin client fds
+        size_t admin_listen_index = pfds.size();
+        struct pollfd admin_listen_pfd = {};
+        admin_listen_pfd.fd = admin_server->get_listen_fd();
+        admin_listen_pfd.events = POLLIN;
+        pfds.push_back(admin_listen_pfd);
+
+        auto admin_client_fds = admin_server->get_client_fds();
+        size_t admin_clients_start = pfds.size();
+        for (int cfd : admin_client_fds) {
             struct pollfd cpfd = {};
             cpfd.fd = cfd;
-            cpfd.events = POLLIN;
+            cpfd.events = admin_server->client_events(cfd);
             pfds.push_back(cpfd);
         }
 
-        int ret = poll(pfds.data(), pfds.size(), -1);
+        int ret = poll(pfds.data(), pfds.size(), client_io->prepare_wait());
         if (ret < 0) {
             if (errno == EINTR) {
                 if (should_exit) {
@@ -357,19 +933,33 @@ int main(int argc, char* argv[])
                 }
                 continue;
             }
-            std::cerr << "poll error: " << strerror(errno) << std::endl;
+            LOG_ERROR("poll error: {}", log_errno(errno));
             break;
         }
+        flip_capture_wakeup();
 
         // Handle tap device events
         for (size_t i = 0; i < tap_devs.size(); ++i) {
-            if (pfds[i].revents & POLLIN) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            for (size_t burst = tap_devs[i]->rx_burst(); burst > 0; --burst) {
                 ssize_t n = tap_devs[i]->recv(buf, BUF_SIZE);
                 if (n > 0) {
-                    std::cout << "Received packet of size " << n << " from tap " << i << std::endl;
-                    recv_packet(buf, n, tap_devs[i]->get_network_id());
+                    LOG_DEBUG("Received packet of size {} from tap {}", n, i);
+                    flip_network_t net_id = tap_devs[i]->get_network_id();
+                    ++g_flip_stats.net(net_id).rx_frames;
+                    g_flip_stats.net(net_id).rx_bytes += n;
+                    auto rx_start = std::chrono::steady_clock::now();
+                    flip_capture_stamp(rx_start);
+                    receiver->recv_packet(buf, n, net_id);
+                    g_flip_stats.processing_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - rx_start).count());
                 } else {
-                    std::cerr << "Error reading from tap " << argv[i+1] << ": " << strerror(errno) << std::endl;
+                    if (errno != EAGAIN) {
+                        LOG_WARN("Error reading from tap {}: {}", argv[i+1], log_errno(errno));
+                    }
+                    break;
                 }
             }
         }
@@ -377,25 +967,63 @@ int main(int argc, char* argv[])
         // Timer event (index = tap_devs.size())
         if (pfds[tap_devs.size()].revents & POLLIN) {
             uint64_t expirations;
-            read(timer_fd, &expirations, sizeof(expirations));
-            std::cout << "Timer event: 30 seconds elapsed" << std::endl;
+            read(age_timer_fd, &expirations, sizeof(expirations));
+            LOG_DEBUG("Timer event: {} seconds elapsed", g_flip_tunables.age_interval_sec);
             router->increment_age();
+            receiver->expire_reassembly();
+            if (!snapshot_path.empty()) {
+                snapshot_save(snapshot_path, *router);
+            }
         }
 
-        // Unix listen socket (index = tap_devs.size() + 1)
+        // Stats timer (index = tap_devs.size() + 1)
         if (pfds[tap_devs.size() + 1].revents & POLLIN) {
-            unix_server->accept_client();
+            uint64_t expirations;
+            read(stats_timer_fd, &expirations, sizeof(expirations));
+            g_flip_stats.log_dropped = Logger::instance().dropped();
+            g_flip_stats.capture_frames = g_frame_capture.captured();
+            g_flip_stats.capture_dropped = g_frame_capture.dropped();
+            g_flip_stats.unix_queue_full = client_io->queue_full();
+            stats_publisher.publish(g_flip_stats);
+        }
+
+        // RPC retransmission timer (index = tap_devs.size() + 2)
+        if (pfds[tap_devs.size() + 2].revents & POLLIN) {
+            uint64_t expirations;
+            read(rpc_timer_fd, &expirations, sizeof(expirations));
+            rpc_timer_armed.reset();
+            retransmitter->expire(std::chrono::steady_clock::now());
         }
 
-        // Unix client sockets
-        for (size_t i = 0; i < unix_client_fds.size(); ++i) {
-            if (pfds[unix_clients_start + i].revents & POLLIN) {
-                unix_server->handle_client_data(unix_client_fds[i]);
+        // Connects, disconnects and messages from Unix clients (index = tap_devs.size() + 3)
+        client_io->dispatch();
+
+        // Admin socket and admin clients
+        if (pfds[admin_listen_index].revents & POLLIN) {
+            admin_server->accept_client();
+        }
+        for (size_t i = 0; i < admin_client_fds.size(); ++i) {
+            short revents = pfds[admin_clients_start + i].revents;
+            if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+                admin_server->handle_client_writable(admin_client_fds[i]);
+            }
+            if (revents & POLLIN) {
+                admin_server->handle_client_data(admin_client_fds[i]);
             }
         }
+
+        arm_rpc_timer();
     }
 
-    unix_server->stop();
-    close(timer_fd);
+    if (!snapshot_path.empty()) {
+        snapshot_save(snapshot_path, *router);
+    }
+    g_frame_capture.stop();
+    client_io->stop();
+    admin_server->stop();
+    close(age_timer_fd);
+    close(stats_timer_fd);
+    close(rpc_timer_fd);
+    Logger::instance().stop();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "group_manager.hpp"
+
+GroupManager::GroupManager()
+{
+    recent.reserve(GROUP_RECENT_MESSAGES);
+    recent_set.reserve(GROUP_RECENT_MESSAGES);
+}
+
+bool GroupManager::join(const rpc_port_t& port, int client_fd)
+{
+    auto& members = groups[port];
+    if (std::find(members.begin(), members.end(), client_fd) != members.end()) {
+        return false;
+    }
+    members.push_back(client_fd);
+    return true;
+}
+
+bool GroupManager::leave(const rpc_port_t& port, int client_fd)
+{
+    auto it = groups.find(port);
+    if (it == groups.end()) {
+        return false;
+    }
+    auto& members = it->second;
+    auto member = std::find(members.begin(), members.end(), client_fd);
+    if (member == members.end()) {
+        return false;
+    }
+    members.erase(member);
+    if (members.empty()) {
+        groups.erase(it);
+    }
+    return true;
+}
+
+void GroupManager::remove_client(int client_fd)
+{
+    for (auto it = groups.begin(); it != groups.end(); ) {
+        std::erase(it->second, client_fd);
+        if (it->second.empty()) {
+            it = groups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+const std::vector<int>* GroupManager::members(const rpc_port_t& port) const
+{
+    auto it = groups.find(port);
+    return it == groups.end() ? nullptr : &it->second;
+}
+
+bool GroupManager::first_sighting(flip_address_t src, uint32_t message_id)
+{
+    message_key key{src, message_id};
+    if (recent_set.contains(key)) {
+        return false;
+    }
+    if (recent.size() < GROUP_RECENT_MESSAGES) {
+        recent.push_back(key);
+    } else {
+        recent_set.erase(recent[recent_next]);
+        recent[recent_next] = key;
+        recent_next = (recent_next + 1) % GROUP_RECENT_MESSAGES;
+    }
+    recent_set.insert(key);
+    return true;
+}
+
+void GroupManager::dump(std::string& out) const
+{
+    char line[64];
+    for (const auto& [port, members] : groups) {
+        snprintf(line, sizeof(line), "group %02x%02x%02x%02x%02x%02x fds",
+                 port[0], port[1], port[2], port[3], port[4], port[5]);
+        out += line;
+        for (int fd : members) {
+            out += " " + std::to_string(fd);
+        }
+        out += "\n";
+    }
+}
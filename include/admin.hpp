@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// Admin channel used by flipctl. Requests and replies are framed with
+// unix_message_header on a separate socket; request arguments and reply
+// bodies are plain text.
+
+constexpr const char* FLIP_ADMIN_SOCKET_PATH = "/tmp/flip.ctl";
+
+enum admin_msg_type : uint32_t {
+    ADMIN_MSG_DUMP_ROUTES     = 1,  // Routing table
+    ADMIN_MSG_DUMP_LOOKUPS    = 2,  // Local ports and pending remote lookups
+    ADMIN_MSG_DUMP_REASSEMBLY = 3,  // In-progress fragment reassemblies
+    ADMIN_MSG_FLUSH           = 4,  // Argument: routes | lookups | reassembly | trans | all
+    ADMIN_MSG_GET             = 5,  // Argument: tunable name, or empty for all
+    ADMIN_MSG_SET             = 6,  // Argument: "name value"
+    ADMIN_MSG_DUMP_TRANS      = 7,  // RPC phase latencies per port and slow transactions
+    ADMIN_MSG_CAPTURE         = 8,  // Argument: "start [key=value ...]" | "stop" | empty for status
+    ADMIN_MSG_DUMP_GROUPS     = 9,  // Process groups with local members
+
+    ADMIN_MSG_OK              = 100,
+    ADMIN_MSG_ERROR           = 101,
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "flip_proto.hpp"
+#include "netdrv.hpp"
+
+// Packet capture of FLIP frames to pcapng files.
+//
+// The packet path copies matching frames into a bounded single-producer
+// byte ring and returns; a background thread writes them out as pcapng
+// Enhanced Packet Blocks and rotates files by size. When the ring is full the
+// frame is dropped and counted instead of blocking the forwarding path. While
+// capture is stopped the only cost on the packet path is one relaxed atomic
+// load.
+//
+// Frames are recorded only on the event loop thread. By default each frame
+// keeps its first 128 bytes, and its timestamp is the clock reading the
+// event loop already takes for each received frame (flip_capture_stamp()),
+// which frames sent in response share; such captures cannot be replayed.
+// mode=replay keeps whole frames and reads the clock for each one, at a
+// higher cost per frame.
+//
+// Capture is controlled at run time through flipctl ("capture start ...").
+
+constexpr const char* FLIP_CAPTURE_PATH = "/tmp/flip.pcapng";
+
+// Largest frame kept whole in replay mode
+constexpr uint32_t CAPTURE_MAX_SNAPLEN = 65535;
+
+// Direction of a captured frame; values match the pcapng epb_flags direction bits
+enum class capture_dir : uint8_t {
+    RX = 1,
+    TX = 2,
+};
+
+struct capture_filter {
+    flip_address_t address{0};   // Source or destination FLIP address; 0 matches any
+    uint8_t type_mask{0};        // Bit (1 << flip_type) per type to keep; 0 matches any
+    flip_network_t network{0};   // Network id; 0 matches any
+};
+
+struct capture_config {
+    std::string path{FLIP_CAPTURE_PATH};
+    capture_filter filter;
+    bool replayable{false};                  // Whole frames and per-frame timestamps, for replay
+    uint32_t snaplen{128};                   // Bytes kept per frame; enough for the Ethernet, FLIP and RPC headers
+    uint64_t max_file_bytes{64ULL << 20};    // Rotate once a file reaches this size
+    uint32_t max_files{4};                   // path, path.1, ... path.(max_files-1)
+    uint32_t ring_bytes{4u << 20};           // Must be a power of two
+};
+
+// Parse "key=value" arguments (file, addr, type, net, mode, snaplen, size,
+// files, ring) on top of the defaults in cfg; returns false and sets error on
+// bad input
+bool capture_config_parse(std::string_view args, capture_config& cfg, std::string& error);
+
+class FrameCapture
+{
+public:
+    FrameCapture() = default;
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Open the first file and start the writer thread
+    bool start(const capture_config& cfg, std::string& error);
+    // Stop capturing; frames already queued are written before this returns
+    void stop();
+
+    bool active() const { return enabled.load(std::memory_order_relaxed); }
+
+    // Timestamp the frames recorded from now on with a clock reading the
+    // caller already has, until the next stamp() or wakeup()
+    void stamp(std::chrono::steady_clock::time_point now);
+    // A new event loop wakeup: the next frame recorded reads the clock itself
+    void wakeup() { stamp_valid = false; }
+
+    // Capture a frame made of an optional header and a body (for frames that
+    // are assembled by the driver, such as TX frames before the Ethernet header
+    // is added). Must only be called while active(), on the event loop thread.
+    void record(flip_network_t network, capture_dir dir, const uint8_t* hdr, size_t hdr_len,
+                const uint8_t* body, size_t body_len);
+
+    // Both counts are kept by the event loop thread and read there
+    uint64_t captured() const { return captured_count; }
+    uint64_t dropped() const { return dropped_count; }
+
+    // Append a human-readable description of the capture state to out
+    void status(std::string& out) const;
+
+private:
+    // Precedes each frame in the ring; records are padded to 8 bytes and never
+    // wrap, a record with dir 0 fills the end of the ring instead
+    struct record_header {
+        uint64_t timestamp_ns;
+        flip_network_t network;
+        uint32_t orig_len;
+        uint32_t size;           // Header, data and padding
+        uint16_t cap_len;
+        capture_dir dir;
+        uint8_t reserved;
+    };
+    static_assert(sizeof(record_header) == 24);
+
+    bool matches(const uint8_t* hdr, size_t hdr_len, const uint8_t* body, size_t body_len,
+                 flip_network_t network) const;
+    bool drain();
+    void run();
+    bool open_file(std::string& error);
+    void rotate();
+    void write_block(const uint8_t* data, size_t len);
+    void write_packet(const record_header& r, const uint8_t* data);
+
+    capture_config config;
+    bool filtered{false};
+    std::unique_ptr<uint8_t[]> ring;
+    size_t ring_mask{0};
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> running{false};
+    std::thread writer;
+
+    // Event loop thread state
+    alignas(64) size_t tail{0};
+    size_t head_seen{0};         // Last head read from the writer; space is rechecked only when this looks full
+    int64_t realtime_offset_ns{0};   // CLOCK_REALTIME minus steady_clock, taken at start()
+    uint64_t stamp_ns{0};
+    bool stamp_valid{false};
+    uint64_t captured_count{0};
+    uint64_t dropped_count{0};
+    alignas(64) std::atomic<size_t> published_tail{0};
+
+    // Writer thread state
+    alignas(64) std::atomic<size_t> head{0};
+    int fd{-1};
+    uint64_t file_bytes{0};
+    std::unordered_map<flip_network_t, uint32_t> interface_ids;  // Network id -> pcapng interface id
+    std::string out_buf;
+};
+
+extern FrameCapture g_frame_capture;
+
+// Give capture the clock reading taken for a received frame, if it is running
+inline void flip_capture_stamp(std::chrono::steady_clock::time_point now)
+{
+    if (g_frame_capture.active()) [[unlikely]] {
+        g_frame_capture.stamp(now);
+    }
+}
+
+// Mark the start of an event loop wakeup, if capture is running
+inline void flip_capture_wakeup()
+{
+    if (g_frame_capture.active()) [[unlikely]] {
+        g_frame_capture.wakeup();
+    }
+}
+
+// Capture a received Ethernet frame if capture is running
+inline void flip_capture_rx(flip_network_t network, const uint8_t* frame, size_t len)
+{
+    if (g_frame_capture.active()) [[unlikely]] {
+        g_frame_capture.record(network, capture_dir::RX, nullptr, 0, frame, len);
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/uio.h>
+
+#include "spsc_queue.hpp"
+#include "unix_server.hpp"
+
+class ShmChannel;
+
+// Unix client I/O on a thread of its own.
+//
+// The I/O thread owns the UnixServer and every client's shared-memory rings:
+// it accepts clients, reads and frames their messages, answers
+// UNIX_MSG_SHM_ATTACH itself and writes replies out. Connects, disconnects
+// and messages are handed to the router thread through one bounded SPSC
+// queue, and replies come back through another, so a burst of client traffic
+// never holds up frame forwarding, nor a burst of frames the client sockets.
+//
+// Each side sleeps in poll() on an eventfd of its own, which the other side
+// only writes while it is asleep. A message that does not fit in a full queue
+// is held back by its sender until the other side makes room; the I/O thread
+// stops reading clients meanwhile, so the clients are the ones to wait.
+//
+// Clients are known by fd on both sides. Every connection also gets a
+// generation number, so a reply for a client that has gone away is never
+// written to a new client that was given the same fd.
+
+// Queue slots in each direction; must be a power of two
+constexpr size_t CLIENT_IO_QUEUE_SIZE = 4096;
+// Most client events the router thread handles before going back to poll()
+constexpr size_t CLIENT_IO_DISPATCH_BATCH = 32;
+
+class ClientIoThread
+{
+public:
+    ClientIoThread(const std::string& path, const std::string& seqpacket_path);
+    ~ClientIoThread();
+
+    ClientIoThread(const ClientIoThread&) = delete;
+    ClientIoThread& operator=(const ClientIoThread&) = delete;
+
+    // Callbacks run on the router thread, from dispatch(). They are the same
+    // as UnixServer's, except that the message payload is a copy.
+    void set_on_message(unix_message_cb cb)       { on_message = std::move(cb); }
+    void set_on_connect(unix_connect_cb cb)        { on_connect = std::move(cb); }
+    void set_on_disconnect(unix_disconnect_cb cb)   { on_disconnect = std::move(cb); }
+
+    // Listen on the Unix socket(s) and start the I/O thread
+    bool start();
+    // Stop the I/O thread and disconnect all clients
+    void stop();
+
+    // Router thread side. Add event_fd() to the poll set, call prepare_wait()
+    // right before poll() and wait no longer than it returns, and call
+    // dispatch() after every poll().
+    int event_fd() const { return router_side.wake_fd; }
+    int prepare_wait();
+    void dispatch();
+
+    // Queue a framed message for a client, through its shared-memory ring if
+    // it has one and the message fits. Returns false if the client is not
+    // connected (as far as the router thread has heard).
+    bool send_to_client(int client_fd, uint32_t type, const struct iovec* parts, size_t count);
+    bool send_to_client(int client_fd, uint32_t type, const uint8_t* payload, size_t len);
+    // Queue a message made of a prefix, which is copied, and len bytes of a
+    // body from offset, which is not: every client sent the same body holds
+    // a reference to the one buffer until its message is written out
+    bool send_to_client(int client_fd, uint32_t type, const uint8_t* prefix, size_t prefix_len,
+                        std::shared_ptr<const std::vector<uint8_t>> body, size_t offset, size_t len);
+    // Shut a client's socket down; its disconnect follows as usual
+    void disconnect(int client_fd);
+
+    // Messages either side had to hold back because a queue was full
+    uint64_t queue_full() const { return queue_full_count.load(std::memory_order_relaxed); }
+
+private:
+    struct item {
+        enum kind_t : uint8_t {
+            CONNECT,      // I/O -> router
+            DISCONNECT,   // I/O -> router
+            MESSAGE,      // Both ways: a framed message from or to a client
+            SHUTDOWN,     // Router -> I/O: shut the client's socket down
+        };
+        kind_t kind{MESSAGE};
+        int fd{-1};
+        uint32_t generation{0};
+        uint32_t type{0};
+        std::vector<uint8_t> payload;
+        // MESSAGE to a client: follows payload, shared with other messages
+        std::shared_ptr<const std::vector<uint8_t>> body{};
+        size_t body_offset{0};
+        size_t body_len{0};
+    };
+
+    // One thread's end: the queue it reads, what it could not yet write to
+    // the other one, and how it is woken
+    struct side {
+        SpscQueue<item> inbox{CLIENT_IO_QUEUE_SIZE};
+        std::deque<item> backlog;
+        int wake_fd{-1};
+        alignas(64) std::atomic<bool> idle{false};      // Asleep; wake on a push to inbox
+        std::atomic<bool> blocked{false};               // Has a backlog; wake on a pop from the other inbox
+    };
+
+    // Queue an item for the other side, or add it to the backlog
+    void post(side& from, side& to, item&& it);
+    // Move as much of the backlog as fits into the other side's inbox
+    void flush_backlog(side& from, side& to);
+    // Wake a side if flag says it is waiting
+    static void wake(side& s, std::atomic<bool>& flag);
+    // Get ready to sleep; returns false if there is work already
+    bool prepare_sleep(side& self, side& other);
+    static void clear_wake(const side& s);
+
+    // I/O thread
+    void run();
+    void handle_router_items();
+    void handle_client_message(int client_fd, uint32_t type, const uint8_t* payload, size_t len);
+    void attach_shm_channel(int client_fd);
+    void send_on_io_thread(const item& it);
+
+    UnixServer server;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> queue_full_count{0};
+
+    side router_side;   // inbox: client events for the router thread
+    side io_side;       // inbox: replies and shutdowns for the I/O thread
+
+    // I/O thread only
+    std::vector<uint32_t> io_generation;   // By fd, of the client connected now
+    uint32_t next_generation{0};
+    std::unordered_map<int, std::unique_ptr<ShmChannel>> shm_channels;
+
+    // Router thread only
+    std::unordered_map<int, uint32_t> connected;  // Client fd -> generation
+    unix_message_cb on_message;
+    unix_connect_cb on_connect;
+    unix_disconnect_cb on_disconnect;
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation for read-mostly structures.
+//
+// Readers wrap every access in an epoch_guard. Entering one stores the
+// global epoch in a slot owned by the calling thread, on a cache line of its
+// own, so readers never write anything another thread writes. A writer that
+// unlinks an object hands it to its RetireList, which frees it only once
+// every thread that was reading at the time has left its guard.
+//
+// There is one domain per process, g_epoch, shared by all such structures.
+
+// Threads that may hold a guard at the same time
+constexpr size_t EPOCH_MAX_READERS = 64;
+
+class EpochDomain
+{
+public:
+    // Start a new epoch; returns the one that ended. A reader that enters in
+    // a later epoch sees every store the caller made before advancing.
+    uint64_t advance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    // Oldest epoch a reader is still in, or UINT64_MAX if none is reading
+    uint64_t oldest_reader() const
+    {
+        uint64_t oldest = UINT64_MAX;
+        for (const auto& s : slots) {
+            uint64_t e = s.active.load(std::memory_order_acquire);
+            if (e != 0 && e < oldest) {
+                oldest = e;
+            }
+        }
+        return oldest;
+    }
+
+    void enter()
+    {
+        reader& r = this_reader();
+        if (r.depth++ == 0) {
+            r.mine->active.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+            // Publish the slot before loading anything the guard protects
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void leave()
+    {
+        reader& r = this_reader();
+        if (--r.depth == 0) {
+            r.mine->active.store(0, std::memory_order_release);
+        }
+    }
+
+private:
+    struct alignas(64) slot {
+        std::atomic<uint64_t> active{0};     // Epoch the owner entered in; 0 while not reading
+        std::atomic<bool> claimed{false};
+    };
+
+    // A thread's slot, claimed on its first guard and given back when it exits
+    struct reader {
+        slot* mine{nullptr};
+        unsigned depth{0};
+        ~reader()
+        {
+            if (mine) {
+                mine->claimed.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    reader& this_reader()
+    {
+        static thread_local reader r;
+        if (!r.mine) [[unlikely]] {
+            for (auto& s : slots) {
+                if (!s.claimed.exchange(true, std::memory_order_acq_rel)) {
+                    r.mine = &s;
+                    return r;
+                }
+            }
+            fprintf(stderr, "epoch: more than %zu reader threads\n", EPOCH_MAX_READERS);
+            std::abort();
+        }
+        return r;
+    }
+
+    slot slots[EPOCH_MAX_READERS];
+    alignas(64) std::atomic<uint64_t> epoch{1};
+};
+
+inline EpochDomain g_epoch;
+
+// Holds off reclamation of anything the calling thread loads until it goes
+// out of scope. Guards nest.
+class epoch_guard
+{
+public:
+    epoch_guard() { g_epoch.enter(); }
+    ~epoch_guard() { g_epoch.leave(); }
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+};
+
+// Objects unlinked by one writer thread, waiting for the readers that might
+// still see them
+class RetireList
+{
+public:
+    RetireList() = default;
+    RetireList(const RetireList&) = delete;
+    RetireList& operator=(const RetireList&) = delete;
+
+    // Frees everything; no reader may still be using any of it
+    ~RetireList()
+    {
+        for (auto& r : items) {
+            r.free(r.ptr);
+        }
+    }
+
+    // Call after the object is no longer reachable from the structure
+    template <typename T>
+    void retire(const T* p)
+    {
+        items.push_back(item{0, const_cast<T*>(p), [](void* q) { delete static_cast<T*>(q); }});
+    }
+
+    // Free what no reader can still see; returns the number freed
+    size_t collect()
+    {
+        if (items.empty()) {
+            return 0;
+        }
+        // Objects retired since the last collect() were unlinked in the epoch
+        // that ends here; only readers already in it or before can hold them
+        uint64_t ended = g_epoch.advance();
+        uint64_t oldest = g_epoch.oldest_reader();
+        size_t kept = 0;
+        for (auto& r : items) {
+            if (r.epoch == 0) {
+                r.epoch = ended;
+            }
+            if (r.epoch < oldest) {
+                r.free(r.ptr);
+            } else {
+                items[kept++] = r;
+            }
+        }
+        size_t freed = items.size() - kept;
+        items.resize(kept);
+        return freed;
+    }
+
+    size_t size() const { return items.size(); }
+
+private:
+    struct item {
+        uint64_t epoch;     // Last epoch a reader could have found it in; 0 until collect()
+        void* ptr;
+        void (*free)(void*);
+    };
+    std::vector<item> items;
+};
@@ -67,6 +67,30 @@ struct rpc_header {
     uint16_t from;
 } __attribute__((packed));
 
+// rpc_header flags
+constexpr uint8_t RPC_FLAG_ACKS      = 0x01;  // REQUEST: an rpc_ack_list precedes the payload
+constexpr uint8_t RPC_FLAG_ACK_LISTS = 0x02;  // Sender understands rpc_ack_lists (set on its replies and ACKs)
+
+// Replies acknowledged in bulk, by tid: the payload of an ACK (beyond the one
+// named in its rpc_header), or piggybacked on a REQUEST flagged RPC_FLAG_ACKS.
+// Followed by count uint32_t tids.
+struct rpc_ack_list {
+    uint32_t count;
+} __attribute__((packed));
+
+// Follows the PROTO_GROUP proto field of a MULTIDATA packet; the message
+// data comes after it. The FLIP src_address is the sending member's address
+// and (src_address, message_id) tells messages apart.
+struct group_header {
+    uint8_t port[6];        // Group the message is for
+    uint8_t type;
+    uint8_t flags;
+} __attribute__((packed));
+
+enum am_group_type {
+    AM_GROUP_DATA = 1,      // Data for every member
+};
+
 enum am_rpc_type {
     AM_RPC_LOCATE = 1,
     AM_RPC_HEREIS = 2,
@@ -0,0 +1,67 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flip_proto.hpp"
+#include "flip_router.hpp"
+#include "netdrv.hpp"
+#include "packet_view.hpp"
+#include "rpc_trans_tracker.hpp"
+
+// Receive side of the FLIP stack: validates Ethernet frames, strips the
+// fragment control header, reassembles fragmented messages and hands complete
+// FLIP packets to the router.
+class flip_receiver
+{
+private:
+    struct ReassemblyKey {
+        flip_address_t src_address;
+        uint32_t message_id;
+        bool operator==(const ReassemblyKey& o) const {
+            return src_address == o.src_address && message_id == o.message_id;
+        }
+    };
+
+    struct ReassemblyKeyHash {
+        size_t operator()(const ReassemblyKey& k) const {
+            return std::hash<uint64_t>()(k.src_address) ^ (std::hash<uint32_t>()(k.message_id) * 2654435761ULL);
+        }
+    };
+
+    struct ReassemblyEntry {
+        hwaddr_t src_mac;
+        flip_network_t incoming_network;
+        std::vector<uint8_t> packet;    // First fragment's FLIP header, then the payload as it arrives
+        uint32_t bytes_received;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    flip_router& router;
+    std::shared_ptr<flip_networks> networks;
+    RpcTransTracker* trans_tracker;
+    std::unordered_map<ReassemblyKey, ReassemblyEntry, ReassemblyKeyHash> reassembly_map;
+
+    // The FLIP part of a frame, whose headers are in byte order Order
+    template <std::endian Order>
+    void recv_fragment(const hwaddr_t& src_mac, const uint8_t* flip_data, size_t flip_len, flip_network_t incoming_network);
+
+public:
+    flip_receiver(flip_router& router, std::shared_ptr<flip_networks> networks, RpcTransTracker* trans_tracker = nullptr);
+
+    // Handle one Ethernet frame received on the given network
+    void recv_packet(const uint8_t* packet, size_t len, flip_network_t incoming_network);
+
+    // Discard incomplete reassemblies older than the reassembly timeout
+    void expire_reassembly();
+
+    // Append a human-readable dump of in-progress reassemblies to out
+    void dump_reassembly(std::string& out) const;
+
+    // Discard all in-progress reassemblies; returns the number discarded
+    size_t flush_reassembly();
+
+    size_t reassembly_count() const { return reassembly_map.size(); }
+};
@@ -1,49 +1,126 @@
 #pragma once
 #include <functional>
-#include <map>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 #include "flip_proto.hpp"
+#include "group_manager.hpp"
 #include "netdrv.hpp"
+#include "packet_view.hpp"
+#include "route_table.hpp"
 #include "rpc_port_manager.hpp"
 
-class flip_route_entry
-{
-public:
-    flip_address_t dst_address;
-    flip_network_t network;
-    hwaddr_t next_hop_mac;
-    uint16_t hopcount;
-    bool trusted;
-    uint16_t age;
-    bool local;
-};
+// Send a FLIP packet (without fc_header), fragmenting across multiple Ethernet frames if needed.
+// Fragments are sized to the MTU of the egress network.
+bool fragment_and_send(std::shared_ptr<NetDrv> driver, const hwaddr_t& dst, uint16_t ethertype,
+                       const uint8_t* packet, size_t len);
+
+// The rpc_headers handed to these callbacks, and taken by send_rpc_control(),
+// are decoded to host byte order whatever order the packet was in.
 
 // Called when a UNIDATA RPC reply is destined for a local address.
-// Parameters: dst flip address, payload after the rpc_header, payload length.
-using local_rpc_reply_cb = std::function<void(flip_address_t dst, const uint8_t* payload, size_t len)>;
+// Parameters: dst flip address, RPC tid of the reply, payload after the rpc_header, payload length.
+using local_rpc_reply_cb = std::function<void(flip_address_t dst, uint32_t tid, const uint8_t* payload, size_t len)>;
+
+// Called when a UNIDATA RPC request is destined for a local address.
+// Parameters: dst (local) and src flip addresses, the request's rpc_header,
+// payload after the rpc_header, payload length.
+using local_rpc_request_cb = std::function<void(flip_address_t dst, flip_address_t src, const rpc_header& rpc_hdr,
+                                                const uint8_t* payload, size_t len)>;
+
+// Called when any other UNIDATA RPC message (ACK, NAK, ENQUIRE, ALIVE,
+// RECEIVED, FAIL) is destined for a local address, with its payload.
+using local_rpc_control_cb = std::function<void(flip_address_t dst, flip_address_t src, const rpc_header& rpc_hdr,
+                                                const uint8_t* payload, size_t len)>;
+
+// Called, once the reply has been delivered, instead of sending the ACK for
+// a UNIDATA RPC reply at once, so it can be delayed and coalesced.
+// Parameters: local (the reply's dst) and peer (its src) addresses, the reply's rpc_header.
+using rpc_ack_cb = std::function<void(flip_address_t local, flip_address_t peer, const rpc_header& reply_hdr)>;
+
+// Called when a group message arrives for a group with local members, once
+// per message however many copies of it arrive.
+// Parameters: sending member's address, the group_header, data after it, data
+// length, and the buffer data lies in when the message was reassembled (null
+// when it arrived in one frame and data points into the receive buffer).
+using local_group_cb = std::function<void(flip_address_t src, const group_header& hdr, const uint8_t* data, size_t len,
+                                          const std::shared_ptr<const std::vector<uint8_t>>& buffer)>;
+
+// Bytes in front of the data of a group message: FLIP header, proto, group_header
+constexpr size_t FLIP_GROUP_HEADERS = sizeof(flip_packet) + sizeof(uint32_t) + sizeof(group_header);
 
 class flip_router
 {
 private:
-    std::map<flip_address_t, std::shared_ptr<flip_route_entry>> routing_table;
+    // Written only by the thread that calls route_packet() and the other
+    // non-const members; see next_hop() for readers on other threads
+    RouteTable routing_table;
     std::shared_ptr<RpcPortManager> rpc_port_mgr;
+    std::shared_ptr<GroupManager> group_mgr;
     std::shared_ptr<flip_networks> networks;
     uint32_t locate_tid{0};
     local_rpc_reply_cb on_local_rpc_reply;
-    std::shared_ptr<flip_route_entry> find_route(flip_address_t dst);
-    void handle_rpc_locate(flip_address_t src_addr, flip_address_t dst_addr, const rpc_header* rpc_hdr, uint16_t actual_hopcount, const uint8_t* payload, size_t payload_len, flip_network_t incoming_network);
-    void handle_rpc_hereis(flip_address_t src_addr, const rpc_header* rpc_hdr);
-    void send_rpc_ack(flip_address_t src, flip_address_t dst, const rpc_header* original_rpc_hdr);
+    local_rpc_request_cb on_local_rpc_request;
+    local_rpc_control_cb on_local_rpc_control;
+    rpc_ack_cb on_rpc_ack;
+    local_group_cb on_local_group;
+    // Inside an epoch_guard
+    const flip_route_entry* find_route(flip_address_t dst) const { return routing_table.find(dst); }
+    void learn_route(flip_address_t src, flip_network_t network, const hwaddr_t& mac, uint16_t hopcount, bool trusted, bool unsafe);
+    // route_packet() for a packet whose headers are in byte order Order; buffer
+    // holds it when it has a buffer of its own, and is null otherwise
+    template <std::endian Order>
+    void route_packet_as(const hwaddr_t& src_mac, const uint8_t* packet, size_t len, flip_network_t incoming_network,
+                         const std::shared_ptr<const std::vector<uint8_t>>& buffer);
+    template <std::endian Order>
+    void handle_rpc_locate(flip_address_t src_addr, const rpc_view<Order>& rpc_hdr);
+    void handle_rpc_hereis(flip_address_t src_addr, const uint8_t* port);
+    // Returns false for a copy of a message seen before, which goes no further
+    bool handle_group_message(flip_address_t src_addr, uint32_t message_id, const uint8_t* body, size_t body_len,
+                              const std::shared_ptr<const std::vector<uint8_t>>& buffer);
     void forward_broadcast(const uint8_t* packet, size_t len, flip_network_t incoming_network);
     void forward_unicast(const uint8_t* packet, size_t len, const hwaddr_t dst_mac, flip_network_t dst_network);
 public:
     flip_router(std::shared_ptr<flip_networks> net);
     ~flip_router();
+    // Route a FLIP packet whose headers are in the byte order its FLIP_FLAG_ENDIAN names
     void route_packet(hwaddr_t src_mac, const uint8_t* packet, size_t len, flip_network_t incoming_network);
+    // route_packet() for a packet in a buffer of its own, such as a reassembled
+    // one; a group message in it is handed to local members in that buffer
+    void route_packet(hwaddr_t src_mac, std::shared_ptr<const std::vector<uint8_t>> packet,
+                      flip_network_t incoming_network);
+    // Called every age interval; also frees replaced routes readers are done with
     void increment_age();
     bool install_local_address(flip_address_t address);
     void remove_local_address(flip_address_t address);
     void send_rpc_locate(flip_address_t src_addr, const rpc_port_t& port);
+    // Broadcast a group message from a local member. The data is in packet
+    // behind FLIP_GROUP_HEADERS bytes, which are filled in here, so the
+    // message is built once and fragmented straight from the caller's
+    // buffer. Returns its message id.
+    uint32_t send_group_message(flip_address_t src, const rpc_port_t& port, std::vector<uint8_t>& packet);
+    // Answer an RPC message with a payload-less one of the given type
+    // (AM_RPC_ACK, AM_RPC_NAK, AM_RPC_ALIVE, ...) carrying its kid, port and tid
+    void send_rpc_control(flip_address_t src, flip_address_t dst, const rpc_header* original_rpc_hdr, am_rpc_type type);
+    // Next hop for a message from src to dst, or nothing if dst has no
+    // route or is local. Takes no locks, so any thread may call it.
+    std::optional<flip_route_path> next_hop(flip_address_t src, flip_address_t dst, uint32_t message_id) const;
+    // Add a route loaded from a snapshot, unless the address has a route
+    // already. It is untrusted, and used like any other until a packet from
+    // the address arrives, whose path then replaces its paths outright.
+    bool install_provisional_route(flip_address_t address, std::vector<flip_route_path> paths);
+    // Visit every route, on the thread that writes the routing table
+    void for_each_route(const std::function<void(const flip_route_entry&)>& fn) const { routing_table.for_each(fn); }
+    // Append a human-readable dump of the routing table to out
+    void dump_routes(std::string& out) const;
+    // Remove all learned (non-local) routes; returns the number removed
+    size_t flush_routes();
     void set_local_rpc_reply_cb(local_rpc_reply_cb cb) { on_local_rpc_reply = std::move(cb); }
-    std::shared_ptr<RpcPortManager> get_rpc_port_manager() { return rpc_port_mgr; }
+    void set_local_rpc_request_cb(local_rpc_request_cb cb) { on_local_rpc_request = std::move(cb); }
+    void set_local_rpc_control_cb(local_rpc_control_cb cb) { on_local_rpc_control = std::move(cb); }
+    void set_rpc_ack_cb(rpc_ack_cb cb) { on_rpc_ack = std::move(cb); }
+    void set_local_group_cb(local_group_cb cb) { on_local_group = std::move(cb); }
+    std::shared_ptr<RpcPortManager> get_rpc_port_manager() const { return rpc_port_mgr; }
+    std::shared_ptr<GroupManager> get_group_manager() const { return group_mgr; }
 };
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "flip_proto.hpp"
+#include "rpc_port_manager.hpp"
+
+// Group messages remembered per host to recognise copies of one arriving
+// over several networks or around a loop
+constexpr size_t GROUP_RECENT_MESSAGES = 1024;
+
+// Process group membership of the local clients.
+//
+// A group is named by a port like an RPC service. Any number of local
+// clients may join one; a group message is taken off the network once per
+// host and handed to each of them. Messages are told apart by sender address
+// and FLIP message id, and the most recent GROUP_RECENT_MESSAGES are kept so
+// that a copy arriving later is dropped instead of delivered and forwarded
+// again.
+class GroupManager
+{
+public:
+    GroupManager();
+
+    // Add a client to a group; returns false if it was a member already
+    bool join(const rpc_port_t& port, int client_fd);
+    // Take a client out of a group; returns false if it was not a member
+    bool leave(const rpc_port_t& port, int client_fd);
+    void remove_client(int client_fd);
+
+    // Local members of a group, in the order they joined; nullptr if there are none
+    const std::vector<int>* members(const rpc_port_t& port) const;
+
+    // Remember a message; returns false if it has been seen already
+    bool first_sighting(flip_address_t src, uint32_t message_id);
+
+    size_t group_count() const { return groups.size(); }
+
+    // Append a human-readable dump of the groups and their members to out
+    void dump(std::string& out) const;
+
+private:
+    struct message_key {
+        flip_address_t src;
+        uint32_t message_id;
+        bool operator==(const message_key&) const = default;
+    };
+    struct message_key_hash {
+        size_t operator()(const message_key& k) const
+        {
+            return std::hash<uint64_t>()(k.src * 0x9e3779b97f4a7c15ULL ^ k.message_id);
+        }
+    };
+
+    std::map<rpc_port_t, std::vector<int>, RpcPortLess> groups;
+    // Recently seen messages: a ring in arrival order, and a set to look them up
+    std::vector<message_key> recent;
+    size_t recent_next{0};
+    std::unordered_set<message_key, message_key_hash> recent_set;
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <random>
+#include <unordered_map>
+
+#include "flip_proto.hpp"
+
+class flip_router;
+
+// Bidirectional index between Unix clients and the FLIP addresses assigned
+// to them. Addresses are installed in and removed from the router's local
+// routes together with the index, so the two never disagree, and both
+// directions are O(1) lookups.
+class LocalClients
+{
+public:
+    explicit LocalClients(flip_router& router);
+
+    // Allocate a random FLIP address for a client and install it as a local
+    // route; returns 0 if no free address could be found
+    flip_address_t attach(int client_fd);
+    // Forget a client and remove its local route; returns its address, or 0
+    flip_address_t detach(int client_fd);
+
+    // Address of a client, or 0 if the fd has none
+    flip_address_t address_of(int client_fd) const
+    {
+        auto it = by_fd.find(client_fd);
+        return it == by_fd.end() ? 0 : it->second;
+    }
+
+    // Client owning a local address, or -1 if the address is not a local client
+    int fd_of(flip_address_t address) const
+    {
+        auto it = by_address.find(address);
+        return it == by_address.end() ? -1 : it->second;
+    }
+
+    size_t size() const { return by_fd.size(); }
+
+private:
+    flip_router& router;
+    std::unordered_map<int, flip_address_t> by_fd;
+    std::unordered_map<flip_address_t, int> by_address;
+    std::mt19937_64 rng{std::random_device{}()};
+};
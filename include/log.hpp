@@ -0,0 +1,186 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <array>
+
+// Leveled, asynchronous logger.
+//
+// Log calls never format or write on the caller's thread: the format string
+// pointer and up to LOG_MAX_ARGS binary-encoded arguments are pushed into a
+// lock-free bounded ring, and a background thread formats and writes them in
+// batches. When the ring is full the record is dropped and counted.
+//
+// Format strings must be string literals and use "{}" for each argument.
+// Levels below FLIP_LOG_COMPILE_LEVEL are removed at compile time; the
+// runtime level can be changed at any time with Logger::set_level().
+
+enum class log_level : uint8_t {
+    TRACE = 0,
+    DEBUG = 1,
+    INFO  = 2,
+    WARN  = 3,
+    ERROR = 4,
+    OFF   = 5,
+};
+
+#ifndef FLIP_LOG_COMPILE_LEVEL
+#define FLIP_LOG_COMPILE_LEVEL 1  // DEBUG and above are compiled in
+#endif
+
+constexpr size_t LOG_MAX_ARGS = 6;
+constexpr size_t LOG_TEXT_SIZE = 64;
+constexpr size_t LOG_RING_SIZE = 4096;  // Must be a power of two
+
+struct log_arg {
+    enum kind_t : uint8_t {
+        INT,    // Signed decimal
+        UINT,   // Unsigned decimal
+        HEX,    // Unsigned hexadecimal
+        STR,    // Pointer to a string with static lifetime
+        TEXT,   // Offset of a string copied into the record
+        ERRNO,  // errno value, printed with strerror()
+        MAC,    // 6-byte hardware address packed into the value
+    };
+    kind_t kind;
+    uint64_t value;
+};
+
+// Argument wrappers for non-default formatting
+inline log_arg log_hex(uint64_t v) { return {log_arg::HEX, v}; }
+inline log_arg log_errno(int e) { return {log_arg::ERRNO, static_cast<uint64_t>(e)}; }
+inline log_arg log_mac(const std::array<uint8_t, 6>& mac)
+{
+    uint64_t v = 0;
+    for (uint8_t b : mac) {
+        v = (v << 8) | b;
+    }
+    return {log_arg::MAC, v};
+}
+
+struct log_record {
+    uint64_t timestamp_ns;
+    const char* fmt;
+    log_level level;
+    uint8_t nargs;
+    uint8_t text_used;
+    log_arg args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+};
+
+class Logger
+{
+public:
+    static Logger& instance();
+
+    // Start/stop the background writer. stop() drains all queued records.
+    void start();
+    void stop();
+
+    void set_level(log_level lvl) { level.store(static_cast<uint8_t>(lvl), std::memory_order_relaxed); }
+    log_level get_level() const { return static_cast<log_level>(level.load(std::memory_order_relaxed)); }
+    bool enabled(log_level lvl) const { return static_cast<uint8_t>(lvl) >= level.load(std::memory_order_relaxed); }
+
+    // Records dropped because the ring was full
+    uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void log(log_level lvl, const char* fmt, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        slot* s = claim();
+        if (!s) {
+            return;
+        }
+        log_record& r = s->record;
+        r.timestamp_ns = now_ns();
+        r.fmt = fmt;
+        r.level = lvl;
+        r.nargs = 0;
+        r.text_used = 0;
+        (encode(r, args), ...);
+        publish(s);
+    }
+
+    static const char* level_name(log_level lvl);
+    static bool parse_level(std::string_view name, log_level& lvl);
+
+private:
+    struct alignas(64) slot {
+        std::atomic<size_t> sequence;
+        log_record record;
+    };
+
+    Logger();
+    ~Logger();
+
+    slot* claim();
+    void publish(slot* s);
+    bool drain();
+    void run();
+    static uint64_t now_ns();
+
+    template <typename T>
+    static void encode(log_record& r, const T& v)
+    {
+        if constexpr (std::is_same_v<T, log_arg>) {
+            r.args[r.nargs++] = v;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            r.args[r.nargs++] = {log_arg::UINT, v ? 1u : 0u};
+        } else if constexpr (std::is_enum_v<T>) {
+            r.args[r.nargs++] = {log_arg::INT, static_cast<uint64_t>(static_cast<int64_t>(v))};
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            r.args[r.nargs++] = {log_arg::INT, static_cast<uint64_t>(static_cast<int64_t>(v))};
+        } else if constexpr (std::is_integral_v<T>) {
+            r.args[r.nargs++] = {log_arg::UINT, static_cast<uint64_t>(v)};
+        } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+            encode_text(r, v.data(), v.size());
+        } else {
+            // String literals and other static strings are stored by pointer
+            static_assert(std::is_convertible_v<T, const char*>, "unsupported log argument type");
+            r.args[r.nargs++] = {log_arg::STR, reinterpret_cast<uint64_t>(static_cast<const char*>(v))};
+        }
+    }
+
+    static void encode_text(log_record& r, const char* s, size_t len)
+    {
+        size_t room = LOG_TEXT_SIZE - r.text_used;
+        if (room == 0) {
+            r.args[r.nargs++] = {log_arg::STR, reinterpret_cast<uint64_t>("")};
+            return;
+        }
+        len = std::min(len, room - 1);
+        std::memcpy(r.text + r.text_used, s, len);
+        r.text[r.text_used + len] = '\0';
+        r.args[r.nargs++] = {log_arg::TEXT, r.text_used};
+        r.text_used = static_cast<uint8_t>(r.text_used + len + 1);
+    }
+
+    std::unique_ptr<slot[]> ring;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) size_t dequeue_pos{0};
+    std::atomic<uint8_t> level{static_cast<uint8_t>(log_level::INFO)};
+    std::atomic<uint64_t> dropped_count{0};
+    std::atomic<bool> running{false};
+    std::thread writer;
+};
+
+#define FLIP_LOG(lvl, ...)                                                        \
+    do {                                                                          \
+        if constexpr (static_cast<int>(lvl) >= FLIP_LOG_COMPILE_LEVEL) {          \
+            if (Logger::instance().enabled(lvl)) {                                \
+                Logger::instance().log(lvl, __VA_ARGS__);                         \
+            }                                                                     \
+        }                                                                         \
+    } while (0)
+
+#define LOG_TRACE(...) FLIP_LOG(log_level::TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) FLIP_LOG(log_level::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  FLIP_LOG(log_level::INFO, __VA_ARGS__)
+#define LOG_WARN(...)  FLIP_LOG(log_level::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) FLIP_LOG(log_level::ERROR, __VA_ARGS__)
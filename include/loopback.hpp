@@ -0,0 +1,69 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "netdrv.hpp"
+
+// In-memory network driver. Frames are kept in fixed-size rings, so sending
+// and receiving never allocate. Transmitted frames go to this driver's TX ring,
+// or straight into the RX ring of a connected peer. get_fd() returns an
+// eventfd that is readable while the RX ring is non-empty, so a Loopback can
+// sit in the same poll set as real drivers.
+class Loopback : public NetDrv
+{
+private:
+    struct frame_ring {
+        std::vector<uint8_t> storage;
+        std::vector<uint32_t> lengths;
+        size_t frame_size;
+        size_t head{0};
+        size_t count{0};
+
+        frame_ring(size_t frames, size_t frame_size);
+        bool push(const void* hdr, size_t hdr_len, const void* buf, size_t len);
+        ssize_t pop(void* buf, size_t len);
+    };
+
+    hwaddr_t mac;
+    size_t mtu;
+    int event_fd{-1};
+    frame_ring rx;
+    frame_ring tx;
+    Loopback* peer{nullptr};
+    uint64_t tx_frames{0};
+    uint64_t tx_drops{0};
+    uint64_t rx_drops{0};
+
+    // Make the eventfd readable; called when the RX ring becomes non-empty
+    void signal_rx();
+
+public:
+    Loopback(hwaddr_t mac, size_t mtu = 1500, size_t ring_frames = 1024);
+    ~Loopback() override;
+
+    Loopback(const Loopback&) = delete;
+    Loopback& operator=(const Loopback&) = delete;
+
+    bool send(hwaddr_t dst, uint16_t proto, const void *buf, size_t len) override;
+    int get_fd() const override;
+    ssize_t recv(void* buf, size_t len) override;
+    hwaddr_t get_mac() const override;
+    size_t get_mtu() const override;
+
+    // Deliver transmitted frames to peer's RX ring instead of our own TX ring
+    void connect(Loopback* other) { peer = other; }
+
+    // Queue a complete Ethernet frame as if it had been received
+    bool inject(const void* frame, size_t len);
+
+    // Remove the oldest transmitted frame; returns its length or -1 if none
+    ssize_t pop_tx(void* buf, size_t len);
+    // Drop all transmitted frames
+    void clear_tx();
+
+    uint64_t get_tx_frames() const { return tx_frames; }
+    uint64_t get_tx_drops() const { return tx_drops; }
+    uint64_t get_rx_drops() const { return rx_drops; }
+    size_t rx_pending() const { return rx.count; }
+    size_t tx_pending() const { return tx.count; }
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <cstdint>
@@ -18,6 +19,10 @@ public:
     virtual int get_fd() const = 0;
     virtual ssize_t recv(void* buf, size_t len) = 0;
     virtual hwaddr_t get_mac() const = 0;
+    // Largest Ethernet payload (excluding the Ethernet header) the network carries
+    virtual size_t get_mtu() const = 0;
+    // Frames the main loop reads per wakeup; only drivers whose recv() never blocks return more than one
+    virtual size_t rx_burst() const { return 1; }
     void set_network_id(flip_network_t id) { network_id = id; }
     flip_network_t get_network_id() const { return network_id; }
 };
@@ -36,4 +41,11 @@ public:
     const std::map<flip_network_t, std::shared_ptr<NetDrv>>& get_networks() const {
         return networks;
     }
+    size_t max_mtu() const {
+        size_t mtu = 0;
+        for (const auto& [id, driver] : networks) {
+            mtu = std::max(mtu, driver->get_mtu());
+        }
+        return mtu;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,225 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "flip_proto.hpp"
+
+// Typed views of the headers in packet memory.
+//
+// A FLIP header, and the Amoeba RPC header behind it, are in the byte order
+// of the host that sent them, which the FLIP_FLAG_ENDIAN flag names. A view
+// reads a header's fields where it lies in a receive buffer; a builder writes
+// them straight into a transmit buffer. Nothing is staged in a struct on the
+// way in or out.
+//
+// Views and builders are templates on the byte order. A packet's order is
+// looked at once, by with_packet_order(), and the code behind it is compiled
+// for that order: each field is a plain load or store, plus a byte swap only
+// in the instantiation for the order this host does not use. Packets this
+// host sends are in its own order, so building them never swaps.
+//
+// Field offsets are those of the packed structs in flip_proto.hpp, which
+// remain the definition of the layouts.
+
+// The flags bit a packet in this host's byte order carries
+constexpr uint8_t FLIP_NATIVE_ENDIAN_FLAG = std::endian::native == std::endian::little ? FLIP_FLAG_ENDIAN : 0;
+
+// Loads and stores of unaligned integers in the given byte order
+template <std::endian Order>
+struct byte_order {
+    template <typename T>
+    static T load(const uint8_t* p)
+    {
+        T v;
+        std::memcpy(&v, p, sizeof(v));
+        if constexpr (Order != std::endian::native && sizeof(T) > 1) {
+            v = std::byteswap(v);
+        }
+        return v;
+    }
+
+    template <typename T>
+    static void store(uint8_t* p, T v)
+    {
+        if constexpr (Order != std::endian::native && sizeof(T) > 1) {
+            v = std::byteswap(v);
+        }
+        std::memcpy(p, &v, sizeof(v));
+    }
+};
+
+// Fields in network order whatever the packet's flag says: the proto word of
+// a MULTIDATA packet and the tids of an rpc_ack_list
+using network_order = byte_order<std::endian::big>;
+
+// A header of type Header at p. Byte is const uint8_t for a view and
+// uint8_t for a builder, which adds the set_ members.
+template <typename Header, std::endian Order, typename Byte>
+class header_ref
+{
+public:
+    static constexpr size_t size = sizeof(Header);
+    static constexpr std::endian order = Order;
+    static constexpr bool writable = !std::is_const_v<Byte>;
+
+    explicit header_ref(Byte* p) : p(p) {}
+
+    Byte* data() const { return p; }
+    // What follows the header
+    Byte* payload() const { return p + size; }
+
+protected:
+    template <typename T, size_t Offset>
+    T get() const { return byte_order<Order>::template load<T>(p + Offset); }
+
+    template <size_t Offset, typename T>
+    void put(T v) const requires writable { byte_order<Order>::store(p + Offset, v); }
+
+    Byte* p;
+};
+
+// Getter and setter of one integer field of Header
+#define PACKET_FIELD(Header, name)                                                                  \
+    decltype(Header::name) name() const                                                             \
+    {                                                                                               \
+        return this->template get<decltype(Header::name), offsetof(Header, name)>();                \
+    }                                                                                               \
+    void set_##name(decltype(Header::name) v) const requires base::writable                         \
+    {                                                                                               \
+        this->template put<offsetof(Header, name)>(v);                                              \
+    }
+
+// Getter and setter of a 6-byte port field of Header
+#define PACKET_PORT_FIELD(Header)                                                                   \
+    const uint8_t* port() const { return this->p + offsetof(Header, port); }                        \
+    void set_port(const uint8_t* port) const requires base::writable                                \
+    {                                                                                               \
+        std::memcpy(this->p + offsetof(Header, port), port, sizeof(Header::port));                  \
+    }
+
+template <std::endian Order, typename Byte>
+class flip_header : public header_ref<flip_packet, Order, Byte>
+{
+    using base = header_ref<flip_packet, Order, Byte>;
+public:
+    using base::base;
+
+    PACKET_FIELD(flip_packet, version)
+    PACKET_FIELD(flip_packet, type)
+    PACKET_FIELD(flip_packet, flags)
+    PACKET_FIELD(flip_packet, reserved)
+    PACKET_FIELD(flip_packet, actual_hopcount)
+    PACKET_FIELD(flip_packet, max_hopcount)
+    PACKET_FIELD(flip_packet, dst_address)
+    PACKET_FIELD(flip_packet, src_address)
+    PACKET_FIELD(flip_packet, message_id)
+    PACKET_FIELD(flip_packet, length)
+    PACKET_FIELD(flip_packet, offset)
+    PACKET_FIELD(flip_packet, total_length)
+};
+
+template <std::endian Order, typename Byte>
+class rpc_header_ref : public header_ref<rpc_header, Order, Byte>
+{
+    using base = header_ref<rpc_header, Order, Byte>;
+public:
+    using base::base;
+
+    PACKET_FIELD(rpc_header, kid)
+    PACKET_PORT_FIELD(rpc_header)
+    PACKET_FIELD(rpc_header, type)
+    PACKET_FIELD(rpc_header, flags)
+    PACKET_FIELD(rpc_header, tid)
+    PACKET_FIELD(rpc_header, dest)
+    PACKET_FIELD(rpc_header, from)
+
+    // The header as a host-order struct, for code that keeps it or hands it on
+    rpc_header decode() const
+    {
+        rpc_header h;
+        h.kid = kid();
+        std::memcpy(h.port, port(), sizeof(h.port));
+        h.type = type();
+        h.flags = flags();
+        h.tid = tid();
+        h.dest = dest();
+        h.from = from();
+        return h;
+    }
+};
+
+// All bytes, so the same in either order
+template <std::endian Order, typename Byte>
+class group_header_ref : public header_ref<group_header, Order, Byte>
+{
+    using base = header_ref<group_header, Order, Byte>;
+public:
+    using base::base;
+
+    PACKET_PORT_FIELD(group_header)
+    PACKET_FIELD(group_header, type)
+    PACKET_FIELD(group_header, flags)
+};
+
+#undef PACKET_FIELD
+#undef PACKET_PORT_FIELD
+
+template <std::endian Order> using flip_view = flip_header<Order, const uint8_t>;
+template <std::endian Order> using flip_builder = flip_header<Order, uint8_t>;
+template <std::endian Order> using rpc_view = rpc_header_ref<Order, const uint8_t>;
+template <std::endian Order> using rpc_builder = rpc_header_ref<Order, uint8_t>;
+template <std::endian Order> using group_view = group_header_ref<Order, const uint8_t>;
+template <std::endian Order> using group_builder = group_header_ref<Order, uint8_t>;
+
+template <std::endian Order> using endian_tag = std::integral_constant<std::endian, Order>;
+
+// Call fn with the endian_tag of the byte order of the FLIP packet at p,
+// so that fn is compiled once for each order
+template <typename Fn>
+decltype(auto) with_packet_order(const uint8_t* p, Fn&& fn)
+{
+    if (p[offsetof(flip_packet, flags)] & FLIP_FLAG_ENDIAN) {
+        return fn(endian_tag<std::endian::little>{});
+    }
+    return fn(endian_tag<std::endian::big>{});
+}
+
+// Write the FLIP header of a packet this host sends, with payload_len bytes
+// after it in one piece, at p
+inline flip_builder<std::endian::native> build_flip_header(uint8_t* p, flip_type type, flip_address_t src,
+                                                           flip_address_t dst, uint32_t message_id,
+                                                           uint32_t payload_len, uint16_t max_hopcount)
+{
+    flip_builder<std::endian::native> fp(p);
+    fp.set_version(1);
+    fp.set_type(static_cast<uint8_t>(type));
+    fp.set_flags(FLIP_NATIVE_ENDIAN_FLAG);
+    fp.set_reserved(0);
+    fp.set_actual_hopcount(0);
+    fp.set_max_hopcount(max_hopcount);
+    fp.set_dst_address(dst);
+    fp.set_src_address(src);
+    fp.set_message_id(message_id);
+    fp.set_length(payload_len);
+    fp.set_offset(0);
+    fp.set_total_length(payload_len);
+    return fp;
+}
+
+// Write the rpc_header of a message this host sends at p
+inline rpc_builder<std::endian::native> build_rpc_header(uint8_t* p, uint64_t kid, const uint8_t* port,
+                                                         am_rpc_type type, uint8_t flags, uint32_t tid,
+                                                         uint16_t dest = 0, uint16_t from = 0)
+{
+    rpc_builder<std::endian::native> rpc(p);
+    rpc.set_kid(kid);
+    rpc.set_port(port);
+    rpc.set_type(static_cast<uint8_t>(type));
+    rpc.set_flags(flags);
+    rpc.set_tid(tid);
+    rpc.set_dest(dest);
+    rpc.set_from(from);
+    return rpc;
+}
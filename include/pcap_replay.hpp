@@ -0,0 +1,102 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "netdrv.hpp"
+
+// How a PcapReplay paces the frames it hands out
+enum class replay_pacing {
+    RECORDED,  // Keep the recorded gaps between frames, divided by speed
+    FAST,      // Every frame is available immediately
+};
+
+struct replay_options {
+    replay_pacing pacing{replay_pacing::RECORDED};
+    double speed{1.0};          // Rate multiplier for RECORDED pacing
+    uint32_t loops{1};          // Times to play the capture; 0 repeats forever
+    bool include_tx{false};     // Also replay frames a pcapng capture marks as outbound
+    int interface{-1};          // Only replay this pcapng interface; -1 for all
+};
+
+// Frames replay hands the main loop per wakeup, so a burst of due frames does
+// not hold off clients and timers for long
+constexpr size_t REPLAY_RX_BURST = 64;
+
+// Parse "speed=N", "fast", "loops=N", "tx" and "if=N" separated by commas
+// on top of the defaults in opts; returns false on bad input
+bool replay_options_parse(std::string_view args, replay_options& opts);
+
+// Network driver that replays FLIP frames from a pcap or pcapng capture as
+// received traffic. Frames are loaded into memory up front, so replay speed
+// is not limited by file I/O. Transmitted frames are counted and discarded.
+//
+// get_fd() returns a timerfd that becomes readable when the next frame is
+// due, so the driver sits in the daemon's poll set like a TAP device. It
+// stays readable while frames are due, so one wakeup takes all of them (up
+// to rx_burst()), and is only rearmed for a frame that is not due yet. When
+// every loop has been played the fd stays idle and finished() returns true.
+class PcapReplay : public NetDrv
+{
+private:
+    struct frame_ref {
+        uint64_t timestamp_ns;
+        size_t offset;
+        uint32_t length;
+    };
+
+    std::string path;
+    replay_options options;
+    hwaddr_t mac;
+    size_t mtu{1500};
+    int timer_fd{-1};
+    std::vector<uint8_t> data;
+    std::vector<frame_ref> frames;
+
+    size_t next{0};
+    uint32_t loops_done{0};
+    std::chrono::steady_clock::time_point loop_start;
+
+    uint64_t rx_frames{0};
+    uint64_t rx_bytes{0};
+    uint64_t tx_frames{0};
+    uint64_t tx_bytes{0};
+    uint64_t skipped{0};
+
+    void load_pcap(const std::vector<uint8_t>& file);
+    void load_pcapng(const std::vector<uint8_t>& file);
+    void add_frame(uint64_t timestamp_ns, const uint8_t* frame, uint32_t cap_len, uint32_t orig_len);
+    // When the frame at next is due, relative to the start of the current loop
+    std::chrono::steady_clock::time_point due_time() const;
+    // Arm the timer for the next frame, or disarm it once replay has finished
+    void arm();
+
+public:
+    PcapReplay(const std::string& path, const replay_options& options = {}, hwaddr_t mac = {0x02, 0, 0, 0, 0xfe, 0x01});
+    ~PcapReplay() override;
+
+    PcapReplay(const PcapReplay&) = delete;
+    PcapReplay& operator=(const PcapReplay&) = delete;
+
+    bool send(hwaddr_t dst, uint16_t proto, const void *buf, size_t len) override;
+    int get_fd() const override;
+    // Copy the next due frame into buf; returns -1 with EAGAIN if none is due yet
+    ssize_t recv(void* buf, size_t len) override;
+    hwaddr_t get_mac() const override;
+    size_t get_mtu() const override;
+    size_t rx_burst() const override { return REPLAY_RX_BURST; }
+
+    // Restart replay from the first frame
+    void rewind();
+    bool finished() const { return frames.empty() || (options.loops && loops_done >= options.loops); }
+
+    const std::string& get_path() const { return path; }
+    size_t frame_count() const { return frames.size(); }
+    uint64_t get_rx_frames() const { return rx_frames; }
+    uint64_t get_rx_bytes() const { return rx_bytes; }
+    uint64_t get_tx_frames() const { return tx_frames; }
+    uint64_t get_tx_bytes() const { return tx_bytes; }
+    // Frames in the file that are not replayed (not FLIP, truncated, outbound or another interface)
+    uint64_t get_skipped() const { return skipped; }
+};
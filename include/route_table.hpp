@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "epoch.hpp"
+#include "flip_proto.hpp"
+#include "netdrv.hpp"
+
+// Maximum number of parallel next hops kept for a single destination
+constexpr size_t FLIP_MAX_ROUTE_PATHS = 4;
+// Paths whose hopcount is within this much of the best path are kept as
+// alternatives (a single hop costs 3, so this only admits equal-cost paths
+// plus small weight differences)
+constexpr uint16_t FLIP_ROUTE_PATH_SLACK = 2;
+// A path that carries no traffic for this many routing table maintenance
+// periods (age_interval_sec) is dropped, and a route left without paths with it
+constexpr uint16_t FLIP_ROUTE_MAX_AGE = 3;
+// Smallest number of hash slots in a RouteTable; must be a power of two
+constexpr size_t ROUTE_TABLE_MIN_SLOTS = 64;
+// Replaced or removed entries a RouteTable keeps before trying to free them
+constexpr size_t ROUTE_TABLE_RETIRE_BATCH = 64;
+
+class flip_route_path
+{
+public:
+    flip_network_t network;
+    hwaddr_t next_hop_mac;
+    uint16_t hopcount;
+    uint16_t age;         // Maintenance periods since traffic was last learned over this path
+};
+
+class flip_route_entry
+{
+public:
+    flip_address_t dst_address;
+    std::vector<flip_route_path> paths;
+    bool trusted;
+    bool local;
+    bool provisional;     // Loaded from a snapshot and not yet confirmed by traffic
+    bool unsafe{false};   // Learned from packets that crossed an untrusted network
+
+    uint16_t best_hopcount() const;
+    // True if learn_path() with these arguments would change the entry, its ages included
+    bool needs_learn(flip_network_t network, const hwaddr_t& mac, uint16_t hopcount) const;
+    // Add or refresh a next hop; returns true if the set of paths changed
+    bool learn_path(flip_network_t network, const hwaddr_t& mac, uint16_t hopcount);
+    // Drop next hops on the given network (and mac, if one matches); returns true if any were removed
+    bool remove_paths(flip_network_t network, const hwaddr_t& mac);
+    // Age every next hop by one maintenance period and drop those reaching
+    // FLIP_ROUTE_MAX_AGE; returns the number dropped
+    size_t age_paths();
+    // Pick a next hop for a message; all fragments of one message map to the same path
+    const flip_route_path& select_path(flip_address_t src, flip_address_t dst, uint32_t message_id) const;
+    // select_path(), but never a path on network avoid; nullptr if every path is on it
+    const flip_route_path* select_path_avoiding(flip_address_t src, flip_address_t dst, uint32_t message_id,
+                                                flip_network_t avoid) const;
+};
+
+// Routing table that any number of threads can read without locks.
+//
+// An open-addressing hash table of pointers to entries. A published entry is
+// never modified: the writer changes a route by publishing a copy in its
+// slot, and removes one by leaving a tombstone. Growing the table builds a
+// new slot array and swaps it in whole. Replaced entries and slot arrays are
+// retired and freed by epoch-based reclamation, so a reader inside an
+// epoch_guard can keep using whatever it found until it leaves the guard.
+//
+// find() only loads. All other members belong to a single writer thread.
+class RouteTable
+{
+public:
+    RouteTable();
+    ~RouteTable();
+
+    RouteTable(const RouteTable&) = delete;
+    RouteTable& operator=(const RouteTable&) = delete;
+
+    // Any thread, inside an epoch_guard; nullptr if there is no route
+    const flip_route_entry* find(flip_address_t address) const;
+
+    // Publish entry, replacing the entry for the same address if there is one
+    void publish(std::unique_ptr<flip_route_entry> entry);
+    // Remove the entry for address; returns false if there was none
+    bool erase(flip_address_t address);
+    // Remove every entry pred returns true for; returns the number removed
+    size_t erase_if(const std::function<bool(const flip_route_entry&)>& pred);
+    // Visit every entry, in no particular order
+    void for_each(const std::function<void(const flip_route_entry&)>& fn) const;
+    size_t size() const { return count; }
+    // Free retired entries that no reader can still be using
+    void reclaim() { retired.collect(); }
+
+private:
+    struct slot_array {
+        size_t mask;
+        std::unique_ptr<std::atomic<const flip_route_entry*>[]> slots;
+        explicit slot_array(size_t n);
+    };
+
+    // Move every entry to a new slot array sized for n entries
+    void rebuild(size_t n);
+    void retire(const flip_route_entry* entry);
+
+    std::atomic<slot_array*> current;   // Loaded by readers
+    size_t count{0};                    // Entries in current
+    size_t tombstones{0};               // Tombstones in current
+    RetireList retired;
+};
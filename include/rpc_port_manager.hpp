@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include "flip_proto.hpp"
 
 using rpc_port_t = std::array<uint8_t, 6>;
 
@@ -17,9 +18,19 @@ struct RpcPortLess {
     }
 };
 
+// One client serving a port. Several clients may bind the same port; each
+// request goes to the one with the fewest requests outstanding.
 struct RpcPortBinding {
     int client_fd{-1};
+    flip_address_t address{0};    // FLIP address of the serving client
     std::string unix_socket;
+    uint32_t outstanding{0};      // Requests handed to the client and not yet answered
+};
+
+// Where a port served on another host was last found
+struct RpcPortLocation {
+    flip_address_t address{0};    // FLIP address that answered the LOCATE
+    bool provisional{false};      // Loaded from a snapshot; not yet confirmed by an answer
 };
 
 class RpcPortManager
@@ -27,25 +38,50 @@ class RpcPortManager
 public:
     using lookup_cb = std::function<void(int client_fd, const rpc_port_t& port, const std::string& remote_socket, bool found)>;
 
-    bool register_local_port(const rpc_port_t& port, int client_fd, std::string unix_socket = {});
+    // Add a client to the bindings of a port; binding the same client twice is a no-op
+    bool register_local_port(const rpc_port_t& port, int client_fd, flip_address_t address, std::string unix_socket = {});
     bool unregister_local_port(const rpc_port_t& port, int client_fd);
     void remove_client(int client_fd);
 
+    // Binding the next request for a port should go to: the one with the
+    // fewest requests outstanding, the longest-standing one on a tie
     std::optional<RpcPortBinding> get_local_binding(const rpc_port_t& port) const;
+    // Keep the outstanding counts that get_local_binding() balances on
+    void request_started(const rpc_port_t& port, int client_fd);
+    void request_finished(const rpc_port_t& port, int client_fd);
 
     void begin_remote_lookup(const rpc_port_t& port, int client_fd, lookup_cb cb);
     void resolve_remote_lookup(const rpc_port_t& port, const std::string& remote_socket, bool found);
     bool has_pending_lookup(const rpc_port_t& port) const;
 
+    // Remote port locations, learned from HEREIS so that later requests for
+    // the port need no LOCATE
+    std::optional<RpcPortLocation> get_remote_location(const rpc_port_t& port) const;
+    void cache_remote_location(const rpc_port_t& port, flip_address_t address, bool provisional = false);
+    // The server at address answered a request for port
+    void confirm_remote_location(const rpc_port_t& port, flip_address_t address);
+    // The server at address stopped answering; returns true if it was the cached location
+    bool forget_remote_location(const rpc_port_t& port, flip_address_t address);
+    const std::map<rpc_port_t, RpcPortLocation, RpcPortLess>& remote_locations() const { return remote_ports; }
+
     size_t local_port_count() const { return local_ports.size(); }
     size_t pending_lookup_count() const;
 
+    // Append a human-readable dump of local ports, remote locations and pending lookups to out
+    void dump(std::string& out) const;
+    // Fail every pending lookup and forget every remote location; returns the
+    // number of requests dropped
+    size_t flush_pending_lookups();
+
 private:
     struct RpcLookupRequest {
         int client_fd{-1};
         lookup_cb callback;
     };
 
-    std::map<rpc_port_t, RpcPortBinding, RpcPortLess> local_ports;
+    RpcPortBinding* find_binding(const rpc_port_t& port, int client_fd);
+
+    std::map<rpc_port_t, std::vector<RpcPortBinding>, RpcPortLess> local_ports;
     std::map<rpc_port_t, std::vector<RpcLookupRequest>, RpcPortLess> pending_lookups;
+    std::map<rpc_port_t, RpcPortLocation, RpcPortLess> remote_ports;
 };
@@ -0,0 +1,141 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "flip_proto.hpp"
+
+// Retransmission and liveness for RPC messages that cross FLIP.
+//
+// A request we send is retransmitted on timeout until the server shows it
+// has it. An ALIVE or RECEIVED (including an ALIVE sent for a duplicate)
+// stops the retransmissions. From then on the server is probed with ENQUIRE
+// every rpc_enquire_ms for as long as it keeps answering. A NAK means the
+// server has lost the request, which is then resent at once. A reply we send
+// for a remote request is kept and resent until the client ACKs it.
+//
+// Timeouts come from a smoothed RTT per destination (RFC 6298), sampled only
+// from exchanges that were not retried (Karn), and double with every retry.
+// After rpc_max_retries unanswered attempts in a row the message is given up.
+//
+// ACKs for replies we receive are held for rpc_ack_delay_us and sent
+// together, one frame per peer, to peers whose replies carry
+// RPC_FLAG_ACK_LISTS. Before then a request to the same peer carries them
+// instead, so a client calling one server in a loop sends no ACK frames.
+
+// Most replies acknowledged by one ACK frame or request
+constexpr size_t RPC_ACK_LIST_MAX = 64;
+
+// Round-trip estimate for one destination
+struct rpc_rtt_estimator {
+    uint32_t srtt_us{0};     // 0 until the first sample
+    uint32_t rttvar_us{0};
+    uint32_t samples{0};
+
+    void sample(uint32_t rtt_us);
+    // Current timeout, within the rpc_rto_min_ms..rpc_rto_max_ms tunables
+    uint32_t rto_us() const;
+};
+
+class RpcRetransmitter
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using packet_ptr = std::shared_ptr<const std::vector<uint8_t>>;
+    // Hand a complete FLIP packet (without fc_header) to the router
+    using send_cb = std::function<void(const uint8_t* packet, size_t len)>;
+    // The peer stopped answering, or never answered a tentative request;
+    // reply is true for a reply we were serving
+    using give_up_cb = std::function<void(uint32_t tid, flip_address_t peer, uint32_t peer_tid, bool reply)>;
+
+    RpcRetransmitter(send_cb send, give_up_cb give_up);
+
+    // Client side. tid is the local transaction, which is also the RPC tid
+    // the request carries; packet is the request as first sent. A tentative
+    // request, to an address that may be stale, is given up at its first
+    // timeout instead of resent, unless the peer has answered by then.
+    void request_sent(uint32_t tid, flip_address_t peer, packet_ptr packet, bool tentative = false);
+    void reply_received(uint32_t tid);
+    void alive_received(uint32_t tid);  // ALIVE or RECEIVED
+    void nak_received(uint32_t tid);
+
+    // Server side. tid is the local transaction the request was served under,
+    // peer_tid the tid the client gave it; packet is the reply.
+    void reply_sent(uint32_t tid, flip_address_t peer, uint32_t peer_tid, packet_ptr packet);
+    // Send a held reply again now, for a duplicate request or an ENQUIRE;
+    // returns false if there is no reply held for the transaction
+    bool resend_reply(uint32_t tid);
+    void ack_received(uint32_t tid);
+
+    // Acknowledge a reply from peer to local, after rpc_ack_delay_us at the latest
+    void ack_reply(flip_address_t local, flip_address_t peer, const rpc_header& reply_hdr);
+    // Take the ACKs a request from local to peer can carry; empty unless the
+    // peer understands ACK lists
+    std::vector<uint32_t> take_acks(flip_address_t local, flip_address_t peer);
+
+    // Stop tracking a transaction without a sample, e.g. its client went away
+    void forget(uint32_t tid);
+    bool holds(uint32_t tid) const { return pending.contains(tid); }
+    size_t pending_count() const { return pending.size(); }
+
+    // Retransmit, probe, give up or acknowledge whatever is due
+    void expire(clock::time_point now);
+    // Earliest time expire() has work to do
+    std::optional<clock::time_point> next_deadline() const;
+
+    // Append per-destination timeouts and messages in flight to out
+    void dump(std::string& out) const;
+
+private:
+    enum class pending_state : uint8_t {
+        REQUEST,   // Request not yet acknowledged by the server; resend it
+        PROBING,   // Server has the request; ENQUIRE while it works on it
+        REPLY,     // Reply not yet ACKed by the client; resend it
+    };
+
+    struct pending_msg {
+        pending_state state{pending_state::REQUEST};
+        flip_address_t peer{0};
+        uint32_t peer_tid{0};
+        packet_ptr packet;
+        uint32_t retries{0};          // Unanswered attempts since the peer was last heard from
+        clock::time_point sent{};     // Last transmission of the packet or an ENQUIRE
+        clock::time_point deadline{};
+        bool tentative{false};        // Give up at the first timeout until the peer answers
+    };
+
+    void schedule(uint32_t tid, pending_msg& msg, clock::time_point deadline);
+    void erase(std::unordered_map<uint32_t, pending_msg>::iterator it);
+    // Feed the estimator if the exchange that just completed was not retried
+    void sample(const pending_msg& msg, clock::time_point now);
+    // Replies from one peer to one local address waiting to be ACKed
+    using ack_key = std::pair<flip_address_t, flip_address_t>;  // (local, peer)
+    struct pending_acks {
+        std::vector<rpc_header> replies;
+        bool lists{false};        // The peer understands rpc_ack_lists
+        clock::time_point deadline{};
+    };
+
+    void send_enquire(const pending_msg& msg);
+    void send_acks(const ack_key& key, pending_acks& acks);
+    clock::duration backoff(const pending_msg& msg) const;
+
+    send_cb send;
+    give_up_cb give_up;
+    std::unordered_map<uint32_t, pending_msg> pending;
+    std::set<std::pair<clock::time_point, uint32_t>> timers;
+    std::unordered_map<flip_address_t, rpc_rtt_estimator> rtt;
+    std::map<ack_key, pending_acks> acks;
+    // ACK deadlines in the order they were set; entries whose ACKs have gone
+    // out early are skipped when they come up
+    std::deque<std::pair<clock::time_point, ack_key>> ack_timers;
+};
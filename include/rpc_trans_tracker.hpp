@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "flip_proto.hpp"
+#include "rpc_port_manager.hpp"
+#include "stats.hpp"
+
+// Per-transaction latency tracing for RPCs issued by local Unix clients.
+//
+// Each transaction is timestamped as it moves through the daemon:
+//   START           UNIX_MSG_TRANS received from the client
+//   SENT            port resolved and UNIDATA request handed to the router
+//   REPLY_FIRST     first frame of the reply received
+//   REPLY_COMPLETE  reply reassembled and handed to the Unix side
+//   DELIVERED       reply queued to the client I/O thread, which writes it
+//                   to the socket or shared-memory ring on its own time
+// and aggregated per destination port into phase histograms:
+//   lookup = SENT - START, wire = REPLY_FIRST - SENT,
+//   reassembly = REPLY_COMPLETE - REPLY_FIRST, delivery = DELIVERED - REPLY_COMPLETE.
+// The delivery phase therefore ends at the handoff; time spent in the SPSC
+// queue and the client write is not included.
+// Transactions slower than the slow_trans_us tunable are kept as samples.
+
+enum rpc_trans_phase : uint8_t {
+    TRANS_START = 0,
+    TRANS_SENT,
+    TRANS_REPLY_FIRST,
+    TRANS_REPLY_COMPLETE,
+    TRANS_DELIVERED,
+    TRANS_PHASE_COUNT,
+};
+
+constexpr size_t RPC_TRANS_SLOW_SAMPLES = 64;
+
+struct rpc_trans_record {
+    int client_fd{-1};
+    flip_address_t client_addr{0};
+    uint32_t tid{0};
+    rpc_port_t port{};
+    uint64_t t_ns[TRANS_PHASE_COUNT]{};
+};
+
+class RpcTransTracker
+{
+public:
+    // Transactions are identified by their RPC tid, which is unique among
+    // those in flight; reply phases also check the client address, so a
+    // stray packet with a matching tid is not mistaken for a reply
+    void begin(int client_fd, flip_address_t client_addr, uint32_t tid, const rpc_port_t& port);
+    void request_sent(uint32_t tid);
+    void reply_started(flip_address_t client_addr, uint32_t tid);
+    void reply_complete(flip_address_t client_addr, uint32_t tid);
+    void reply_delivered(uint32_t tid);
+    void abort(uint32_t tid);
+
+    size_t active_count() const { return active.size(); }
+
+    // Append per-port phase latencies and slow transaction samples to out
+    void dump(std::string& out) const;
+    void reset();
+
+private:
+    struct port_latency {
+        stats_histogram lookup{};
+        stats_histogram wire{};
+        stats_histogram reassembly{};
+        stats_histogram delivery{};
+        stats_histogram total{};
+    };
+
+    void mark(flip_address_t client_addr, uint32_t tid, rpc_trans_phase phase);
+    void finish(const rpc_trans_record& rec);
+
+    std::unordered_map<uint32_t, rpc_trans_record> active;
+    std::map<rpc_port_t, port_latency, RpcPortLess> per_port;
+    std::array<rpc_trans_record, RPC_TRANS_SLOW_SAMPLES> slow{};
+    size_t slow_count{0};
+};
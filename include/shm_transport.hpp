@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+// Optional shared-memory transport between the Amoeba client library and the
+// daemon, for bulk transactions.
+//
+// The client creates a memfd (sealed against shrinking) laid out as a
+// shm_region_header followed by two byte rings, plus two eventfds used as
+// doorbells, and passes all three over its Unix socket with SCM_RIGHTS in a
+// UNIX_MSG_SHM_ATTACH message. From then on it may put requests in the
+// request ring and ring the request doorbell instead of writing them to the
+// socket; the daemon puts replies in the reply ring and rings the reply
+// doorbell. Anything that does not fit still goes over the socket, so the
+// client must be prepared to read replies from either.
+//
+// Each ring holds records of a unix_message_header and its payload, padded
+// to 8 bytes. Records never wrap: when the space left at the end of the ring
+// is too small the producer fills it with a SHM_RECORD_PAD record and starts
+// again at offset 0. head (consumer) and tail (producer) are byte positions
+// that only grow. The client library (amoeba.c) keeps its own copy of this
+// layout.
+
+constexpr uint32_t SHM_TRANSPORT_MAGIC = 0x464c534d;  // "FLSM"
+constexpr uint32_t SHM_TRANSPORT_VERSION = 1;
+constexpr size_t SHM_DATA_OFFSET = 4096;              // Request ring data starts here
+constexpr uint32_t SHM_MIN_RING_SIZE = 64 * 1024;
+constexpr uint32_t SHM_MAX_RING_SIZE = 64 * 1024 * 1024;
+constexpr uint32_t SHM_RECORD_PAD = 0;                // Record type that skips to the end of the ring
+
+struct shm_ring_header {
+    alignas(64) uint64_t head;
+    alignas(64) uint64_t tail;
+};
+
+struct shm_region_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;        // Bytes of data in each ring; a power of two
+    uint32_t reserved;
+    shm_ring_header request;   // Client -> daemon
+    shm_ring_header reply;     // Daemon -> client
+};
+static_assert(sizeof(shm_region_header) <= SHM_DATA_OFFSET);
+
+// Payload of UNIX_MSG_SHM_ATTACH sent back to the client
+struct shm_attach_result {
+    int32_t status;            // 0, or the errno explaining why the region was refused
+} __attribute__((packed));
+
+// Daemon side of one client's shared-memory region
+class ShmChannel
+{
+public:
+    using message_cb = std::function<void(uint32_t type, const uint8_t* payload, size_t len)>;
+
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    // Validate and map a region the client passed us, taking ownership of
+    // the three fds whether or not it succeeds; returns nullptr and sets
+    // status to an errno value if the region is unusable
+    static std::unique_ptr<ShmChannel> attach(int mem_fd, int request_fd, int reply_fd, int& status);
+
+    // Readable when the client has rung the request doorbell
+    int doorbell_fd() const { return request_fd; }
+
+    // Clear the doorbell and hand every queued request to cb. The payload
+    // points into shared memory and is only valid during the call; the client
+    // can still write to it, so anything that must stay consistent has to be
+    // copied out first. Returns false if the client corrupted the ring.
+    bool drain(const message_cb& cb);
+
+    // Put a message in the reply ring and ring the reply doorbell; returns
+    // false if it does not fit right now
+    bool post(uint32_t type, const struct iovec* parts, size_t count);
+
+    uint32_t ring_size() const { return size; }
+
+private:
+    ShmChannel() = default;
+
+    int mem_fd{-1};
+    int request_fd{-1};
+    int reply_fd{-1};
+    uint8_t* base{nullptr};
+    size_t map_len{0};
+    uint32_t size{0};
+    shm_region_header* header{nullptr};
+    uint8_t* request_data{nullptr};
+    uint8_t* reply_data{nullptr};
+};
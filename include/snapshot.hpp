@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "flip_proto.hpp"
+#include "netdrv.hpp"
+
+class flip_router;
+
+// Warm-restart snapshot of what the daemon has learned about other hosts.
+//
+// The daemon writes its learned routes and confirmed remote port locations
+// to a small file every age interval and when it exits. On startup it loads
+// them back as provisional entries, so the first transactions after a
+// restart go straight to UNIDATA instead of each flooding a LOCATE.
+// Provisional routes are replaced by the first packet from their address;
+// a request to a provisional port location that goes unanswered locates the
+// port again.
+//
+// The file is a header followed by fixed-size records in host byte order,
+// written through a memory mapping to a temporary file that is then renamed
+// over the old one, so a reader never sees a partial snapshot.
+//
+// Whoever can write the file chooses where this host sends traffic, so it
+// lives in a directory only the daemon writes to, and a file the daemon does
+// not own, or that others may write, is not loaded. Trust is not part of the
+// snapshot: restored routes are untrusted until a packet proves otherwise.
+
+constexpr const char* FLIP_SNAPSHOT_DIR = "/var/lib/flip";
+constexpr const char* FLIP_SNAPSHOT_PATH = "/var/lib/flip/flip.snapshot";
+constexpr uint32_t FLIP_SNAPSHOT_MAGIC = 0x464c534e;  // "FLSN"
+constexpr uint32_t FLIP_SNAPSHOT_VERSION = 2;
+
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t path_count;
+    uint32_t location_count;
+};
+
+// One next hop of a route; the paths of one route are consecutive
+struct snapshot_path {
+    flip_address_t address;
+    flip_network_t network;
+    uint16_t hopcount;
+    uint8_t next_hop_mac[6];
+    uint8_t reserved[4];
+};
+static_assert(sizeof(snapshot_path) == 24);
+
+struct snapshot_location {
+    flip_address_t address;
+    uint8_t port[6];
+    uint8_t reserved[2];
+};
+static_assert(sizeof(snapshot_location) == 16);
+
+// Write the router's learned routes and its port manager's confirmed remote
+// locations to path, creating FLIP_SNAPSHOT_DIR (mode 0700) if path is in it;
+// returns false (and logs why) on failure
+bool snapshot_save(const std::string& path, const flip_router& router);
+
+// Load a snapshot written by snapshot_save() as provisional routes and
+// locations. Routes over networks that no longer exist are skipped. Returns
+// false if there is no usable snapshot at path, including when it is a
+// symlink, is not owned by the daemon's user or is writable by others.
+bool snapshot_load(const std::string& path, flip_router& router, const flip_networks& networks);
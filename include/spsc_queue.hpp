@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side keeps its own index on a cache line of its own, plus a
+// cached copy of the other side's index, so a push or pop only touches the
+// shared line of the other side when the cached copy says the queue looks
+// full or empty.
+//
+// Items are moved in and out of preallocated slots. The queue never blocks;
+// waking a sleeping consumer is up to the caller.
+template <typename T>
+class SpscQueue
+{
+public:
+    // capacity must be a power of two
+    explicit SpscQueue(size_t capacity)
+        : slots(std::make_unique<T[]>(capacity)), mask(capacity - 1)
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer: returns false, leaving item alone, if the queue is full
+    bool push(T&& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head_cache > mask) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t - head_cache > mask) {
+                return false;
+            }
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: returns false if the queue is empty
+    bool pop(T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail_cache) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h == tail_cache) {
+                return false;
+            }
+        }
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; only a hint while the other side is active
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::unique_ptr<T[]> slots;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};   // Written by the producer
+    size_t head_cache{0};                      // Producer's view of head
+    alignas(64) std::atomic<size_t> head{0};   // Written by the consumer
+    size_t tail_cache{0};                      // Consumer's view of tail
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Daemon statistics.
+//
+// Counters live in a plain process-local struct and are bumped without atomics
+// by the event loop thread. StatsPublisher periodically copies them into a
+// memory-mapped file guarded by a seqlock, so monitoring tools can read a
+// consistent snapshot without talking to the daemon.
+
+constexpr const char* FLIP_STATS_PATH = "/dev/shm/flip_stats";
+constexpr uint32_t FLIP_STATS_MAGIC = 0x464c5354;  // "FLST"
+constexpr uint32_t FLIP_STATS_VERSION = 7;
+
+constexpr size_t STATS_MAX_NETWORKS = 16;   // Indexed by network id; 0 is the local host
+constexpr size_t STATS_FLIP_TYPES = 8;      // Indexed by flip_type; 0 counts unknown types
+constexpr size_t STATS_HIST_BUCKETS = 32;   // Bucket n holds values in [2^(n-1), 2^n)
+
+struct stats_histogram {
+    uint64_t buckets[STATS_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+
+    void record(uint64_t value)
+    {
+        size_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+        if (bucket >= STATS_HIST_BUCKETS) {
+            bucket = STATS_HIST_BUCKETS - 1;
+        }
+        ++buckets[bucket];
+        ++count;
+        sum += value;
+    }
+
+    // Upper bound of the bucket containing the given percentile (0-100)
+    uint64_t percentile(double pct) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(count * pct / 100.0);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < STATS_HIST_BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen > target) {
+                return i == 0 ? 0 : (1ULL << i) - 1;
+            }
+        }
+        return (1ULL << (STATS_HIST_BUCKETS - 1)) - 1;
+    }
+};
+
+struct stats_network {
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    uint64_t rx_drops;
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t tx_drops;
+};
+
+struct flip_stats {
+    stats_network networks[STATS_MAX_NETWORKS];
+    uint64_t flip_type_packets[STATS_FLIP_TYPES];
+
+    uint64_t reassembly_started;
+    uint64_t reassembly_completed;
+    uint64_t reassembly_timeouts;
+    uint64_t reassembly_drops;
+
+    uint64_t routes;
+    uint64_t route_learns;
+    uint64_t route_evictions;
+    uint64_t route_no_path;      // Packets dropped because every path led back to the network they came from
+
+    uint64_t rpc_lookups;
+    uint64_t rpc_cache_hits;     // Resolved locally or joined an in-flight lookup
+    uint64_t rpc_cache_misses;   // Needed a LOCATE on the wire
+    uint64_t rpc_retransmits;    // Requests and replies resent on timeout
+    uint64_t rpc_fast_retransmits;  // Resent at once for a NAK, duplicate request or ENQUIRE
+    uint64_t rpc_enquiries;      // ENQUIREs sent to servers working on a request
+    uint64_t rpc_give_ups;       // Requests failed and replies dropped after rpc_max_retries
+    uint64_t rpc_ack_frames;     // ACK frames sent
+    uint64_t rpc_acks_piggybacked;  // Replies acknowledged on a request instead
+
+    uint64_t group_sent;         // Group messages sent by local members
+    uint64_t group_received;     // Group messages from other hosts, first copy only
+    uint64_t group_duplicates;   // Further copies of group messages, dropped
+    uint64_t group_deliveries;   // Group messages handed to local members
+
+    uint64_t log_dropped;
+    uint64_t capture_frames;     // Frames queued for the pcapng writer
+    uint64_t capture_dropped;    // Frames dropped because the capture ring was full
+    uint64_t unix_queue_full;    // Client messages held back because the queue between threads was full
+
+    stats_histogram message_size;    // Bytes per message handed to the router
+    stats_histogram processing_ns;   // Time to handle one received frame
+
+    stats_network& net(uint32_t id)
+    {
+        return networks[id < STATS_MAX_NETWORKS ? id : 0];
+    }
+
+    void count_flip_type(uint8_t type)
+    {
+        ++flip_type_packets[type < STATS_FLIP_TYPES ? type : 0];
+    }
+};
+
+// Layout of the shared statistics file
+struct flip_stats_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t sequence;          // Odd while the writer is updating the snapshot
+    uint64_t publish_time_ns;   // CLOCK_REALTIME of the last publish
+    flip_stats stats;
+};
+
+// Live counters for this process
+extern flip_stats g_flip_stats;
+
+class StatsPublisher
+{
+private:
+    std::string path;
+    int fd{-1};
+    flip_stats_page* page{nullptr};
+
+public:
+    StatsPublisher(const std::string& path = FLIP_STATS_PATH);
+    ~StatsPublisher();
+
+    StatsPublisher(const StatsPublisher&) = delete;
+    StatsPublisher& operator=(const StatsPublisher&) = delete;
+
+    bool open();
+    void close();
+
+    // Copy the live counters into the shared page
+    void publish(const flip_stats& stats);
+};
+
+// Take a consistent snapshot of a mapped stats page; returns false if the
+// writer kept it busy for too long or the page is not a stats page.
+inline bool flip_stats_read(const flip_stats_page* page, flip_stats& out)
+{
+    if (page->magic != FLIP_STATS_MAGIC || page->version != FLIP_STATS_VERSION) {
+        return false;
+    }
+
+    std::atomic_ref<uint64_t> seq(const_cast<uint64_t&>(page->sequence));
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        uint64_t before = seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        std::memcpy(&out, &page->stats, sizeof(out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -7,11 +7,13 @@ class Tap : public NetDrv
 private:
     int fd;
     hwaddr_t mac;
+    size_t mtu;
 public:
     Tap(const char* dev);
     ~Tap() override;
     bool send(hwaddr_t dst, uint16_t proto, const void *buf, size_t len) override;
     int get_fd() const override;
     hwaddr_t get_mac() const override;
+    size_t get_mtu() const override;
     ssize_t recv(void* buf, size_t len) override;
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// USDT static tracepoints (provider "flip").
+//
+// With <sys/sdt.h> available each probe compiles to a single NOP plus a note
+// describing its arguments, so it costs nothing until a tracer such as
+// bpftrace or perf attaches. Without the header, or with FLIP_NO_USDT
+// defined, probes compile away entirely. Probe arguments must not have side
+// effects.
+//
+//   frame_rx(network, len)
+//   reassembly_start(src, message_id, total_length)
+//   reassembly_complete(src, message_id, total_length)
+//   reassembly_drop(src, message_id, reason)          reason: trace_drop_reason
+//   route_learn(address, network, hopcount)
+//   route_remove(address, network)
+//   route_decision(type, src, dst, decision)          decision: trace_route_decision
+//   fragment_tx(network, message_id, offset, len)
+//   rpc_locate_tx(port, src)
+//   rpc_locate_rx(port, src)
+//   rpc_hereis_tx(port, dst)
+//   rpc_hereis_rx(port, src)
+//   rpc_ack_tx(dst, tid)
+//   rpc_retransmit(dst, tid, type, attempt)          type: am_rpc_type sent
+//   unix_msg_in(fd, type, len)
+//   unix_msg_out(fd, type, len)
+//
+// Ports are passed as the 48-bit big-endian value of the 6 port bytes.
+
+#if !defined(FLIP_NO_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FLIP_TRACE(name, ...) STAP_PROBEV(flip, name, __VA_ARGS__)
+#else
+// Keep the arguments referenced so trace-only values do not trigger unused warnings
+template <typename... T>
+inline void flip_trace_unused(const T&...) {}
+#define FLIP_TRACE(name, ...) do { if (false) { flip_trace_unused(__VA_ARGS__); } } while (0)
+#endif
+
+enum trace_route_decision : uint8_t {
+    TRACE_ROUTE_LOCAL     = 0,  // Delivered to or answered for a local address
+    TRACE_ROUTE_UNICAST   = 1,  // Forwarded to a single next hop
+    TRACE_ROUTE_BROADCAST = 2,  // Forwarded to all other networks
+    TRACE_ROUTE_NO_ROUTE  = 3,  // No route to the destination
+    TRACE_ROUTE_DROP      = 4,  // Dropped (hop limit, loop, unknown type)
+};
+
+enum trace_drop_reason : uint8_t {
+    TRACE_DROP_NO_FIRST_FRAGMENT = 0,
+    TRACE_DROP_BAD_BOUNDS        = 1,
+    TRACE_DROP_TIMEOUT           = 2,
+};
+
+inline uint64_t trace_port(const uint8_t* port)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 6; ++i) {
+        v = (v << 8) | port[i];
+    }
+    return v;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Runtime-adjustable daemon parameters. They are read on the event loop
+// thread and changed there through the admin socket (see flipctl).
+struct flip_tunables {
+    uint16_t max_hopcount{8};             // Hop limit for packets we originate
+    uint32_t age_interval_sec{30};        // Routing table maintenance period
+    uint32_t fragment_delay_us{1000};     // Pacing gap between transmitted fragments
+    uint32_t reassembly_timeout_sec{30};  // Incomplete reassemblies are dropped after this
+    uint32_t slow_trans_us{100000};       // RPC transactions slower than this are sampled
+    uint32_t rpc_rto_initial_ms{500};     // RPC retransmission timeout before a destination's RTT is known
+    uint32_t rpc_rto_min_ms{20};          // Bounds on the RTT-derived retransmission timeout
+    uint32_t rpc_rto_max_ms{8000};
+    uint32_t rpc_max_retries{6};          // Unanswered retransmissions or ENQUIREs before giving up
+    uint32_t rpc_enquire_ms{2000};        // ENQUIRE period while a server works on a request
+    uint32_t rpc_ack_delay_us{2000};      // Longest an ACK waits to be coalesced or piggybacked; 0 sends at once
+};
+
+extern flip_tunables g_flip_tunables;
+
+// Set a tunable by name; returns false on an unknown name, an out-of-range
+// value, or one that would leave rpc_rto_initial_ms outside [rpc_rto_min_ms, rpc_rto_max_ms]
+bool flip_tunable_set(std::string_view name, std::string_view value);
+
+// Read a tunable by name; returns false on an unknown name
+bool flip_tunable_get(std::string_view name, std::string& value);
+
+// "name value" lines for every tunable
+std::string flip_tunables_dump();
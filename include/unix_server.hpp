@@ -4,7 +4,9 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include "flip_proto.hpp"
 
 // Message header sent over the Unix socket
@@ -15,9 +17,54 @@ struct unix_message_header {
 
 // Unix message types
 enum unix_msg_type : uint32_t {
-    UNIX_MSG_TRANS = 3,  // Transmit a FLIP UNIDATA packet
+    UNIX_MSG_TRANS = 3,       // Transmit a FLIP UNIDATA packet
+    UNIX_MSG_REQUEST = 4,     // Daemon -> serving client: unix_request_header, am_header, data
+    UNIX_MSG_REPLY = 5,       // Serving client -> daemon: unix_request_header, am_header, data
+    UNIX_MSG_SHM_ATTACH = 6,  // Client -> daemon: no payload; memfd, request eventfd and reply
+                              // eventfd passed with SCM_RIGHTS (see shm_transport.hpp).
+                              // Daemon -> client: shm_attach_result
+    UNIX_MSG_TRANS_TAGGED = 7,  // Like UNIX_MSG_TRANS with a unix_trans_tag first; the reply
+                                // carries the same tag, so many can be in flight at once
+    UNIX_MSG_REGISTER = 8,    // Client -> daemon: unix_port_request; serve requests for the port.
+                              // Daemon -> client: unix_port_result
+    UNIX_MSG_UNREGISTER = 9,  // Client -> daemon: unix_port_request; stop serving the port.
+                              // Daemon -> client: unix_port_result
+    UNIX_MSG_GROUP_JOIN = 10,     // Client -> daemon: unix_port_request; join the group.
+                                  // Daemon -> client: unix_port_result
+    UNIX_MSG_GROUP_LEAVE = 11,    // Client -> daemon: unix_port_request; leave the group.
+                                  // Daemon -> client: unix_port_result
+    UNIX_MSG_GROUP_SEND = 12,     // Client -> daemon: unix_port_request, data; send to every
+                                  // member of the group, the sender too if it is one
+    UNIX_MSG_GROUP_MESSAGE = 13,  // Daemon -> member: unix_group_message, data
 };
 
+// Prefix of UNIX_MSG_TRANS_TAGGED requests and replies
+struct unix_trans_tag {
+    uint32_t tag;           // Chosen by the client
+} __attribute__((packed));
+
+// Payload of UNIX_MSG_REGISTER and UNIX_MSG_UNREGISTER requests
+struct unix_port_request {
+    uint8_t port[6];
+} __attribute__((packed));
+
+// Payload of the daemon's answer to UNIX_MSG_REGISTER and UNIX_MSG_UNREGISTER
+struct unix_port_result {
+    int32_t status;         // 0, or an errno value
+} __attribute__((packed));
+
+// Prefix of a group message handed to a member
+struct unix_group_message {
+    flip_address_t sender;  // FLIP address of the sending member, local or remote
+    uint8_t port[6];        // Group the message was sent to
+} __attribute__((packed));
+
+// Prefix of requests handed to a serving client, echoed back in its reply
+struct unix_request_header {
+    flip_address_t client;  // FLIP address of the requesting client, local or remote
+    uint32_t tid;           // Transaction id assigned by the daemon
+} __attribute__((packed));
+
 struct port {
     uint8_t port_id[6];
 };
@@ -38,11 +85,61 @@ struct am_header {
     uint16_t extra;
 } __attribute__((packed));
 
+// Receive ring size per client; must be a power of two
+constexpr size_t UNIX_RECV_RING_SIZE = 64 * 1024;
+// Payloads at least this large skip the ring and are read straight into a buffer of their own
+constexpr size_t UNIX_LARGE_MESSAGE = 16 * 1024;
+
+// Largest payload accepted from a stream client. The header's length is
+// checked against it before a large message buffer is sized, so a client
+// cannot make the daemon allocate whatever a 32-bit length asks for.
+constexpr size_t UNIX_STREAM_MAX_MESSAGE = 16 * 1024 * 1024;
+
+// Descriptors a client may have passed with SCM_RIGHTS and not yet had claimed
+constexpr size_t UNIX_MAX_PASSED_FDS = 4;
+
+// Output queued for a client beyond which the server stops reading its requests
+constexpr size_t UNIX_OUTPUT_LIMIT = 1024 * 1024;
+
+// Largest message (header included) accepted from a SOCK_SEQPACKET client.
+// Must stay below the kernel's socket buffer size, which bounds what a
+// client can send in one datagram anyway.
+constexpr size_t UNIX_SEQPACKET_MAX_MESSAGE = 128 * 1024;
+
 // Per-client state
 struct unix_client {
     int fd;
-    // Partial read buffer for reassembling framed messages
-    std::vector<uint8_t> recv_buf;
+    size_t index;                 // Position in UnixServer::client_fds
+    // Connected through the SOCK_SEQPACKET listener: every datagram is one
+    // framed message, so none of the ring or large message state is used
+    bool seqpacket{false};
+
+    // Framed messages are parsed in place from a ring buffer. head and tail
+    // only ever grow; their difference is the number of buffered bytes.
+    std::unique_ptr<uint8_t[]> ring;
+    size_t head{0};
+    size_t tail{0};
+    // Copy of a message whose bytes wrap around the end of the ring
+    std::vector<uint8_t> scratch;
+
+    // Large message being read directly into its own buffer
+    bool in_large{false};
+    unix_message_header large_hdr{};
+    std::vector<uint8_t> large;
+    size_t large_filled{0};
+
+    // Descriptors received with SCM_RIGHTS and not yet claimed
+    std::vector<int> received_fds;
+
+    // Output the socket has not accepted yet; bytes from out_off on are pending.
+    // For a SOCK_SEQPACKET client these are whole framed messages, each sent
+    // as one datagram.
+    std::vector<uint8_t> out_buf;
+    size_t out_off{0};
+    bool write_failed{false};
+
+    size_t queued() const { return out_buf.size() - out_off; }
+    bool over_limit() const { return queued() > UNIX_OUTPUT_LIMIT; }
 };
 
 // Callback invoked when a complete message is received from a client.
@@ -60,24 +157,48 @@ class UnixServer
 private:
     int listen_fd{-1};
     std::string socket_path;
-    std::vector<unix_client> clients;
+    // Optional SOCK_SEQPACKET listener, and the buffer its datagrams are read into
+    int seqpacket_fd{-1};
+    std::string seqpacket_path;
+    std::vector<uint8_t> datagram;
+    // Clients indexed by fd, plus a dense list of connected fds for iteration
+    std::vector<std::unique_ptr<unix_client>> clients;
+    std::vector<int> client_fds;
 
     unix_message_cb on_message;
     unix_connect_cb on_connect;
     unix_disconnect_cb on_disconnect;
 
-    // Process any complete framed messages in a client's recv buffer
+    unix_client* find_client(int fd) const
+    {
+        return fd >= 0 && static_cast<size_t>(fd) < clients.size() ? clients[fd].get() : nullptr;
+    }
+    int open_listener(const std::string& path, int type);
+    void add_client(int listen, bool seqpacket);
+    void remove_client(int fd);
+    // Read into the ring or the large message buffer; returns false if the client went away
+    bool read_client(unix_client& client);
+    // Hold on to descriptors received with SCM_RIGHTS until the message handler takes them
+    void keep_passed_fds(unix_client& client, struct msghdr& msg);
+    // Process any complete framed messages buffered for a client
     void process_client_buffer(unix_client& client);
+    // Receive and deliver datagrams from a SOCK_SEQPACKET client; returns
+    // false if the client went away
+    bool read_datagrams(unix_client& client);
+    // Write queued output until the socket would block; returns false on a socket error
+    bool flush_client(unix_client& client);
 
 public:
-    UnixServer(const std::string& path);
+    // A non-empty seqpacket_path adds a SOCK_SEQPACKET listener next to the
+    // stream one; clients of both share the callbacks and fd space
+    UnixServer(const std::string& path, const std::string& seqpacket_path = {});
     ~UnixServer();
 
     // No copy
     UnixServer(const UnixServer&) = delete;
     UnixServer& operator=(const UnixServer&) = delete;
 
-    // Start listening on the Unix socket
+    // Start listening on the Unix socket(s)
     bool start();
 
     // Stop the server and disconnect all clients
@@ -90,23 +211,51 @@ public:
 
     // Return the listening socket fd (for adding to poll set)
     int get_listen_fd() const { return listen_fd; }
+    // Return the SOCK_SEQPACKET listening socket fd, or -1 if there is none
+    int get_seqpacket_listen_fd() const { return seqpacket_fd; }
 
     // Return fds of all connected clients (for adding to poll set)
-    std::vector<int> get_client_fds() const;
+    const std::vector<int>& get_client_fds() const { return client_fds; }
 
     // Call when poll indicates the listen fd is readable — accepts a new client
     void accept_client();
+    // Same, for the SOCK_SEQPACKET listen fd
+    void accept_seqpacket_client();
 
     // Call when poll indicates a client fd is readable — reads data and
     // invokes the message callback for each complete message
     void handle_client_data(int client_fd);
 
-    // Send a framed message to a specific client
+    // poll() events to wait for on a client fd: POLLIN unless the client is
+    // over its output limit, plus POLLOUT while output is queued
+    short client_events(int client_fd) const;
+
+    // Call when poll indicates a client fd is writable (or hung up) — flushes
+    // queued output and resumes reading once the client is below its limit
+    void handle_client_writable(int client_fd);
+
+    // Send a framed message to a specific client. Whatever the socket does not
+    // accept right away is queued and flushed from handle_client_writable().
+    // Returns false if the client is unknown or its socket has failed.
     bool send_to_client(int client_fd, uint32_t type, const uint8_t* payload, size_t len);
+    // Same, with the payload gathered from several parts
+    bool send_to_client(int client_fd, uint32_t type, const struct iovec* parts, size_t count);
+
+    // Take the descriptors a client has passed with SCM_RIGHTS so far. They
+    // arrive with the bytes of the message they were sent with, so they are
+    // available by the time that message is delivered.
+    std::vector<int> take_client_fds(int client_fd);
+
+    // Output bytes queued for a client
+    size_t queued_bytes(int client_fd) const
+    {
+        const unix_client* client = find_client(client_fd);
+        return client ? client->queued() : 0;
+    }
 
     // Broadcast a framed message to all connected clients
     void broadcast(uint32_t type, const uint8_t* payload, size_t len);
 
     // Number of connected clients
-    size_t client_count() const { return clients.size(); }
+    size_t client_count() const { return client_fds.size(); }
 };
@@ -0,0 +1,218 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+
+#include "log.hpp"
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : ring(new slot[LOG_RING_SIZE])
+{
+    static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+Logger::~Logger()
+{
+    stop();
+}
+
+uint64_t Logger::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Bounded multi-producer ring (one sequence number per slot); the writer thread
+// is the only consumer.
+Logger::slot* Logger::claim()
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        slot* s = &ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = s->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return s;
+            }
+        } else if (diff < 0) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::publish(slot* s)
+{
+    size_t pos = s->sequence.load(std::memory_order_relaxed);
+    s->sequence.store(pos + 1, std::memory_order_release);
+}
+
+const char* Logger::level_name(log_level lvl)
+{
+    switch (lvl) {
+        case log_level::TRACE: return "trace";
+        case log_level::DEBUG: return "debug";
+        case log_level::INFO:  return "info";
+        case log_level::WARN:  return "warn";
+        case log_level::ERROR: return "error";
+        case log_level::OFF:   return "off";
+    }
+    return "unknown";
+}
+
+bool Logger::parse_level(std::string_view name, log_level& lvl)
+{
+    for (uint8_t i = 0; i <= static_cast<uint8_t>(log_level::OFF); ++i) {
+        if (name == level_name(static_cast<log_level>(i))) {
+            lvl = static_cast<log_level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void format_record(std::string& out, const log_record& r)
+{
+    char prefix[64];
+    time_t secs = static_cast<time_t>(r.timestamp_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    size_t n = strftime(prefix, sizeof(prefix), "%H:%M:%S", &tm);
+    snprintf(prefix + n, sizeof(prefix) - n, ".%06llu %-5s ",
+             static_cast<unsigned long long>((r.timestamp_ns % 1000000000ULL) / 1000),
+             Logger::level_name(r.level));
+    out += prefix;
+
+    uint8_t next = 0;
+    for (const char* p = r.fmt; *p; ++p) {
+        if (p[0] != '{' || p[1] != '}' || next >= r.nargs) {
+            out += *p;
+            continue;
+        }
+        ++p;
+
+        const log_arg& a = r.args[next++];
+        char num[32];
+        switch (a.kind) {
+            case log_arg::INT:
+                snprintf(num, sizeof(num), "%lld", static_cast<long long>(a.value));
+                out += num;
+                break;
+            case log_arg::UINT:
+                snprintf(num, sizeof(num), "%llu", static_cast<unsigned long long>(a.value));
+                out += num;
+                break;
+            case log_arg::HEX:
+                snprintf(num, sizeof(num), "0x%llx", static_cast<unsigned long long>(a.value));
+                out += num;
+                break;
+            case log_arg::STR:
+                out += reinterpret_cast<const char*>(a.value);
+                break;
+            case log_arg::TEXT:
+                out += r.text + a.value;
+                break;
+            case log_arg::ERRNO:
+                out += strerror(static_cast<int>(a.value));
+                break;
+            case log_arg::MAC:
+                snprintf(num, sizeof(num), "%02x:%02x:%02x:%02x:%02x:%02x",
+                         static_cast<unsigned>((a.value >> 40) & 0xff), static_cast<unsigned>((a.value >> 32) & 0xff),
+                         static_cast<unsigned>((a.value >> 24) & 0xff), static_cast<unsigned>((a.value >> 16) & 0xff),
+                         static_cast<unsigned>((a.value >> 8) & 0xff), static_cast<unsigned>(a.value & 0xff));
+                out += num;
+                break;
+        }
+    }
+    out += '\n';
+}
+
+static void write_all(int fd, const std::string& s)
+{
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t n = ::write(fd, s.data() + off, s.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        off += n;
+    }
+}
+
+// Format and write everything currently queued; returns false if the ring was empty.
+bool Logger::drain()
+{
+    static std::string out_buf;
+    static std::string err_buf;
+    out_buf.clear();
+    err_buf.clear();
+
+    bool any = false;
+    for (;;) {
+        slot* s = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+        size_t seq = s->sequence.load(std::memory_order_acquire);
+        if (seq != dequeue_pos + 1) {
+            break;
+        }
+        format_record(s->record.level >= log_level::WARN ? err_buf : out_buf, s->record);
+        s->sequence.store(dequeue_pos + LOG_RING_SIZE, std::memory_order_release);
+        ++dequeue_pos;
+        any = true;
+    }
+
+    static uint64_t reported_drops = 0;
+    uint64_t drops = dropped();
+    if (drops != reported_drops) {
+        err_buf += "logger: dropped " + std::to_string(drops - reported_drops) + " records\n";
+        reported_drops = drops;
+    }
+
+    write_all(STDOUT_FILENO, out_buf);
+    write_all(STDERR_FILENO, err_buf);
+    return any;
+}
+
+void Logger::run()
+{
+    while (running.load(std::memory_order_acquire)) {
+        if (!drain()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    drain();
+}
+
+void Logger::start()
+{
+    if (running.exchange(true)) {
+        return;
+    }
+    writer = std::thread([this] { run(); });
+}
+
+void Logger::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
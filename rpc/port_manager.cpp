@@ -1,15 +1,15 @@
 #include <algorithm>
+#include <cstdio>
 
 #include "rpc_port_manager.hpp"
 
-bool RpcPortManager::register_local_port(const rpc_port_t& port, int client_fd, std::string unix_socket)
+bool RpcPortManager::register_local_port(const rpc_port_t& port, int client_fd, flip_address_t address, std::string unix_socket)
 {
-    auto it = local_ports.find(port);
-    if (it != local_ports.end()) {
-        return it->second.client_fd == client_fd;
+    if (find_binding(port, client_fd)) {
+        return true;
     }
 
-    local_ports.emplace(port, RpcPortBinding{client_fd, std::move(unix_socket)});
+    local_ports[port].push_back(RpcPortBinding{client_fd, address, std::move(unix_socket), 0});
     return true;
 }
 
@@ -20,18 +20,30 @@ bool RpcPortManager::unregister_local_port(const rpc_port_t& port, int client_fd
         return false;
     }
 
-    if (it->second.client_fd != client_fd) {
+    auto& bindings = it->second;
+    auto binding = std::find_if(bindings.begin(), bindings.end(),
+        [client_fd](const RpcPortBinding& b) { return b.client_fd == client_fd; });
+    if (binding == bindings.end()) {
         return false;
     }
 
-    local_ports.erase(it);
+    bindings.erase(binding);
+    if (bindings.empty()) {
+        local_ports.erase(it);
+    }
     return true;
 }
 
 void RpcPortManager::remove_client(int client_fd)
 {
     for (auto it = local_ports.begin(); it != local_ports.end(); ) {
-        if (it->second.client_fd == client_fd) {
+        auto& bindings = it->second;
+        bindings.erase(
+            std::remove_if(bindings.begin(), bindings.end(),
+                [client_fd](const RpcPortBinding& b) { return b.client_fd == client_fd; }),
+            bindings.end());
+
+        if (bindings.empty()) {
             it = local_ports.erase(it);
         } else {
             ++it;
@@ -60,7 +72,40 @@ std::optional<RpcPortBinding> RpcPortManager::get_local_binding(const rpc_port_t
         return std::nullopt;
     }
 
-    return it->second;
+    // Bindings are few per port, so a scan beats keeping them ordered by load
+    const auto& bindings = it->second;
+    auto best = std::min_element(bindings.begin(), bindings.end(),
+        [](const RpcPortBinding& a, const RpcPortBinding& b) { return a.outstanding < b.outstanding; });
+    return *best;
+}
+
+RpcPortBinding* RpcPortManager::find_binding(const rpc_port_t& port, int client_fd)
+{
+    auto it = local_ports.find(port);
+    if (it == local_ports.end()) {
+        return nullptr;
+    }
+    for (auto& binding : it->second) {
+        if (binding.client_fd == client_fd) {
+            return &binding;
+        }
+    }
+    return nullptr;
+}
+
+void RpcPortManager::request_started(const rpc_port_t& port, int client_fd)
+{
+    if (RpcPortBinding* binding = find_binding(port, client_fd)) {
+        ++binding->outstanding;
+    }
+}
+
+void RpcPortManager::request_finished(const rpc_port_t& port, int client_fd)
+{
+    RpcPortBinding* binding = find_binding(port, client_fd);
+    if (binding && binding->outstanding > 0) {
+        --binding->outstanding;
+    }
 }
 
 void RpcPortManager::begin_remote_lookup(const rpc_port_t& port, int client_fd, lookup_cb cb)
@@ -91,6 +136,41 @@ bool RpcPortManager::has_pending_lookup(const rpc_port_t& port) const
     return it != pending_lookups.end() && !it->second.empty();
 }
 
+std::optional<RpcPortLocation> RpcPortManager::get_remote_location(const rpc_port_t& port) const
+{
+    auto it = remote_ports.find(port);
+    if (it == remote_ports.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void RpcPortManager::cache_remote_location(const rpc_port_t& port, flip_address_t address, bool provisional)
+{
+    if (provisional && remote_ports.contains(port)) {
+        return;
+    }
+    remote_ports[port] = RpcPortLocation{address, provisional};
+}
+
+void RpcPortManager::confirm_remote_location(const rpc_port_t& port, flip_address_t address)
+{
+    auto it = remote_ports.find(port);
+    if (it != remote_ports.end() && it->second.address == address) {
+        it->second.provisional = false;
+    }
+}
+
+bool RpcPortManager::forget_remote_location(const rpc_port_t& port, flip_address_t address)
+{
+    auto it = remote_ports.find(port);
+    if (it == remote_ports.end() || it->second.address != address) {
+        return false;
+    }
+    remote_ports.erase(it);
+    return true;
+}
+
 size_t RpcPortManager::pending_lookup_count() const
 {
     size_t total = 0;
@@ -99,3 +179,48 @@ size_t RpcPortManager::pending_lookup_count() const
     }
     return total;
 }
+
+static std::string port_to_string(const rpc_port_t& port)
+{
+    char buf[13];
+    snprintf(buf, sizeof(buf), "%02x%02x%02x%02x%02x%02x", port[0], port[1], port[2], port[3], port[4], port[5]);
+    return buf;
+}
+
+void RpcPortManager::dump(std::string& out) const
+{
+    for (const auto& [port, bindings] : local_ports) {
+        for (const auto& binding : bindings) {
+            out += "local " + port_to_string(port) + " fd " + std::to_string(binding.client_fd) +
+                   " outstanding " + std::to_string(binding.outstanding) + "\n";
+        }
+    }
+    for (const auto& [port, location] : remote_ports) {
+        char addr[17];
+        snprintf(addr, sizeof(addr), "%016llx", static_cast<unsigned long long>(location.address));
+        out += "remote " + port_to_string(port) + " at " + addr + (location.provisional ? " provisional\n" : "\n");
+    }
+    for (const auto& [port, requests] : pending_lookups) {
+        out += "pending " + port_to_string(port) + " fds";
+        for (const auto& req : requests) {
+            out += " " + std::to_string(req.client_fd);
+        }
+        out += "\n";
+    }
+}
+
+size_t RpcPortManager::flush_pending_lookups()
+{
+    size_t total = pending_lookup_count();
+    remote_ports.clear();
+    auto lookups = std::move(pending_lookups);
+    pending_lookups.clear();
+    for (auto& [port, requests] : lookups) {
+        for (auto& req : requests) {
+            if (req.callback) {
+                req.callback(req.client_fd, port, std::string{}, false);
+            }
+        }
+    }
+    return total;
+}
@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "rpc_retransmit.hpp"
+#include "packet_view.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "tunables.hpp"
+
+void rpc_rtt_estimator::sample(uint32_t rtt_us)
+{
+    // RFC 6298: alpha = 1/8, beta = 1/4
+    if (samples++ == 0) {
+        srtt_us = rtt_us;
+        rttvar_us = rtt_us / 2;
+        return;
+    }
+    uint32_t delta = srtt_us > rtt_us ? srtt_us - rtt_us : rtt_us - srtt_us;
+    rttvar_us = rttvar_us - rttvar_us / 4 + delta / 4;
+    srtt_us = srtt_us - srtt_us / 8 + rtt_us / 8;
+}
+
+uint32_t rpc_rtt_estimator::rto_us() const
+{
+    uint64_t rto = samples ? srtt_us + std::max<uint64_t>(1000, 4ull * rttvar_us)
+                           : g_flip_tunables.rpc_rto_initial_ms * 1000ull;
+    rto = std::clamp<uint64_t>(rto, g_flip_tunables.rpc_rto_min_ms * 1000ull, g_flip_tunables.rpc_rto_max_ms * 1000ull);
+    return static_cast<uint32_t>(rto);
+}
+
+RpcRetransmitter::RpcRetransmitter(send_cb send, give_up_cb give_up)
+    : send(std::move(send)), give_up(std::move(give_up))
+{
+}
+
+RpcRetransmitter::clock::duration RpcRetransmitter::backoff(const pending_msg& msg) const
+{
+    auto it = rtt.find(msg.peer);
+    uint64_t rto = it != rtt.end() ? it->second.rto_us() : rpc_rtt_estimator{}.rto_us();
+    // A PROBING message counts the ENQUIRE it is waiting on as its first attempt
+    uint32_t shift = msg.state == pending_state::PROBING && msg.retries ? msg.retries - 1 : msg.retries;
+    rto = std::min<uint64_t>(rto << std::min<uint32_t>(shift, 16), g_flip_tunables.rpc_rto_max_ms * 1000ull);
+    return std::chrono::microseconds(rto);
+}
+
+void RpcRetransmitter::schedule(uint32_t tid, pending_msg& msg, clock::time_point deadline)
+{
+    timers.erase({msg.deadline, tid});
+    msg.deadline = deadline;
+    timers.emplace(deadline, tid);
+}
+
+void RpcRetransmitter::erase(std::unordered_map<uint32_t, pending_msg>::iterator it)
+{
+    timers.erase({it->second.deadline, it->first});
+    pending.erase(it);
+}
+
+void RpcRetransmitter::sample(const pending_msg& msg, clock::time_point now)
+{
+    // Only while exactly one transmission is outstanding is it clear which
+    // one is being answered
+    uint32_t outstanding = msg.state == pending_state::PROBING ? msg.retries : msg.retries + 1;
+    if (outstanding != 1) {
+        return;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - msg.sent).count();
+    rtt[msg.peer].sample(static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX)));
+}
+
+void RpcRetransmitter::request_sent(uint32_t tid, flip_address_t peer, packet_ptr packet, bool tentative)
+{
+    auto now = clock::now();
+    pending_msg& msg = pending[tid];
+    timers.erase({msg.deadline, tid});
+    msg = pending_msg{pending_state::REQUEST, peer, tid, std::move(packet), 0, now, {}, tentative};
+    schedule(tid, msg, now + backoff(msg));
+}
+
+void RpcRetransmitter::reply_received(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it == pending.end() || it->second.state == pending_state::REPLY) {
+        return;
+    }
+    // The reply answers the request itself, not an ENQUIRE
+    if (it->second.state == pending_state::REQUEST) {
+        sample(it->second, clock::now());
+    }
+    erase(it);
+}
+
+void RpcRetransmitter::alive_received(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it == pending.end() || it->second.state == pending_state::REPLY) {
+        return;
+    }
+    auto now = clock::now();
+    pending_msg& msg = it->second;
+    sample(msg, now);
+    if (msg.state == pending_state::REQUEST) {
+        LOG_DEBUG("Server {} has request {}, probing it from now on", msg.peer, tid);
+    }
+    msg.state = pending_state::PROBING;
+    msg.retries = 0;
+    msg.tentative = false;
+    schedule(tid, msg, now + std::chrono::milliseconds(g_flip_tunables.rpc_enquire_ms));
+}
+
+void RpcRetransmitter::nak_received(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it == pending.end() || it->second.state == pending_state::REPLY) {
+        return;
+    }
+    // The server does not have the request (any more): resend it without
+    // waiting for the timer
+    auto now = clock::now();
+    pending_msg& msg = it->second;
+    LOG_DEBUG("NAK from {} for request {}, resending it", msg.peer, tid);
+    ++g_flip_stats.rpc_fast_retransmits;
+    FLIP_TRACE(rpc_retransmit, msg.peer, tid, static_cast<uint8_t>(AM_RPC_REQUEST), msg.retries);
+    msg.state = pending_state::REQUEST;
+    msg.retries = 0;
+    msg.tentative = false;
+    msg.sent = now;
+    send(msg.packet->data(), msg.packet->size());
+    schedule(tid, msg, now + backoff(msg));
+}
+
+void RpcRetransmitter::reply_sent(uint32_t tid, flip_address_t peer, uint32_t peer_tid, packet_ptr packet)
+{
+    auto now = clock::now();
+    pending_msg& msg = pending[tid];
+    timers.erase({msg.deadline, tid});
+    msg = pending_msg{pending_state::REPLY, peer, peer_tid, std::move(packet), 0, now, {}, false};
+    schedule(tid, msg, now + backoff(msg));
+}
+
+bool RpcRetransmitter::resend_reply(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it == pending.end() || it->second.state != pending_state::REPLY) {
+        return false;
+    }
+    pending_msg& msg = it->second;
+    ++g_flip_stats.rpc_fast_retransmits;
+    FLIP_TRACE(rpc_retransmit, msg.peer, msg.peer_tid, static_cast<uint8_t>(AM_RPC_REPLY), msg.retries);
+    send(msg.packet->data(), msg.packet->size());
+    return true;
+}
+
+void RpcRetransmitter::ack_received(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it == pending.end() || it->second.state != pending_state::REPLY) {
+        return;
+    }
+    sample(it->second, clock::now());
+    erase(it);
+}
+
+void RpcRetransmitter::forget(uint32_t tid)
+{
+    auto it = pending.find(tid);
+    if (it != pending.end()) {
+        erase(it);
+    }
+}
+
+void RpcRetransmitter::send_enquire(const pending_msg& msg)
+{
+    // Same addresses, kid, port and tid as the request, with no payload
+    uint8_t buf[sizeof(flip_packet) + sizeof(rpc_header)];
+    std::memcpy(buf, msg.packet->data(), sizeof(buf));
+    flip_builder<std::endian::native> fp(buf);
+    fp.set_actual_hopcount(0);
+    fp.set_length(sizeof(rpc_header));
+    fp.set_offset(0);
+    fp.set_total_length(sizeof(rpc_header));
+    rpc_builder<std::endian::native> rpc(fp.payload());
+    rpc.set_type(AM_RPC_ENQUIRE);
+    rpc.set_flags(0);
+    send(buf, sizeof(buf));
+}
+
+void RpcRetransmitter::ack_reply(flip_address_t local, flip_address_t peer, const rpc_header& reply_hdr)
+{
+    ack_key key{local, peer};
+    auto [it, added] = acks.try_emplace(key);
+    pending_acks& pa = it->second;
+    pa.lists = (reply_hdr.flags & RPC_FLAG_ACK_LISTS) != 0;
+    // A retransmitted reply is acknowledged once
+    bool queued = std::any_of(pa.replies.begin(), pa.replies.end(),
+                              [&](const rpc_header& h) { return h.tid == reply_hdr.tid; });
+    if (!queued) {
+        pa.replies.push_back(reply_hdr);
+    }
+
+    if (g_flip_tunables.rpc_ack_delay_us == 0 || pa.replies.size() >= RPC_ACK_LIST_MAX) {
+        send_acks(key, pa);
+        acks.erase(it);
+    } else if (added) {
+        pa.deadline = clock::now() + std::chrono::microseconds(g_flip_tunables.rpc_ack_delay_us);
+        ack_timers.emplace_back(pa.deadline, key);
+    }
+}
+
+std::vector<uint32_t> RpcRetransmitter::take_acks(flip_address_t local, flip_address_t peer)
+{
+    std::vector<uint32_t> tids;
+    auto it = acks.find({local, peer});
+    if (it == acks.end() || !it->second.lists) {
+        return tids;
+    }
+    tids.reserve(it->second.replies.size());
+    for (const rpc_header& h : it->second.replies) {
+        tids.push_back(h.tid);
+    }
+    g_flip_stats.rpc_acks_piggybacked += tids.size();
+    acks.erase(it);
+    return tids;
+}
+
+void RpcRetransmitter::send_acks(const ack_key& key, pending_acks& pa)
+{
+    // One frame naming the first reply and listing the rest, or one frame
+    // per reply to peers that do not understand the list
+    size_t frames = pa.lists ? 1 : pa.replies.size();
+    for (size_t i = 0; i < frames; ++i) {
+        const rpc_header& reply = pa.replies[i];
+        size_t listed = pa.lists ? pa.replies.size() - 1 : 0;
+        size_t list_len = listed ? sizeof(rpc_ack_list) + listed * sizeof(uint32_t) : 0;
+        uint8_t buf[sizeof(flip_packet) + sizeof(rpc_header) + sizeof(rpc_ack_list) + RPC_ACK_LIST_MAX * sizeof(uint32_t)];
+
+        auto fp = build_flip_header(buf, flip_type::UNIDATA, key.first, key.second, reply.tid,
+                                    static_cast<uint32_t>(sizeof(rpc_header) + list_len), g_flip_tunables.max_hopcount);
+        auto ack = build_rpc_header(fp.payload(), reply.kid, reply.port, AM_RPC_ACK, RPC_FLAG_ACK_LISTS, reply.tid,
+                                    reply.from, reply.dest);
+        if (listed) {
+            uint8_t* out = ack.payload();
+            network_order::store<uint32_t>(out, static_cast<uint32_t>(listed));
+            out += sizeof(rpc_ack_list);
+            for (size_t j = 1; j < pa.replies.size(); ++j, out += sizeof(uint32_t)) {
+                network_order::store<uint32_t>(out, pa.replies[j].tid);
+            }
+        }
+        ++g_flip_stats.rpc_ack_frames;
+        FLIP_TRACE(rpc_ack_tx, key.second, reply.tid);
+        send(buf, sizeof(flip_packet) + fp.length());
+    }
+}
+
+void RpcRetransmitter::expire(clock::time_point now)
+{
+    while (!ack_timers.empty() && ack_timers.front().first <= now) {
+        auto [deadline, key] = ack_timers.front();
+        ack_timers.pop_front();
+        auto it = acks.find(key);
+        if (it != acks.end() && it->second.deadline == deadline) {
+            send_acks(key, it->second);
+            acks.erase(it);
+        }
+    }
+
+    while (!timers.empty() && timers.begin()->first <= now) {
+        uint32_t tid = timers.begin()->second;
+        auto it = pending.find(tid);
+        pending_msg& msg = it->second;
+
+        if (msg.tentative) {
+            flip_address_t peer = msg.peer;
+            LOG_DEBUG("Tentative request {} to {} unanswered, giving it back", tid, peer);
+            erase(it);
+            give_up(tid, peer, tid, false);
+            continue;
+        }
+        if (msg.retries >= g_flip_tunables.rpc_max_retries) {
+            flip_address_t peer = msg.peer;
+            uint32_t peer_tid = msg.peer_tid;
+            bool reply = msg.state == pending_state::REPLY;
+            LOG_WARN("{} {} to {} unanswered after {} attempts, giving up",
+                     reply ? "Reply" : "Request", peer_tid, peer, msg.retries + 1);
+            ++g_flip_stats.rpc_give_ups;
+            erase(it);
+            give_up(tid, peer, peer_tid, reply);
+            continue;
+        }
+
+        ++msg.retries;
+        msg.sent = now;
+        if (msg.state == pending_state::PROBING) {
+            ++g_flip_stats.rpc_enquiries;
+            FLIP_TRACE(rpc_retransmit, msg.peer, tid, static_cast<uint8_t>(AM_RPC_ENQUIRE), msg.retries);
+            send_enquire(msg);
+        } else {
+            ++g_flip_stats.rpc_retransmits;
+            FLIP_TRACE(rpc_retransmit, msg.peer, msg.peer_tid,
+                       static_cast<uint8_t>(msg.state == pending_state::REPLY ? AM_RPC_REPLY : AM_RPC_REQUEST), msg.retries);
+            send(msg.packet->data(), msg.packet->size());
+        }
+        schedule(tid, msg, now + backoff(msg));
+    }
+}
+
+std::optional<RpcRetransmitter::clock::time_point> RpcRetransmitter::next_deadline() const
+{
+    std::optional<clock::time_point> next;
+    if (!timers.empty()) {
+        next = timers.begin()->first;
+    }
+    if (!ack_timers.empty() && (!next || ack_timers.front().first < *next)) {
+        next = ack_timers.front().first;
+    }
+    return next;
+}
+
+void RpcRetransmitter::dump(std::string& out) const
+{
+    static const char* const state_names[] = {"request", "probing", "reply"};
+    auto now = clock::now();
+    char line[160];
+    for (const auto& [peer, est] : rtt) {
+        snprintf(line, sizeof(line), "peer %016llx srtt %uus rttvar %uus rto %uus samples %u\n",
+                 static_cast<unsigned long long>(peer), est.srtt_us, est.rttvar_us, est.rto_us(), est.samples);
+        out += line;
+    }
+    for (const auto& [tid, msg] : pending) {
+        auto due_ms = std::chrono::duration_cast<std::chrono::milliseconds>(msg.deadline - now).count();
+        snprintf(line, sizeof(line), "pending tid %u %s peer %016llx peer_tid %u retries %u due %lldms\n",
+                 tid, state_names[static_cast<size_t>(msg.state)], static_cast<unsigned long long>(msg.peer),
+                 msg.peer_tid, msg.retries, static_cast<long long>(due_ms));
+        out += line;
+    }
+    for (const auto& [key, pa] : acks) {
+        auto due_us = std::chrono::duration_cast<std::chrono::microseconds>(pa.deadline - now).count();
+        snprintf(line, sizeof(line), "acks %016llx -> %016llx count %zu%s due %lldus\n",
+                 static_cast<unsigned long long>(key.first), static_cast<unsigned long long>(key.second),
+                 pa.replies.size(), pa.lists ? " lists" : "", static_cast<long long>(due_us));
+        out += line;
+    }
+}
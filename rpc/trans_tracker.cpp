@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "rpc_trans_tracker.hpp"
+#include "tunables.hpp"
+
+static uint64_t trans_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RpcTransTracker::begin(int client_fd, flip_address_t client_addr, uint32_t tid, const rpc_port_t& port)
+{
+    rpc_trans_record& rec = active[tid];
+    rec = rpc_trans_record{};
+    rec.client_fd = client_fd;
+    rec.client_addr = client_addr;
+    rec.tid = tid;
+    rec.port = port;
+    rec.t_ns[TRANS_START] = trans_now_ns();
+}
+
+void RpcTransTracker::request_sent(uint32_t tid)
+{
+    auto it = active.find(tid);
+    if (it != active.end() && it->second.t_ns[TRANS_SENT] == 0) {
+        it->second.t_ns[TRANS_SENT] = trans_now_ns();
+    }
+}
+
+void RpcTransTracker::mark(flip_address_t client_addr, uint32_t tid, rpc_trans_phase phase)
+{
+    auto it = active.find(tid);
+    if (it == active.end() || it->second.client_addr != client_addr ||
+        it->second.t_ns[TRANS_SENT] == 0 || it->second.t_ns[phase] != 0) {
+        return;
+    }
+    it->second.t_ns[phase] = trans_now_ns();
+}
+
+void RpcTransTracker::reply_started(flip_address_t client_addr, uint32_t tid)
+{
+    mark(client_addr, tid, TRANS_REPLY_FIRST);
+}
+
+void RpcTransTracker::reply_complete(flip_address_t client_addr, uint32_t tid)
+{
+    // An unfragmented reply starts and completes at the same time
+    mark(client_addr, tid, TRANS_REPLY_FIRST);
+    mark(client_addr, tid, TRANS_REPLY_COMPLETE);
+}
+
+void RpcTransTracker::reply_delivered(uint32_t tid)
+{
+    auto it = active.find(tid);
+    if (it == active.end() || it->second.t_ns[TRANS_REPLY_COMPLETE] == 0) {
+        return;
+    }
+    it->second.t_ns[TRANS_DELIVERED] = trans_now_ns();
+    finish(it->second);
+    active.erase(it);
+}
+
+void RpcTransTracker::abort(uint32_t tid)
+{
+    active.erase(tid);
+}
+
+void RpcTransTracker::finish(const rpc_trans_record& rec)
+{
+    const uint64_t* t = rec.t_ns;
+    port_latency& lat = per_port[rec.port];
+    lat.lookup.record(t[TRANS_SENT] - t[TRANS_START]);
+    lat.wire.record(t[TRANS_REPLY_FIRST] - t[TRANS_SENT]);
+    lat.reassembly.record(t[TRANS_REPLY_COMPLETE] - t[TRANS_REPLY_FIRST]);
+    lat.delivery.record(t[TRANS_DELIVERED] - t[TRANS_REPLY_COMPLETE]);
+
+    uint64_t total = t[TRANS_DELIVERED] - t[TRANS_START];
+    lat.total.record(total);
+
+    if (total >= static_cast<uint64_t>(g_flip_tunables.slow_trans_us) * 1000) {
+        slow[slow_count % RPC_TRANS_SLOW_SAMPLES] = rec;
+        ++slow_count;
+    }
+}
+
+static void append_port(std::string& out, const rpc_port_t& port)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02x%02x%02x%02x%02x%02x", port[0], port[1], port[2], port[3], port[4], port[5]);
+    out += buf;
+}
+
+static void append_histogram(std::string& out, const char* name, const stats_histogram& h)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "  %-10s mean %8lluus p50<=%8lluus p99<=%8lluus\n", name,
+             static_cast<unsigned long long>(h.count ? h.sum / h.count / 1000 : 0),
+             static_cast<unsigned long long>(h.percentile(50) / 1000),
+             static_cast<unsigned long long>(h.percentile(99) / 1000));
+    out += buf;
+}
+
+void RpcTransTracker::dump(std::string& out) const
+{
+    for (const auto& [port, lat] : per_port) {
+        out += "port ";
+        append_port(out, port);
+        out += " transactions " + std::to_string(lat.total.count) + "\n";
+        append_histogram(out, "lookup", lat.lookup);
+        append_histogram(out, "wire", lat.wire);
+        append_histogram(out, "reassembly", lat.reassembly);
+        append_histogram(out, "delivery", lat.delivery);
+        append_histogram(out, "total", lat.total);
+    }
+
+    size_t n = std::min(slow_count, RPC_TRANS_SLOW_SAMPLES);
+    if (n) {
+        out += "slow transactions (oldest first):\n";
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const rpc_trans_record& rec = slow[(slow_count - n + i) % RPC_TRANS_SLOW_SAMPLES];
+        const uint64_t* t = rec.t_ns;
+        char buf[192];
+        snprintf(buf, sizeof(buf), " fd %d tid %u lookup %lluus wire %lluus reassembly %lluus delivery %lluus port ",
+                 rec.client_fd, rec.tid,
+                 static_cast<unsigned long long>((t[TRANS_SENT] - t[TRANS_START]) / 1000),
+                 static_cast<unsigned long long>((t[TRANS_REPLY_FIRST] - t[TRANS_SENT]) / 1000),
+                 static_cast<unsigned long long>((t[TRANS_REPLY_COMPLETE] - t[TRANS_REPLY_FIRST]) / 1000),
+                 static_cast<unsigned long long>((t[TRANS_DELIVERED] - t[TRANS_REPLY_COMPLETE]) / 1000));
+        out += buf;
+        append_port(out, rec.port);
+        out += "\n";
+    }
+    out += "in flight " + std::to_string(active.size()) + "\n";
+}
+
+void RpcTransTracker::reset()
+{
+    per_port.clear();
+    slow_count = 0;
+}
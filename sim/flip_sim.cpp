@@ -0,0 +1,756 @@
+// flip_sim: multi-node topology simulator and load generator.
+//
+// Instantiates many flip_router/flip_receiver pairs in one process and wires
+// them together with simulated Ethernet segments that model latency, loss,
+// bandwidth and a bounded transmit queue. Time is virtual: a discrete event
+// queue drives frame delivery, client think time and timeouts, so results do
+// not depend on the speed of the machine running the simulation.
+//
+// Clients live on bridge nodes the same way Unix socket clients live on a
+// flip_linux daemon: each has a local FLIP address, resolves a service port
+// with an RPC LOCATE broadcast and then sends UNIDATA requests. Services are
+// simulated Amoeba hosts attached directly to a segment; they answer LOCATEs
+// for their port and reply to requests. They are big-endian hosts, so the
+// bridges handle packets in both byte orders on every run.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+#include <linux/if_ether.h>
+
+#include "flip_receiver.hpp"
+#include "flip_router.hpp"
+#include "log.hpp"
+#include "tunables.hpp"
+
+struct sim_config {
+    std::string topology{"all"};
+    size_t nodes{4};
+    size_t clients{16};
+    size_t services{4};
+    uint64_t duration_ms{2000};
+    uint64_t latency_us{50};
+    uint64_t bandwidth_mbps{1000};
+    double loss{0.0};                // Per-frame loss probability
+    uint64_t queue_us{10000};        // Transmit queue depth per segment, in time
+    size_t request_bytes{128};
+    size_t reply_bytes{1024};
+    uint64_t think_us{0};            // Client pause between transactions
+    uint64_t service_us{20};         // Service processing time per request
+    uint64_t timeout_ms{100};        // Client gives up and retries after this
+    uint64_t flood_rate{0};          // Background broadcasts per second
+    uint64_t churn_ms{0};            // Flush a random node's routes this often
+    uint64_t age_ms{100};            // Routing table maintenance period (age_interval_sec on a daemon)
+    uint64_t seed{1};
+};
+
+static const hwaddr_t broadcast_mac{0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+class sim_segment;
+
+// Discrete event queue with a virtual clock in nanoseconds
+class sim_world
+{
+private:
+    struct event {
+        uint64_t time;
+        uint64_t seq;
+        std::function<void()> fn;
+        bool operator>(const event& o) const { return time != o.time ? time > o.time : seq > o.seq; }
+    };
+
+    std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+    uint64_t next_seq{0};
+
+public:
+    uint64_t now{0};
+    uint64_t events_run{0};
+    std::mt19937_64 rng;
+
+    explicit sim_world(uint64_t seed) : rng(seed) {}
+
+    void at(uint64_t time, std::function<void()> fn)
+    {
+        events.push(event{std::max(time, now), next_seq++, std::move(fn)});
+    }
+
+    void run_until(uint64_t end)
+    {
+        while (!events.empty() && events.top().time <= end) {
+            event e = events.top();
+            events.pop();
+            now = e.time;
+            ++events_run;
+            e.fn();
+        }
+        now = end;
+    }
+
+    double uniform() { return std::uniform_real_distribution<double>(0.0, 1.0)(rng); }
+};
+
+// A network port on a simulated segment. Received frames are handed to the
+// owner's handler when the segment delivers them.
+class SimPort : public NetDrv
+{
+private:
+    hwaddr_t mac;
+    size_t mtu;
+    sim_segment* segment;
+
+public:
+    std::function<void(const uint8_t* frame, size_t len)> on_frame;
+
+    SimPort(hwaddr_t mac, size_t mtu, sim_segment* segment) : mac(mac), mtu(mtu), segment(segment) {}
+
+    bool send(hwaddr_t dst, uint16_t proto, const void* buf, size_t len) override;
+    int get_fd() const override { return -1; }
+    ssize_t recv(void*, size_t) override { return -1; }
+    hwaddr_t get_mac() const override { return mac; }
+    size_t get_mtu() const override { return mtu; }
+};
+
+// Shared Ethernet segment. Frames are serialised one at a time at the
+// segment bandwidth, then arrive at every matching port after the latency.
+class sim_segment
+{
+private:
+    sim_world& world;
+    const sim_config& cfg;
+    uint64_t busy_until{0};
+
+public:
+    std::vector<SimPort*> ports;
+    uint64_t frames{0};
+    uint64_t bytes{0};
+    uint64_t broadcast_frames{0};
+    uint64_t loss_drops{0};
+    uint64_t queue_drops{0};
+    bool down{false};                // Link failure: frames are sent but never arrive
+
+    sim_segment(sim_world& world, const sim_config& cfg) : world(world), cfg(cfg) {}
+
+    bool transmit(const SimPort* from, std::shared_ptr<std::vector<uint8_t>> frame)
+    {
+        uint64_t start = std::max(world.now, busy_until);
+        if (start - world.now > cfg.queue_us * 1000) {
+            ++queue_drops;
+            return false;
+        }
+        uint64_t serialise_ns = frame->size() * 8000 / std::max<uint64_t>(cfg.bandwidth_mbps, 1);
+        busy_until = start + serialise_ns;
+        uint64_t arrival = busy_until + cfg.latency_us * 1000;
+
+        const ethhdr* eth = reinterpret_cast<const ethhdr*>(frame->data());
+        hwaddr_t dst = std::to_array(eth->h_dest);
+        bool is_broadcast = dst == broadcast_mac;
+        ++frames;
+        bytes += frame->size();
+        if (is_broadcast) {
+            ++broadcast_frames;
+        }
+
+        for (SimPort* port : ports) {
+            if (port == from || (!is_broadcast && port->get_mac() != dst)) {
+                continue;
+            }
+            if (down || (cfg.loss > 0 && world.uniform() < cfg.loss)) {
+                ++loss_drops;
+                continue;
+            }
+            world.at(arrival, [port, frame] {
+                if (port->on_frame) {
+                    port->on_frame(frame->data(), frame->size());
+                }
+            });
+        }
+        return true;
+    }
+};
+
+bool SimPort::send(hwaddr_t dst, uint16_t proto, const void* buf, size_t len)
+{
+    auto frame = std::make_shared<std::vector<uint8_t>>(sizeof(ethhdr) + len);
+    ethhdr eth;
+    std::memcpy(eth.h_dest, dst.data(), 6);
+    std::memcpy(eth.h_source, mac.data(), 6);
+    eth.h_proto = htons(proto);
+    std::memcpy(frame->data(), &eth, sizeof(eth));
+    std::memcpy(frame->data() + sizeof(eth), buf, len);
+    return segment->transmit(this, std::move(frame));
+}
+
+// A flip_linux instance: router plus receiver with a port on each attached segment
+struct sim_node {
+    std::shared_ptr<flip_networks> networks = std::make_shared<flip_networks>();
+    std::unique_ptr<flip_router> router;
+    std::unique_ptr<flip_receiver> receiver;
+    std::vector<std::shared_ptr<SimPort>> ports;
+};
+
+struct sim_client {
+    size_t node;
+    flip_address_t addr;
+    uint64_t seq{0};
+    uint64_t started_ns{0};
+    bool outstanding{false};
+};
+
+// Simulated Amoeba host offering one RPC port
+// Byte order of the simulated Amoeba hosts
+constexpr std::endian SERVICE_ORDER = std::endian::big;
+
+struct sim_service {
+    flip_address_t addr;
+    rpc_port_t port;
+    std::shared_ptr<SimPort> nic;
+    uint32_t message_id{0};
+    uint64_t requests{0};
+    struct partial_request {
+        uint32_t received{0};
+        bool is_request{false};
+        uint32_t tid{0};
+    };
+    // Messages being received, keyed by (source, message id)
+    std::map<std::pair<flip_address_t, uint32_t>, partial_request> partial;
+};
+
+class sim_run
+{
+private:
+    const sim_config& cfg;
+    sim_world world;
+    std::vector<std::unique_ptr<sim_segment>> segments;
+    std::vector<std::unique_ptr<sim_node>> nodes;
+    std::vector<sim_client> clients;
+    std::vector<std::unique_ptr<sim_service>> services;
+    std::unordered_map<flip_address_t, size_t> client_by_addr;
+    uint16_t next_mac{1};
+    flip_address_t next_addr{0x100};
+    uint64_t next_kid{1};
+    uint32_t next_message_id{0};
+
+    std::vector<uint64_t> latencies_ns;
+    uint64_t timeouts{0};
+    uint64_t locates{0};
+    uint64_t floods{0};
+    uint64_t churns{0};
+
+    // Failover topology: the parallel links, the one taken down half way and
+    // the unicast frames each had carried at that point
+    std::vector<sim_segment*> links;
+    uint64_t cut_ns{0};
+    std::vector<uint64_t> link_unicast_at_cut;
+    uint64_t timeouts_at_cut{0};
+    uint64_t last_timeout_ns{0};
+
+    sim_segment* add_segment()
+    {
+        segments.push_back(std::make_unique<sim_segment>(world, cfg));
+        return segments.back().get();
+    }
+
+    std::shared_ptr<SimPort> make_port(sim_segment* seg)
+    {
+        hwaddr_t mac{0x02, 0, 0, 0, static_cast<uint8_t>(next_mac >> 8), static_cast<uint8_t>(next_mac)};
+        ++next_mac;
+        auto port = std::make_shared<SimPort>(mac, ETH_DATA_LEN, seg);
+        seg->ports.push_back(port.get());
+        return port;
+    }
+
+    sim_node* add_node(std::initializer_list<sim_segment*> segs)
+    {
+        auto node = std::make_unique<sim_node>();
+        for (sim_segment* seg : segs) {
+            auto port = make_port(seg);
+            node->networks->add_network(port);
+            node->ports.push_back(port);
+        }
+        node->router = std::make_unique<flip_router>(node->networks);
+        node->receiver = std::make_unique<flip_receiver>(*node->router, node->networks);
+
+        sim_node* raw = node.get();
+        for (auto& port : node->ports) {
+            SimPort* p = port.get();
+            p->on_frame = [raw, p](const uint8_t* frame, size_t len) {
+                raw->receiver->recv_packet(frame, len, p->get_network_id());
+            };
+        }
+        raw->router->set_local_rpc_reply_cb([this](flip_address_t dst, uint32_t, const uint8_t*, size_t) {
+            auto it = client_by_addr.find(dst);
+            if (it != client_by_addr.end()) {
+                complete_trans(it->second);
+            }
+        });
+        nodes.push_back(std::move(node));
+        return raw;
+    }
+
+    void add_client(size_t node_index)
+    {
+        flip_address_t addr = next_addr++;
+        nodes[node_index]->router->install_local_address(addr);
+        client_by_addr[addr] = clients.size();
+        clients.push_back(sim_client{node_index, addr});
+    }
+
+    void add_service(sim_segment* seg)
+    {
+        auto svc = std::make_unique<sim_service>();
+        svc->addr = next_addr++;
+        uint32_t id = static_cast<uint32_t>(services.size() + 1);
+        svc->port = rpc_port_t{0x5e, 0x41, 0, 0, static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id)};
+        svc->nic = make_port(seg);
+        sim_service* raw = svc.get();
+        svc->nic->on_frame = [this, raw](const uint8_t* frame, size_t len) { service_frame(*raw, frame, len); };
+        services.push_back(std::move(svc));
+    }
+
+    void build_topology(const std::string& topology)
+    {
+        size_t n = std::max<size_t>(cfg.nodes, 2);
+        if (topology == "line") {
+            // seg0 - node0 - seg1 - node1 - ... - seg(n); clients on node0, services on the far end
+            std::vector<sim_segment*> segs;
+            for (size_t i = 0; i <= n; ++i) {
+                segs.push_back(add_segment());
+            }
+            for (size_t i = 0; i < n; ++i) {
+                add_node({segs[i], segs[i + 1]});
+            }
+            for (size_t i = 0; i < cfg.clients; ++i) {
+                add_client(0);
+            }
+            for (size_t i = 0; i < cfg.services; ++i) {
+                add_service(segs[n]);
+            }
+        } else if (topology == "star") {
+            // Hub node with a core segment for the services and one spoke per leaf node
+            sim_segment* core = add_segment();
+            std::vector<sim_segment*> spokes;
+            for (size_t i = 1; i < n; ++i) {
+                spokes.push_back(add_segment());
+            }
+            sim_node* hub = add_node({core});
+            for (sim_segment* spoke : spokes) {
+                auto port = make_port(spoke);
+                hub->networks->add_network(port);
+                hub->ports.push_back(port);
+                SimPort* p = port.get();
+                p->on_frame = [hub, p](const uint8_t* frame, size_t len) {
+                    hub->receiver->recv_packet(frame, len, p->get_network_id());
+                };
+                add_node({spoke});
+            }
+            for (size_t i = 0; i < cfg.clients; ++i) {
+                add_client(1 + i % spokes.size());
+            }
+            for (size_t i = 0; i < cfg.services; ++i) {
+                add_service(core);
+            }
+        } else if (topology == "failover") {
+            // Two nodes joined by two parallel links, clients on one and services
+            // behind the other; link 1 goes down half way through the run
+            links = {add_segment(), add_segment()};
+            sim_segment* core = add_segment();
+            add_node({links[0], links[1]});
+            add_node({links[0], links[1], core});
+            for (size_t i = 0; i < cfg.clients; ++i) {
+                add_client(0);
+            }
+            for (size_t i = 0; i < cfg.services; ++i) {
+                add_service(core);
+            }
+        } else {
+            // Ring of n nodes; clients on node0 and services half way round, so there are two equal paths
+            std::vector<sim_segment*> segs;
+            for (size_t i = 0; i < n; ++i) {
+                segs.push_back(add_segment());
+            }
+            for (size_t i = 0; i < n; ++i) {
+                add_node({segs[i], segs[(i + 1) % n]});
+            }
+            for (size_t i = 0; i < cfg.clients; ++i) {
+                add_client(0);
+            }
+            for (size_t i = 0; i < cfg.services; ++i) {
+                add_service(segs[(n + 1) / 2]);
+            }
+        }
+    }
+
+    // A UNIDATA packet with its headers in byte order Order, as a host of that order sends it
+    template <std::endian Order>
+    static std::vector<uint8_t> build_unidata(flip_address_t src, flip_address_t dst, uint32_t message_id,
+                                              const rpc_header& rpc, size_t body_len)
+    {
+        std::vector<uint8_t> pkt(sizeof(flip_packet) + sizeof(rpc_header) + body_len, 0);
+        flip_builder<Order> fp(pkt.data());
+        fp.set_version(1);
+        fp.set_type(static_cast<uint8_t>(flip_type::UNIDATA));
+        fp.set_flags(Order == std::endian::little ? FLIP_FLAG_ENDIAN : 0);
+        fp.set_max_hopcount(g_flip_tunables.max_hopcount);
+        fp.set_dst_address(dst);
+        fp.set_src_address(src);
+        fp.set_message_id(message_id);
+        fp.set_length(static_cast<uint32_t>(sizeof(rpc_header) + body_len));
+        fp.set_total_length(fp.length());
+
+        rpc_builder<Order> hdr(fp.payload());
+        hdr.set_kid(rpc.kid);
+        hdr.set_port(rpc.port);
+        hdr.set_type(rpc.type);
+        hdr.set_tid(rpc.tid);
+        return pkt;
+    }
+
+    // Start a transaction the way the daemon handles UNIX_MSG_TRANS. A retry
+    // always sends its own LOCATE: the one other clients wait on may be lost.
+    void start_trans(size_t index, bool retry = false)
+    {
+        sim_client& c = clients[index];
+        sim_node& node = *nodes[c.node];
+        const sim_service& svc = *services[world.rng() % services.size()];
+
+        c.outstanding = true;
+        c.started_ns = world.now;
+        uint64_t seq = ++c.seq;
+        world.at(world.now + cfg.timeout_ms * 1000000, [this, index, seq] { timeout_trans(index, seq); });
+
+        auto rpc_mgr = node.router->get_rpc_port_manager();
+        bool need_locate = retry || !rpc_mgr->has_pending_lookup(svc.port);
+        rpc_port_t port = svc.port;
+        rpc_mgr->begin_remote_lookup(port, static_cast<int>(index),
+            [this, index, seq, port](int, const rpc_port_t&, const std::string& remote, bool found) {
+                if (!found) return;
+                flip_address_t dst = std::stoull(remote);
+                // Resolved from inside route_packet; send once the router has returned
+                world.at(world.now, [this, index, seq, port, dst] { send_request(index, seq, port, dst); });
+            });
+        if (need_locate) {
+            ++locates;
+            node.router->send_rpc_locate(c.addr, port);
+        }
+    }
+
+    void send_request(size_t index, uint64_t seq, const rpc_port_t& port, flip_address_t dst)
+    {
+        sim_client& c = clients[index];
+        if (!c.outstanding || c.seq != seq) {
+            return;
+        }
+        rpc_header rpc{};
+        rpc.kid = next_kid++;
+        std::copy(port.begin(), port.end(), rpc.port);
+        rpc.type = AM_RPC_REQUEST;
+        rpc.tid = static_cast<uint32_t>(seq);
+        auto pkt = build_unidata<std::endian::native>(c.addr, dst, ++next_message_id, rpc, sizeof(am_header_stub) + cfg.request_bytes);
+        static const hwaddr_t local_mac{};
+        nodes[c.node]->router->route_packet(local_mac, pkt.data(), pkt.size(), 0);
+    }
+
+    void complete_trans(size_t index)
+    {
+        sim_client& c = clients[index];
+        if (!c.outstanding) {
+            return;
+        }
+        c.outstanding = false;
+        latencies_ns.push_back(world.now - c.started_ns);
+        // Replies are delivered from inside route_packet; start the next transaction afterwards
+        world.at(world.now + cfg.think_us * 1000, [this, index] { start_trans(index); });
+    }
+
+    void timeout_trans(size_t index, uint64_t seq)
+    {
+        sim_client& c = clients[index];
+        if (!c.outstanding || c.seq != seq) {
+            return;
+        }
+        ++timeouts;
+        last_timeout_ns = world.now;
+        c.outstanding = false;
+        // Drop our part of any lookup that never resolved so the retry sends a fresh LOCATE
+        nodes[c.node]->router->get_rpc_port_manager()->remove_client(static_cast<int>(index));
+        start_trans(index, true);
+    }
+
+    void service_frame(sim_service& svc, const uint8_t* frame, size_t len)
+    {
+        if (len < sizeof(ethhdr) + sizeof(fc_header) + sizeof(flip_packet)) {
+            return;
+        }
+        const ethhdr* eth = reinterpret_cast<const ethhdr*>(frame);
+        hwaddr_t from_mac = std::to_array(eth->h_source);
+        const uint8_t* flip = frame + sizeof(ethhdr) + sizeof(fc_header);
+        size_t flip_len = len - sizeof(ethhdr) - sizeof(fc_header);
+        with_packet_order(flip, [&](auto order) {
+            service_packet<decltype(order)::value>(svc, from_mac, flip, flip_len);
+        });
+    }
+
+    template <std::endian Order>
+    void service_packet(sim_service& svc, const hwaddr_t& from_mac, const uint8_t* flip, size_t flip_len)
+    {
+        const flip_view<Order> fp(flip);
+
+        if (fp.type() == static_cast<uint8_t>(flip_type::MULTIDATA) &&
+            flip_len >= sizeof(flip_packet) + sizeof(uint32_t) + sizeof(rpc_header)) {
+            const rpc_view<Order> rpc(fp.payload() + sizeof(uint32_t));
+            if (network_order::load<uint32_t>(fp.payload()) != PROTO_RPC || rpc.type() != AM_RPC_LOCATE ||
+                !std::equal(svc.port.begin(), svc.port.end(), rpc.port())) {
+                return;
+            }
+            rpc_header hereis{};
+            std::copy(svc.port.begin(), svc.port.end(), hereis.port);
+            hereis.type = AM_RPC_HEREIS;
+            hereis.tid = rpc.tid();
+            auto pkt = build_unidata<SERVICE_ORDER>(svc.addr, fp.src_address(), ++svc.message_id, hereis, 0);
+            fragment_and_send(svc.nic, from_mac, FLIP_ETHERTYPE, pkt.data(), pkt.size());
+            return;
+        }
+
+        if (fp.type() != static_cast<uint8_t>(flip_type::UNIDATA) || fp.dst_address() != svc.addr) {
+            return;
+        }
+
+        // Only the first fragment carries the RPC header; wait until every byte has arrived
+        uint32_t total = fp.total_length() ? fp.total_length() : fp.length();
+        auto key = std::make_pair(fp.src_address(), fp.message_id());
+        sim_service::partial_request& part = svc.partial[key];
+        if (fp.offset() == 0 && flip_len >= sizeof(flip_packet) + sizeof(rpc_header)) {
+            const rpc_view<Order> req(fp.payload());
+            part.is_request = req.type() == AM_RPC_REQUEST;  // Anything else is an ACK for an earlier reply
+            part.tid = req.tid();
+        }
+        part.received += fp.length();
+        if (part.received < total) {
+            return;
+        }
+        bool is_request = part.is_request;
+        uint32_t tid = part.tid;
+        svc.partial.erase(key);
+        if (!is_request) {
+            return;
+        }
+
+        ++svc.requests;
+        rpc_header reply{};
+        std::copy(svc.port.begin(), svc.port.end(), reply.port);
+        reply.type = AM_RPC_REPLY;
+        reply.tid = tid;
+        flip_address_t client = fp.src_address();
+        sim_service* raw = &svc;
+        world.at(world.now + cfg.service_us * 1000, [this, raw, client, from_mac, reply] {
+            auto pkt = build_unidata<SERVICE_ORDER>(raw->addr, client, ++raw->message_id, reply, cfg.reply_bytes);
+            fragment_and_send(raw->nic, from_mac, FLIP_ETHERTYPE, pkt.data(), pkt.size());
+        });
+    }
+
+    // Background broadcast load: RPC LOCATEs for a port nobody serves
+    void flood()
+    {
+        sim_node& node = *nodes.front();
+        static const rpc_port_t nobody{0xde, 0xad, 0, 0, 0, 0};
+        ++floods;
+        node.router->send_rpc_locate(0xf100d, nobody);
+        world.at(world.now + 1000000000ULL / cfg.flood_rate, [this] { flood(); });
+    }
+
+    void churn()
+    {
+        nodes[world.rng() % nodes.size()]->router->flush_routes();
+        ++churns;
+        world.at(world.now + cfg.churn_ms * 1000000, [this] { churn(); });
+    }
+
+    void age_routes()
+    {
+        for (auto& node : nodes) {
+            node->router->increment_age();
+        }
+        world.at(world.now + cfg.age_ms * 1000000, [this] { age_routes(); });
+    }
+
+    void cut_link()
+    {
+        cut_ns = world.now;
+        timeouts_at_cut = timeouts;
+        for (sim_segment* link : links) {
+            link_unicast_at_cut.push_back(link->frames - link->broadcast_frames);
+        }
+        links[1]->down = true;
+    }
+
+    uint64_t percentile(double pct) const
+    {
+        if (latencies_ns.empty()) {
+            return 0;
+        }
+        size_t i = std::min(latencies_ns.size() - 1, static_cast<size_t>(latencies_ns.size() * pct / 100.0));
+        return latencies_ns[i];
+    }
+
+    // Stand-in for the Amoeba am_header that clients put in front of request data
+    struct am_header_stub {
+        uint8_t bytes[32];
+    };
+
+public:
+    sim_run(const sim_config& cfg, const std::string& topology) : cfg(cfg), world(cfg.seed)
+    {
+        build_topology(topology);
+    }
+
+    void run(const std::string& topology)
+    {
+        // Stagger client starts so the first LOCATEs do not all land in the same instant
+        for (size_t i = 0; i < clients.size(); ++i) {
+            world.at(world.rng() % 1000000, [this, i] { start_trans(i); });
+        }
+        if (cfg.flood_rate) {
+            world.at(0, [this] { flood(); });
+        }
+        if (cfg.churn_ms) {
+            world.at(cfg.churn_ms * 1000000, [this] { churn(); });
+        }
+        if (cfg.age_ms) {
+            world.at(cfg.age_ms * 1000000, [this] { age_routes(); });
+        }
+        if (!links.empty()) {
+            world.at(cfg.duration_ms * 1000000 / 2, [this] { cut_link(); });
+        }
+
+        auto wall_start = std::chrono::steady_clock::now();
+        world.run_until(cfg.duration_ms * 1000000);
+        double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+        uint64_t frames = 0, bytes = 0, bcast = 0, loss_drops = 0, queue_drops = 0;
+        for (const auto& seg : segments) {
+            frames += seg->frames;
+            bytes += seg->bytes;
+            bcast += seg->broadcast_frames;
+            loss_drops += seg->loss_drops;
+            queue_drops += seg->queue_drops;
+        }
+        std::sort(latencies_ns.begin(), latencies_ns.end());
+        double sim_s = cfg.duration_ms / 1000.0;
+        uint64_t originated = locates + floods;
+
+        printf("%s: %zu nodes, %zu segments, %zu clients, %zu services\n", topology.c_str(),
+               nodes.size(), segments.size(), clients.size(), services.size());
+        printf("  transactions %zu (%.0f/s), timeouts %llu\n", latencies_ns.size(), latencies_ns.size() / sim_s,
+               static_cast<unsigned long long>(timeouts));
+        printf("  latency us   p50 %.1f  p99 %.1f  p99.9 %.1f\n", percentile(50) / 1000.0,
+               percentile(99) / 1000.0, percentile(99.9) / 1000.0);
+        printf("  broadcasts   originated %llu (locates %llu, floods %llu), frames %llu, amplification %.2f\n",
+               static_cast<unsigned long long>(originated), static_cast<unsigned long long>(locates),
+               static_cast<unsigned long long>(floods), static_cast<unsigned long long>(bcast),
+               originated ? static_cast<double>(bcast) / originated : 0.0);
+        printf("  frames       %llu (%.0f/s, %.1f MB/s), lost %llu, queue drops %llu, route flushes %llu\n",
+               static_cast<unsigned long long>(frames), frames / sim_s, bytes / sim_s / 1e6,
+               static_cast<unsigned long long>(loss_drops), static_cast<unsigned long long>(queue_drops),
+               static_cast<unsigned long long>(churns));
+        if (!links.empty()) {
+            printf("  failover     link 1 down at %.0f ms, %llu timeouts after, the last at %.0f ms\n", cut_ns / 1e6,
+                   static_cast<unsigned long long>(timeouts - timeouts_at_cut), last_timeout_ns / 1e6);
+            for (size_t i = 0; i < links.size(); ++i) {
+                uint64_t unicast = links[i]->frames - links[i]->broadcast_frames;
+                printf("               link %zu unicast frames before %llu, after %llu\n", i,
+                       static_cast<unsigned long long>(link_unicast_at_cut[i]),
+                       static_cast<unsigned long long>(unicast - link_unicast_at_cut[i]));
+            }
+        }
+        printf("  wall         %.3f s, %llu events, %.0f ns/frame\n\n", wall_s,
+               static_cast<unsigned long long>(world.events_run), frames ? wall_s * 1e9 / frames : 0.0);
+    }
+};
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -t topology     line, star, loop, failover or all (default all)\n"
+            "  -n nodes        bridge nodes per topology (default 4)\n"
+            "  -c clients      RPC clients (default 16)\n"
+            "  -s services     simulated services (default 4)\n"
+            "  -d ms           simulated duration (default 2000)\n"
+            "  -l us           per-segment latency (default 50)\n"
+            "  -b mbps         per-segment bandwidth (default 1000)\n"
+            "  -p loss         per-frame loss probability (default 0)\n"
+            "  -q bytes        request size (default 128)\n"
+            "  -r bytes        reply size (default 1024)\n"
+            "  -w us           client think time (default 0)\n"
+            "  -T ms           client transaction timeout (default 100)\n"
+            "  -f rate         background broadcasts per second (default 0)\n"
+            "  -k ms           flush a random node's routes this often (default off)\n"
+            "  -a ms           route aging period, 0 for none (default 100)\n"
+            "  -S seed         random seed (default 1)\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    sim_config cfg;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:c:s:d:l:b:p:q:r:w:T:f:k:a:S:h")) != -1) {
+        switch (opt) {
+            case 't': cfg.topology = optarg; break;
+            case 'n': cfg.nodes = strtoul(optarg, nullptr, 0); break;
+            case 'c': cfg.clients = strtoul(optarg, nullptr, 0); break;
+            case 's': cfg.services = strtoul(optarg, nullptr, 0); break;
+            case 'd': cfg.duration_ms = strtoull(optarg, nullptr, 0); break;
+            case 'l': cfg.latency_us = strtoull(optarg, nullptr, 0); break;
+            case 'b': cfg.bandwidth_mbps = strtoull(optarg, nullptr, 0); break;
+            case 'p': cfg.loss = strtod(optarg, nullptr); break;
+            case 'q': cfg.request_bytes = strtoul(optarg, nullptr, 0); break;
+            case 'r': cfg.reply_bytes = strtoul(optarg, nullptr, 0); break;
+            case 'w': cfg.think_us = strtoull(optarg, nullptr, 0); break;
+            case 'T': cfg.timeout_ms = strtoull(optarg, nullptr, 0); break;
+            case 'f': cfg.flood_rate = strtoull(optarg, nullptr, 0); break;
+            case 'k': cfg.churn_ms = strtoull(optarg, nullptr, 0); break;
+            case 'a': cfg.age_ms = strtoull(optarg, nullptr, 0); break;
+            case 'S': cfg.seed = strtoull(optarg, nullptr, 0); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (cfg.clients == 0 || cfg.services == 0 || cfg.timeout_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> topologies;
+    if (cfg.topology == "all") {
+        topologies = {"line", "star", "loop"};
+    } else if (cfg.topology == "line" || cfg.topology == "star" || cfg.topology == "loop" ||
+               cfg.topology == "failover") {
+        topologies = {cfg.topology};
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Logger::instance().set_level(log_level::OFF);
+    g_flip_tunables.fragment_delay_us = 0;
+    // Every forward adds 3 to the hopcount; leave room to cross the whole topology
+    g_flip_tunables.max_hopcount = static_cast<uint16_t>(3 * (std::max<size_t>(cfg.nodes, 2) + 1));
+
+    for (const auto& topology : topologies) {
+        sim_run run(cfg, topology);
+        run.run(topology);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "log.hpp"
+
+flip_stats g_flip_stats{};
+
+StatsPublisher::StatsPublisher(const std::string& path)
+    : path(path)
+{
+}
+
+StatsPublisher::~StatsPublisher()
+{
+    close();
+}
+
+bool StatsPublisher::open()
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("StatsPublisher: open({}) failed: {}", path, log_errno(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(flip_stats_page)) < 0) {
+        LOG_ERROR("StatsPublisher: ftruncate() failed: {}", log_errno(errno));
+        close();
+        return false;
+    }
+
+    void* mem = mmap(nullptr, sizeof(flip_stats_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        LOG_ERROR("StatsPublisher: mmap() failed: {}", log_errno(errno));
+        close();
+        return false;
+    }
+
+    page = static_cast<flip_stats_page*>(mem);
+    page->magic = FLIP_STATS_MAGIC;
+    page->version = FLIP_STATS_VERSION;
+    page->size = sizeof(flip_stats_page);
+    page->sequence = 0;
+    publish(g_flip_stats);
+    LOG_INFO("StatsPublisher: publishing statistics to {}", path);
+    return true;
+}
+
+void StatsPublisher::close()
+{
+    if (page) {
+        munmap(page, sizeof(flip_stats_page));
+        page = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void StatsPublisher::publish(const flip_stats& stats)
+{
+    if (!page) {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    std::atomic_ref<uint64_t> seq(page->sequence);
+    uint64_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&page->stats, &stats, sizeof(stats));
+    page->publish_time_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    seq.store(s + 2, std::memory_order_release);
+}
@@ -0,0 +1,124 @@
+// flipctl: inspect and tune a running flip_linux through its admin socket
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "admin.hpp"
+#include "unix_server.hpp"
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-s socket] command\n"
+            "Commands:\n"
+            "  routes                     dump the routing table\n"
+            "  lookups                    dump local ports, remote port locations and pending RPC lookups\n"
+            "  reassembly                 dump in-progress fragment reassemblies\n"
+            "  trans                      RPC phase latencies per port and slow transactions\n"
+            "  groups                     dump process groups and their local members\n"
+            "  flush [routes|lookups|reassembly|trans|all]\n"
+            "  get [name]                 show one or all tunables\n"
+            "  set name value             change a tunable\n"
+            "  capture [start [key=value ...]|stop]\n"
+            "                             packet capture status, or start/stop it; keys:\n"
+            "                             file, addr, type, net, mode (headers|replay), snaplen,\n"
+            "                             size (MiB), files, ring (KiB)\n",
+            prog);
+}
+
+static bool read_full(int fd, void* buf, size_t len)
+{
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = FLIP_ADMIN_SOCKET_PATH;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            path = optarg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string cmd = argv[optind];
+    std::string arg;
+    for (int i = optind + 1; i < argc; ++i) {
+        if (!arg.empty()) arg += ' ';
+        arg += argv[i];
+    }
+
+    uint32_t type;
+    if (cmd == "routes") type = ADMIN_MSG_DUMP_ROUTES;
+    else if (cmd == "lookups") type = ADMIN_MSG_DUMP_LOOKUPS;
+    else if (cmd == "reassembly") type = ADMIN_MSG_DUMP_REASSEMBLY;
+    else if (cmd == "trans") type = ADMIN_MSG_DUMP_TRANS;
+    else if (cmd == "groups") type = ADMIN_MSG_DUMP_GROUPS;
+    else if (cmd == "flush") type = ADMIN_MSG_FLUSH;
+    else if (cmd == "get") type = ADMIN_MSG_GET;
+    else if (cmd == "set") type = ADMIN_MSG_SET;
+    else if (cmd == "capture") type = ADMIN_MSG_CAPTURE;
+    else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return 1;
+    }
+    struct sockaddr_un sa{};
+    sa.sun_family = AF_UNIX;
+    strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    unix_message_header hdr{type, static_cast<uint32_t>(arg.size())};
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = arg.data();
+    iov[1].iov_len = arg.size();
+    if (writev(fd, iov, 2) != static_cast<ssize_t>(sizeof(hdr) + arg.size())) {
+        fprintf(stderr, "Failed to send request: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (!read_full(fd, &hdr, sizeof(hdr))) {
+        fprintf(stderr, "No reply from %s\n", path);
+        return 1;
+    }
+    std::vector<char> body(hdr.length);
+    if (!read_full(fd, body.data(), body.size())) {
+        fprintf(stderr, "Truncated reply from %s\n", path);
+        return 1;
+    }
+    close(fd);
+
+    fwrite(body.data(), 1, body.size(), hdr.type == ADMIN_MSG_OK ? stdout : stderr);
+    return hdr.type == ADMIN_MSG_OK ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// flipstat: print the statistics published by flip_linux
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+
+static const char* flip_type_names[STATS_FLIP_TYPES] = {
+    "unknown", "LOCATE", "HEREIS", "UNIDATA", "MULTIDATA", "NOTHERE", "UNTRUSTED", "type7",
+};
+
+static void print_histogram(const char* name, const char* unit, const stats_histogram& h)
+{
+    printf("%-16s count=%llu", name, (unsigned long long)h.count);
+    if (h.count) {
+        printf(" mean=%llu%s p50<=%llu%s p99<=%llu%s p99.9<=%llu%s",
+               (unsigned long long)(h.sum / h.count), unit,
+               (unsigned long long)h.percentile(50), unit,
+               (unsigned long long)h.percentile(99), unit,
+               (unsigned long long)h.percentile(99.9), unit);
+    }
+    printf("\n");
+}
+
+static void print_stats(const flip_stats& s)
+{
+    printf("%-4s %12s %14s %9s %12s %14s %9s\n", "net", "rx_frames", "rx_bytes", "rx_drops", "tx_frames", "tx_bytes", "tx_drops");
+    for (size_t i = 0; i < STATS_MAX_NETWORKS; ++i) {
+        const stats_network& n = s.networks[i];
+        if (!n.rx_frames && !n.tx_frames && !n.rx_drops && !n.tx_drops) {
+            continue;
+        }
+        printf("%-4zu %12llu %14llu %9llu %12llu %14llu %9llu\n", i,
+               (unsigned long long)n.rx_frames, (unsigned long long)n.rx_bytes, (unsigned long long)n.rx_drops,
+               (unsigned long long)n.tx_frames, (unsigned long long)n.tx_bytes, (unsigned long long)n.tx_drops);
+    }
+
+    printf("\npackets:");
+    for (size_t i = 0; i < STATS_FLIP_TYPES; ++i) {
+        if (s.flip_type_packets[i]) {
+            printf(" %s=%llu", flip_type_names[i], (unsigned long long)s.flip_type_packets[i]);
+        }
+    }
+    printf("\nreassembly: started=%llu completed=%llu timeouts=%llu drops=%llu\n",
+           (unsigned long long)s.reassembly_started, (unsigned long long)s.reassembly_completed,
+           (unsigned long long)s.reassembly_timeouts, (unsigned long long)s.reassembly_drops);
+    printf("routes: size=%llu learns=%llu evictions=%llu no_path=%llu\n",
+           (unsigned long long)s.routes, (unsigned long long)s.route_learns, (unsigned long long)s.route_evictions,
+           (unsigned long long)s.route_no_path);
+    printf("rpc: lookups=%llu hits=%llu misses=%llu\n",
+           (unsigned long long)s.rpc_lookups, (unsigned long long)s.rpc_cache_hits, (unsigned long long)s.rpc_cache_misses);
+    printf("rpc retransmit: timeouts=%llu fast=%llu enquiries=%llu give_ups=%llu\n",
+           (unsigned long long)s.rpc_retransmits, (unsigned long long)s.rpc_fast_retransmits,
+           (unsigned long long)s.rpc_enquiries, (unsigned long long)s.rpc_give_ups);
+    printf("rpc acks: frames=%llu piggybacked=%llu\n",
+           (unsigned long long)s.rpc_ack_frames, (unsigned long long)s.rpc_acks_piggybacked);
+    printf("group: sent=%llu received=%llu duplicates=%llu deliveries=%llu\n",
+           (unsigned long long)s.group_sent, (unsigned long long)s.group_received,
+           (unsigned long long)s.group_duplicates, (unsigned long long)s.group_deliveries);
+    printf("unix: queue_full=%llu\n", (unsigned long long)s.unix_queue_full);
+    printf("log: dropped=%llu\n", (unsigned long long)s.log_dropped);
+    printf("capture: frames=%llu dropped=%llu\n", (unsigned long long)s.capture_frames, (unsigned long long)s.capture_dropped);
+    print_histogram("message_size", "B", s.message_size);
+    print_histogram("processing", "ns", s.processing_ns);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = FLIP_STATS_PATH;
+    unsigned interval = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:i:")) != -1) {
+        switch (opt) {
+            case 'f': path = optarg; break;
+            case 'i': interval = static_cast<unsigned>(atoi(optarg)); break;
+            default:
+                fprintf(stderr, "Usage: %s [-f stats_file] [-i interval_seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    void* mem = mmap(nullptr, sizeof(flip_stats_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const flip_stats_page* page = static_cast<const flip_stats_page*>(mem);
+
+    do {
+        flip_stats snapshot;
+        if (!flip_stats_read(page, snapshot)) {
+            fprintf(stderr, "%s does not hold a consistent statistics snapshot\n", path);
+            return 1;
+        }
+        print_stats(snapshot);
+        if (interval) {
+            printf("\n");
+            fflush(stdout);
+            sleep(interval);
+        }
+    } while (interval);
+
+    munmap(mem, sizeof(flip_stats_page));
+    return 0;
+}
@@ -0,0 +1,407 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "client_io.hpp"
+#include "shm_transport.hpp"
+#include "log.hpp"
+
+ClientIoThread::ClientIoThread(const std::string& path, const std::string& seqpacket_path)
+    : server(path, seqpacket_path)
+{
+}
+
+ClientIoThread::~ClientIoThread()
+{
+    stop();
+}
+
+bool ClientIoThread::start()
+{
+    router_side.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    io_side.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (router_side.wake_fd < 0 || io_side.wake_fd < 0) {
+        LOG_ERROR("ClientIoThread: eventfd() failed: {}", log_errno(errno));
+        stop();
+        return false;
+    }
+    if (!server.start()) {
+        stop();
+        return false;
+    }
+
+    server.set_on_message([this](int client_fd, uint32_t type, const uint8_t* payload, size_t len) {
+        handle_client_message(client_fd, type, payload, len);
+    });
+    server.set_on_connect([this](int client_fd) {
+        if (static_cast<size_t>(client_fd) >= io_generation.size()) {
+            io_generation.resize(client_fd + 1);
+        }
+        if (++next_generation == 0) {
+            ++next_generation;
+        }
+        io_generation[client_fd] = next_generation;
+        post(io_side, router_side, item{item::CONNECT, client_fd, next_generation, 0, {}});
+    });
+    server.set_on_disconnect([this](int client_fd) {
+        shm_channels.erase(client_fd);
+        post(io_side, router_side, item{item::DISCONNECT, client_fd, io_generation[client_fd], 0, {}});
+        io_generation[client_fd] = 0;
+    });
+
+    // Signals are meant for the router thread, whose poll() they interrupt
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    running.store(true);
+    thread = std::thread([this] { run(); });
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    return true;
+}
+
+void ClientIoThread::stop()
+{
+    if (thread.joinable()) {
+        running.store(false);
+        uint64_t one = 1;
+        (void)write(io_side.wake_fd, &one, sizeof(one));
+        thread.join();
+    }
+    server.stop();
+    shm_channels.clear();
+    for (side* s : {&router_side, &io_side}) {
+        if (s->wake_fd >= 0) {
+            close(s->wake_fd);
+            s->wake_fd = -1;
+        }
+        s->backlog.clear();
+    }
+    connected.clear();
+}
+
+void ClientIoThread::post(side& from, side& to, item&& it)
+{
+    // Keep to the order messages were sent in: nothing overtakes the backlog
+    if (!from.backlog.empty() || !to.inbox.push(std::move(it))) {
+        queue_full_count.fetch_add(1, std::memory_order_relaxed);
+        from.backlog.push_back(std::move(it));
+        return;
+    }
+    wake(to, to.idle);
+}
+
+void ClientIoThread::flush_backlog(side& from, side& to)
+{
+    bool moved = false;
+    while (!from.backlog.empty() && to.inbox.push(std::move(from.backlog.front()))) {
+        from.backlog.pop_front();
+        moved = true;
+    }
+    if (moved) {
+        wake(to, to.idle);
+    }
+}
+
+void ClientIoThread::wake(side& s, std::atomic<bool>& flag)
+{
+    // Pairs with the fence in prepare_sleep(): either the sleeper sees our
+    // push or pop, or we see its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (flag.load(std::memory_order_relaxed) && flag.exchange(false)) {
+        uint64_t one = 1;
+        (void)write(s.wake_fd, &one, sizeof(one));
+    }
+}
+
+bool ClientIoThread::prepare_sleep(side& self, side& other)
+{
+    self.idle.store(true, std::memory_order_relaxed);
+    if (!self.backlog.empty()) {
+        self.blocked.store(true, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    flush_backlog(self, other);
+    if (self.backlog.empty()) {
+        self.blocked.store(false, std::memory_order_relaxed);
+    }
+    if (!self.inbox.empty()) {
+        self.idle.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void ClientIoThread::clear_wake(const side& s)
+{
+    uint64_t value;
+    (void)read(s.wake_fd, &value, sizeof(value));
+}
+
+int ClientIoThread::prepare_wait()
+{
+    return prepare_sleep(router_side, io_side) ? -1 : 0;
+}
+
+void ClientIoThread::dispatch()
+{
+    // Still idle means nobody wrote the eventfd since prepare_wait()
+    if (!router_side.idle.exchange(false)) {
+        clear_wake(router_side);
+    }
+    flush_backlog(router_side, io_side);
+
+    item it;
+    size_t handled = 0;
+    while (handled < CLIENT_IO_DISPATCH_BATCH && router_side.inbox.pop(it)) {
+        ++handled;
+        switch (it.kind) {
+            case item::CONNECT:
+                connected[it.fd] = it.generation;
+                if (on_connect) {
+                    on_connect(it.fd);
+                }
+                break;
+            case item::DISCONNECT:
+                connected.erase(it.fd);
+                if (on_disconnect) {
+                    on_disconnect(it.fd);
+                }
+                break;
+            case item::MESSAGE: {
+                // Dropped if the router thread has already given up on the client
+                auto c = connected.find(it.fd);
+                if (c != connected.end() && c->second == it.generation && on_message) {
+                    on_message(it.fd, it.type, it.payload.data(), it.payload.size());
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    if (handled) {
+        wake(io_side, io_side.blocked);
+    }
+}
+
+bool ClientIoThread::send_to_client(int client_fd, uint32_t type, const struct iovec* parts, size_t count)
+{
+    auto c = connected.find(client_fd);
+    if (c == connected.end()) {
+        return false;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += parts[i].iov_len;
+    }
+    item it{item::MESSAGE, client_fd, c->second, type, {}};
+    it.payload.resize(len);
+    size_t off = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (parts[i].iov_len) {
+            std::memcpy(it.payload.data() + off, parts[i].iov_base, parts[i].iov_len);
+            off += parts[i].iov_len;
+        }
+    }
+    post(router_side, io_side, std::move(it));
+    return true;
+}
+
+bool ClientIoThread::send_to_client(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    struct iovec part;
+    part.iov_base = const_cast<uint8_t*>(payload);
+    part.iov_len = len;
+    return send_to_client(client_fd, type, &part, 1);
+}
+
+bool ClientIoThread::send_to_client(int client_fd, uint32_t type, const uint8_t* prefix, size_t prefix_len,
+                                    std::shared_ptr<const std::vector<uint8_t>> body, size_t offset, size_t len)
+{
+    auto c = connected.find(client_fd);
+    if (c == connected.end()) {
+        return false;
+    }
+    item it{item::MESSAGE, client_fd, c->second, type, {}};
+    it.payload.assign(prefix, prefix + prefix_len);
+    it.body = std::move(body);
+    it.body_offset = offset;
+    it.body_len = len;
+    post(router_side, io_side, std::move(it));
+    return true;
+}
+
+void ClientIoThread::disconnect(int client_fd)
+{
+    auto c = connected.find(client_fd);
+    if (c != connected.end()) {
+        post(router_side, io_side, item{item::SHUTDOWN, client_fd, c->second, 0, {}});
+    }
+}
+
+void ClientIoThread::handle_client_message(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
+{
+    if (type == UNIX_MSG_SHM_ATTACH) {
+        attach_shm_channel(client_fd);
+        return;
+    }
+    item it{item::MESSAGE, client_fd, io_generation[client_fd], type, {}};
+    it.payload.assign(payload, payload + len);
+    post(io_side, router_side, std::move(it));
+}
+
+void ClientIoThread::attach_shm_channel(int client_fd)
+{
+    shm_attach_result result{0};
+    auto fds = server.take_client_fds(client_fd);
+    if (fds.size() != 3) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        result.status = EBADF;
+    } else {
+        int status = 0;
+        auto channel = ShmChannel::attach(fds[0], fds[1], fds[2], status);
+        result.status = status;
+        if (channel) {
+            LOG_INFO("Unix client fd={} attached shared-memory rings of {} KiB", client_fd, channel->ring_size() / 1024);
+            shm_channels[client_fd] = std::move(channel);
+        } else {
+            LOG_WARN("Unix client fd={} passed an unusable shared-memory region: {}", client_fd, log_errno(status));
+        }
+    }
+    // Always answered over the socket, since the client may not have a ring
+    server.send_to_client(client_fd, UNIX_MSG_SHM_ATTACH, reinterpret_cast<const uint8_t*>(&result), sizeof(result));
+}
+
+void ClientIoThread::send_on_io_thread(const item& it)
+{
+    struct iovec parts[2];
+    parts[0].iov_base = const_cast<uint8_t*>(it.payload.data());
+    parts[0].iov_len = it.payload.size();
+    size_t count = 1;
+    if (it.body) {
+        parts[1].iov_base = const_cast<uint8_t*>(it.body->data() + it.body_offset);
+        parts[1].iov_len = it.body_len;
+        count = 2;
+    }
+    auto shm = shm_channels.find(it.fd);
+    if (shm != shm_channels.end() && shm->second->post(it.type, parts, count)) {
+        return;
+    }
+    server.send_to_client(it.fd, it.type, parts, count);
+}
+
+void ClientIoThread::handle_router_items()
+{
+    item it;
+    bool popped = false;
+    // Bounded, so a router thread that keeps the queue full cannot starve the clients' sockets
+    for (size_t n = 0; n < CLIENT_IO_QUEUE_SIZE && io_side.inbox.pop(it); ++n) {
+        popped = true;
+        if (static_cast<size_t>(it.fd) >= io_generation.size() || io_generation[it.fd] != it.generation) {
+            continue;  // The client has gone away since
+        }
+        if (it.kind == item::SHUTDOWN) {
+            // The server sees EOF on the next poll and drops the client
+            shutdown(it.fd, SHUT_RDWR);
+        } else {
+            send_on_io_thread(it);
+        }
+    }
+    if (popped) {
+        wake(router_side, router_side.blocked);
+    }
+}
+
+void ClientIoThread::run()
+{
+    std::vector<struct pollfd> pfds;
+    std::vector<int> client_fds;
+    std::vector<int> shm_client_fds;
+
+    while (running.load(std::memory_order_relaxed)) {
+        int timeout = prepare_sleep(io_side, router_side) ? -1 : 0;
+        // While the router thread has no room for more, leave client requests
+        // in the sockets, where they push back on the clients
+        bool reading = io_side.backlog.empty();
+        short in = reading ? POLLIN : 0;
+
+        pfds.clear();
+        pfds.push_back({io_side.wake_fd, POLLIN, 0});
+        pfds.push_back({server.get_listen_fd(), in, 0});
+        pfds.push_back({server.get_seqpacket_listen_fd(), in, 0});
+        const size_t clients_start = pfds.size();
+        client_fds = server.get_client_fds();
+        for (int cfd : client_fds) {
+            short events = server.client_events(cfd);
+            pfds.push_back({cfd, static_cast<short>(reading ? events : events & ~POLLIN), 0});
+        }
+        const size_t shm_start = pfds.size();
+        shm_client_fds.clear();
+        for (const auto& [cfd, channel] : shm_channels) {
+            pfds.push_back({channel->doorbell_fd(), in, 0});
+            shm_client_fds.push_back(cfd);
+        }
+
+        int ret = poll(pfds.data(), pfds.size(), timeout);
+        io_side.idle.store(false, std::memory_order_relaxed);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("ClientIoThread: poll error: {}", log_errno(errno));
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            clear_wake(io_side);
+        }
+
+        handle_router_items();
+
+        if (pfds[1].revents & POLLIN) {
+            server.accept_client();
+        }
+        if (pfds[2].revents & POLLIN) {
+            server.accept_seqpacket_client();
+        }
+
+        for (size_t i = 0; i < client_fds.size(); ++i) {
+            short revents = pfds[clients_start + i].revents;
+            if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+                server.handle_client_writable(client_fds[i]);
+            }
+            if (revents & POLLIN) {
+                server.handle_client_data(client_fds[i]);
+            }
+        }
+
+        // Requests placed in shared memory
+        for (size_t i = 0; i < shm_client_fds.size(); ++i) {
+            if (!(pfds[shm_start + i].revents & POLLIN)) {
+                continue;
+            }
+            int cfd = shm_client_fds[i];
+            auto it = shm_channels.find(cfd);
+            if (it == shm_channels.end()) {
+                continue;
+            }
+            bool ok = it->second->drain([this, cfd](uint32_t type, const uint8_t* payload, size_t len) {
+                // Attaching from inside the ring would free it under our feet
+                if (type == UNIX_MSG_TRANS || type == UNIX_MSG_TRANS_TAGGED || type == UNIX_MSG_REPLY ||
+                    type == UNIX_MSG_GROUP_SEND) {
+                    handle_client_message(cfd, type, payload, len);
+                }
+            });
+            if (!ok) {
+                LOG_WARN("Unix client fd={} corrupted its shared-memory ring, detaching it", cfd);
+                shm_channels.erase(cfd);
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#include "local_clients.hpp"
+#include "flip_router.hpp"
+
+LocalClients::LocalClients(flip_router& router)
+    : router(router)
+{
+}
+
+flip_address_t LocalClients::attach(int client_fd)
+{
+    static constexpr flip_address_t kAddressMask = 0x00FFFFFFFFFFFFFFULL;
+
+    for (int attempt = 0; attempt < 1024; ++attempt) {
+        flip_address_t candidate = rng() & kAddressMask;
+        if (candidate == 0 || by_address.contains(candidate)) {
+            continue;
+        }
+        // install_local_address() also accepts an address that is already
+        // local, so the index check above is what keeps clients apart
+        if (router.install_local_address(candidate)) {
+            by_fd[client_fd] = candidate;
+            by_address[candidate] = client_fd;
+            return candidate;
+        }
+    }
+
+    return 0;
+}
+
+flip_address_t LocalClients::detach(int client_fd)
+{
+    auto it = by_fd.find(client_fd);
+    if (it == by_fd.end()) {
+        return 0;
+    }
+
+    flip_address_t address = it->second;
+    by_fd.erase(it);
+    by_address.erase(address);
+    router.remove_local_address(address);
+    return address;
+}
@@ -0,0 +1,196 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_transport.hpp"
+#include "unix_server.hpp"
+#include "log.hpp"
+
+static size_t record_size(size_t payload_len)
+{
+    return (sizeof(unix_message_header) + payload_len + 7) & ~size_t{7};
+}
+
+// Writes to the reply doorbell must never block the event loop, which only
+// holds for an eventfd
+static bool is_eventfd(int fd)
+{
+    char link[64];
+    std::string path = "/proc/self/fd/" + std::to_string(fd);
+    ssize_t n = readlink(path.c_str(), link, sizeof(link) - 1);
+    return n > 0 && std::string_view(link, n) == "anon_inode:[eventfd]";
+}
+
+std::unique_ptr<ShmChannel> ShmChannel::attach(int mem_fd, int request_fd, int reply_fd, int& status)
+{
+    std::unique_ptr<ShmChannel> channel(new ShmChannel());
+    channel->mem_fd = mem_fd;
+    channel->request_fd = request_fd;
+    channel->reply_fd = reply_fd;
+
+    if (!is_eventfd(request_fd) || !is_eventfd(reply_fd)) {
+        status = EBADF;
+        return nullptr;
+    }
+    // Spurious doorbell wakeups must not block the event loop either
+    fcntl(request_fd, F_SETFL, fcntl(request_fd, F_GETFL) | O_NONBLOCK);
+
+    // A client that could shrink the file would make us fault on access
+    int seals = fcntl(mem_fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        status = EPERM;
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(mem_fd, &st) < 0 || static_cast<size_t>(st.st_size) < SHM_DATA_OFFSET) {
+        status = EINVAL;
+        return nullptr;
+    }
+
+    // Map the header first to learn the ring size, then the whole region
+    shm_region_header hdr;
+    if (pread(mem_fd, &hdr, sizeof(hdr), 0) != static_cast<ssize_t>(sizeof(hdr)) ||
+        hdr.magic != SHM_TRANSPORT_MAGIC || hdr.version != SHM_TRANSPORT_VERSION ||
+        hdr.ring_size < SHM_MIN_RING_SIZE || hdr.ring_size > SHM_MAX_RING_SIZE ||
+        (hdr.ring_size & (hdr.ring_size - 1)) != 0) {
+        status = EINVAL;
+        return nullptr;
+    }
+
+    size_t len = SHM_DATA_OFFSET + 2 * size_t{hdr.ring_size};
+    if (static_cast<size_t>(st.st_size) < len) {
+        status = EINVAL;
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (mem == MAP_FAILED) {
+        status = errno;
+        return nullptr;
+    }
+
+    channel->base = static_cast<uint8_t*>(mem);
+    channel->map_len = len;
+    channel->size = hdr.ring_size;
+    channel->header = reinterpret_cast<shm_region_header*>(channel->base);
+    channel->request_data = channel->base + SHM_DATA_OFFSET;
+    channel->reply_data = channel->request_data + hdr.ring_size;
+    status = 0;
+    return channel;
+}
+
+ShmChannel::~ShmChannel()
+{
+    if (base) {
+        munmap(base, map_len);
+    }
+    for (int fd : {mem_fd, request_fd, reply_fd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool ShmChannel::drain(const message_cb& cb)
+{
+    uint64_t rings;
+    while (read(request_fd, &rings, sizeof(rings)) < 0 && errno == EINTR) {
+    }
+
+    std::atomic_ref<uint64_t> head_ref(header->request.head);
+    std::atomic_ref<uint64_t> tail_ref(header->request.tail);
+    uint64_t head = head_ref.load(std::memory_order_relaxed);
+    uint64_t tail = tail_ref.load(std::memory_order_acquire);
+    if (tail - head > size) {
+        LOG_WARN("ShmChannel: request ring positions out of range (head {} tail {})", head, tail);
+        return false;
+    }
+
+    while (head != tail) {
+        size_t pos = head & (size - 1);
+        size_t contiguous = size - pos;
+        if (tail - head < sizeof(unix_message_header) || (pos & 7) != 0) {
+            LOG_WARN("ShmChannel: torn record in request ring at {}", head);
+            return false;
+        }
+
+        unix_message_header msg;
+        std::memcpy(&msg, request_data + pos, sizeof(msg));
+        if (msg.type == SHM_RECORD_PAD) {
+            // Padding runs to the end of the ring, so the client must have posted all of it
+            if (contiguous > tail - head) {
+                LOG_WARN("ShmChannel: padding at {} runs past the request ring tail {}", head, tail);
+                return false;
+            }
+            head += contiguous;
+        } else {
+            size_t rec = record_size(msg.length);
+            if (msg.length > size || rec > contiguous || rec > tail - head) {
+                LOG_WARN("ShmChannel: bad record length {} in request ring", msg.length);
+                return false;
+            }
+            cb(msg.type, request_data + pos + sizeof(msg), msg.length);
+            head += rec;
+        }
+        // Release each record as soon as it is consumed so the client can reuse the space
+        head_ref.store(head, std::memory_order_release);
+    }
+    return true;
+}
+
+bool ShmChannel::post(uint32_t type, const struct iovec* parts, size_t count)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += parts[i].iov_len;
+    }
+    size_t rec = record_size(len);
+    if (rec > size / 2) {
+        return false;
+    }
+
+    std::atomic_ref<uint64_t> head_ref(header->reply.head);
+    std::atomic_ref<uint64_t> tail_ref(header->reply.tail);
+    uint64_t tail = tail_ref.load(std::memory_order_relaxed);
+    uint64_t head = head_ref.load(std::memory_order_acquire);
+    if (tail - head > size) {
+        return false;  // Client scribbled on the ring header
+    }
+
+    size_t pos = tail & (size - 1);
+    size_t contiguous = size - pos;
+    size_t needed = rec > contiguous ? contiguous + rec : rec;
+    if (size - (tail - head) < needed) {
+        return false;
+    }
+
+    if (rec > contiguous) {
+        unix_message_header pad{SHM_RECORD_PAD, static_cast<uint32_t>(contiguous - sizeof(unix_message_header))};
+        std::memcpy(reply_data + pos, &pad, sizeof(pad));
+        tail += contiguous;
+        pos = 0;
+    }
+
+    unix_message_header msg{type, static_cast<uint32_t>(len)};
+    uint8_t* out = reply_data + pos;
+    std::memcpy(out, &msg, sizeof(msg));
+    out += sizeof(msg);
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(out, parts[i].iov_base, parts[i].iov_len);
+        out += parts[i].iov_len;
+    }
+    tail_ref.store(tail + rec, std::memory_order_release);
+
+    uint64_t one = 1;
+    if (write(reply_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_WARN("ShmChannel: reply doorbell write failed: {}", log_errno(errno));
+    }
+    return true;
+}
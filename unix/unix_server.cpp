@@ -1,17 +1,20 @@
-#include <iostream>
 #include <cstring>
 #include <algorithm>
+#include <utility>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <fcntl.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <poll.h>
 
 #include "unix_server.hpp"
+#include "log.hpp"
+#include "trace.hpp"
 
-UnixServer::UnixServer(const std::string& path)
-    : socket_path(path)
+UnixServer::UnixServer(const std::string& path, const std::string& seqpacket_path)
+    : socket_path(path), seqpacket_path(seqpacket_path)
 {
 }
 
@@ -20,51 +23,72 @@ UnixServer::~UnixServer()
     stop();
 }
 
-bool UnixServer::start()
+int UnixServer::open_listener(const std::string& path, int type)
 {
     // Remove stale socket file if it exists
-    unlink(socket_path.c_str());
+    unlink(path.c_str());
 
-    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-    if (listen_fd < 0) {
-        std::cerr << "UnixServer: socket() failed: " << strerror(errno) << std::endl;
-        return false;
+    int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("UnixServer: socket() failed: {}", log_errno(errno));
+        return -1;
     }
 
     struct sockaddr_un addr{};
     addr.sun_family = AF_UNIX;
-    if (socket_path.size() >= sizeof(addr.sun_path)) {
-        std::cerr << "UnixServer: socket path too long" << std::endl;
-        close(listen_fd);
-        listen_fd = -1;
-        return false;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("UnixServer: socket path too long");
+        close(fd);
+        return -1;
     }
-    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
 
-    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        std::cerr << "UnixServer: bind() failed: " << strerror(errno) << std::endl;
-        close(listen_fd);
-        listen_fd = -1;
-        return false;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("UnixServer: bind() failed: {}", log_errno(errno));
+        close(fd);
+        return -1;
     }
 
-    if (listen(listen_fd, 8) < 0) {
-        std::cerr << "UnixServer: listen() failed: " << strerror(errno) << std::endl;
-        close(listen_fd);
-        listen_fd = -1;
-        unlink(socket_path.c_str());
+    // A seqpacket connection inherits the backlog as the number of datagrams
+    // it queues, which bounds how many requests a client can pipeline
+    if (listen(fd, type == SOCK_SEQPACKET ? 256 : 8) < 0) {
+        LOG_ERROR("UnixServer: listen() failed: {}", log_errno(errno));
+        close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    LOG_INFO("UnixServer: listening on {}", path);
+    return fd;
+}
+
+bool UnixServer::start()
+{
+    listen_fd = open_listener(socket_path, SOCK_STREAM);
+    if (listen_fd < 0) {
         return false;
     }
 
-    std::cout << "UnixServer: listening on " << socket_path << std::endl;
+    if (!seqpacket_path.empty()) {
+        seqpacket_fd = open_listener(seqpacket_path, SOCK_SEQPACKET);
+        if (seqpacket_fd < 0) {
+            stop();
+            return false;
+        }
+        datagram.resize(UNIX_SEQPACKET_MAX_MESSAGE);
+    }
     return true;
 }
 
 void UnixServer::stop()
 {
-    for (auto& client : clients) {
-        close(client.fd);
+    for (int fd : client_fds) {
+        for (int passed : clients[fd]->received_fds) {
+            close(passed);
+        }
+        close(fd);
     }
+    client_fds.clear();
     clients.clear();
 
     if (listen_fd >= 0) {
@@ -72,111 +96,496 @@ void UnixServer::stop()
         listen_fd = -1;
         unlink(socket_path.c_str());
     }
+    if (seqpacket_fd >= 0) {
+        close(seqpacket_fd);
+        seqpacket_fd = -1;
+        unlink(seqpacket_path.c_str());
+    }
 }
 
-std::vector<int> UnixServer::get_client_fds() const
+void UnixServer::accept_client()
 {
-    std::vector<int> fds;
-    fds.reserve(clients.size());
-    for (const auto& c : clients) {
-        fds.push_back(c.fd);
-    }
-    return fds;
+    add_client(listen_fd, false);
 }
 
-void UnixServer::accept_client()
+void UnixServer::accept_seqpacket_client()
 {
-    int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    add_client(seqpacket_fd, true);
+}
+
+void UnixServer::add_client(int listen, bool seqpacket)
+{
+    int client_fd = accept4(listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_fd < 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            std::cerr << "UnixServer: accept4() failed: " << strerror(errno) << std::endl;
+            LOG_WARN("UnixServer: accept4() failed: {}", log_errno(errno));
         }
         return;
     }
 
-    clients.push_back({client_fd, {}});
-    std::cout << "UnixServer: client connected (fd=" << client_fd << ")" << std::endl;
+    auto client = std::make_unique<unix_client>();
+    client->fd = client_fd;
+    client->index = client_fds.size();
+    client->seqpacket = seqpacket;
+    if (!seqpacket) {
+        client->ring = std::make_unique<uint8_t[]>(UNIX_RECV_RING_SIZE);
+    }
+    if (static_cast<size_t>(client_fd) >= clients.size()) {
+        clients.resize(client_fd + 1);
+    }
+    clients[client_fd] = std::move(client);
+    client_fds.push_back(client_fd);
+    LOG_INFO("UnixServer: {} client connected (fd={})", seqpacket ? "seqpacket" : "stream", client_fd);
 
     if (on_connect) {
         on_connect(client_fd);
     }
 }
 
+void UnixServer::remove_client(int client_fd)
+{
+    unix_client* client = find_client(client_fd);
+    if (!client) {
+        return;
+    }
+
+    for (int fd : client->received_fds) {
+        close(fd);
+    }
+    close(client_fd);
+    if (on_disconnect) {
+        on_disconnect(client_fd);
+    }
+
+    // Swap the last fd into the removed slot to keep client_fds dense
+    size_t index = client->index;
+    int last = client_fds.back();
+    client_fds[index] = last;
+    clients[last]->index = index;
+    client_fds.pop_back();
+    clients[client_fd].reset();
+}
+
 void UnixServer::handle_client_data(int client_fd)
 {
-    auto it = std::find_if(clients.begin(), clients.end(),
-        [client_fd](const unix_client& c) { return c.fd == client_fd; });
+    unix_client* client = find_client(client_fd);
+    if (!client) {
+        return;
+    }
+
+    if (client->seqpacket) {
+        if (!client->over_limit() && !read_datagrams(*client)) {
+            LOG_INFO("UnixServer: client disconnected (fd={})", client_fd);
+            remove_client(client_fd);
+        }
+        return;
+    }
 
-    if (it == clients.end()) {
+    // A client over its output limit is not read from until it drains its replies
+    if (!client->over_limit() && !read_client(*client)) {
+        LOG_INFO("UnixServer: client disconnected (fd={})", client_fd);
+        remove_client(client_fd);
         return;
     }
 
-    uint8_t tmp[4096];
-    ssize_t n = read(client_fd, tmp, sizeof(tmp));
+    process_client_buffer(*client);
+}
 
-    if (n <= 0) {
-        // Client disconnected or error
-        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            return; // Spurious wakeup
+short UnixServer::client_events(int client_fd) const
+{
+    const unix_client* client = find_client(client_fd);
+    if (!client) {
+        return 0;
+    }
+    short events = client->over_limit() ? 0 : POLLIN;
+    if (client->queued()) {
+        events |= POLLOUT;
+    }
+    return events;
+}
+
+void UnixServer::handle_client_writable(int client_fd)
+{
+    unix_client* client = find_client(client_fd);
+    if (!client) {
+        return;
+    }
+
+    bool was_over = client->over_limit();
+    if (!flush_client(*client)) {
+        LOG_INFO("UnixServer: client disconnected (fd={})", client_fd);
+        remove_client(client_fd);
+        return;
+    }
+
+    if (was_over && !client->over_limit() && !client->seqpacket) {
+        LOG_DEBUG("UnixServer: fd={} below output limit, resuming reads", client_fd);
+        // Requests may already be sitting in the ring with nothing left on
+        // the socket to wake us up again
+        process_client_buffer(*client);
+    }
+}
+
+bool UnixServer::flush_client(unix_client& client)
+{
+    while (client.queued()) {
+        size_t len = client.queued();
+        if (client.seqpacket) {
+            // One queued message per datagram
+            unix_message_header hdr;
+            std::memcpy(&hdr, client.out_buf.data() + client.out_off, sizeof(hdr));
+            len = sizeof(hdr) + hdr.length;
         }
-        std::cout << "UnixServer: client disconnected (fd=" << client_fd << ")" << std::endl;
-        close(client_fd);
-        if (on_disconnect) {
-            on_disconnect(client_fd);
+        ssize_t n = send(client.fd, client.out_buf.data() + client.out_off, len,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_WARN("UnixServer: send() failed for fd={}: {}", client.fd, log_errno(errno));
+            return false;
         }
-        clients.erase(it);
-        return;
+        client.out_off += n;
     }
 
-    it->recv_buf.insert(it->recv_buf.end(), tmp, tmp + n);
-    process_client_buffer(*it);
+    if (client.out_off == client.out_buf.size()) {
+        client.out_buf.clear();
+        client.out_off = 0;
+    } else if (client.out_off > client.out_buf.size() / 2) {
+        client.out_buf.erase(client.out_buf.begin(), client.out_buf.begin() + client.out_off);
+        client.out_off = 0;
+    }
+    return true;
+}
+
+void UnixServer::keep_passed_fds(unix_client& client, struct msghdr& msg)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (client.received_fds.size() < UNIX_MAX_PASSED_FDS) {
+                client.received_fds.push_back(fd);
+            } else {
+                close(fd);
+            }
+        }
+    }
+}
+
+std::vector<int> UnixServer::take_client_fds(int client_fd)
+{
+    unix_client* client = find_client(client_fd);
+    return client ? std::exchange(client->received_fds, {}) : std::vector<int>{};
+}
+
+bool UnixServer::read_client(unix_client& client)
+{
+    // Bound the reads per call so one busy client cannot starve the poll loop
+    for (int reads = 0; reads < 4; ++reads) {
+        struct iovec iov[2];
+        int iovcnt;
+
+        if (client.in_large) {
+            iov[0].iov_base = client.large.data() + client.large_filled;
+            iov[0].iov_len = client.large.size() - client.large_filled;
+            iovcnt = 1;
+        } else {
+            size_t used = client.tail - client.head;
+            size_t space = UNIX_RECV_RING_SIZE - used;
+            if (space == 0) {
+                return true;
+            }
+            size_t pos = client.tail & (UNIX_RECV_RING_SIZE - 1);
+            size_t first = std::min(space, UNIX_RECV_RING_SIZE - pos);
+            iov[0].iov_base = client.ring.get() + pos;
+            iov[0].iov_len = first;
+            iov[1].iov_base = client.ring.get();
+            iov[1].iov_len = space - first;
+            iovcnt = iov[1].iov_len ? 2 : 1;
+        }
+
+        size_t wanted = iov[0].iov_len + (iovcnt == 2 ? iov[1].iov_len : 0);
+        alignas(struct cmsghdr) char control[CMSG_SPACE(UNIX_MAX_PASSED_FDS * sizeof(int))];
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(client.fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            // Nothing more to read for now (or a spurious wakeup)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if (n == 0) {
+            return false;
+        }
+        if (msg.msg_controllen) [[unlikely]] {
+            keep_passed_fds(client, msg);
+        }
+
+        if (client.in_large) {
+            client.large_filled += n;
+            if (client.large_filled == client.large.size()) {
+                // Deliver from process_client_buffer, then go back to the ring
+                return true;
+            }
+        } else {
+            client.tail += n;
+        }
+
+        if (static_cast<size_t>(n) < wanted) {
+            return true;  // Socket drained
+        }
+    }
+    return true;
+}
+
+bool UnixServer::read_datagrams(unix_client& client)
+{
+    const int fd = client.fd;
+    auto still_connected = [&] { return find_client(fd) == &client; };
+
+    // Bound the messages per call so one busy client cannot starve the poll loop
+    for (int reads = 0; reads < 16 && !client.over_limit(); ++reads) {
+        struct iovec iov;
+        iov.iov_base = datagram.data();
+        iov.iov_len = datagram.size();
+        alignas(struct cmsghdr) char control[CMSG_SPACE(UNIX_MAX_PASSED_FDS * sizeof(int))];
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            // Nothing more to read for now (or a spurious wakeup)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if (n == 0) {
+            return false;
+        }
+        if (msg.msg_controllen) [[unlikely]] {
+            keep_passed_fds(client, msg);
+        }
+
+        unix_message_header hdr;
+        if (static_cast<size_t>(n) < sizeof(hdr) || (msg.msg_flags & MSG_TRUNC)) {
+            LOG_WARN("UnixServer: dropping {} datagram from fd={}",
+                     (msg.msg_flags & MSG_TRUNC) ? "oversized" : "short", fd);
+            continue;
+        }
+        std::memcpy(&hdr, datagram.data(), sizeof(hdr));
+        if (hdr.length != n - sizeof(hdr)) {
+            LOG_WARN("UnixServer: datagram from fd={} holds {} bytes, header says {}", fd, n - sizeof(hdr), hdr.length);
+            continue;
+        }
+
+        FLIP_TRACE(unix_msg_in, fd, hdr.type, hdr.length);
+        if (on_message) {
+            on_message(fd, hdr.type, datagram.data() + sizeof(hdr), hdr.length);
+            if (!still_connected()) {
+                return true;
+            }
+        }
+    }
+    return true;
 }
 
 void UnixServer::process_client_buffer(unix_client& client)
 {
-    while (client.recv_buf.size() >= sizeof(unix_message_header)) {
+    const int fd = client.fd;
+    // The message callback may remove clients (including this one)
+    auto still_connected = [&] { return find_client(fd) == &client; };
+
+    for (;;) {
+        if (client.over_limit()) {
+            // Backpressure: leave further requests buffered until replies drain
+            break;
+        }
+        if (client.in_large) {
+            if (client.large_filled < client.large.size()) {
+                return;  // Wait for more data
+            }
+            FLIP_TRACE(unix_msg_in, fd, client.large_hdr.type, client.large_hdr.length);
+            std::vector<uint8_t> payload = std::move(client.large);
+            client.in_large = false;
+            client.large.clear();
+            client.large_filled = 0;
+            if (on_message) {
+                on_message(fd, client.large_hdr.type, payload.data(), payload.size());
+                if (!still_connected()) {
+                    return;
+                }
+            }
+            // Keep the buffer for the next large message unless it is unusually big
+            if (payload.capacity() <= 4 * UNIX_LARGE_MESSAGE) {
+                client.large = std::move(payload);
+            }
+            continue;
+        }
+
+        size_t used = client.tail - client.head;
+        if (used < sizeof(unix_message_header)) {
+            break;
+        }
+
+        const uint8_t* ring = client.ring.get();
+        size_t pos = client.head & (UNIX_RECV_RING_SIZE - 1);
         unix_message_header hdr;
-        std::memcpy(&hdr, client.recv_buf.data(), sizeof(hdr));
+        size_t first = std::min(sizeof(hdr), UNIX_RECV_RING_SIZE - pos);
+        std::memcpy(&hdr, ring + pos, first);
+        std::memcpy(reinterpret_cast<uint8_t*>(&hdr) + first, ring, sizeof(hdr) - first);
+
+        if (hdr.length > UNIX_STREAM_MAX_MESSAGE) {
+            LOG_WARN("UnixServer: {} byte message from fd={} exceeds the {} byte limit, disconnecting",
+                     hdr.length, fd, UNIX_STREAM_MAX_MESSAGE);
+            remove_client(fd);
+            return;
+        }
+        if (hdr.length >= UNIX_LARGE_MESSAGE) {
+            // Move what we already have of the payload out of the ring and
+            // read the rest straight into a buffer of the right size
+            client.head += sizeof(hdr);
+            size_t have = std::min<size_t>(client.tail - client.head, hdr.length);
+            client.large.resize(hdr.length);
+            size_t p = client.head & (UNIX_RECV_RING_SIZE - 1);
+            size_t part = std::min(have, UNIX_RECV_RING_SIZE - p);
+            std::memcpy(client.large.data(), ring + p, part);
+            std::memcpy(client.large.data() + part, ring, have - part);
+            client.head += have;
+            client.large_filled = have;
+            client.large_hdr = hdr;
+            client.in_large = true;
+            continue;
+        }
 
         size_t total = sizeof(unix_message_header) + hdr.length;
-        if (client.recv_buf.size() < total) {
+        if (used < total) {
             break; // Wait for more data
         }
 
+        size_t payload_pos = (client.head + sizeof(hdr)) & (UNIX_RECV_RING_SIZE - 1);
+        const uint8_t* payload = ring + payload_pos;
+        if (payload_pos + hdr.length > UNIX_RECV_RING_SIZE) {
+            // Payload wraps around the end of the ring; hand out a linear copy
+            size_t part = UNIX_RECV_RING_SIZE - payload_pos;
+            client.scratch.resize(hdr.length);
+            std::memcpy(client.scratch.data(), payload, part);
+            std::memcpy(client.scratch.data() + part, ring, hdr.length - part);
+            payload = client.scratch.data();
+        }
+        client.head += total;
+
+        FLIP_TRACE(unix_msg_in, fd, hdr.type, hdr.length);
         if (on_message) {
-            const uint8_t* payload = client.recv_buf.data() + sizeof(unix_message_header);
-            on_message(client.fd, hdr.type, payload, hdr.length);
+            on_message(fd, hdr.type, payload, hdr.length);
+            if (!still_connected()) {
+                return;
+            }
         }
+    }
 
-        client.recv_buf.erase(client.recv_buf.begin(), client.recv_buf.begin() + total);
+    if (client.head == client.tail) {
+        // Restart at the beginning of the ring so later payloads are less likely to wrap
+        client.head = client.tail = 0;
     }
 }
 
 bool UnixServer::send_to_client(int client_fd, uint32_t type, const uint8_t* payload, size_t len)
 {
+    struct iovec part;
+    part.iov_base = const_cast<uint8_t*>(payload);
+    part.iov_len = len;
+    return send_to_client(client_fd, type, &part, len ? 1 : 0);
+}
+
+bool UnixServer::send_to_client(int client_fd, uint32_t type, const struct iovec* parts, size_t count)
+{
+    unix_client* client = find_client(client_fd);
+    if (!client || client->write_failed) {
+        return false;
+    }
+
+    constexpr size_t MAX_PARTS = 7;
+    if (count > MAX_PARTS) {
+        LOG_WARN("UnixServer: too many payload parts ({}) for fd={}", count, client_fd);
+        return false;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += parts[i].iov_len;
+    }
+
     unix_message_header hdr{};
     hdr.length = static_cast<uint32_t>(len);
-    hdr.type = static_cast<uint8_t>(type);
+    hdr.type = type;
 
-    // Use writev to send header + payload atomically
-    struct iovec iov[2];
+    struct iovec iov[MAX_PARTS + 1];
     iov[0].iov_base = &hdr;
     iov[0].iov_len = sizeof(hdr);
-    iov[1].iov_base = const_cast<uint8_t*>(payload);
-    iov[1].iov_len = len;
+    std::copy(parts, parts + count, iov + 1);
+    const size_t iovcnt = count + 1;
 
-    ssize_t written = writev(client_fd, iov, 2);
-    if (written < 0) {
-        std::cerr << "UnixServer: writev() failed for fd=" << client_fd << ": " << strerror(errno) << std::endl;
-        return false;
+    FLIP_TRACE(unix_msg_out, client_fd, type, len);
+
+    // Send header + payload in one call unless earlier output is still queued
+    size_t sent = 0;
+    if (!client->queued()) {
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t n = sendmsg(client_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EMSGSIZE && client->seqpacket) {
+            LOG_WARN("UnixServer: {} byte message too large for seqpacket fd={}", sizeof(hdr) + len, client_fd);
+            return false;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_WARN("UnixServer: sendmsg() failed for fd={}: {}", client_fd, log_errno(errno));
+                // The client is removed from the poll loop, which sees the
+                // shut-down socket as readable and reads EOF
+                client->write_failed = true;
+                client->out_buf.clear();
+                client->out_off = 0;
+                shutdown(client_fd, SHUT_RDWR);
+                return false;
+            }
+            n = 0;
+        }
+        sent = n;
+        if (sent == sizeof(hdr) + len) {
+            return true;
+        }
     }
 
-    return static_cast<size_t>(written) == sizeof(hdr) + len;
+    // Queue whatever the socket did not take
+    bool was_over = client->over_limit();
+    for (size_t i = 0; i < iovcnt; ++i) {
+        const uint8_t* base = static_cast<const uint8_t*>(iov[i].iov_base);
+        size_t skip = std::min(sent, iov[i].iov_len);
+        sent -= skip;
+        client->out_buf.insert(client->out_buf.end(), base + skip, base + iov[i].iov_len);
+    }
+
+    if (!was_over && client->over_limit()) {
+        LOG_DEBUG("UnixServer: fd={} has {} bytes queued, pausing reads", client_fd, client->queued());
+    }
+    return true;
 }
 
 void UnixServer::broadcast(uint32_t type, const uint8_t* payload, size_t len)
 {
-    for (const auto& client : clients) {
-        send_to_client(client.fd, type, payload, len);
+    for (int fd : client_fds) {
+        send_to_client(fd, type, payload, len);
     }
 }